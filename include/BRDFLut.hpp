@@ -0,0 +1,320 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VKPBR_BRDF_LUT_SSE
+#endif
+
+#include <vulkan/vulkan.hpp>
+
+#include <gli/gli.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <VulkanDevice.hpp>
+#include <VulkanTexture.hpp>
+#include <UploadManager.hpp>
+#include <ThreadPool.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Split sum BRDF integration LUT, x = NdotV, y = roughness
+	RG = scale and bias of F0, generated once (CPU or compute) and cached as RG16F KTX
+	*/
+	class BRDFLut {
+	public:
+		using Settings = struct {
+			uint32_t size = 512;
+			uint32_t sampleCount = 1024;
+			bool     useCompute = false;
+		};
+
+		static auto cacheFilename(const std::string& cache_dir, const Settings& settings) -> std::string
+		{
+			return cache_dir + "brdf_lut_" + std::to_string(settings.size) + "_" + std::to_string(sampleCount(settings)) + ".ktx";
+		}
+
+		/* Loads LUT from cache, generates and stores it there on first run */
+		static auto load(
+			vkpbr::Texture2D& texture,
+			const Settings& settings,
+			const std::string& cache_dir,
+			vkpbr::VulkanDevice* device,
+			vkpbr::UploadManager* uploader,
+			vkpbr::ThreadPool* thread_pool,
+			const vk::Queue compute_queue,
+			const vk::PipelineCache pipeline_cache) -> void
+		{
+			const auto filename = cacheFilename(cache_dir, settings);
+
+			if (!std::ifstream(filename).good()) {
+				const auto data = settings.useCompute
+					? generateGPU(settings, device, compute_queue, pipeline_cache)
+					: generateCPU(settings, *thread_pool);
+
+				gli::texture2d lut(gli::FORMAT_RG16_SFLOAT_PACK16, gli::extent2d(settings.size, settings.size), 1);
+				memcpy(lut.data(), data.data(), lut.size());
+
+				std::filesystem::create_directories(cache_dir);
+				if (!gli::save_ktx(lut, filename)) {
+					std::cerr << "[ERROR] Could not write BRDF LUT cache: " << filename << std::endl;
+				}
+			}
+
+			texture.loadFromFile(
+				filename,
+				vk::Format::eR16G16Sfloat,
+				device,
+				uploader,
+				vk::ImageUsageFlagBits::eSampled,
+				vk::ImageLayout::eShaderReadOnlyOptimal,
+				vk::SamplerAddressMode::eClampToEdge
+			);
+		}
+
+		/* Rows are split between pool workers, samples of one texel are integrated 4 at a time */
+		static auto generateCPU(const Settings& settings, vkpbr::ThreadPool& thread_pool) -> std::vector<uint16_t>
+		{
+			const auto sample_count = sampleCount(settings);
+
+			/* Hammersley points do not depend on texel, only cos(phi) is needed since V lies in XZ plane */
+			auto cos_phi = std::vector<float>(sample_count);
+			auto xi_y = std::vector<float>(sample_count);
+			for (uint32_t i = 0; i < sample_count; i++) {
+				cos_phi[i] = std::cos(2.0f * glm::pi<float>() * static_cast<float>(i) / static_cast<float>(sample_count));
+				xi_y[i] = radicalInverse(i);
+			}
+
+			auto data = std::vector<uint16_t>(static_cast<size_t>(settings.size) * settings.size * 2);
+			thread_pool.parallelFor(settings.size, 8, [&](const size_t first, const size_t last) {
+				for (auto y = first; y < last; y++) {
+					const auto roughness = (static_cast<float>(y) + 0.5f) / static_cast<float>(settings.size);
+					for (uint32_t x = 0; x < settings.size; x++) {
+						const auto n_dot_v = (static_cast<float>(x) + 0.5f) / static_cast<float>(settings.size);
+						const auto result = integrate(n_dot_v, roughness, cos_phi.data(), xi_y.data(), sample_count);
+						const auto index = (y * settings.size + x) * 2;
+						data[index + 0] = glm::packHalf1x16(result.x);
+						data[index + 1] = glm::packHalf1x16(result.y);
+					}
+				}
+			});
+			return data;
+		}
+
+		/* Same integral in genbrdflut.comp, result is read back for the cache */
+		static auto generateGPU(const Settings& settings, vkpbr::VulkanDevice* device, const vk::Queue compute_queue, const vk::PipelineCache pipeline_cache) -> std::vector<uint16_t>
+		{
+			using PushConstants = struct {
+				uint32_t size;
+				uint32_t sampleCount;
+			};
+
+			auto& logical_device = device->logicalDevice;
+			const auto buffer_size = static_cast<vk::DeviceSize>(settings.size) * settings.size * sizeof(uint32_t);
+
+			vk::Buffer output_buffer;
+			vk::DeviceMemory output_memory;
+			VK_ASSERT(device->createBuffer(
+				buffer_size,
+				vk::BufferUsageFlagBits::eStorageBuffer,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				output_buffer,
+				output_memory
+			));
+
+			vk::DescriptorSetLayoutBinding layout_binding = { 0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr };
+			vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
+			descriptor_set_layout_create_info.bindingCount = 1;
+			descriptor_set_layout_create_info.pBindings = &layout_binding;
+			vk::DescriptorSetLayout descriptor_set_layout;
+			VK_ASSERT(logical_device.createDescriptorSetLayout(&descriptor_set_layout_create_info, nullptr, &descriptor_set_layout));
+
+			vk::DescriptorPoolSize pool_size = { vk::DescriptorType::eStorageBuffer, 1 };
+			vk::DescriptorPoolCreateInfo descriptor_pool_create_info = {};
+			descriptor_pool_create_info.poolSizeCount = 1;
+			descriptor_pool_create_info.pPoolSizes = &pool_size;
+			descriptor_pool_create_info.maxSets = 1;
+			vk::DescriptorPool descriptor_pool;
+			VK_ASSERT(logical_device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &descriptor_pool));
+
+			vk::DescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+			descriptor_set_allocate_info.descriptorPool = descriptor_pool;
+			descriptor_set_allocate_info.descriptorSetCount = 1;
+			descriptor_set_allocate_info.pSetLayouts = &descriptor_set_layout;
+			vk::DescriptorSet descriptor_set;
+			VK_ASSERT(logical_device.allocateDescriptorSets(&descriptor_set_allocate_info, &descriptor_set));
+
+			vk::DescriptorBufferInfo buffer_info = { output_buffer, 0, buffer_size };
+			vk::WriteDescriptorSet write_descriptor_set = {};
+			write_descriptor_set.dstSet = descriptor_set;
+			write_descriptor_set.dstBinding = 0;
+			write_descriptor_set.descriptorCount = 1;
+			write_descriptor_set.descriptorType = vk::DescriptorType::eStorageBuffer;
+			write_descriptor_set.pBufferInfo = &buffer_info;
+			logical_device.updateDescriptorSets(1, &write_descriptor_set, 0, nullptr);
+
+			vk::PushConstantRange push_constant_range = { vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants) };
+			vk::PipelineLayoutCreateInfo pipeline_layout_create_info = {};
+			pipeline_layout_create_info.setLayoutCount = 1;
+			pipeline_layout_create_info.pSetLayouts = &descriptor_set_layout;
+			pipeline_layout_create_info.pushConstantRangeCount = 1;
+			pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+			vk::PipelineLayout pipeline_layout;
+			VK_ASSERT(logical_device.createPipelineLayout(&pipeline_layout_create_info, nullptr, &pipeline_layout));
+
+			vk::ComputePipelineCreateInfo compute_pipeline_create_info = {};
+			compute_pipeline_create_info.layout = pipeline_layout;
+			compute_pipeline_create_info.stage = loadShaderFromFile(logical_device, "genbrdflut.comp.spv", vk::ShaderStageFlagBits::eCompute);
+			vk::Pipeline pipeline;
+			VK_ASSERT(logical_device.createComputePipelines(pipeline_cache, 1, &compute_pipeline_create_info, nullptr, &pipeline));
+
+			const auto push_constants = PushConstants{ settings.size, sampleCount(settings) };
+			auto cmd_buffer = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+			cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+			cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipeline_layout, 0, 1, &descriptor_set, 0, nullptr);
+			cmd_buffer.pushConstants(pipeline_layout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &push_constants);
+			cmd_buffer.dispatch((settings.size + 15) / 16, (settings.size + 15) / 16, 1);
+
+			vk::BufferMemoryBarrier memory_barrier = {};
+			memory_barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+			memory_barrier.dstAccessMask = vk::AccessFlagBits::eHostRead;
+			memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			memory_barrier.buffer = output_buffer;
+			memory_barrier.size = buffer_size;
+			cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, vk::DependencyFlagBits(0), 0, nullptr, 1, &memory_barrier, 0, nullptr);
+
+			/* One off bake, waiting here is fine */
+			device->finishAndSubmitCmdBuffer(cmd_buffer, compute_queue);
+
+			auto data = std::vector<uint16_t>(static_cast<size_t>(settings.size) * settings.size * 2);
+			void* mapped;
+			VK_ASSERT(logical_device.mapMemory(output_memory, 0, buffer_size, static_cast<vk::MemoryMapFlagBits>(0), &mapped));
+			memcpy(data.data(), mapped, static_cast<size_t>(buffer_size));
+			logical_device.unmapMemory(output_memory);
+
+			logical_device.destroyPipeline(pipeline, nullptr);
+			logical_device.destroyShaderModule(compute_pipeline_create_info.stage.module, nullptr);
+			logical_device.destroyPipelineLayout(pipeline_layout, nullptr);
+			logical_device.destroyDescriptorPool(descriptor_pool, nullptr);
+			logical_device.destroyDescriptorSetLayout(descriptor_set_layout, nullptr);
+			logical_device.destroyBuffer(output_buffer, nullptr);
+			logical_device.freeMemory(output_memory, nullptr);
+
+			return data;
+		}
+
+	private:
+		/* Rounded up to whole SIMD lanes */
+		static auto sampleCount(const Settings& settings) -> uint32_t
+		{
+			return (std::max(settings.sampleCount, 4u) + 3) & ~3u;
+		}
+
+		static auto radicalInverse(uint32_t bits) -> float
+		{
+			bits = (bits << 16u) | (bits >> 16u);
+			bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+			bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+			bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+			bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+			return static_cast<float>(bits) * 2.3283064365386963e-10f;
+		}
+
+		/*
+		GGX importance sampled around N = +Z, Smith G with k = a / 2
+		A += (1 - Fc) * G_Vis, B += Fc * G_Vis
+		*/
+		static auto integrate(const float n_dot_v, const float roughness, const float* cos_phi, const float* xi_y, const uint32_t sample_count) -> glm::vec2
+		{
+			const auto a = roughness * roughness;
+			const auto a2 = a * a;
+			const auto k = a / 2.0f;
+			const auto v_x = std::sqrt(1.0f - n_dot_v * n_dot_v);
+			const auto v_z = n_dot_v;
+			const auto g1_v = n_dot_v / (n_dot_v * (1.0f - k) + k);
+
+			auto sum_a = 0.0f;
+			auto sum_b = 0.0f;
+
+#ifdef VKPBR_BRDF_LUT_SSE
+			const auto one = _mm_set1_ps(1.0f);
+			const auto zero = _mm_setzero_ps();
+			const auto two = _mm_set1_ps(2.0f);
+			const auto a2_minus_one = _mm_set1_ps(a2 - 1.0f);
+			const auto k4 = _mm_set1_ps(k);
+			const auto one_minus_k = _mm_set1_ps(1.0f - k);
+			const auto v_x4 = _mm_set1_ps(v_x);
+			const auto v_z4 = _mm_set1_ps(v_z);
+			const auto g1_v_over_n_dot_v = _mm_set1_ps(g1_v / n_dot_v);
+			const auto epsilon = _mm_set1_ps(1e-6f);
+
+			auto sum_a4 = _mm_setzero_ps();
+			auto sum_b4 = _mm_setzero_ps();
+			for (uint32_t i = 0; i < sample_count; i += 4) {
+				const auto xy = _mm_loadu_ps(xi_y + i);
+				const auto cp = _mm_loadu_ps(cos_phi + i);
+
+				const auto cos_theta2 = _mm_div_ps(_mm_sub_ps(one, xy), _mm_add_ps(one, _mm_mul_ps(a2_minus_one, xy)));
+				const auto h_z = _mm_sqrt_ps(cos_theta2);
+				const auto h_x = _mm_mul_ps(_mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(one, cos_theta2), zero)), cp);
+
+				const auto v_dot_h = _mm_max_ps(_mm_add_ps(_mm_mul_ps(v_x4, h_x), _mm_mul_ps(v_z4, h_z)), zero);
+				const auto n_dot_l = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(two, v_dot_h), h_z), v_z4);
+				const auto valid = _mm_cmpgt_ps(n_dot_l, zero);
+				const auto n_dot_l_clamped = _mm_max_ps(n_dot_l, epsilon);
+
+				const auto g1_l = _mm_div_ps(n_dot_l_clamped, _mm_add_ps(_mm_mul_ps(n_dot_l_clamped, one_minus_k), k4));
+				auto g_vis = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(g1_l, g1_v_over_n_dot_v), v_dot_h), _mm_max_ps(h_z, epsilon));
+				g_vis = _mm_and_ps(valid, g_vis);
+
+				const auto f = _mm_sub_ps(one, v_dot_h);
+				const auto f2 = _mm_mul_ps(f, f);
+				const auto fc = _mm_mul_ps(_mm_mul_ps(f2, f2), f);
+
+				sum_a4 = _mm_add_ps(sum_a4, _mm_mul_ps(_mm_sub_ps(one, fc), g_vis));
+				sum_b4 = _mm_add_ps(sum_b4, _mm_mul_ps(fc, g_vis));
+			}
+
+			alignas(16) float lanes_a[4];
+			alignas(16) float lanes_b[4];
+			_mm_store_ps(lanes_a, sum_a4);
+			_mm_store_ps(lanes_b, sum_b4);
+			sum_a = (lanes_a[0] + lanes_a[1]) + (lanes_a[2] + lanes_a[3]);
+			sum_b = (lanes_b[0] + lanes_b[1]) + (lanes_b[2] + lanes_b[3]);
+#else
+			for (uint32_t i = 0; i < sample_count; i++) {
+				const auto cos_theta2 = (1.0f - xi_y[i]) / (1.0f + (a2 - 1.0f) * xi_y[i]);
+				const auto h_z = std::sqrt(cos_theta2);
+				const auto h_x = std::sqrt(std::max(1.0f - cos_theta2, 0.0f)) * cos_phi[i];
+
+				const auto v_dot_h = std::max(v_x * h_x + v_z * h_z, 0.0f);
+				const auto n_dot_l = 2.0f * v_dot_h * h_z - v_z;
+				if (n_dot_l <= 0.0f) {
+					continue;
+				}
+
+				const auto g1_l = n_dot_l / (n_dot_l * (1.0f - k) + k);
+				const auto g_vis = g1_l * g1_v * v_dot_h / (std::max(h_z, 1e-6f) * n_dot_v);
+				const auto fc = std::pow(1.0f - v_dot_h, 5.0f);
+
+				sum_a += (1.0f - fc) * g_vis;
+				sum_b += fc * g_vis;
+			}
+#endif
+
+			return glm::vec2(sum_a, sum_b) / static_cast<float>(sample_count);
+		}
+	};
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <VulkanDevice.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Clustered forward lighting of punctual lights
+	The view frustum is split into a froxel grid, screen tiles in x and y and exponential depth slices in z.
+	lightcull.comp tests every light against the view space bounds of every cluster and writes a record per
+	cluster, its light count followed by the light indices. Shading finds its cluster from gl_FragCoord and
+	the view depth and iterates only over the lights of that record. Lights and records are per frame in flight.
+	*/
+	class ClusteredLighting {
+	public:
+		static constexpr uint32_t gridWidth = 16;
+		static constexpr uint32_t gridHeight = 9;
+		static constexpr uint32_t gridDepth = 24;
+		static constexpr uint32_t clusterCount = gridWidth * gridHeight * gridDepth;
+		static constexpr uint32_t maxLights = 1024;
+		/* A record is the count followed by the indices, 128 uints */
+		static constexpr uint32_t maxLightsPerCluster = 127;
+
+		enum class Type : uint32_t {
+			directional = 0,
+			point = 1,
+			spot = 2
+		};
+
+		/* World space, color is premultiplied by the intensity, range 0 is unlimited */
+		using Light = struct {
+			Type      type;
+			glm::vec3 position;
+			glm::vec3 direction;
+			glm::vec3 color;
+			float     range;
+			float     innerConeAngle;
+			float     outerConeAngle;
+		};
+
+		/* std140, shading locates its cluster with it */
+		using GridParameters = struct {
+			/* Grid size, uints per cluster record */
+			glm::uvec4 size;
+			/* Slice = log(depth) * x + y, pixels per tile in z and w */
+			glm::vec4  slicing;
+		};
+
+		ClusteredLighting() = default;
+		ClusteredLighting(const ClusteredLighting&) = delete;
+		auto operator=(const ClusteredLighting&) -> ClusteredLighting& = delete;
+
+		auto init(vkpbr::VulkanDevice* device, const uint32_t frame_count, const vk::PipelineCache pipeline_cache) -> void
+		{
+			this->device = device;
+			this->frameCount = frame_count;
+			frameParameters.resize(frame_count);
+			auto& logical_device = device->logicalDevice;
+
+			/* Lights are written by the CPU every frame, records only ever live on the GPU */
+			const auto alignment = device->deviceProperties.limits.minStorageBufferOffsetAlignment;
+			lightSliceSize = (sizeof(GPULight) * maxLights + alignment - 1) & ~(alignment - 1);
+			clusterSliceSize = (sizeof(uint32_t) * recordSize * clusterCount + alignment - 1) & ~(alignment - 1);
+			VK_ASSERT(device->createBuffer(
+				lightSliceSize * frame_count,
+				vk::BufferUsageFlagBits::eStorageBuffer,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				lightBuffer.buffer,
+				lightBuffer.memory
+			));
+			VK_ASSERT(logical_device.mapMemory(lightBuffer.memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &lightsMapped));
+			VK_ASSERT(device->createBuffer(
+				clusterSliceSize * frame_count,
+				vk::BufferUsageFlagBits::eStorageBuffer,
+				vk::MemoryPropertyFlagBits::eDeviceLocal,
+				clusterBuffer.buffer,
+				clusterBuffer.memory
+			));
+
+			/* Lights, cluster records */
+			const auto layout_bindings = std::array<vk::DescriptorSetLayoutBinding, 2>{
+				vk::DescriptorSetLayoutBinding{ 0, vk::DescriptorType::eStorageBufferDynamic, 1, vk::ShaderStageFlagBits::eCompute, nullptr },
+				vk::DescriptorSetLayoutBinding{ 1, vk::DescriptorType::eStorageBufferDynamic, 1, vk::ShaderStageFlagBits::eCompute, nullptr }
+			};
+			vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
+			descriptor_set_layout_create_info.bindingCount = static_cast<uint32_t>(layout_bindings.size());
+			descriptor_set_layout_create_info.pBindings = layout_bindings.data();
+			VK_ASSERT(logical_device.createDescriptorSetLayout(&descriptor_set_layout_create_info, nullptr, &descriptorSetLayout));
+
+			const auto pool_size = vk::DescriptorPoolSize{ vk::DescriptorType::eStorageBufferDynamic, 2 };
+			vk::DescriptorPoolCreateInfo descriptor_pool_create_info = {};
+			descriptor_pool_create_info.poolSizeCount = 1;
+			descriptor_pool_create_info.pPoolSizes = &pool_size;
+			descriptor_pool_create_info.maxSets = 1;
+			VK_ASSERT(logical_device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &descriptorPool));
+
+			vk::DescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+			descriptor_set_allocate_info.descriptorPool = descriptorPool;
+			descriptor_set_allocate_info.descriptorSetCount = 1;
+			descriptor_set_allocate_info.pSetLayouts = &descriptorSetLayout;
+			VK_ASSERT(logical_device.allocateDescriptorSets(&descriptor_set_allocate_info, &descriptorSet));
+
+			const auto light_info = lightDescriptor();
+			const auto cluster_info = clusterDescriptor();
+			auto write_descriptor_sets = std::array<vk::WriteDescriptorSet, 2>{};
+			for (uint32_t binding = 0; binding < 2; binding++) {
+				write_descriptor_sets[binding].dstSet = descriptorSet;
+				write_descriptor_sets[binding].dstBinding = binding;
+				write_descriptor_sets[binding].descriptorCount = 1;
+				write_descriptor_sets[binding].descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+			}
+			write_descriptor_sets[0].pBufferInfo = &light_info;
+			write_descriptor_sets[1].pBufferInfo = &cluster_info;
+			logical_device.updateDescriptorSets(static_cast<uint32_t>(write_descriptor_sets.size()), write_descriptor_sets.data(), 0, nullptr);
+
+			vk::PushConstantRange push_constant_range = { vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants) };
+			vk::PipelineLayoutCreateInfo pipeline_layout_create_info = {};
+			pipeline_layout_create_info.setLayoutCount = 1;
+			pipeline_layout_create_info.pSetLayouts = &descriptorSetLayout;
+			pipeline_layout_create_info.pushConstantRangeCount = 1;
+			pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+			VK_ASSERT(logical_device.createPipelineLayout(&pipeline_layout_create_info, nullptr, &pipelineLayout));
+
+			vk::ComputePipelineCreateInfo compute_pipeline_create_info = {};
+			compute_pipeline_create_info.layout = pipelineLayout;
+			compute_pipeline_create_info.stage = loadShaderFromFile(logical_device, "lightcull.comp.spv", vk::ShaderStageFlagBits::eCompute);
+			VK_ASSERT(logical_device.createComputePipelines(pipeline_cache, 1, &compute_pipeline_create_info, nullptr, &pipeline));
+			logical_device.destroyShaderModule(compute_pipeline_create_info.stage.module, nullptr);
+		}
+
+		auto release() -> void
+		{
+			if (!device) {
+				return;
+			}
+			auto& logical_device = device->logicalDevice;
+			logical_device.unmapMemory(lightBuffer.memory);
+			for (auto* buffer : { &lightBuffer, &clusterBuffer }) {
+				logical_device.destroyBuffer(buffer->buffer, nullptr);
+				logical_device.freeMemory(buffer->memory, nullptr);
+			}
+			logical_device.destroyPipeline(pipeline, nullptr);
+			logical_device.destroyPipelineLayout(pipelineLayout, nullptr);
+			logical_device.destroyDescriptorPool(descriptorPool, nullptr);
+			logical_device.destroyDescriptorSetLayout(descriptorSetLayout, nullptr);
+			device = nullptr;
+		}
+
+		/* Whole slices, graphics binds them with frameOffset() */
+		auto lightDescriptor() const -> vk::DescriptorBufferInfo
+		{
+			return { lightBuffer.buffer, 0, sizeof(GPULight) * maxLights };
+		}
+
+		auto clusterDescriptor() const -> vk::DescriptorBufferInfo
+		{
+			return { clusterBuffer.buffer, 0, sizeof(uint32_t) * recordSize * clusterCount };
+		}
+
+		auto lightOffset(const uint32_t frame_index) const -> uint32_t
+		{
+			return static_cast<uint32_t>(lightSliceSize * frame_index);
+		}
+
+		auto clusterOffset(const uint32_t frame_index) const -> uint32_t
+		{
+			return static_cast<uint32_t>(clusterSliceSize * frame_index);
+		}
+
+		/* Writes the light slice of the frame, lights past maxLights are dropped */
+		auto update(
+			const uint32_t frame_index,
+			const std::vector<Light>& lights,
+			const glm::mat4& view,
+			const glm::mat4& projection,
+			const float near_plane,
+			const float far_plane,
+			const uint32_t width,
+			const uint32_t height
+		) -> GridParameters
+		{
+			const auto light_count = std::min(static_cast<uint32_t>(lights.size()), maxLights);
+			auto* gpu_lights = reinterpret_cast<GPULight*>(static_cast<uint8_t*>(lightsMapped) + lightSliceSize * frame_index);
+			for (uint32_t i = 0; i < light_count; i++) {
+				const auto& light = lights[i];
+
+				/* Unlimited range ends where the inverse square falloff drops below cutoffIntensity */
+				auto cull_range = light.range;
+				if (cull_range <= 0.0f) {
+					const auto peak = std::max({ light.color.r, light.color.g, light.color.b });
+					cull_range = std::sqrt(std::max(peak, 0.0f) / cutoffIntensity);
+				}
+
+				const auto cos_outer = std::cos(light.outerConeAngle);
+				const auto spot_scale = 1.0f / std::max(0.001f, std::cos(light.innerConeAngle) - cos_outer);
+
+				gpu_lights[i].positionRange = glm::vec4(light.position, light.range);
+				gpu_lights[i].colorType = glm::vec4(light.color, static_cast<float>(light.type));
+				gpu_lights[i].directionSpotScale = glm::vec4(glm::normalize(light.direction), spot_scale);
+				gpu_lights[i].spotOffset = glm::vec4(-cos_outer * spot_scale, 0.0f, 0.0f, 0.0f);
+				gpu_lights[i].viewPositionRadius = glm::vec4(glm::vec3(view * glm::vec4(light.position, 1.0f)), cull_range);
+			}
+
+			auto& parameters = frameParameters[frame_index];
+			parameters.projectionScale = glm::vec2(projection[0][0], projection[1][1]);
+			parameters.nearPlane = near_plane;
+			parameters.farPlane = far_plane;
+			parameters.lightCount = light_count;
+
+			const auto log_depth_range = std::log(far_plane / near_plane);
+			auto grid = GridParameters{};
+			grid.size = glm::uvec4(gridWidth, gridHeight, gridDepth, recordSize);
+			grid.slicing = glm::vec4(
+				static_cast<float>(gridDepth) / log_depth_range,
+				-static_cast<float>(gridDepth) * std::log(near_plane) / log_depth_range,
+				static_cast<float>(width) / static_cast<float>(gridWidth),
+				static_cast<float>(height) / static_cast<float>(gridHeight)
+			);
+			return grid;
+		}
+
+		/* Before the render pass, records are visible to fragment shaders afterwards */
+		auto recordCull(const vk::CommandBuffer cmd_buffer, const uint32_t frame_index) const -> void
+		{
+			const auto dynamic_offsets = std::array<uint32_t, 2>{ lightOffset(frame_index), clusterOffset(frame_index) };
+			cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+			cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &descriptorSet, static_cast<uint32_t>(dynamic_offsets.size()), dynamic_offsets.data());
+			cmd_buffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &frameParameters[frame_index]);
+			cmd_buffer.dispatch((clusterCount + localSize - 1) / localSize, 1, 1);
+
+			vk::BufferMemoryBarrier cluster_barrier = {};
+			cluster_barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+			cluster_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+			cluster_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			cluster_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			cluster_barrier.buffer = clusterBuffer.buffer;
+			cluster_barrier.offset = clusterSliceSize * frame_index;
+			cluster_barrier.size = clusterSliceSize;
+			cmd_buffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eFragmentShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				1, &cluster_barrier,
+				0, nullptr
+			);
+		}
+
+	private:
+		static constexpr uint32_t localSize = 64;
+		static constexpr uint32_t recordSize = maxLightsPerCluster + 1;
+		/* Radiance below which an unlimited range light stops contributing */
+		static constexpr float    cutoffIntensity = 0.01f;
+
+		/* std430, mirrored by lightcull.comp and pbr_shader.frag */
+		using GPULight = struct {
+			/* World position, glTF range */
+			glm::vec4 positionRange;
+			glm::vec4 colorType;
+			/* Direction the light points to, cone angle scale */
+			glm::vec4 directionSpotScale;
+			/* Cone angle offset */
+			glm::vec4 spotOffset;
+			/* View position and range used for culling */
+			glm::vec4 viewPositionRadius;
+		};
+
+		using PushConstants = struct {
+			glm::vec2 projectionScale;
+			float     nearPlane;
+			float     farPlane;
+			uint32_t  lightCount;
+		};
+
+		using Buffer = struct {
+			vk::Buffer       buffer;
+			vk::DeviceMemory memory;
+		};
+
+		vkpbr::VulkanDevice*       device = nullptr;
+		uint32_t                   frameCount = 1;
+		std::vector<PushConstants> frameParameters;
+		Buffer                     lightBuffer;
+		Buffer                     clusterBuffer;
+		void*                      lightsMapped = nullptr;
+		vk::DeviceSize             lightSliceSize = 0;
+		vk::DeviceSize             clusterSliceSize = 0;
+		vk::DescriptorSetLayout    descriptorSetLayout;
+		vk::DescriptorPool         descriptorPool;
+		vk::DescriptorSet          descriptorSet;
+		vk::PipelineLayout         pipelineLayout;
+		vk::Pipeline               pipeline;
+	};
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+#include <vulkan/vulkan.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Graphics state tracker in front of one command buffer, calls that would bind what is bound already are dropped
+	All pipelines recorded through it share one layout, so descriptor sets and push constants stay valid across
+	pipeline changes. Shadow state lives in fixed size arrays, recording a draw does not allocate.
+	*/
+	class CommandState {
+	public:
+		static constexpr uint32_t maxDescriptorSets = 4;
+		static constexpr uint32_t maxDynamicOffsets = 5;
+		static constexpr uint32_t maxPushConstantSize = 128;
+
+		CommandState(const vk::CommandBuffer cmd_buffer, const vk::PipelineLayout pipeline_layout)
+			: cmdBuffer(cmd_buffer)
+			, pipelineLayout(pipeline_layout)
+		{
+		}
+
+		CommandState(const CommandState&) = delete;
+		auto operator=(const CommandState&) -> CommandState& = delete;
+
+		auto setViewport(const uint32_t width, const uint32_t height) -> void
+		{
+			if (width == viewportWidth && height == viewportHeight) {
+				return;
+			}
+			viewportWidth = width;
+			viewportHeight = height;
+
+			vk::Viewport viewport = {};
+			viewport.width = static_cast<float>(width);
+			viewport.height = static_cast<float>(height);
+			viewport.minDepth = 0.0f;
+			viewport.maxDepth = 1.0f;
+			cmdBuffer.setViewport(0, 1, &viewport);
+
+			vk::Rect2D scissors = {};
+			scissors.extent = vk::Extent2D{ width, height };
+			cmdBuffer.setScissor(0, 1, &scissors);
+		}
+
+		auto bindPipeline(const vk::Pipeline pipeline) -> void
+		{
+			if (pipeline == boundPipeline) {
+				return;
+			}
+			boundPipeline = pipeline;
+			cmdBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+		}
+
+		auto bindDescriptorSet(const uint32_t index, const vk::DescriptorSet set, const uint32_t* dynamic_offsets = nullptr, const uint32_t dynamic_offset_count = 0) -> void
+		{
+			assert(index < maxDescriptorSets && dynamic_offset_count <= maxDynamicOffsets);
+
+			auto& bound = descriptorSets[index];
+			if (bound.set == set && bound.dynamicOffsetCount == dynamic_offset_count
+				&& std::equal(dynamic_offsets, dynamic_offsets + dynamic_offset_count, bound.dynamicOffsets.begin())) {
+				return;
+			}
+			bound.set = set;
+			bound.dynamicOffsetCount = dynamic_offset_count;
+			std::copy(dynamic_offsets, dynamic_offsets + dynamic_offset_count, bound.dynamicOffsets.begin());
+			cmdBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, index, 1, &set, dynamic_offset_count, dynamic_offsets);
+		}
+
+		auto bindVertexBuffer(const vk::Buffer buffer) -> void
+		{
+			if (buffer == boundVertexBuffer) {
+				return;
+			}
+			boundVertexBuffer = buffer;
+			const auto offset = vk::DeviceSize{ 0 };
+			cmdBuffer.bindVertexBuffers(0, 1, &buffer, &offset);
+		}
+
+		auto bindIndexBuffer(const vk::Buffer buffer, const vk::IndexType index_type) -> void
+		{
+			if (buffer == boundIndexBuffer && index_type == boundIndexType) {
+				return;
+			}
+			boundIndexBuffer = buffer;
+			boundIndexType = index_type;
+			cmdBuffer.bindIndexBuffer(buffer, 0, index_type);
+		}
+
+		/* Range starting at offset 0, compared byte wise with what was pushed last */
+		auto pushConstants(const vk::ShaderStageFlags stages, const void* data, const uint32_t size) -> void
+		{
+			assert(size <= maxPushConstantSize);
+
+			if (stages == pushConstantStages && size == pushConstantSize && memcmp(pushConstantData.data(), data, size) == 0) {
+				return;
+			}
+			pushConstantStages = stages;
+			pushConstantSize = size;
+			memcpy(pushConstantData.data(), data, size);
+			cmdBuffer.pushConstants(pipelineLayout, stages, 0, size, data);
+		}
+
+	private:
+		using BoundSet = struct {
+			vk::DescriptorSet                       set;
+			uint32_t                                dynamicOffsetCount;
+			std::array<uint32_t, maxDynamicOffsets> dynamicOffsets;
+		};
+
+		vk::CommandBuffer                        cmdBuffer;
+		vk::PipelineLayout                       pipelineLayout;
+		uint32_t                                 viewportWidth = 0;
+		uint32_t                                 viewportHeight = 0;
+		vk::Pipeline                             boundPipeline;
+		std::array<BoundSet, maxDescriptorSets>  descriptorSets = {};
+		vk::Buffer                               boundVertexBuffer;
+		vk::Buffer                               boundIndexBuffer;
+		vk::IndexType                            boundIndexType = vk::IndexType::eUint32;
+		vk::ShaderStageFlags                     pushConstantStages;
+		uint32_t                                 pushConstantSize = 0;
+		std::array<uint8_t, maxPushConstantSize> pushConstantData = {};
+	};
+}
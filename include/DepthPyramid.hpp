@@ -0,0 +1,446 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+
+#include <vulkan/vulkan.hpp>
+
+#include <VulkanDevice.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Hierarchical Z, a R32F mip chain where every texel keeps the farthest depth it covers
+	Level 0 is the depth buffer reduced to the previous power of two so each level halves exactly,
+	a box whose nearest depth is behind the pyramid value of its footprint is hidden.
+	The image stays in general layout, every level is written by depthpyramid.comp.
+	Multisampled depth is first resolved to its farthest sample by depthresolve.comp.
+	*/
+	class DepthPyramid {
+	public:
+		DepthPyramid() = default;
+		DepthPyramid(const DepthPyramid&) = delete;
+		auto operator=(const DepthPyramid&) -> DepthPyramid& = delete;
+
+		uint32_t                width = 0;
+		uint32_t                height = 0;
+		uint32_t                levelCount = 0;
+		vk::DescriptorImageInfo descriptorInfo;
+
+		/* depth_view is a depth aspect only view of a stored depth buffer, read in depth stencil read only layout */
+		auto init(
+			vkpbr::VulkanDevice* device,
+			const vk::Queue queue,
+			const vk::ImageView depth_view,
+			const uint32_t depth_width,
+			const uint32_t depth_height,
+			const vk::SampleCountFlagBits depth_samples,
+			const vk::PipelineCache pipeline_cache) -> void
+		{
+			assert(depth_view);
+			this->device = device;
+			auto& logical_device = device->logicalDevice;
+
+			resolveDepth = depth_samples != vk::SampleCountFlagBits::e1;
+			resolvedWidth = depth_width;
+			resolvedHeight = depth_height;
+			width = previousPowerOfTwo(depth_width);
+			height = previousPowerOfTwo(depth_height);
+			levelCount = 1;
+			while ((std::max(width, height) >> levelCount) > 0) {
+				levelCount++;
+			}
+
+			createImage(queue);
+			if (resolveDepth) {
+				createResolveImage(queue);
+			}
+
+			/* Nearest lookups, the reduction is done by the shaders */
+			vk::SamplerCreateInfo sampler_create_info = {};
+			sampler_create_info.magFilter = vk::Filter::eNearest;
+			sampler_create_info.minFilter = vk::Filter::eNearest;
+			sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+			sampler_create_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+			sampler_create_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+			sampler_create_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+			sampler_create_info.maxLod = static_cast<float>(levelCount);
+			sampler_create_info.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+			sampler = device->samplerCache.get(sampler_create_info);
+
+			descriptorInfo.sampler = sampler;
+			descriptorInfo.imageView = view;
+			descriptorInfo.imageLayout = vk::ImageLayout::eGeneral;
+
+			const auto layout_bindings = std::array<vk::DescriptorSetLayoutBinding, 2>{
+				vk::DescriptorSetLayoutBinding{ 0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute, nullptr },
+				vk::DescriptorSetLayoutBinding{ 1, vk::DescriptorType::eStorageImage, 1, vk::ShaderStageFlagBits::eCompute, nullptr }
+			};
+			vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
+			descriptor_set_layout_create_info.bindingCount = static_cast<uint32_t>(layout_bindings.size());
+			descriptor_set_layout_create_info.pBindings = layout_bindings.data();
+			VK_ASSERT(logical_device.createDescriptorSetLayout(&descriptor_set_layout_create_info, nullptr, &descriptorSetLayout));
+
+			/* One set per level, the resolve has its own set in front of them */
+			const auto set_count = levelCount + (resolveDepth ? 1 : 0);
+			const auto pool_sizes = std::array<vk::DescriptorPoolSize, 2>{
+				vk::DescriptorPoolSize{ vk::DescriptorType::eCombinedImageSampler, set_count },
+				vk::DescriptorPoolSize{ vk::DescriptorType::eStorageImage, set_count }
+			};
+			vk::DescriptorPoolCreateInfo descriptor_pool_create_info = {};
+			descriptor_pool_create_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+			descriptor_pool_create_info.pPoolSizes = pool_sizes.data();
+			descriptor_pool_create_info.maxSets = set_count;
+			VK_ASSERT(logical_device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &descriptorPool));
+
+			/* Level i reads level i - 1, level 0 reads the depth buffer or its resolve */
+			descriptorSets.resize(set_count);
+			const auto set_layouts = std::vector<vk::DescriptorSetLayout>(set_count, descriptorSetLayout);
+			vk::DescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+			descriptor_set_allocate_info.descriptorPool = descriptorPool;
+			descriptor_set_allocate_info.descriptorSetCount = set_count;
+			descriptor_set_allocate_info.pSetLayouts = set_layouts.data();
+			VK_ASSERT(logical_device.allocateDescriptorSets(&descriptor_set_allocate_info, descriptorSets.data()));
+
+			const auto depth_info = vk::DescriptorImageInfo{ sampler, depth_view, vk::ImageLayout::eDepthStencilReadOnlyOptimal };
+			if (resolveDepth) {
+				const auto resolved_info = vk::DescriptorImageInfo{ sampler, resolvedView, vk::ImageLayout::eGeneral };
+				writeDescriptorSet(descriptorSets[levelCount], depth_info, { nullptr, resolvedView, vk::ImageLayout::eGeneral });
+				writeDescriptorSet(descriptorSets[0], resolved_info, { nullptr, levelViews[0], vk::ImageLayout::eGeneral });
+			}
+			else {
+				writeDescriptorSet(descriptorSets[0], depth_info, { nullptr, levelViews[0], vk::ImageLayout::eGeneral });
+			}
+			for (uint32_t level = 1; level < levelCount; level++) {
+				const auto source_info = vk::DescriptorImageInfo{ sampler, levelViews[level - 1], vk::ImageLayout::eGeneral };
+				writeDescriptorSet(descriptorSets[level], source_info, { nullptr, levelViews[level], vk::ImageLayout::eGeneral });
+			}
+
+			vk::PushConstantRange push_constant_range = { vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants) };
+			vk::PipelineLayoutCreateInfo pipeline_layout_create_info = {};
+			pipeline_layout_create_info.setLayoutCount = 1;
+			pipeline_layout_create_info.pSetLayouts = &descriptorSetLayout;
+			pipeline_layout_create_info.pushConstantRangeCount = 1;
+			pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+			VK_ASSERT(logical_device.createPipelineLayout(&pipeline_layout_create_info, nullptr, &pipelineLayout));
+
+			vk::ComputePipelineCreateInfo compute_pipeline_create_info = {};
+			compute_pipeline_create_info.layout = pipelineLayout;
+			compute_pipeline_create_info.stage = loadShaderFromFile(logical_device, "depthpyramid.comp.spv", vk::ShaderStageFlagBits::eCompute);
+			VK_ASSERT(logical_device.createComputePipelines(pipeline_cache, 1, &compute_pipeline_create_info, nullptr, &pipeline));
+			logical_device.destroyShaderModule(compute_pipeline_create_info.stage.module, nullptr);
+
+			/* Same layout, the push constants carry the resolved size */
+			if (resolveDepth) {
+				compute_pipeline_create_info.stage = loadShaderFromFile(logical_device, "depthresolve.comp.spv", vk::ShaderStageFlagBits::eCompute);
+				VK_ASSERT(logical_device.createComputePipelines(pipeline_cache, 1, &compute_pipeline_create_info, nullptr, &resolvePipeline));
+				logical_device.destroyShaderModule(compute_pipeline_create_info.stage.module, nullptr);
+			}
+		}
+
+		auto initialized() const -> bool
+		{
+			return device != nullptr;
+		}
+
+		/* GPU must be done with the pyramid */
+		auto release() -> void
+		{
+			if (!device) {
+				return;
+			}
+			auto& logical_device = device->logicalDevice;
+			logical_device.destroyPipeline(pipeline, nullptr);
+			logical_device.destroyPipeline(resolvePipeline, nullptr);
+			resolvePipeline = nullptr;
+			logical_device.destroyPipelineLayout(pipelineLayout, nullptr);
+			logical_device.destroyDescriptorPool(descriptorPool, nullptr);
+			logical_device.destroyDescriptorSetLayout(descriptorSetLayout, nullptr);
+			for (auto& level_view : levelViews) {
+				logical_device.destroyImageView(level_view, nullptr);
+			}
+			levelViews.clear();
+			descriptorSets.clear();
+			logical_device.destroyImageView(view, nullptr);
+			logical_device.destroyImage(image, nullptr);
+			logical_device.freeMemory(memory, nullptr);
+			logical_device.destroyImageView(resolvedView, nullptr);
+			logical_device.destroyImage(resolvedImage, nullptr);
+			logical_device.freeMemory(resolvedMemory, nullptr);
+			resolvedView = nullptr;
+			resolvedImage = nullptr;
+			resolvedMemory = nullptr;
+			device = nullptr;
+		}
+
+		/*
+		Depth has to be in depth stencil read only layout and visible to compute,
+		the whole pyramid is readable by compute shaders afterwards.
+		Only source_extent of the depth buffer is reduced, the pyramid covers what was rendered.
+		*/
+		auto recordBuild(const vk::CommandBuffer cmd_buffer, const vk::Extent2D source_extent) const -> void
+		{
+			if (resolveDepth) {
+				recordResolve(cmd_buffer, source_extent);
+			}
+			cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+
+			for (uint32_t level = 0; level < levelCount; level++) {
+				auto push_constants = PushConstants{};
+				push_constants.sourceWidth = level == 0 ? source_extent.width : levelWidth(level - 1);
+				push_constants.sourceHeight = level == 0 ? source_extent.height : levelHeight(level - 1);
+				push_constants.destinationWidth = levelWidth(level);
+				push_constants.destinationHeight = levelHeight(level);
+
+				cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &descriptorSets[level], 0, nullptr);
+				cmd_buffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &push_constants);
+				cmd_buffer.dispatch((push_constants.destinationWidth + 7) / 8, (push_constants.destinationHeight + 7) / 8, 1);
+
+				vk::ImageMemoryBarrier level_barrier = {};
+				level_barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+				level_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+				level_barrier.oldLayout = vk::ImageLayout::eGeneral;
+				level_barrier.newLayout = vk::ImageLayout::eGeneral;
+				level_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				level_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				level_barrier.image = image;
+				level_barrier.subresourceRange = { vk::ImageAspectFlagBits::eColor, level, 1, 0, 1 };
+				cmd_buffer.pipelineBarrier(
+					vk::PipelineStageFlagBits::eComputeShader,
+					vk::PipelineStageFlagBits::eComputeShader,
+					vk::DependencyFlags(),
+					0, nullptr,
+					0, nullptr,
+					1, &level_barrier
+				);
+			}
+		}
+
+	private:
+		using PushConstants = struct {
+			uint32_t sourceWidth;
+			uint32_t sourceHeight;
+			uint32_t destinationWidth;
+			uint32_t destinationHeight;
+		};
+
+		vkpbr::VulkanDevice*           device = nullptr;
+		vk::Image                      image;
+		vk::DeviceMemory               memory;
+		vk::ImageView                  view;
+		std::vector<vk::ImageView>     levelViews;
+		vk::Sampler                    sampler;
+		vk::DescriptorSetLayout        descriptorSetLayout;
+		vk::DescriptorPool             descriptorPool;
+		std::vector<vk::DescriptorSet> descriptorSets;
+		vk::PipelineLayout             pipelineLayout;
+		vk::Pipeline                   pipeline;
+		/* Single sampled copy of multisampled depth, level 0 is built from it */
+		bool                           resolveDepth = false;
+		uint32_t                       resolvedWidth = 0;
+		uint32_t                       resolvedHeight = 0;
+		vk::Image                      resolvedImage;
+		vk::DeviceMemory               resolvedMemory;
+		vk::ImageView                  resolvedView;
+		vk::Pipeline                   resolvePipeline;
+
+		static auto previousPowerOfTwo(const uint32_t value) -> uint32_t
+		{
+			auto result = uint32_t{ 1 };
+			while (result * 2 <= value) {
+				result *= 2;
+			}
+			return result;
+		}
+
+		auto levelWidth(const uint32_t level) const -> uint32_t
+		{
+			return std::max(width >> level, 1u);
+		}
+
+		auto levelHeight(const uint32_t level) const -> uint32_t
+		{
+			return std::max(height >> level, 1u);
+		}
+
+		auto writeDescriptorSet(const vk::DescriptorSet descriptor_set, const vk::DescriptorImageInfo& source_info, const vk::DescriptorImageInfo& destination_info) const -> void
+		{
+			auto write_descriptor_sets = std::array<vk::WriteDescriptorSet, 2>{};
+			write_descriptor_sets[0].dstSet = descriptor_set;
+			write_descriptor_sets[0].dstBinding = 0;
+			write_descriptor_sets[0].descriptorCount = 1;
+			write_descriptor_sets[0].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+			write_descriptor_sets[0].pImageInfo = &source_info;
+			write_descriptor_sets[1].dstSet = descriptor_set;
+			write_descriptor_sets[1].dstBinding = 1;
+			write_descriptor_sets[1].descriptorCount = 1;
+			write_descriptor_sets[1].descriptorType = vk::DescriptorType::eStorageImage;
+			write_descriptor_sets[1].pImageInfo = &destination_info;
+			device->logicalDevice.updateDescriptorSets(static_cast<uint32_t>(write_descriptor_sets.size()), write_descriptor_sets.data(), 0, nullptr);
+		}
+
+		/* Farthest sample of source_extent, visible to the level 0 reduction afterwards */
+		auto recordResolve(const vk::CommandBuffer cmd_buffer, const vk::Extent2D source_extent) const -> void
+		{
+			auto push_constants = PushConstants{};
+			push_constants.sourceWidth = source_extent.width;
+			push_constants.sourceHeight = source_extent.height;
+			push_constants.destinationWidth = source_extent.width;
+			push_constants.destinationHeight = source_extent.height;
+
+			cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, resolvePipeline);
+			cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &descriptorSets[levelCount], 0, nullptr);
+			cmd_buffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &push_constants);
+			cmd_buffer.dispatch((source_extent.width + 7) / 8, (source_extent.height + 7) / 8, 1);
+
+			vk::ImageMemoryBarrier resolve_barrier = {};
+			resolve_barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+			resolve_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+			resolve_barrier.oldLayout = vk::ImageLayout::eGeneral;
+			resolve_barrier.newLayout = vk::ImageLayout::eGeneral;
+			resolve_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			resolve_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			resolve_barrier.image = resolvedImage;
+			resolve_barrier.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+			cmd_buffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				0, nullptr,
+				1, &resolve_barrier
+			);
+		}
+
+		auto createImage(const vk::Queue queue) -> void
+		{
+			auto& logical_device = device->logicalDevice;
+
+			vk::ImageCreateInfo image_create_info = {};
+			image_create_info.imageType = vk::ImageType::e2D;
+			image_create_info.format = vk::Format::eR32Sfloat;
+			image_create_info.extent = vk::Extent3D{ width, height, 1 };
+			image_create_info.mipLevels = levelCount;
+			image_create_info.arrayLayers = 1;
+			image_create_info.samples = vk::SampleCountFlagBits::e1;
+			image_create_info.tiling = vk::ImageTiling::eOptimal;
+			image_create_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eTransferDst;
+			image_create_info.initialLayout = vk::ImageLayout::eUndefined;
+			VK_ASSERT(logical_device.createImage(&image_create_info, nullptr, &image));
+
+			vk::MemoryRequirements memory_requirements;
+			logical_device.getImageMemoryRequirements(image, &memory_requirements);
+			vk::MemoryAllocateInfo memory_allocate_info = {};
+			memory_allocate_info.allocationSize = memory_requirements.size;
+			memory_allocate_info.memoryTypeIndex = device->findMemoryType(memory_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			VK_ASSERT(logical_device.allocateMemory(&memory_allocate_info, nullptr, &memory));
+			logical_device.bindImageMemory(image, memory, 0);
+
+			vk::ImageViewCreateInfo view_create_info = {};
+			view_create_info.image = image;
+			view_create_info.viewType = vk::ImageViewType::e2D;
+			view_create_info.format = vk::Format::eR32Sfloat;
+			view_create_info.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, levelCount, 0, 1 };
+			VK_ASSERT(logical_device.createImageView(&view_create_info, nullptr, &view));
+
+			levelViews.resize(levelCount);
+			for (uint32_t level = 0; level < levelCount; level++) {
+				view_create_info.subresourceRange = { vk::ImageAspectFlagBits::eColor, level, 1, 0, 1 };
+				VK_ASSERT(logical_device.createImageView(&view_create_info, nullptr, &levelViews[level]));
+			}
+
+			/* Cleared to the far plane so a culling pass before the first build hides nothing */
+			auto cmd_buffer = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+			vk::ImageMemoryBarrier layout_barrier = {};
+			layout_barrier.srcAccessMask = vk::AccessFlags();
+			layout_barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+			layout_barrier.oldLayout = vk::ImageLayout::eUndefined;
+			layout_barrier.newLayout = vk::ImageLayout::eGeneral;
+			layout_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			layout_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			layout_barrier.image = image;
+			layout_barrier.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, levelCount, 0, 1 };
+			cmd_buffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTopOfPipe,
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::DependencyFlags(),
+				0, nullptr,
+				0, nullptr,
+				1, &layout_barrier
+			);
+
+			const auto far_plane = vk::ClearColorValue(std::array<float, 4>{ 1.0f, 1.0f, 1.0f, 1.0f });
+			cmd_buffer.clearColorImage(image, vk::ImageLayout::eGeneral, &far_plane, 1, &layout_barrier.subresourceRange);
+
+			layout_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+			layout_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+			layout_barrier.oldLayout = vk::ImageLayout::eGeneral;
+			cmd_buffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				0, nullptr,
+				1, &layout_barrier
+			);
+			device->finishAndSubmitCmdBuffer(cmd_buffer, queue);
+		}
+
+		/* Full size of the depth buffer, rewritten by every build before level 0 reads it */
+		auto createResolveImage(const vk::Queue queue) -> void
+		{
+			auto& logical_device = device->logicalDevice;
+
+			vk::ImageCreateInfo image_create_info = {};
+			image_create_info.imageType = vk::ImageType::e2D;
+			image_create_info.format = vk::Format::eR32Sfloat;
+			image_create_info.extent = vk::Extent3D{ resolvedWidth, resolvedHeight, 1 };
+			image_create_info.mipLevels = 1;
+			image_create_info.arrayLayers = 1;
+			image_create_info.samples = vk::SampleCountFlagBits::e1;
+			image_create_info.tiling = vk::ImageTiling::eOptimal;
+			image_create_info.usage = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eStorage;
+			image_create_info.initialLayout = vk::ImageLayout::eUndefined;
+			VK_ASSERT(logical_device.createImage(&image_create_info, nullptr, &resolvedImage));
+
+			vk::MemoryRequirements memory_requirements;
+			logical_device.getImageMemoryRequirements(resolvedImage, &memory_requirements);
+			vk::MemoryAllocateInfo memory_allocate_info = {};
+			memory_allocate_info.allocationSize = memory_requirements.size;
+			memory_allocate_info.memoryTypeIndex = device->findMemoryType(memory_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			VK_ASSERT(logical_device.allocateMemory(&memory_allocate_info, nullptr, &resolvedMemory));
+			logical_device.bindImageMemory(resolvedImage, resolvedMemory, 0);
+
+			vk::ImageViewCreateInfo view_create_info = {};
+			view_create_info.image = resolvedImage;
+			view_create_info.viewType = vk::ImageViewType::e2D;
+			view_create_info.format = vk::Format::eR32Sfloat;
+			view_create_info.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+			VK_ASSERT(logical_device.createImageView(&view_create_info, nullptr, &resolvedView));
+
+			auto cmd_buffer = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+			vk::ImageMemoryBarrier layout_barrier = {};
+			layout_barrier.srcAccessMask = vk::AccessFlags();
+			layout_barrier.dstAccessMask = vk::AccessFlagBits::eShaderWrite;
+			layout_barrier.oldLayout = vk::ImageLayout::eUndefined;
+			layout_barrier.newLayout = vk::ImageLayout::eGeneral;
+			layout_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			layout_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			layout_barrier.image = resolvedImage;
+			layout_barrier.subresourceRange = view_create_info.subresourceRange;
+			cmd_buffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTopOfPipe,
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::DependencyFlags(),
+				0, nullptr,
+				0, nullptr,
+				1, &layout_barrier
+			);
+			device->finishAndSubmitCmdBuffer(cmd_buffer, queue);
+		}
+	};
+}
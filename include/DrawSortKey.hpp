@@ -0,0 +1,47 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+
+namespace vkpbr {
+
+	/*
+	64 bit draw sort keys, ascending order is submission order
+	Opaque:  [63] 0 | [62..59] pipeline | [58..40] material | [39..24] mesh buffers | [23..0] depth
+	Blended: [63] 1 | [62..39] inverted depth | [38..35] pipeline | [34..16] material
+	Opaque draws are grouped by state and go front to back inside a group for early depth rejection,
+	blended draws go back to front and only use state as a tie breaker.
+	*/
+	class DrawSortKey {
+	public:
+		static constexpr uint32_t depthBits = 24;
+		static constexpr uint32_t maxPipeline = (1u << 4) - 1;
+		static constexpr uint32_t maxMaterial = (1u << 19) - 1;
+		static constexpr uint32_t maxMeshBuffer = (1u << 16) - 1;
+
+		/* Linear view depth in [0, far] to depthBits */
+		static auto quantizeDepth(const float view_depth, const float far_plane) -> uint32_t
+		{
+			const auto normalized = std::clamp(view_depth / far_plane, 0.0f, 1.0f);
+			return static_cast<uint32_t>(normalized * static_cast<float>((1u << depthBits) - 1));
+		}
+
+		static auto opaque(const uint32_t pipeline, const uint32_t material, const uint32_t mesh_buffer, const uint32_t depth) -> uint64_t
+		{
+			return (static_cast<uint64_t>(std::min(pipeline, maxPipeline)) << 59)
+				| (static_cast<uint64_t>(std::min(material, maxMaterial)) << 40)
+				| (static_cast<uint64_t>(std::min(mesh_buffer, maxMeshBuffer)) << 24)
+				| static_cast<uint64_t>(depth);
+		}
+
+		static auto blended(const uint32_t pipeline, const uint32_t material, const uint32_t depth) -> uint64_t
+		{
+			const auto inverted_depth = ((1u << depthBits) - 1) - depth;
+			return (uint64_t{ 1 } << 63)
+				| (static_cast<uint64_t>(inverted_depth) << 39)
+				| (static_cast<uint64_t>(std::min(pipeline, maxPipeline)) << 35)
+				| (static_cast<uint64_t>(std::min(material, maxMaterial)) << 16);
+		}
+	};
+}
@@ -0,0 +1,291 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <gli/gli.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <ThreadPool.hpp>
+#include "stb_image.h"
+
+
+namespace vkpbr {
+
+	/*
+	CPU side copy of an environment cubemap in linear RGB, used as the source for
+	IBL precomputation. Faces follow Vulkan order +X, -X, +Y, -Y, +Z, -Z.
+	*/
+	class EnvironmentMap {
+	public:
+		uint32_t                               size = 0;
+		std::array<std::vector<glm::vec3>, 6>  faces;
+
+		/* Equirectangular .hdr or base level of an uncompressed KTX/DDS cubemap */
+		auto loadFromFile(const std::string& filename, vkpbr::ThreadPool& thread_pool) -> bool
+		{
+			const auto extension = filename.substr(filename.find_last_of('.') + 1);
+			if (extension == "hdr") {
+				return loadEquirectangular(filename, thread_pool);
+			}
+
+			gli::texture_cube texture(gli::load(filename));
+			if (texture.empty()) {
+				std::cerr << "[ERROR] Could not load environment map: " << filename << std::endl;
+				return false;
+			}
+			if (gli::is_compressed(texture.format())) {
+				std::cerr << "[ERROR] Compressed environment maps are not supported: " << filename << std::endl;
+				return false;
+			}
+
+			const auto converted = gli::convert(texture, gli::FORMAT_RGBA32_SFLOAT_PACK32);
+			size = static_cast<uint32_t>(converted.extent().x);
+			for (uint32_t face = 0; face < 6; face++) {
+				const auto* texels = converted[face][0].data<glm::vec4>();
+				faces[face].resize(static_cast<size_t>(size) * size);
+				for (size_t i = 0; i < faces[face].size(); i++) {
+					faces[face][i] = glm::vec3(texels[i]);
+				}
+			}
+			return true;
+		}
+
+		/*
+		Radiance HDR latitude/longitude image resampled to a cube, face size defaults to
+		the largest power of two not above a quarter of the image width. Each face row is a pool job.
+		*/
+		auto loadEquirectangular(const std::string& filename, vkpbr::ThreadPool& thread_pool, const uint32_t face_size = 0) -> bool
+		{
+			int width, height, components;
+			auto* pixels = stbi_loadf(filename.c_str(), &width, &height, &components, 3);
+			if (nullptr == pixels) {
+				std::cerr << "[ERROR] Could not load equirectangular environment: " << filename << " (" << stbi_failure_reason() << ")" << std::endl;
+				return false;
+			}
+
+			size = face_size;
+			if (0 == size) {
+				size = 1;
+				while (size * 2 <= static_cast<uint32_t>(width) / 4) {
+					size *= 2;
+				}
+			}
+			for (auto& face : faces) {
+				face.resize(static_cast<size_t>(size) * size);
+			}
+
+			const auto* source = reinterpret_cast<const glm::vec3*>(pixels);
+			const auto source_width = static_cast<uint32_t>(width);
+			const auto source_height = static_cast<uint32_t>(height);
+
+			thread_pool.parallelFor(static_cast<size_t>(size) * 6, 4, [&](const size_t first, const size_t last) {
+				for (auto row = first; row < last; row++) {
+					const auto face = static_cast<uint32_t>(row / size);
+					const auto y = static_cast<uint32_t>(row % size);
+					auto* destination = faces[face].data() + static_cast<size_t>(y) * size;
+					for (uint32_t x = 0; x < size; x++) {
+						const auto direction = glm::normalize(texelDirection(face, x, y, size));
+						destination[x] = sampleEquirectangular(source, source_width, source_height, direction);
+					}
+				}
+			});
+
+			stbi_image_free(pixels);
+			return true;
+		}
+
+		/*
+		GPU copy with a box filtered mip chain in shared exponent E5B9G9R9,
+		4 bytes per texel against 8 for RGBA16F, every (level, face) is encoded on a pool worker
+		*/
+		auto toCubemap(vkpbr::ThreadPool& thread_pool) const -> gli::texture_cube
+		{
+			auto chain = std::vector<EnvironmentMap>{ *this };
+			while (chain.back().size > 1) {
+				chain.push_back(chain.back().downsample());
+			}
+
+			auto result = gli::texture_cube(gli::FORMAT_RGB9E5_UFLOAT_PACK32, gli::extent2d(size, size), chain.size());
+			thread_pool.parallelFor(chain.size() * 6, 1, [&](const size_t first, const size_t last) {
+				for (auto job = first; job < last; job++) {
+					const auto level = job / 6;
+					const auto face = job % 6;
+					const auto& texels = chain[level].faces[face];
+					auto* destination = result[face][level].data<uint32_t>();
+					for (size_t i = 0; i < texels.size(); i++) {
+						destination[i] = glm::packF3x9_E1x5(texels[i]);
+					}
+				}
+			});
+			return result;
+		}
+
+		/* Constant radiance, fallback when no environment is available */
+		static auto uniform(const glm::vec3& radiance, const uint32_t size = 8) -> EnvironmentMap
+		{
+			auto environment = EnvironmentMap{};
+			environment.size = size;
+			for (auto& face : environment.faces) {
+				face.assign(static_cast<size_t>(size) * size, radiance);
+			}
+			return environment;
+		}
+
+		auto empty() const -> bool
+		{
+			return size == 0;
+		}
+
+		auto texel(const uint32_t face, const uint32_t x, const uint32_t y) const -> const glm::vec3&
+		{
+			return faces[face][static_cast<size_t>(y) * size + x];
+		}
+
+		/* Bilinear lookup, filtering does not cross face edges */
+		auto sample(const glm::vec3& direction) const -> glm::vec3
+		{
+			uint32_t face;
+			float u, v;
+			directionToFace(direction, face, u, v);
+
+			const auto max_coordinate = static_cast<float>(size - 1);
+			const auto px = glm::clamp((u + 1.0f) * 0.5f * static_cast<float>(size) - 0.5f, 0.0f, max_coordinate);
+			const auto py = glm::clamp((v + 1.0f) * 0.5f * static_cast<float>(size) - 0.5f, 0.0f, max_coordinate);
+			const auto x0 = static_cast<uint32_t>(px);
+			const auto y0 = static_cast<uint32_t>(py);
+			const auto x1 = std::min(x0 + 1, size - 1);
+			const auto y1 = std::min(y0 + 1, size - 1);
+			const auto fx = px - static_cast<float>(x0);
+			const auto fy = py - static_cast<float>(y0);
+
+			const auto top = glm::mix(texel(face, x0, y0), texel(face, x1, y0), fx);
+			const auto bottom = glm::mix(texel(face, x0, y1), texel(face, x1, y1), fx);
+			return glm::mix(top, bottom, fy);
+		}
+
+		/* Next level of a box filtered mip chain */
+		auto downsample() const -> EnvironmentMap
+		{
+			auto result = EnvironmentMap{};
+			result.size = std::max(size / 2, 1u);
+			for (uint32_t face = 0; face < 6; face++) {
+				result.faces[face].resize(static_cast<size_t>(result.size) * result.size);
+				for (uint32_t y = 0; y < result.size; y++) {
+					for (uint32_t x = 0; x < result.size; x++) {
+						const auto sx = std::min(x * 2, size - 1);
+						const auto sy = std::min(y * 2, size - 1);
+						const auto sx1 = std::min(sx + 1, size - 1);
+						const auto sy1 = std::min(sy + 1, size - 1);
+						result.faces[face][static_cast<size_t>(y) * result.size + x] =
+							(texel(face, sx, sy) + texel(face, sx1, sy) + texel(face, sx, sy1) + texel(face, sx1, sy1)) * 0.25f;
+					}
+				}
+			}
+			return result;
+		}
+
+		/* Identifies the environment content for on disk caches of derived data */
+		auto contentHash() const -> uint64_t
+		{
+			auto hash = uint64_t{ 14695981039346656037ull };
+			const auto combine = [&hash](const uint64_t value) {
+				hash = (hash ^ value) * 1099511628211ull;
+			};
+
+			combine(size);
+			for (const auto& face : faces) {
+				const auto* words = reinterpret_cast<const uint32_t*>(face.data());
+				const auto word_count = face.size() * sizeof(glm::vec3) / sizeof(uint32_t);
+				for (size_t i = 0; i < word_count; i++) {
+					combine(words[i]);
+				}
+			}
+			return hash;
+		}
+
+		/* Inverse of faceDirection */
+		static auto directionToFace(const glm::vec3& direction, uint32_t& face, float& u, float& v) -> void
+		{
+			const auto abs_direction = glm::abs(direction);
+			if (abs_direction.x >= abs_direction.y && abs_direction.x >= abs_direction.z) {
+				face = direction.x > 0.0f ? 0 : 1;
+				u = (direction.x > 0.0f ? -direction.z : direction.z) / abs_direction.x;
+				v = -direction.y / abs_direction.x;
+			} else if (abs_direction.y >= abs_direction.z) {
+				face = direction.y > 0.0f ? 2 : 3;
+				u = direction.x / abs_direction.y;
+				v = (direction.y > 0.0f ? direction.z : -direction.z) / abs_direction.y;
+			} else {
+				face = direction.z > 0.0f ? 4 : 5;
+				u = (direction.z > 0.0f ? direction.x : -direction.x) / abs_direction.z;
+				v = -direction.y / abs_direction.z;
+			}
+		}
+
+		/* Direction through texel center, not normalized */
+		static auto texelDirection(const uint32_t face, const uint32_t x, const uint32_t y, const uint32_t size) -> glm::vec3
+		{
+			const auto u = 2.0f * (static_cast<float>(x) + 0.5f) / static_cast<float>(size) - 1.0f;
+			const auto v = 2.0f * (static_cast<float>(y) + 0.5f) / static_cast<float>(size) - 1.0f;
+			return faceDirection(face, u, v);
+		}
+
+		/* u, v in [-1, 1] on given face */
+		static auto faceDirection(const uint32_t face, const float u, const float v) -> glm::vec3
+		{
+			switch (face) {
+				case 0:  return glm::vec3( 1.0f,   -v,   -u);
+				case 1:  return glm::vec3(-1.0f,   -v,    u);
+				case 2:  return glm::vec3(    u, 1.0f,    v);
+				case 3:  return glm::vec3(    u,-1.0f,   -v);
+				case 4:  return glm::vec3(    u,   -v, 1.0f);
+				default: return glm::vec3(   -u,   -v,-1.0f);
+			}
+		}
+
+		/* Exact solid angle subtended by a texel */
+		static auto texelSolidAngle(const uint32_t x, const uint32_t y, const uint32_t size) -> float
+		{
+			const auto inv_size = 1.0f / static_cast<float>(size);
+			const auto x0 = 2.0f * static_cast<float>(x) * inv_size - 1.0f;
+			const auto y0 = 2.0f * static_cast<float>(y) * inv_size - 1.0f;
+			const auto x1 = x0 + 2.0f * inv_size;
+			const auto y1 = y0 + 2.0f * inv_size;
+			return areaElement(x0, y0) - areaElement(x0, y1) - areaElement(x1, y0) + areaElement(x1, y1);
+		}
+
+	private:
+		/* Bilinear, wraps around longitude and clamps at the poles, +Y is the top row */
+		static auto sampleEquirectangular(const glm::vec3* pixels, const uint32_t width, const uint32_t height, const glm::vec3& direction) -> glm::vec3
+		{
+			const auto u = 0.5f + std::atan2(direction.x, -direction.z) / (2.0f * glm::pi<float>());
+			const auto v = std::acos(glm::clamp(direction.y, -1.0f, 1.0f)) / glm::pi<float>();
+
+			const auto px = u * static_cast<float>(width) - 0.5f;
+			const auto py = glm::clamp(v * static_cast<float>(height) - 0.5f, 0.0f, static_cast<float>(height - 1));
+			const auto fx = px - std::floor(px);
+			const auto fy = py - std::floor(py);
+			const auto signed_width = static_cast<int64_t>(width);
+			const auto x0 = static_cast<size_t>((static_cast<int64_t>(std::floor(px)) % signed_width + signed_width) % signed_width);
+			const auto x1 = (x0 + 1) % width;
+			const auto y0 = static_cast<uint32_t>(py);
+			const auto y1 = std::min(y0 + 1, height - 1);
+
+			const auto top = glm::mix(pixels[static_cast<size_t>(y0) * width + x0], pixels[static_cast<size_t>(y0) * width + x1], fx);
+			const auto bottom = glm::mix(pixels[static_cast<size_t>(y1) * width + x0], pixels[static_cast<size_t>(y1) * width + x1], fx);
+			return glm::mix(top, bottom, fy);
+		}
+
+		static auto areaElement(const float x, const float y) -> float
+		{
+			return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0f));
+		}
+	};
+}
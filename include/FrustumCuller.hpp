@@ -0,0 +1,198 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define VKPBR_CULL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VKPBR_CULL_SSE
+#endif
+
+#include <glm/glm.hpp>
+
+#include <ThreadPool.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Frustum culling of world space AABBs kept as structure of arrays
+	Boxes are tested 8 (AVX) or 4 (SSE) at a time against all six planes,
+	batches are split between pool workers.
+	*/
+	class FrustumCuller {
+	public:
+		/* xyz = inward normal, w = distance, normalized */
+		using Frustum = std::array<glm::vec4, 6>;
+
+		/* Planes of a [0, 1] depth range projection (GLM_FORCE_DEPTH_ZERO_TO_ONE) */
+		static auto extractPlanes(const glm::mat4& view_projection) -> Frustum
+		{
+			const auto row = [&view_projection](const int i) {
+				return glm::vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+			};
+
+			auto frustum = Frustum{
+				row(3) + row(0),
+				row(3) - row(0),
+				row(3) + row(1),
+				row(3) - row(1),
+				row(2),
+				row(3) - row(2)
+			};
+			for (auto& plane : frustum) {
+				plane /= glm::length(glm::vec3(plane));
+			}
+			return frustum;
+		}
+
+		/* AABB of a local box after transformation, as center and half extent */
+		static auto transformBounds(const glm::mat4& transform, const glm::vec3& min, const glm::vec3& max, glm::vec3& center, glm::vec3& extent) -> void
+		{
+			const auto local_center = (min + max) * 0.5f;
+			const auto local_extent = (max - min) * 0.5f;
+			center = glm::vec3(transform * glm::vec4(local_center, 1.0f));
+			extent = glm::abs(glm::vec3(transform[0])) * local_extent.x
+				+ glm::abs(glm::vec3(transform[1])) * local_extent.y
+				+ glm::abs(glm::vec3(transform[2])) * local_extent.z;
+		}
+
+		auto clear() -> void
+		{
+			count = 0;
+			for (auto* component : components()) {
+				component->clear();
+			}
+		}
+
+		auto addBox(const glm::vec3& center, const glm::vec3& extent) -> void
+		{
+			centerX.push_back(center.x);
+			centerY.push_back(center.y);
+			centerZ.push_back(center.z);
+			extentX.push_back(extent.x);
+			extentY.push_back(extent.y);
+			extentZ.push_back(extent.z);
+			count++;
+		}
+
+		auto size() const -> size_t
+		{
+			return count;
+		}
+
+		/* visible[i] != 0 for boxes intersecting the frustum, in order of addBox() */
+		auto cull(const Frustum& frustum, vkpbr::ThreadPool& thread_pool) -> const std::vector<uint8_t>&
+		{
+			/* Padding boxes are never read back, arrays only need whole batches */
+			const auto padded_count = (count + laneCount - 1) / laneCount * laneCount;
+			for (auto* component : components()) {
+				component->resize(padded_count, 0.0f);
+			}
+			visible.resize(padded_count);
+
+			const auto batch_count = padded_count / laneCount;
+			thread_pool.parallelFor(batch_count, 64, [&](const size_t first, const size_t last) {
+				cullBatches(frustum, first, last);
+			});
+
+			/* Keeps addBox() appending after the real boxes */
+			for (auto* component : components()) {
+				component->resize(count);
+			}
+			visible.resize(count);
+			return visible;
+		}
+
+	private:
+#if defined(VKPBR_CULL_AVX)
+		static constexpr size_t laneCount = 8;
+#elif defined(VKPBR_CULL_SSE)
+		static constexpr size_t laneCount = 4;
+#else
+		static constexpr size_t laneCount = 1;
+#endif
+
+		size_t               count = 0;
+		std::vector<float>   centerX;
+		std::vector<float>   centerY;
+		std::vector<float>   centerZ;
+		std::vector<float>   extentX;
+		std::vector<float>   extentY;
+		std::vector<float>   extentZ;
+		std::vector<uint8_t> visible;
+
+		auto components() -> std::array<std::vector<float>*, 6>
+		{
+			return { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ };
+		}
+
+		/* Box is outside when center distance + projected radius < 0 for any plane */
+		auto cullBatches(const Frustum& frustum, const size_t first_batch, const size_t last_batch) -> void
+		{
+			for (auto batch = first_batch; batch < last_batch; batch++) {
+				const auto i = batch * laneCount;
+#if defined(VKPBR_CULL_AVX)
+				const auto cx = _mm256_loadu_ps(&centerX[i]);
+				const auto cy = _mm256_loadu_ps(&centerY[i]);
+				const auto cz = _mm256_loadu_ps(&centerZ[i]);
+				const auto ex = _mm256_loadu_ps(&extentX[i]);
+				const auto ey = _mm256_loadu_ps(&extentY[i]);
+				const auto ez = _mm256_loadu_ps(&extentZ[i]);
+				const auto zero = _mm256_setzero_ps();
+
+				auto inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (const auto& plane : frustum) {
+					const auto distance = _mm256_add_ps(
+						_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+						_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+					const auto radius = _mm256_add_ps(
+						_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(std::abs(plane.y)), ey)),
+						_mm256_mul_ps(_mm256_set1_ps(std::abs(plane.z)), ez));
+					inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+				}
+
+				const auto mask = _mm256_movemask_ps(inside);
+#elif defined(VKPBR_CULL_SSE)
+				const auto cx = _mm_loadu_ps(&centerX[i]);
+				const auto cy = _mm_loadu_ps(&centerY[i]);
+				const auto cz = _mm_loadu_ps(&centerZ[i]);
+				const auto ex = _mm_loadu_ps(&extentX[i]);
+				const auto ey = _mm_loadu_ps(&extentY[i]);
+				const auto ez = _mm_loadu_ps(&extentZ[i]);
+				const auto zero = _mm_setzero_ps();
+
+				auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (const auto& plane : frustum) {
+					const auto distance = _mm_add_ps(
+						_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+						_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+					const auto radius = _mm_add_ps(
+						_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::abs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(std::abs(plane.y)), ey)),
+						_mm_mul_ps(_mm_set1_ps(std::abs(plane.z)), ez));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+				}
+
+				const auto mask = _mm_movemask_ps(inside);
+#else
+				auto mask = 1;
+				for (const auto& plane : frustum) {
+					const auto distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+					const auto radius = std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+					if (distance + radius < 0.0f) {
+						mask = 0;
+						break;
+					}
+				}
+#endif
+				for (size_t lane = 0; lane < laneCount; lane++) {
+					visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+				}
+			}
+		}
+	};
+}
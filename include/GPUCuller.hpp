@@ -0,0 +1,503 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <VulkanDevice.hpp>
+#include <UploadManager.hpp>
+#include <FrustumCuller.hpp>
+#include <DepthPyramid.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	GPU driven culling of a static draw set living in device local buffers
+	cull.comp tests every draw against the frustum and writes indirect commands, draws are
+	grouped into one range per material so the CPU records one indirect draw per material
+	whatever the number of primitives. With VK_KHR_draw_indirect_count survivors are compacted
+	and counted per range, otherwise culled draws keep their slot with instanceCount = 0.
+	Commands and counts are per frame in flight.
+
+	Occlusion runs in two passes around a depth pyramid build: previouslyVisible draws what
+	passed last frame, occlusion tests everything against the pyramid of that depth, draws
+	what became visible and stores visibility for the next frame, so disoccluded objects never pop.
+	*/
+	class GPUCuller {
+	public:
+		/* Bounds are in the space the frustum planes are given in */
+		using Draw = struct {
+			glm::vec3 center;
+			glm::vec3 extent;
+			uint32_t  firstIndex;
+			uint32_t  indexCount;
+			uint32_t  material;
+			/* vkpbr::gltf::Node::index, emitted as first instance for the node transform lookup */
+			uint32_t  node;
+		};
+
+		using MaterialRange = struct {
+			uint32_t material;
+			uint32_t firstDraw;
+			uint32_t drawCount;
+		};
+
+		enum class Pass : uint32_t {
+			frustum = 0,
+			previouslyVisible = 1,
+			occlusion = 2
+		};
+
+		GPUCuller() = default;
+		GPUCuller(const GPUCuller&) = delete;
+		auto operator=(const GPUCuller&) -> GPUCuller& = delete;
+
+		auto init(vkpbr::VulkanDevice* device, const uint32_t frame_count, const vk::PipelineCache pipeline_cache) -> void
+		{
+			this->device = device;
+			this->frameCount = frame_count;
+			auto& logical_device = device->logicalDevice;
+
+			if (device->extensionSupported(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+				drawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(logical_device.getProcAddr("vkCmdDrawIndexedIndirectCountKHR"));
+			}
+
+			/* Per frame view parameters */
+			const auto alignment = device->deviceProperties.limits.minUniformBufferOffsetAlignment;
+			viewSliceSize = (sizeof(ViewParameters) + alignment - 1) & ~(alignment - 1);
+			VK_ASSERT(device->createBuffer(
+				viewSliceSize * frame_count,
+				vk::BufferUsageFlagBits::eUniformBuffer,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				viewBuffer.buffer,
+				viewBuffer.memory
+			));
+			VK_ASSERT(logical_device.mapMemory(viewBuffer.memory, 0, VK_WHOLE_SIZE, vk::MemoryMapFlags(), &viewMapped));
+
+			/* Draws, commands, counts, visibility, view, depth pyramid */
+			auto layout_bindings = std::array<vk::DescriptorSetLayoutBinding, 6>{};
+			for (uint32_t binding = 0; binding < 4; binding++) {
+				layout_bindings[binding] = { binding, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute, nullptr };
+			}
+			layout_bindings[4] = { 4, vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eCompute, nullptr };
+			layout_bindings[5] = { 5, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eCompute, nullptr };
+			vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
+			descriptor_set_layout_create_info.bindingCount = static_cast<uint32_t>(layout_bindings.size());
+			descriptor_set_layout_create_info.pBindings = layout_bindings.data();
+			VK_ASSERT(logical_device.createDescriptorSetLayout(&descriptor_set_layout_create_info, nullptr, &descriptorSetLayout));
+
+			const auto pool_sizes = std::array<vk::DescriptorPoolSize, 3>{
+				vk::DescriptorPoolSize{ vk::DescriptorType::eStorageBuffer, 4 },
+				vk::DescriptorPoolSize{ vk::DescriptorType::eUniformBufferDynamic, 1 },
+				vk::DescriptorPoolSize{ vk::DescriptorType::eCombinedImageSampler, 1 }
+			};
+			vk::DescriptorPoolCreateInfo descriptor_pool_create_info = {};
+			descriptor_pool_create_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
+			descriptor_pool_create_info.pPoolSizes = pool_sizes.data();
+			descriptor_pool_create_info.maxSets = 1;
+			VK_ASSERT(logical_device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &descriptorPool));
+
+			vk::DescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+			descriptor_set_allocate_info.descriptorPool = descriptorPool;
+			descriptor_set_allocate_info.descriptorSetCount = 1;
+			descriptor_set_allocate_info.pSetLayouts = &descriptorSetLayout;
+			VK_ASSERT(logical_device.allocateDescriptorSets(&descriptor_set_allocate_info, &descriptorSet));
+
+			const auto view_info = vk::DescriptorBufferInfo{ viewBuffer.buffer, 0, sizeof(ViewParameters) };
+			vk::WriteDescriptorSet write_descriptor_set = {};
+			write_descriptor_set.dstSet = descriptorSet;
+			write_descriptor_set.dstBinding = 4;
+			write_descriptor_set.descriptorCount = 1;
+			write_descriptor_set.descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+			write_descriptor_set.pBufferInfo = &view_info;
+			logical_device.updateDescriptorSets(1, &write_descriptor_set, 0, nullptr);
+
+			vk::PushConstantRange push_constant_range = { vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants) };
+			vk::PipelineLayoutCreateInfo pipeline_layout_create_info = {};
+			pipeline_layout_create_info.setLayoutCount = 1;
+			pipeline_layout_create_info.pSetLayouts = &descriptorSetLayout;
+			pipeline_layout_create_info.pushConstantRangeCount = 1;
+			pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+			VK_ASSERT(logical_device.createPipelineLayout(&pipeline_layout_create_info, nullptr, &pipelineLayout));
+
+			vk::ComputePipelineCreateInfo compute_pipeline_create_info = {};
+			compute_pipeline_create_info.layout = pipelineLayout;
+			compute_pipeline_create_info.stage = loadShaderFromFile(logical_device, "cull.comp.spv", vk::ShaderStageFlagBits::eCompute);
+			VK_ASSERT(logical_device.createComputePipelines(pipeline_cache, 1, &compute_pipeline_create_info, nullptr, &pipeline));
+			logical_device.destroyShaderModule(compute_pipeline_create_info.stage.module, nullptr);
+		}
+
+		/* GPU must not use the previous draw set anymore */
+		auto release() -> void
+		{
+			if (!device) {
+				return;
+			}
+			releaseBuffers();
+			auto& logical_device = device->logicalDevice;
+			logical_device.unmapMemory(viewBuffer.memory);
+			logical_device.destroyBuffer(viewBuffer.buffer, nullptr);
+			logical_device.freeMemory(viewBuffer.memory, nullptr);
+			logical_device.destroyPipeline(pipeline, nullptr);
+			logical_device.destroyPipelineLayout(pipelineLayout, nullptr);
+			logical_device.destroyDescriptorPool(descriptorPool, nullptr);
+			logical_device.destroyDescriptorSetLayout(descriptorSetLayout, nullptr);
+			device = nullptr;
+		}
+
+		/* Replaces the draw set, uploads go through the uploader and are visible after its flush() */
+		auto build(std::vector<Draw> draws, vkpbr::UploadManager* uploader) -> void
+		{
+			releaseBuffers();
+
+			std::stable_sort(draws.begin(), draws.end(), [](const Draw& a, const Draw& b) {
+				return a.material < b.material;
+			});
+
+			ranges.clear();
+			auto gpu_draws = std::vector<GPUDraw>{};
+			gpu_draws.reserve(draws.size());
+			for (uint32_t i = 0; i < static_cast<uint32_t>(draws.size()); i++) {
+				if (ranges.empty() || ranges.back().material != draws[i].material) {
+					ranges.push_back({ draws[i].material, i, 0 });
+				}
+				ranges.back().drawCount++;
+
+				gpu_draws.push_back({
+					glm::vec4(draws[i].center, 0.0f),
+					glm::vec4(draws[i].extent, 0.0f),
+					draws[i].firstIndex,
+					draws[i].indexCount,
+					static_cast<uint32_t>(ranges.size() - 1),
+					ranges.back().firstDraw,
+					draws[i].node
+				});
+			}
+
+			drawCount = static_cast<uint32_t>(gpu_draws.size());
+			if (drawCount == 0) {
+				return;
+			}
+
+			const auto draws_size = static_cast<vk::DeviceSize>(drawCount) * sizeof(GPUDraw);
+			const auto commands_size = static_cast<vk::DeviceSize>(drawCount) * frameCount * slotsPerFrame * sizeof(vk::DrawIndexedIndirectCommand);
+			const auto counts_size = static_cast<vk::DeviceSize>(ranges.size()) * frameCount * slotsPerFrame * sizeof(uint32_t);
+			const auto visibility_size = static_cast<vk::DeviceSize>(drawCount) * sizeof(uint32_t);
+
+			VK_ASSERT(device->createBuffer(
+				draws_size,
+				vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+				vk::MemoryPropertyFlagBits::eDeviceLocal,
+				drawBuffer.buffer,
+				drawBuffer.memory
+			));
+			VK_ASSERT(device->createBuffer(
+				commands_size,
+				vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+				vk::MemoryPropertyFlagBits::eDeviceLocal,
+				commandBuffer.buffer,
+				commandBuffer.memory
+			));
+			VK_ASSERT(device->createBuffer(
+				counts_size,
+				vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+				vk::MemoryPropertyFlagBits::eDeviceLocal,
+				countBuffer.buffer,
+				countBuffer.memory
+			));
+			VK_ASSERT(device->createBuffer(
+				visibility_size,
+				vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst,
+				vk::MemoryPropertyFlagBits::eDeviceLocal,
+				visibilityBuffer.buffer,
+				visibilityBuffer.memory
+			));
+
+			/* Nothing counts as visible before the first occlusion pass, it draws everything in the frustum */
+			const auto visibility = std::vector<uint32_t>(drawCount, 0);
+			uploader->copyToBuffer(gpu_draws.data(), draws_size, drawBuffer.buffer, 0, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead);
+			uploader->copyToBuffer(visibility.data(), visibility_size, visibilityBuffer.buffer, 0, vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+
+			const auto buffer_infos = std::array<vk::DescriptorBufferInfo, 4>{
+				vk::DescriptorBufferInfo{ drawBuffer.buffer, 0, VK_WHOLE_SIZE },
+				vk::DescriptorBufferInfo{ commandBuffer.buffer, 0, VK_WHOLE_SIZE },
+				vk::DescriptorBufferInfo{ countBuffer.buffer, 0, VK_WHOLE_SIZE },
+				vk::DescriptorBufferInfo{ visibilityBuffer.buffer, 0, VK_WHOLE_SIZE }
+			};
+			auto write_descriptor_sets = std::array<vk::WriteDescriptorSet, 4>{};
+			for (uint32_t i = 0; i < static_cast<uint32_t>(write_descriptor_sets.size()); i++) {
+				write_descriptor_sets[i].dstSet = descriptorSet;
+				write_descriptor_sets[i].dstBinding = i;
+				write_descriptor_sets[i].descriptorCount = 1;
+				write_descriptor_sets[i].descriptorType = vk::DescriptorType::eStorageBuffer;
+				write_descriptor_sets[i].pBufferInfo = &buffer_infos[i];
+			}
+			device->logicalDevice.updateDescriptorSets(static_cast<uint32_t>(write_descriptor_sets.size()), write_descriptor_sets.data(), 0, nullptr);
+		}
+
+		/* Pyramid read by the occlusion pass, it has to be set before any cull */
+		auto setDepthPyramid(const vkpbr::DepthPyramid& depth_pyramid) -> void
+		{
+			pyramidWidth = depth_pyramid.width;
+			pyramidHeight = depth_pyramid.height;
+			pyramidLevels = depth_pyramid.levelCount;
+
+			vk::WriteDescriptorSet write_descriptor_set = {};
+			write_descriptor_set.dstSet = descriptorSet;
+			write_descriptor_set.dstBinding = 5;
+			write_descriptor_set.descriptorCount = 1;
+			write_descriptor_set.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+			write_descriptor_set.pImageInfo = &depth_pyramid.descriptorInfo;
+			device->logicalDevice.updateDescriptorSets(1, &write_descriptor_set, 0, nullptr);
+		}
+
+		/* Once per frame before its first recordCull(), view_projection maps draw bounds to clip space */
+		auto updateView(const uint32_t frame_index, const glm::mat4& view_projection) -> void
+		{
+			auto view = ViewParameters{};
+			view.viewProjection = view_projection;
+			const auto frustum = vkpbr::FrustumCuller::extractPlanes(view_projection);
+			std::copy(frustum.begin(), frustum.end(), view.planes.begin());
+			view.pyramidSize = glm::vec2(static_cast<float>(pyramidWidth), static_cast<float>(pyramidHeight));
+			view.pyramidLevels = static_cast<float>(pyramidLevels);
+
+			memcpy(static_cast<uint8_t*>(viewMapped) + viewSliceSize * frame_index, &view, sizeof(view));
+		}
+
+		auto materialRanges() const -> const std::vector<MaterialRange>&
+		{
+			return ranges;
+		}
+
+		auto compacting() const -> bool
+		{
+			return drawIndexedIndirectCount != nullptr;
+		}
+
+		/*
+		Outside of a render pass, before recordDraws() of the same pass. The occlusion
+		pass needs the pyramid built from the depth of the previouslyVisible pass.
+		*/
+		auto recordCull(const vk::CommandBuffer cmd_buffer, const uint32_t frame_index, const Pass pass) const -> void
+		{
+			if (drawCount == 0) {
+				return;
+			}
+
+			/* Visibility written by the occlusion pass of the previous frame or read by the first pass */
+			if (pass != Pass::frustum) {
+				vk::MemoryBarrier visibility_barrier = {};
+				visibility_barrier.srcAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+				visibility_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+				cmd_buffer.pipelineBarrier(
+					vk::PipelineStageFlagBits::eComputeShader,
+					vk::PipelineStageFlagBits::eComputeShader,
+					vk::DependencyFlags(),
+					1, &visibility_barrier,
+					0, nullptr,
+					0, nullptr
+				);
+			}
+
+			const auto slot = slotIndex(frame_index, pass);
+			const auto count_offset = static_cast<vk::DeviceSize>(countBase(slot)) * sizeof(uint32_t);
+			const auto count_size = static_cast<vk::DeviceSize>(ranges.size()) * sizeof(uint32_t);
+			if (compacting()) {
+				cmd_buffer.fillBuffer(countBuffer.buffer, count_offset, count_size, 0);
+
+				vk::BufferMemoryBarrier clear_barrier = {};
+				clear_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				clear_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite;
+				clear_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				clear_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				clear_barrier.buffer = countBuffer.buffer;
+				clear_barrier.offset = count_offset;
+				clear_barrier.size = count_size;
+				cmd_buffer.pipelineBarrier(
+					vk::PipelineStageFlagBits::eTransfer,
+					vk::PipelineStageFlagBits::eComputeShader,
+					vk::DependencyFlags(),
+					0, nullptr,
+					1, &clear_barrier,
+					0, nullptr
+				);
+			}
+
+			auto push_constants = PushConstants{};
+			push_constants.drawCount = drawCount;
+			push_constants.compact = compacting() ? 1 : 0;
+			push_constants.commandBase = commandBase(slot);
+			push_constants.countBase = countBase(slot);
+			push_constants.pass = static_cast<uint32_t>(pass);
+
+			const auto view_offset = static_cast<uint32_t>(viewSliceSize * frame_index);
+			cmd_buffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+			cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, 1, &descriptorSet, 1, &view_offset);
+			cmd_buffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(PushConstants), &push_constants);
+			cmd_buffer.dispatch((drawCount + localSize - 1) / localSize, 1, 1);
+
+			auto indirect_barriers = std::array<vk::BufferMemoryBarrier, 2>{};
+			for (auto& barrier : indirect_barriers) {
+				barrier.srcAccessMask = vk::AccessFlagBits::eShaderWrite;
+				barrier.dstAccessMask = vk::AccessFlagBits::eIndirectCommandRead;
+				barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			}
+			indirect_barriers[0].buffer = commandBuffer.buffer;
+			indirect_barriers[0].offset = static_cast<vk::DeviceSize>(commandBase(slot)) * sizeof(vk::DrawIndexedIndirectCommand);
+			indirect_barriers[0].size = static_cast<vk::DeviceSize>(drawCount) * sizeof(vk::DrawIndexedIndirectCommand);
+			indirect_barriers[1].buffer = countBuffer.buffer;
+			indirect_barriers[1].offset = count_offset;
+			indirect_barriers[1].size = count_size;
+
+			cmd_buffer.pipelineBarrier(
+				vk::PipelineStageFlagBits::eComputeShader,
+				vk::PipelineStageFlagBits::eDrawIndirect,
+				vk::DependencyFlags(),
+				0, nullptr,
+				compacting() ? 2 : 1, indirect_barriers.data(),
+				0, nullptr
+			);
+		}
+
+		/*
+		Inside the render pass with vertex and index buffers bound, bind_material(cmd_buffer, material)
+		binds what the draws of one range need and returns false to skip the range
+		*/
+		template<typename F>
+		auto recordDraws(const vk::CommandBuffer cmd_buffer, const uint32_t frame_index, const Pass pass, F&& bind_material) const -> void
+		{
+			if (drawCount == 0) {
+				return;
+			}
+
+			const auto slot = slotIndex(frame_index, pass);
+			constexpr auto stride = static_cast<uint32_t>(sizeof(vk::DrawIndexedIndirectCommand));
+			const auto multi_draw = device->enabledFeatures.multiDrawIndirect;
+
+			for (uint32_t range_index = 0; range_index < static_cast<uint32_t>(ranges.size()); range_index++) {
+				const auto& range = ranges[range_index];
+				if (!bind_material(cmd_buffer, range.material)) {
+					continue;
+				}
+
+				const auto command_offset = static_cast<vk::DeviceSize>(commandBase(slot) + range.firstDraw) * stride;
+				if (compacting()) {
+					const auto count_offset = static_cast<vk::DeviceSize>(countBase(slot) + range_index) * sizeof(uint32_t);
+					drawIndexedIndirectCount(
+						static_cast<VkCommandBuffer>(cmd_buffer),
+						static_cast<VkBuffer>(commandBuffer.buffer),
+						command_offset,
+						static_cast<VkBuffer>(countBuffer.buffer),
+						count_offset,
+						range.drawCount,
+						stride
+					);
+				} else if (multi_draw) {
+					cmd_buffer.drawIndexedIndirect(commandBuffer.buffer, command_offset, range.drawCount, stride);
+				} else {
+					/* Without multiDrawIndirect every command needs its own call */
+					for (uint32_t i = 0; i < range.drawCount; i++) {
+						cmd_buffer.drawIndexedIndirect(commandBuffer.buffer, command_offset + static_cast<vk::DeviceSize>(i) * stride, 1, stride);
+					}
+				}
+			}
+		}
+
+	private:
+		static constexpr uint32_t localSize = 64;
+		/* Commands and counts of the two occlusion passes */
+		static constexpr uint32_t slotsPerFrame = 2;
+
+		/* std430 layout of cull.comp */
+		using GPUDraw = struct {
+			glm::vec4 center;
+			glm::vec4 extent;
+			uint32_t  firstIndex;
+			uint32_t  indexCount;
+			uint32_t  range;
+			uint32_t  rangeFirstDraw;
+			uint32_t  firstInstance;
+			/* std430 rounds the struct up to the 16 byte alignment of its vectors */
+			uint32_t  padding[3];
+		};
+		static_assert(sizeof(GPUDraw) == 64, "GPUDraw must match the std430 stride of cull.comp");
+
+		using PushConstants = struct {
+			uint32_t drawCount;
+			uint32_t compact;
+			uint32_t commandBase;
+			uint32_t countBase;
+			uint32_t pass;
+		};
+
+		/* std140 */
+		using ViewParameters = struct {
+			glm::mat4                viewProjection;
+			std::array<glm::vec4, 6> planes;
+			glm::vec2                pyramidSize;
+			float                    pyramidLevels;
+			float                    padding;
+		};
+
+		using Buffer = struct {
+			vk::Buffer       buffer;
+			vk::DeviceMemory memory;
+		};
+
+		vkpbr::VulkanDevice*                 device = nullptr;
+		uint32_t                             frameCount = 1;
+		uint32_t                             drawCount = 0;
+		std::vector<MaterialRange>           ranges;
+		Buffer                               drawBuffer;
+		Buffer                               commandBuffer;
+		Buffer                               countBuffer;
+		Buffer                               visibilityBuffer;
+		Buffer                               viewBuffer;
+		void*                                viewMapped = nullptr;
+		vk::DeviceSize                       viewSliceSize = 0;
+		uint32_t                             pyramidWidth = 1;
+		uint32_t                             pyramidHeight = 1;
+		uint32_t                             pyramidLevels = 1;
+		vk::DescriptorSetLayout              descriptorSetLayout;
+		vk::DescriptorPool                   descriptorPool;
+		vk::DescriptorSet                    descriptorSet;
+		vk::PipelineLayout                   pipelineLayout;
+		vk::Pipeline                         pipeline;
+		PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount = nullptr;
+
+		/* Frustum only culling shares the slot of the first pass */
+		static auto slotIndex(const uint32_t frame_index, const Pass pass) -> uint32_t
+		{
+			return frame_index * slotsPerFrame + (pass == Pass::occlusion ? 1 : 0);
+		}
+
+		auto commandBase(const uint32_t slot) const -> uint32_t
+		{
+			return slot * drawCount;
+		}
+
+		auto countBase(const uint32_t slot) const -> uint32_t
+		{
+			return slot * static_cast<uint32_t>(ranges.size());
+		}
+
+		auto releaseBuffers() -> void
+		{
+			auto& logical_device = device->logicalDevice;
+			for (auto* buffer : { &drawBuffer, &commandBuffer, &countBuffer, &visibilityBuffer }) {
+				if (buffer->buffer) {
+					logical_device.destroyBuffer(buffer->buffer, nullptr);
+					logical_device.freeMemory(buffer->memory, nullptr);
+				}
+				*buffer = Buffer{};
+			}
+			drawCount = 0;
+		}
+	};
+}
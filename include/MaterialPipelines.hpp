@@ -0,0 +1,280 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Utility.hpp>
+#include <ThreadPool.hpp>
+#include <gltfModel.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Shading pipelines of pbr_shader.frag, one per used combination of material features
+	Texture set, workflow and alpha mode are specialization constants, so every material runs
+	a straight line shader without the fetches and branches of features it does not have.
+	Permutations compile on an own worker pool against the shared pipeline cache, until one is
+	ready its draws use the generic pipeline of the same workflow, alpha mode and depth test.
+	*/
+	class MaterialPipelines {
+	public:
+		/* [4..0] textures | [5] specular glossiness | [7..6] alpha mode | [8] equal depth test */
+		using Key = uint32_t;
+
+		static constexpr Key baseColorTexture = 1u << 0;
+		static constexpr Key metallicRoughnessTexture = 1u << 1;
+		static constexpr Key normalTexture = 1u << 2;
+		static constexpr Key occlusionTexture = 1u << 3;
+		static constexpr Key emissiveTexture = 1u << 4;
+		static constexpr Key specularGlossiness = 1u << 5;
+		static constexpr uint32_t alphaModeShift = 6;
+		static constexpr Key depthEqual = 1u << 8;
+		/* Texture bits only, the workflow changes how textures are read and is never replaced */
+		static constexpr Key featureMask = specularGlossiness - 1;
+		/* Absent textures are bound as white, so these features are neutral for any material */
+		static constexpr Key genericFeatures = baseColorTexture | metallicRoughnessTexture | occlusionTexture;
+
+		MaterialPipelines() = default;
+		MaterialPipelines(const MaterialPipelines&) = delete;
+		auto operator=(const MaterialPipelines&) -> MaterialPipelines& = delete;
+
+		/* Equal depth testing only applies to opaque materials, the depth pre-pass skips the others */
+		static auto key(const vkpbr::gltf::Material& material, const bool depth_equal) -> Key
+		{
+			const auto specular_glossiness = material.pbrWorkflows.specularGlossiness;
+			auto key = Key{ 0 };
+			key |= (specular_glossiness ? material.extension.diffuseTexture : material.baseColorTexture) ? baseColorTexture : 0;
+			key |= (specular_glossiness ? material.extension.specularGlossinessTexture : material.metallicRoughnessTexture) ? metallicRoughnessTexture : 0;
+			key |= material.normalTexture ? normalTexture : 0;
+			key |= material.occlusionTexture ? occlusionTexture : 0;
+			key |= material.emissiveTexture ? emissiveTexture : 0;
+			key |= specular_glossiness ? specularGlossiness : 0;
+			key |= static_cast<Key>(material.alphaMode) << alphaModeShift;
+			if (depth_equal && material.alphaMode == vkpbr::gltf::Material::AlphaMode::opaque) {
+				key |= depthEqual;
+			}
+			return key;
+		}
+
+		static auto genericKey(const Key key) -> Key
+		{
+			return genericFeatures | (key & ~featureMask);
+		}
+
+		auto init(vk::Device device, const vk::PipelineCache pipeline_cache, const vk::PipelineLayout pipeline_layout, const vk::RenderPass render_pass, const vk::SampleCountFlagBits samples) -> void
+		{
+			this->device = device;
+			this->pipelineCache = pipeline_cache;
+			this->pipelineLayout = pipeline_layout;
+			this->renderPass = render_pass;
+			this->samples = samples;
+
+			shaderStages = {
+				loadShaderFromFile(device, "pbr_shader.vert.spv", vk::ShaderStageFlagBits::eVertex),
+				loadShaderFromFile(device, "pbr_shader.frag.spv", vk::ShaderStageFlagBits::eFragment)
+			};
+
+			/* Fallbacks for every workflow and alpha mode have to exist before the first frame, everything else compiles in the background */
+			for (const auto workflow : { Key{ 0 }, specularGlossiness }) {
+				for (const auto alpha_mode : { vkpbr::gltf::Material::AlphaMode::opaque, vkpbr::gltf::Material::AlphaMode::mask, vkpbr::gltf::Material::AlphaMode::blend }) {
+					const auto key = genericFeatures | workflow | (static_cast<Key>(alpha_mode) << alphaModeShift);
+					pipelines.emplace(key, create(key));
+					if (alpha_mode == vkpbr::gltf::Material::AlphaMode::opaque) {
+						pipelines.emplace(key | depthEqual, create(key | depthEqual));
+					}
+				}
+			}
+
+			/* Separate from the frame pool, a long compile must never hold up parallel recording */
+			compiler = std::make_unique<vkpbr::ThreadPool>(std::max(1u, vkpbr::ThreadPool::defaultThreadCount() / 2));
+		}
+
+		/* Queues the permutation for compilation unless it is ready or already queued, never blocks */
+		auto request(const Key key) -> void
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (pipelines.count(key) != 0 || !pending.insert(key).second) {
+					return;
+				}
+			}
+			compiler->enqueue([this, key] {
+				const auto pipeline = create(key);
+				std::lock_guard<std::mutex> lock(mutex);
+				pipelines.emplace(key, pipeline);
+				pending.erase(key);
+			});
+		}
+
+		/* Permutation when it is compiled, the generic pipeline of its workflow, alpha mode and depth test otherwise */
+		auto get(const Key key) const -> vk::Pipeline
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto it = pipelines.find(key);
+			if (it != pipelines.end()) {
+				return it->second;
+			}
+			return pipelines.at(genericKey(key));
+		}
+
+		/* Waits for queued compilations */
+		auto release() -> void
+		{
+			compiler.reset();
+			for (auto& entry : pipelines) {
+				device.destroyPipeline(entry.second, nullptr);
+			}
+			pipelines.clear();
+			for (auto& shader_stage : shaderStages) {
+				device.destroyShaderModule(shader_stage.module, nullptr);
+			}
+			shaderStages = {};
+		}
+
+	private:
+		/* Layout of the constant_id block in pbr_shader.frag */
+		using SpecializationData = struct {
+			vk::Bool32 hasBaseColorTexture;
+			vk::Bool32 hasMetallicRoughnessTexture;
+			vk::Bool32 hasNormalTexture;
+			vk::Bool32 hasOcclusionTexture;
+			vk::Bool32 hasEmissiveTexture;
+			int32_t    alphaMode;
+			int32_t    workflow;
+		};
+
+		vk::Device                                       device;
+		vk::PipelineCache                                pipelineCache;
+		vk::PipelineLayout                               pipelineLayout;
+		vk::RenderPass                                   renderPass;
+		vk::SampleCountFlagBits                          samples = vk::SampleCountFlagBits::e1;
+		std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages = {};
+		std::unique_ptr<vkpbr::ThreadPool>               compiler;
+		mutable std::mutex                               mutex;
+		std::unordered_map<Key, vk::Pipeline>            pipelines;
+		std::unordered_set<Key>                          pending;
+
+		/* Reads only state that is fixed after init(), runs on compiler threads */
+		auto create(const Key key) const -> vk::Pipeline
+		{
+			const auto alpha_mode = static_cast<vkpbr::gltf::Material::AlphaMode>((key >> alphaModeShift) & 0x3);
+			const auto blended = alpha_mode == vkpbr::gltf::Material::AlphaMode::blend;
+			const auto depth_equal = (key & depthEqual) != 0;
+
+			/* Specialization */
+			SpecializationData specialization_data = {};
+			specialization_data.hasBaseColorTexture = (key & baseColorTexture) != 0;
+			specialization_data.hasMetallicRoughnessTexture = (key & metallicRoughnessTexture) != 0;
+			specialization_data.hasNormalTexture = (key & normalTexture) != 0;
+			specialization_data.hasOcclusionTexture = (key & occlusionTexture) != 0;
+			specialization_data.hasEmissiveTexture = (key & emissiveTexture) != 0;
+			specialization_data.alphaMode = static_cast<int32_t>(alpha_mode);
+			specialization_data.workflow = (key & specularGlossiness) != 0 ? 1 : 0;
+
+			const auto map_entries = std::array<vk::SpecializationMapEntry, 7>{
+				vk::SpecializationMapEntry{ 0, offsetof(SpecializationData, hasBaseColorTexture), sizeof(vk::Bool32) },
+				vk::SpecializationMapEntry{ 1, offsetof(SpecializationData, hasMetallicRoughnessTexture), sizeof(vk::Bool32) },
+				vk::SpecializationMapEntry{ 2, offsetof(SpecializationData, hasNormalTexture), sizeof(vk::Bool32) },
+				vk::SpecializationMapEntry{ 3, offsetof(SpecializationData, hasOcclusionTexture), sizeof(vk::Bool32) },
+				vk::SpecializationMapEntry{ 4, offsetof(SpecializationData, hasEmissiveTexture), sizeof(vk::Bool32) },
+				vk::SpecializationMapEntry{ 5, offsetof(SpecializationData, alphaMode), sizeof(int32_t) },
+				vk::SpecializationMapEntry{ 6, offsetof(SpecializationData, workflow), sizeof(int32_t) }
+			};
+
+			vk::SpecializationInfo specialization_info = {};
+			specialization_info.mapEntryCount = static_cast<uint32_t>(map_entries.size());
+			specialization_info.pMapEntries = map_entries.data();
+			specialization_info.dataSize = sizeof(SpecializationData);
+			specialization_info.pData = &specialization_data;
+
+			auto shader_stages = shaderStages;
+			shader_stages[1].pSpecializationInfo = &specialization_info;
+
+			/* Fixed state */
+			vk::PipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {};
+			input_assembly_state_create_info.topology = vk::PrimitiveTopology::eTriangleList;
+			input_assembly_state_create_info.primitiveRestartEnable = false;
+
+			/* Blended materials are sorted back to front and seen from both sides */
+			vk::PipelineRasterizationStateCreateInfo rasterization_state_create_info = {};
+			rasterization_state_create_info.polygonMode = vk::PolygonMode::eFill;
+			rasterization_state_create_info.cullMode = blended ? vk::CullModeFlagBits::eNone : vk::CullModeFlagBits::eBack;
+			rasterization_state_create_info.frontFace = vk::FrontFace::eCounterClockwise;
+			rasterization_state_create_info.lineWidth = 1.0f;
+
+			vk::PipelineMultisampleStateCreateInfo multisample_state_create_info = {};
+			multisample_state_create_info.rasterizationSamples = samples;
+
+			/* Depth is written by opaque and masked draws unless the pre-pass already did */
+			vk::PipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = {};
+			depth_stencil_state_create_info.depthTestEnable = true;
+			depth_stencil_state_create_info.depthWriteEnable = !blended && !depth_equal;
+			depth_stencil_state_create_info.depthCompareOp = depth_equal ? vk::CompareOp::eEqual : vk::CompareOp::eLessOrEqual;
+			depth_stencil_state_create_info.front = depth_stencil_state_create_info.back;
+			depth_stencil_state_create_info.back.compareOp = vk::CompareOp::eAlways;
+
+			vk::PipelineColorBlendAttachmentState blend_attachment_state = {};
+			blend_attachment_state.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+			blend_attachment_state.blendEnable = blended;
+			blend_attachment_state.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+			blend_attachment_state.dstColorBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+			blend_attachment_state.colorBlendOp = vk::BlendOp::eAdd;
+			blend_attachment_state.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+			blend_attachment_state.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+			blend_attachment_state.alphaBlendOp = vk::BlendOp::eAdd;
+
+			vk::PipelineColorBlendStateCreateInfo color_blend_state_create_info = {};
+			color_blend_state_create_info.attachmentCount = 1;
+			color_blend_state_create_info.pAttachments = &blend_attachment_state;
+
+			/* Dynamic state */
+			const auto dynamic_states = std::array<vk::DynamicState, 2> { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+			vk::PipelineDynamicStateCreateInfo dynamic_state_create_info = {};
+			dynamic_state_create_info.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
+			dynamic_state_create_info.pDynamicStates = dynamic_states.data();
+
+			vk::PipelineViewportStateCreateInfo viewport_state_create_info = {};
+			viewport_state_create_info.viewportCount = 1;
+			viewport_state_create_info.scissorCount = 1;
+
+			/* Vertex binding */
+			vk::VertexInputBindingDescription vertex_input_binding = { 0, sizeof(vkpbr::gltf::Model::Vertex), vk::VertexInputRate::eVertex };
+			const auto vertex_input_attributes = std::array<vk::VertexInputAttributeDescription, 3>{
+				vk::VertexInputAttributeDescription{ 0, 0, vk::Format::eR32G32B32Sfloat, offsetof(vkpbr::gltf::Model::Vertex, position) },
+				vk::VertexInputAttributeDescription{ 1, 0, vk::Format::eR32G32B32Sfloat, offsetof(vkpbr::gltf::Model::Vertex, normal) },
+				vk::VertexInputAttributeDescription{ 2, 0, vk::Format::eR32G32Sfloat, offsetof(vkpbr::gltf::Model::Vertex, uv) }
+			};
+
+			vk::PipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
+			vertex_input_state_create_info.vertexBindingDescriptionCount = 1;
+			vertex_input_state_create_info.pVertexBindingDescriptions = &vertex_input_binding;
+			vertex_input_state_create_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertex_input_attributes.size());
+			vertex_input_state_create_info.pVertexAttributeDescriptions = vertex_input_attributes.data();
+
+			vk::GraphicsPipelineCreateInfo graphics_pipeline_create_info = {};
+			graphics_pipeline_create_info.layout = pipelineLayout;
+			graphics_pipeline_create_info.renderPass = renderPass;
+			graphics_pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
+			graphics_pipeline_create_info.pVertexInputState = &vertex_input_state_create_info;
+			graphics_pipeline_create_info.pRasterizationState = &rasterization_state_create_info;
+			graphics_pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
+			graphics_pipeline_create_info.pMultisampleState = &multisample_state_create_info;
+			graphics_pipeline_create_info.pViewportState = &viewport_state_create_info;
+			graphics_pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
+			graphics_pipeline_create_info.pDynamicState = &dynamic_state_create_info;
+			graphics_pipeline_create_info.stageCount = static_cast<uint32_t>(shader_stages.size());
+			graphics_pipeline_create_info.pStages = shader_stages.data();
+
+			vk::Pipeline pipeline;
+			VK_ASSERT(device.createGraphicsPipelines(pipelineCache, 1, &graphics_pipeline_create_info, nullptr, &pipeline));
+			return pipeline;
+		}
+	};
+}
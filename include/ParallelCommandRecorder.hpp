@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <vulkan/vulkan.hpp>
+
+#include <ThreadPool.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Records a range of work into secondary command buffers on the thread pool
+	Every frame owns one command pool per recording slot (pool workers + calling thread),
+	a slot is used by exactly one chunk per frame so pools never need locking.
+	*/
+	class ParallelCommandRecorder {
+	public:
+		ParallelCommandRecorder() = default;
+		ParallelCommandRecorder(const ParallelCommandRecorder&) = delete;
+		auto operator=(const ParallelCommandRecorder&) -> ParallelCommandRecorder& = delete;
+
+		auto init(const vk::Device device, const uint32_t queue_family, vkpbr::ThreadPool* thread_pool, const uint32_t frame_count) -> void
+		{
+			this->device = device;
+			this->threadPool = thread_pool;
+
+			frames.resize(frame_count);
+			for (auto& frame : frames) {
+				frame.slots.resize(thread_pool->workerCount() + 1);
+				for (auto& slot : frame.slots) {
+					vk::CommandPoolCreateInfo command_pool_create_info = {};
+					command_pool_create_info.queueFamilyIndex = queue_family;
+					command_pool_create_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+					VK_ASSERT(device.createCommandPool(&command_pool_create_info, nullptr, &slot.pool));
+
+					vk::CommandBufferAllocateInfo buffer_allocate_info = {};
+					buffer_allocate_info.commandPool = slot.pool;
+					buffer_allocate_info.level = vk::CommandBufferLevel::eSecondary;
+					buffer_allocate_info.commandBufferCount = 1;
+					VK_ASSERT(device.allocateCommandBuffers(&buffer_allocate_info, &slot.cmdBuffer));
+				}
+			}
+		}
+
+		/* Frame has to be idle on the GPU */
+		auto release() -> void
+		{
+			for (auto& frame : frames) {
+				for (auto& slot : frame.slots) {
+					device.destroyCommandPool(slot.pool, nullptr);
+				}
+			}
+			frames.clear();
+		}
+
+		/*
+		Splits [0, count) into at most one chunk per slot, function(cmd_buffer, first, last) records
+		one chunk inside the render pass described by inheritance_info. Buffers of the previous
+		use of this frame are reset, returned buffers are valid until the next record() on it.
+		*/
+		template<typename F>
+		auto record(
+			const uint32_t frame_index,
+			const size_t count,
+			const size_t min_chunk,
+			const vk::CommandBufferInheritanceInfo& inheritance_info,
+			F&& function) -> const std::vector<vk::CommandBuffer>&
+		{
+			auto& frame = frames[frame_index];
+			if (count == 0) {
+				frame.recorded.clear();
+				return frame.recorded;
+			}
+
+			const auto chunk_count = std::min<size_t>(frame.slots.size(), std::max<size_t>(1, count / std::max<size_t>(1, min_chunk)));
+			const auto chunk_size = (count + chunk_count - 1) / chunk_count;
+			frame.recorded.resize(chunk_count);
+
+			threadPool->parallelFor(chunk_count, 1, [&](const size_t first_chunk, const size_t last_chunk) {
+				for (auto chunk = first_chunk; chunk < last_chunk; chunk++) {
+					auto& slot = frame.slots[chunk];
+					device.resetCommandPool(slot.pool, vk::CommandPoolResetFlags());
+
+					vk::CommandBufferBeginInfo begin_info = {};
+					begin_info.flags = vk::CommandBufferUsageFlagBits::eRenderPassContinue | vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+					begin_info.pInheritanceInfo = &inheritance_info;
+					VK_ASSERT(slot.cmdBuffer.begin(&begin_info));
+
+					const auto first = chunk * chunk_size;
+					const auto last = std::min(count, first + chunk_size);
+					function(slot.cmdBuffer, first, last);
+
+					slot.cmdBuffer.end();
+					frame.recorded[chunk] = slot.cmdBuffer;
+				}
+			});
+
+			return frame.recorded;
+		}
+
+	private:
+		using Slot = struct {
+			vk::CommandPool   pool;
+			vk::CommandBuffer cmdBuffer;
+		};
+
+		using Frame = struct {
+			std::vector<Slot>              slots;
+			std::vector<vk::CommandBuffer> recorded;
+		};
+
+		vk::Device         device;
+		vkpbr::ThreadPool* threadPool = nullptr;
+		std::vector<Frame> frames;
+	};
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+#include <ThreadPool.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Stable LSD radix sort of 64 bit keys with 32 bit payloads, 8 passes of one byte
+	Every pass builds per chunk histograms and scatters the chunks in parallel, passes whose
+	byte is the same for all keys are skipped. Scratch memory is kept between calls.
+	*/
+	class RadixSort {
+	public:
+		/* Sorts keys ascending and moves values with them */
+		auto sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, vkpbr::ThreadPool& thread_pool) -> void
+		{
+			const auto count = keys.size();
+			if (count < 2) {
+				return;
+			}
+
+			const auto chunk_count = std::min<size_t>(
+				std::max<size_t>(1, count / minChunk),
+				static_cast<size_t>(thread_pool.workerCount()) + 1
+			);
+			const auto chunk_size = (count + chunk_count - 1) / chunk_count;
+
+			scratchKeys.resize(count);
+			scratchValues.resize(count);
+			histograms.resize(chunk_count);
+
+			auto* source_keys = &keys;
+			auto* source_values = &values;
+			auto* destination_keys = &scratchKeys;
+			auto* destination_values = &scratchValues;
+
+			for (uint32_t shift = 0; shift < 64; shift += 8) {
+				thread_pool.parallelFor(chunk_count, 1, [&](const size_t first_chunk, const size_t last_chunk) {
+					for (auto chunk = first_chunk; chunk < last_chunk; chunk++) {
+						auto& histogram = histograms[chunk];
+						histogram.fill(0);
+						const auto last = std::min(count, (chunk + 1) * chunk_size);
+						for (auto i = chunk * chunk_size; i < last; i++) {
+							histogram[((*source_keys)[i] >> shift) & 0xFF]++;
+						}
+					}
+				});
+
+				/* Exclusive prefix over (bucket, chunk) keeps equal keys in input order */
+				auto offset = uint32_t{ 0 };
+				auto uniform_byte = false;
+				for (uint32_t bucket = 0; bucket < 256 && !uniform_byte; bucket++) {
+					auto bucket_total = uint32_t{ 0 };
+					for (auto& histogram : histograms) {
+						const auto bucket_count = histogram[bucket];
+						histogram[bucket] = offset;
+						offset += bucket_count;
+						bucket_total += bucket_count;
+					}
+					uniform_byte = bucket_total == count;
+				}
+				if (uniform_byte) {
+					continue;
+				}
+
+				thread_pool.parallelFor(chunk_count, 1, [&](const size_t first_chunk, const size_t last_chunk) {
+					for (auto chunk = first_chunk; chunk < last_chunk; chunk++) {
+						auto& positions = histograms[chunk];
+						const auto last = std::min(count, (chunk + 1) * chunk_size);
+						for (auto i = chunk * chunk_size; i < last; i++) {
+							const auto key = (*source_keys)[i];
+							const auto position = positions[(key >> shift) & 0xFF]++;
+							(*destination_keys)[position] = key;
+							(*destination_values)[position] = (*source_values)[i];
+						}
+					}
+				});
+
+				std::swap(source_keys, destination_keys);
+				std::swap(source_values, destination_values);
+			}
+
+			/* Odd number of executed passes leaves the result in scratch, buffers trade places */
+			if (source_keys != &keys) {
+				keys.swap(scratchKeys);
+				values.swap(scratchValues);
+			}
+		}
+
+	private:
+		static constexpr size_t minChunk = 2048;
+
+		std::vector<uint64_t>                  scratchKeys;
+		std::vector<uint32_t>                  scratchValues;
+		std::vector<std::array<uint32_t, 256>> histograms;
+	};
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+
+#include <VulkanDevice.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Dynamic resolution, the scene is rendered into the corner of a target allocated for the largest scale
+	and stretched over the swapchain image by a bilinear upscale pass.
+	GPU time of a frame comes from timestamps around its command buffer, read back when the fence of its
+	slot signaled, so it is framesInFlight frames old and normalized to the scale it was rendered at.
+	Cost is taken to grow with the pixel count, corrections are damped and small ones are ignored,
+	the resolution settles instead of changing every frame.
+	*/
+	class ResolutionScaler {
+	public:
+		/* Weight of the newest measurement in the average */
+		static constexpr float smoothing = 0.1f;
+		/* Part of the correction applied per measurement */
+		static constexpr float damping = 0.5f;
+		/* Relative scale change below which the resolution stays */
+		static constexpr float threshold = 0.05f;
+
+		ResolutionScaler() = default;
+		ResolutionScaler(const ResolutionScaler&) = delete;
+		auto operator=(const ResolutionScaler&) -> ResolutionScaler& = delete;
+
+		/* render_pass is the pass the upscale is drawn in, one single sampled color attachment */
+		auto init(vkpbr::VulkanDevice* device, const uint32_t frame_count, const vk::RenderPass render_pass, const vk::PipelineCache pipeline_cache) -> void
+		{
+			this->device = device;
+			auto& logical_device = device->logicalDevice;
+
+			/* Without timestamps on the graphics queue the scale stays at its maximum */
+			const auto graphics_family = device->queueFamilyIndices.graphicsFamily.value();
+			const auto valid_bits = device->queueFamilyProperties[graphics_family].timestampValidBits;
+			timestampsSupported = valid_bits > 0;
+			timestampMask = valid_bits >= 64 ? ~uint64_t{ 0 } : (uint64_t{ 1 } << valid_bits) - 1;
+			timestampPeriod = device->deviceProperties.limits.timestampPeriod;
+			if (!timestampsSupported) {
+				std::cerr << "[WARNING] Graphics queue has no timestamps, dynamic resolution is off" << std::endl;
+			}
+
+			frames.assign(frame_count, Frame{ false, 1.0f });
+			if (timestampsSupported) {
+				vk::QueryPoolCreateInfo query_pool_create_info = {};
+				query_pool_create_info.queryType = vk::QueryType::eTimestamp;
+				query_pool_create_info.queryCount = frame_count * 2;
+				VK_ASSERT(logical_device.createQueryPool(&query_pool_create_info, nullptr, &queryPool));
+			}
+
+			/* Bilinear, the edge of the rendered area is clamped in the shader */
+			vk::SamplerCreateInfo sampler_create_info = {};
+			sampler_create_info.magFilter = vk::Filter::eLinear;
+			sampler_create_info.minFilter = vk::Filter::eLinear;
+			sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+			sampler_create_info.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+			sampler_create_info.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+			sampler_create_info.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+			sampler_create_info.maxLod = 1.0f;
+			sampler_create_info.borderColor = vk::BorderColor::eFloatOpaqueBlack;
+			sampler = device->samplerCache.get(sampler_create_info);
+
+			vk::DescriptorSetLayoutBinding layout_binding = { 0, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment, nullptr };
+			vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
+			descriptor_set_layout_create_info.bindingCount = 1;
+			descriptor_set_layout_create_info.pBindings = &layout_binding;
+			VK_ASSERT(logical_device.createDescriptorSetLayout(&descriptor_set_layout_create_info, nullptr, &descriptorSetLayout));
+
+			vk::DescriptorPoolSize pool_size = { vk::DescriptorType::eCombinedImageSampler, 1 };
+			vk::DescriptorPoolCreateInfo descriptor_pool_create_info = {};
+			descriptor_pool_create_info.poolSizeCount = 1;
+			descriptor_pool_create_info.pPoolSizes = &pool_size;
+			descriptor_pool_create_info.maxSets = 1;
+			VK_ASSERT(logical_device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &descriptorPool));
+
+			vk::DescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+			descriptor_set_allocate_info.descriptorPool = descriptorPool;
+			descriptor_set_allocate_info.descriptorSetCount = 1;
+			descriptor_set_allocate_info.pSetLayouts = &descriptorSetLayout;
+			VK_ASSERT(logical_device.allocateDescriptorSets(&descriptor_set_allocate_info, &descriptorSet));
+
+			createPipeline(render_pass, pipeline_cache);
+		}
+
+		auto initialized() const -> bool
+		{
+			return device != nullptr;
+		}
+
+		/* GPU must be done with the scaler */
+		auto release() -> void
+		{
+			if (!device) {
+				return;
+			}
+			auto& logical_device = device->logicalDevice;
+			logical_device.destroyPipeline(pipeline, nullptr);
+			logical_device.destroyPipelineLayout(pipelineLayout, nullptr);
+			logical_device.destroyDescriptorPool(descriptorPool, nullptr);
+			logical_device.destroyDescriptorSetLayout(descriptorSetLayout, nullptr);
+			logical_device.destroyQueryPool(queryPool, nullptr);
+			frames.clear();
+			device = nullptr;
+		}
+
+		/* Scene color in shader read only layout, only while no frame reads the previous one */
+		auto setSource(const vk::ImageView source_view, const uint32_t source_width, const uint32_t source_height) -> void
+		{
+			sourceWidth = source_width;
+			sourceHeight = source_height;
+
+			const auto image_info = vk::DescriptorImageInfo{ sampler, source_view, vk::ImageLayout::eShaderReadOnlyOptimal };
+			vk::WriteDescriptorSet write_descriptor_set = {};
+			write_descriptor_set.dstSet = descriptorSet;
+			write_descriptor_set.dstBinding = 0;
+			write_descriptor_set.descriptorCount = 1;
+			write_descriptor_set.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+			write_descriptor_set.pImageInfo = &image_info;
+			device->logicalDevice.updateDescriptorSets(1, &write_descriptor_set, 0, nullptr);
+		}
+
+		/*
+		Scale for the frame about to be recorded in frame_index, from the GPU time of the frame
+		this slot recorded last, the fence of the slot has to have signaled
+		*/
+		auto update(const uint32_t frame_index, const float target_frame_time, const float min_scale, const float max_scale) -> float
+		{
+			if (!timestampsSupported) {
+				scale = max_scale;
+				return scale;
+			}
+
+			auto& frame = frames[frame_index];
+			auto ticks = std::array<uint64_t, 2>{};
+			const auto result = frame.measured
+				? device->logicalDevice.getQueryPoolResults(queryPool, frame_index * 2, 2, sizeof(ticks), ticks.data(), sizeof(uint64_t), vk::QueryResultFlagBits::e64)
+				: vk::Result::eNotReady;
+			frame.measured = false;
+
+			if (result == vk::Result::eSuccess) {
+				const auto frame_time = static_cast<float>((ticks[1] - ticks[0]) & timestampMask) * timestampPeriod * 1e-6f;
+				const auto area_ratio = (scale * scale) / (frame.scale * frame.scale);
+				const auto normalized_time = frame_time * area_ratio;
+				averageTime = averageTime > 0.0f ? averageTime + (normalized_time - averageTime) * smoothing : normalized_time;
+
+				const auto ideal_scale = scale * std::sqrt(target_frame_time / std::max(averageTime, 0.001f));
+				const auto next_scale = std::clamp(scale + (ideal_scale - scale) * damping, min_scale, max_scale);
+				const auto at_bound = next_scale != scale && (next_scale == min_scale || next_scale == max_scale);
+				if (std::abs(next_scale - scale) > threshold * scale || at_bound) {
+					/* Average follows the predicted cost, the next measurements only correct it */
+					averageTime *= (next_scale * next_scale) / (scale * scale);
+					scale = next_scale;
+				}
+			}
+			scale = std::clamp(scale, min_scale, max_scale);
+			return scale;
+		}
+
+		/* First command of the frame, scale is what the frame renders at */
+		auto recordBegin(const vk::CommandBuffer cmd_buffer, const uint32_t frame_index, const float frame_scale) -> void
+		{
+			if (!timestampsSupported) {
+				return;
+			}
+			frames[frame_index] = Frame{ true, frame_scale };
+			cmd_buffer.resetQueryPool(queryPool, frame_index * 2, 2);
+			cmd_buffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool, frame_index * 2);
+		}
+
+		/* Last command of the frame */
+		auto recordEnd(const vk::CommandBuffer cmd_buffer, const uint32_t frame_index) const -> void
+		{
+			if (!timestampsSupported) {
+				return;
+			}
+			cmd_buffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, frame_index * 2 + 1);
+		}
+
+		/* Inside the upscale render pass, render_extent is the corner of the source the scene was rendered to */
+		auto recordUpscale(const vk::CommandBuffer cmd_buffer, const vk::Extent2D render_extent, const vk::Extent2D target_extent) const -> void
+		{
+			const auto source_size = glm::vec2(static_cast<float>(sourceWidth), static_cast<float>(sourceHeight));
+			const auto render_size = glm::vec2(static_cast<float>(render_extent.width), static_cast<float>(render_extent.height));
+
+			/* Bilinear taps stop half a texel inside the rendered area */
+			auto push_constants = PushConstants{};
+			push_constants.uvScale = render_size / source_size;
+			push_constants.uvMax = (render_size - 0.5f) / source_size;
+
+			vk::Viewport viewport = {};
+			viewport.width = static_cast<float>(target_extent.width);
+			viewport.height = static_cast<float>(target_extent.height);
+			viewport.minDepth = 0.0f;
+			viewport.maxDepth = 1.0f;
+			const auto scissors = vk::Rect2D{ vk::Offset2D{ 0, 0 }, target_extent };
+
+			cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+			cmd_buffer.setViewport(0, 1, &viewport);
+			cmd_buffer.setScissor(0, 1, &scissors);
+			cmd_buffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+			cmd_buffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eFragment, 0, sizeof(PushConstants), &push_constants);
+			cmd_buffer.draw(3, 1, 0, 0);
+		}
+
+	private:
+		using Frame = struct {
+			bool  measured;
+			float scale;
+		};
+
+		using PushConstants = struct {
+			glm::vec2 uvScale;
+			glm::vec2 uvMax;
+		};
+
+		vkpbr::VulkanDevice*    device = nullptr;
+		bool                    timestampsSupported = false;
+		uint64_t                timestampMask = 0;
+		float                   timestampPeriod = 1.0f;
+		vk::QueryPool           queryPool;
+		std::vector<Frame>      frames;
+		float                   scale = 1.0f;
+		/* Milliseconds at the current scale */
+		float                   averageTime = 0.0f;
+		uint32_t                sourceWidth = 1;
+		uint32_t                sourceHeight = 1;
+		vk::Sampler             sampler;
+		vk::DescriptorSetLayout descriptorSetLayout;
+		vk::DescriptorPool      descriptorPool;
+		vk::DescriptorSet       descriptorSet;
+		vk::PipelineLayout      pipelineLayout;
+		vk::Pipeline            pipeline;
+
+		/* Fullscreen triangle generated in the vertex shader, no vertex input */
+		auto createPipeline(const vk::RenderPass render_pass, const vk::PipelineCache pipeline_cache) -> void
+		{
+			auto& logical_device = device->logicalDevice;
+
+			vk::PushConstantRange push_constant_range = { vk::ShaderStageFlagBits::eFragment, 0, sizeof(PushConstants) };
+			vk::PipelineLayoutCreateInfo pipeline_layout_create_info = {};
+			pipeline_layout_create_info.setLayoutCount = 1;
+			pipeline_layout_create_info.pSetLayouts = &descriptorSetLayout;
+			pipeline_layout_create_info.pushConstantRangeCount = 1;
+			pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+			VK_ASSERT(logical_device.createPipelineLayout(&pipeline_layout_create_info, nullptr, &pipelineLayout));
+
+			vk::PipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {};
+			input_assembly_state_create_info.topology = vk::PrimitiveTopology::eTriangleList;
+			input_assembly_state_create_info.primitiveRestartEnable = false;
+
+			vk::PipelineRasterizationStateCreateInfo rasterization_state_create_info = {};
+			rasterization_state_create_info.polygonMode = vk::PolygonMode::eFill;
+			rasterization_state_create_info.cullMode = vk::CullModeFlagBits::eNone;
+			rasterization_state_create_info.frontFace = vk::FrontFace::eCounterClockwise;
+			rasterization_state_create_info.lineWidth = 1.0f;
+
+			vk::PipelineMultisampleStateCreateInfo multisample_state_create_info = {};
+
+			vk::PipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = {};
+
+			vk::PipelineColorBlendAttachmentState blend_attachment_state = {};
+			blend_attachment_state.colorWriteMask = vk::ColorComponentFlagBits::eR | vk::ColorComponentFlagBits::eG | vk::ColorComponentFlagBits::eB | vk::ColorComponentFlagBits::eA;
+			blend_attachment_state.blendEnable = false;
+
+			vk::PipelineColorBlendStateCreateInfo color_blend_state_create_info = {};
+			color_blend_state_create_info.attachmentCount = 1;
+			color_blend_state_create_info.pAttachments = &blend_attachment_state;
+
+			const auto dynamic_states = std::array<vk::DynamicState, 2> { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+			vk::PipelineDynamicStateCreateInfo dynamic_state_create_info = {};
+			dynamic_state_create_info.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
+			dynamic_state_create_info.pDynamicStates = dynamic_states.data();
+
+			vk::PipelineViewportStateCreateInfo viewport_state_create_info = {};
+			viewport_state_create_info.viewportCount = 1;
+			viewport_state_create_info.scissorCount = 1;
+
+			vk::PipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
+
+			const auto shader_stages = std::array<vk::PipelineShaderStageCreateInfo, 2>{
+				loadShaderFromFile(logical_device, "upscale.vert.spv", vk::ShaderStageFlagBits::eVertex),
+				loadShaderFromFile(logical_device, "upscale.frag.spv", vk::ShaderStageFlagBits::eFragment)
+			};
+
+			vk::GraphicsPipelineCreateInfo graphics_pipeline_create_info = {};
+			graphics_pipeline_create_info.layout = pipelineLayout;
+			graphics_pipeline_create_info.renderPass = render_pass;
+			graphics_pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
+			graphics_pipeline_create_info.pVertexInputState = &vertex_input_state_create_info;
+			graphics_pipeline_create_info.pRasterizationState = &rasterization_state_create_info;
+			graphics_pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
+			graphics_pipeline_create_info.pMultisampleState = &multisample_state_create_info;
+			graphics_pipeline_create_info.pViewportState = &viewport_state_create_info;
+			graphics_pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
+			graphics_pipeline_create_info.pDynamicState = &dynamic_state_create_info;
+			graphics_pipeline_create_info.stageCount = static_cast<uint32_t>(shader_stages.size());
+			graphics_pipeline_create_info.pStages = shader_stages.data();
+			VK_ASSERT(logical_device.createGraphicsPipelines(pipeline_cache, 1, &graphics_pipeline_create_info, nullptr, &pipeline));
+			for (const auto& shader_stage : shader_stages) {
+				logical_device.destroyShaderModule(shader_stage.module, nullptr);
+			}
+		}
+	};
+}
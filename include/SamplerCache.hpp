@@ -0,0 +1,100 @@
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <cstring>
+
+#include <vulkan/vulkan.hpp>
+
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Device wide cache of samplers keyed by the full create info
+	Textures with identical sampling state share one handle, samplers live
+	until the cache is released together with the device.
+	*/
+	class SamplerCache {
+	public:
+		SamplerCache() = default;
+		SamplerCache(const SamplerCache&) = delete;
+		auto operator=(const SamplerCache&) -> SamplerCache& = delete;
+
+		auto init(const vk::Device device) -> void
+		{
+			this->device = device;
+		}
+
+		/* Shared sampler for given state, never destroy the returned handle */
+		auto get(const vk::SamplerCreateInfo& create_info) -> vk::Sampler
+		{
+			assert(nullptr == create_info.pNext);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			const auto it = samplers.find(create_info);
+			if (it != samplers.end()) {
+				return it->second;
+			}
+
+			vk::Sampler sampler;
+			VK_ASSERT(device.createSampler(&create_info, nullptr, &sampler));
+			samplers.emplace(create_info, sampler);
+			return sampler;
+		}
+
+		auto size() const -> size_t
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			return samplers.size();
+		}
+
+		auto release() -> void
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto& entry : samplers) {
+				device.destroySampler(entry.second, nullptr);
+			}
+			samplers.clear();
+		}
+
+	private:
+		struct CreateInfoHasher {
+			auto operator()(const vk::SamplerCreateInfo& info) const -> size_t
+			{
+				auto hash = uint64_t{ 14695981039346656037ull };
+				const auto combine = [&hash](const uint64_t value) {
+					hash = (hash ^ value) * 1099511628211ull;
+				};
+				const auto float_bits = [](const float value) {
+					uint32_t bits;
+					memcpy(&bits, &value, sizeof(bits));
+					return static_cast<uint64_t>(bits);
+				};
+
+				combine(static_cast<uint64_t>(static_cast<VkSamplerCreateFlags>(info.flags)));
+				combine(static_cast<uint64_t>(info.magFilter));
+				combine(static_cast<uint64_t>(info.minFilter));
+				combine(static_cast<uint64_t>(info.mipmapMode));
+				combine(static_cast<uint64_t>(info.addressModeU));
+				combine(static_cast<uint64_t>(info.addressModeV));
+				combine(static_cast<uint64_t>(info.addressModeW));
+				combine(float_bits(info.mipLodBias));
+				combine(static_cast<uint64_t>(info.anisotropyEnable));
+				combine(float_bits(info.maxAnisotropy));
+				combine(static_cast<uint64_t>(info.compareEnable));
+				combine(static_cast<uint64_t>(info.compareOp));
+				combine(float_bits(info.minLod));
+				combine(float_bits(info.maxLod));
+				combine(static_cast<uint64_t>(info.borderColor));
+				combine(static_cast<uint64_t>(info.unnormalizedCoordinates));
+				return static_cast<size_t>(hash);
+			}
+		};
+
+		vk::Device                                                               device;
+		mutable std::mutex                                                       mutex;
+		std::unordered_map<vk::SamplerCreateInfo, vk::Sampler, CreateInfoHasher> samplers;
+	};
+}
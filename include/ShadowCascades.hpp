@@ -0,0 +1,460 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <VulkanDevice.hpp>
+#include <FrustumCuller.hpp>
+#include <ThreadPool.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Cascaded shadow maps of one directional light, one layer of a depth array per cascade
+	Every cascade covers a bounding sphere of its slice of the view frustum, so its size does not change
+	when the camera turns, and its origin is snapped to whole texels, so shadow edges do not crawl.
+	Cascades are rendered with a margin around the slice and kept as long as the slice stays inside,
+	nothing is redrawn while the light and the casters keep still and the camera moves little.
+	Casters are static, culled per cascade against its light frustum and drawn from the position stream.
+	*/
+	class ShadowCascades {
+	public:
+		static constexpr uint32_t cascadeCount = 4;
+
+		using Settings = struct {
+			uint32_t resolution = 2048;
+			/* View depth the last cascade ends at, the scene is scaled to unit radius */
+			float    maxDistance = 8.0f;
+			/* Split distances between uniform (0) and logarithmic (1) */
+			float    splitLambda = 0.8f;
+			/* Fraction of the slice radius added around a rendered cascade */
+			float    margin = 0.25f;
+			float    depthBiasConstant = 1.25f;
+			float    depthBiasSlope = 1.75f;
+		};
+
+		/* std140, world space to cascade clip space and the view depth each cascade ends at */
+		using Parameters = struct {
+			std::array<glm::mat4, cascadeCount> viewProjection;
+			glm::vec4                           splits;
+		};
+
+		/* Bounds with the node transform applied, indices into the position stream */
+		using Caster = struct {
+			glm::vec3 center;
+			glm::vec3 extent;
+			glm::mat4 nodeMatrix;
+			uint32_t  firstIndex;
+			uint32_t  indexCount;
+		};
+
+		Settings                settings;
+		/* Depth array for sampler2DArrayShadow */
+		vk::DescriptorImageInfo descriptorInfo;
+
+		ShadowCascades() = default;
+		ShadowCascades(const ShadowCascades&) = delete;
+		auto operator=(const ShadowCascades&) -> ShadowCascades& = delete;
+
+		auto init(vkpbr::VulkanDevice* device, const vk::PipelineCache pipeline_cache) -> void
+		{
+			this->device = device;
+
+			createImage();
+			createRenderPass();
+
+			/* Hardware 2x2 PCF, outside the map is lit */
+			vk::SamplerCreateInfo sampler_create_info = {};
+			sampler_create_info.magFilter = vk::Filter::eLinear;
+			sampler_create_info.minFilter = vk::Filter::eLinear;
+			sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+			sampler_create_info.addressModeU = vk::SamplerAddressMode::eClampToBorder;
+			sampler_create_info.addressModeV = vk::SamplerAddressMode::eClampToBorder;
+			sampler_create_info.addressModeW = vk::SamplerAddressMode::eClampToBorder;
+			sampler_create_info.compareEnable = true;
+			sampler_create_info.compareOp = vk::CompareOp::eLessOrEqual;
+			sampler_create_info.maxLod = 1.0f;
+			sampler_create_info.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+
+			descriptorInfo.sampler = device->samplerCache.get(sampler_create_info);
+			descriptorInfo.imageView = arrayView;
+			descriptorInfo.imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+			createPipeline(pipeline_cache);
+			invalidate();
+		}
+
+		auto release() -> void
+		{
+			if (!device) {
+				return;
+			}
+			auto& logical_device = device->logicalDevice;
+			logical_device.destroyPipeline(pipeline, nullptr);
+			logical_device.destroyPipelineLayout(pipelineLayout, nullptr);
+			for (uint32_t cascade = 0; cascade < cascadeCount; cascade++) {
+				logical_device.destroyFramebuffer(framebuffers[cascade], nullptr);
+				logical_device.destroyImageView(layerViews[cascade], nullptr);
+			}
+			logical_device.destroyRenderPass(renderPass, nullptr);
+			logical_device.destroyImageView(arrayView, nullptr);
+			logical_device.destroyImage(image, nullptr);
+			logical_device.freeMemory(memory, nullptr);
+			device = nullptr;
+		}
+
+		/* Replaces the caster set, every cascade is rendered again */
+		auto setCasters(std::vector<Caster> casters) -> void
+		{
+			this->casters = std::move(casters);
+			culler.clear();
+			for (const auto& caster : this->casters) {
+				culler.addBox(caster.center, caster.extent);
+			}
+			invalidate();
+		}
+
+		auto invalidate() -> void
+		{
+			for (auto& cascade : cascades) {
+				cascade.valid = false;
+			}
+		}
+
+		/*
+		Fits the cascades to the camera, light_direction points towards the light
+		model maps the position stream to world space, the scene sphere bounds casters and receivers in depth.
+		Cascades that have to be rendered again are recorded by the next recordRender().
+		*/
+		auto update(
+			const glm::mat4& view,
+			const glm::mat4& projection,
+			const float near_plane,
+			const float far_plane,
+			const glm::mat4& model,
+			const glm::vec3& light_direction,
+			const glm::vec3& scene_center,
+			const float scene_radius,
+			vkpbr::ThreadPool& thread_pool
+		) -> const Parameters&
+		{
+			const auto direction = glm::normalize(light_direction);
+			if (direction != cachedDirection || model != cachedModel) {
+				cachedDirection = direction;
+				cachedModel = model;
+				invalidate();
+			}
+
+			/* Rotation only, cascades differ by their ortho window */
+			const auto up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+			const auto light_view = glm::lookAt(glm::vec3(0.0f), -direction, up);
+			const auto scene_depth = (light_view * glm::vec4(scene_center, 1.0f)).z;
+
+			const auto inverse_view = glm::inverse(view);
+			const auto tan_half_x = 1.0f / std::abs(projection[0][0]);
+			const auto tan_half_y = 1.0f / std::abs(projection[1][1]);
+			const auto shadow_far = std::min(far_plane, settings.maxDistance);
+
+			auto slice_near = near_plane;
+			for (uint32_t index = 0; index < cascadeCount; index++) {
+				const auto fraction = static_cast<float>(index + 1) / static_cast<float>(cascadeCount);
+				const auto logarithmic = near_plane * std::pow(shadow_far / near_plane, fraction);
+				const auto uniform = near_plane + (shadow_far - near_plane) * fraction;
+				const auto slice_far = settings.splitLambda * logarithmic + (1.0f - settings.splitLambda) * uniform;
+				parameters.splits[index] = slice_far;
+
+				/* Sphere through the far corners with its center on the view axis, encloses the whole slice */
+				const auto corner_squared = tan_half_x * tan_half_x + tan_half_y * tan_half_y;
+				const auto center_depth = std::min(0.5f * (slice_near + slice_far) * (1.0f + corner_squared), slice_far);
+				const auto far_offset = glm::vec2(std::sqrt(corner_squared) * slice_far, slice_far - center_depth);
+				const auto near_offset = glm::vec2(std::sqrt(corner_squared) * slice_near, center_depth - slice_near);
+				const auto radius = std::max(glm::length(far_offset), glm::length(near_offset));
+				const auto center = glm::vec3(inverse_view * glm::vec4(0.0f, 0.0f, -center_depth, 1.0f));
+				const auto light_center = glm::vec2(light_view * glm::vec4(center, 1.0f));
+				slice_near = slice_far;
+
+				auto& cascade = cascades[index];
+				const auto covered = cascade.valid
+					&& cascade.radius >= radius
+					&& cascade.radius <= radius * (1.0f + settings.margin)
+					&& glm::all(glm::lessThanEqual(glm::abs(light_center - cascade.center) + radius, glm::vec2(cascade.halfSize)));
+				cascade.render = !covered;
+				if (covered) {
+					continue;
+				}
+
+				/* Texel snapped window, its size only depends on the slice */
+				cascade.valid = true;
+				cascade.radius = radius;
+				cascade.halfSize = radius * (1.0f + settings.margin);
+				const auto texel_size = 2.0f * cascade.halfSize / static_cast<float>(settings.resolution);
+				cascade.center = glm::floor(light_center / texel_size) * texel_size;
+
+				const auto ortho = glm::ortho(
+					cascade.center.x - cascade.halfSize, cascade.center.x + cascade.halfSize,
+					cascade.center.y - cascade.halfSize, cascade.center.y + cascade.halfSize,
+					-(scene_depth + scene_radius), -(scene_depth - scene_radius)
+				);
+				parameters.viewProjection[index] = ortho * light_view;
+
+				/* Casters of this cascade only, in the space of the position stream */
+				const auto caster_transform = parameters.viewProjection[index] * model;
+				const auto& visible = culler.cull(vkpbr::FrustumCuller::extractPlanes(caster_transform), thread_pool);
+				cascade.casterTransform = caster_transform;
+				cascade.draws.clear();
+				for (uint32_t i = 0; i < static_cast<uint32_t>(visible.size()); i++) {
+					if (visible[i]) {
+						cascade.draws.push_back(i);
+					}
+				}
+			}
+			return parameters;
+		}
+
+		/* Cascades left in the cache by the last update() are skipped, call before the main render pass */
+		auto recordRender(const vk::CommandBuffer cmd_buffer, const vk::Buffer position_buffer, const vk::Buffer index_buffer) const -> void
+		{
+			const auto clear_value = vk::ClearValue(vk::ClearDepthStencilValue(1.0f, 0));
+
+			vk::RenderPassBeginInfo renderpass_begin_info = {};
+			renderpass_begin_info.renderPass = renderPass;
+			renderpass_begin_info.renderArea.extent = vk::Extent2D{ settings.resolution, settings.resolution };
+			renderpass_begin_info.clearValueCount = 1;
+			renderpass_begin_info.pClearValues = &clear_value;
+
+			vk::Viewport viewport = {};
+			viewport.width = static_cast<float>(settings.resolution);
+			viewport.height = static_cast<float>(settings.resolution);
+			viewport.minDepth = 0.0f;
+			viewport.maxDepth = 1.0f;
+
+			for (uint32_t index = 0; index < cascadeCount; index++) {
+				const auto& cascade = cascades[index];
+				if (!cascade.render) {
+					continue;
+				}
+
+				renderpass_begin_info.framebuffer = framebuffers[index];
+				cmd_buffer.beginRenderPass(&renderpass_begin_info, vk::SubpassContents::eInline);
+				cmd_buffer.setViewport(0, 1, &viewport);
+				cmd_buffer.setScissor(0, 1, &renderpass_begin_info.renderArea);
+				cmd_buffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+				const auto offset = vk::DeviceSize{ 0 };
+				cmd_buffer.bindVertexBuffers(0, 1, &position_buffer, &offset);
+				cmd_buffer.bindIndexBuffer(index_buffer, 0, vk::IndexType::eUint32);
+				cmd_buffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(glm::mat4), &cascade.casterTransform);
+				for (const auto draw : cascade.draws) {
+					cmd_buffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex, sizeof(glm::mat4), sizeof(glm::mat4), &casters[draw].nodeMatrix);
+					cmd_buffer.drawIndexed(casters[draw].indexCount, 1, casters[draw].firstIndex, 0, 0);
+				}
+				cmd_buffer.endRenderPass();
+			}
+		}
+
+	private:
+		/* Always supported as sampled depth attachment, linear ortho depth needs no more */
+		static constexpr vk::Format format = vk::Format::eD16Unorm;
+
+		using Cascade = struct {
+			bool                  valid;
+			bool                  render;
+			/* Snapped window center in light space and its half size */
+			glm::vec2             center;
+			float                 halfSize;
+			float                 radius;
+			glm::mat4             casterTransform;
+			std::vector<uint32_t> draws;
+		};
+
+		vkpbr::VulkanDevice*                         device = nullptr;
+		vk::Image                                    image;
+		vk::DeviceMemory                             memory;
+		vk::ImageView                                arrayView;
+		std::array<vk::ImageView, cascadeCount>      layerViews;
+		std::array<vk::Framebuffer, cascadeCount>    framebuffers;
+		vk::RenderPass                               renderPass;
+		vk::PipelineLayout                           pipelineLayout;
+		vk::Pipeline                                 pipeline;
+		std::vector<Caster>                          casters;
+		vkpbr::FrustumCuller                         culler;
+		std::array<Cascade, cascadeCount>            cascades = {};
+		Parameters                                   parameters = {};
+		glm::vec3                                    cachedDirection = glm::vec3(0.0f);
+		glm::mat4                                    cachedModel = glm::mat4(0.0f);
+
+		auto createImage() -> void
+		{
+			auto& logical_device = device->logicalDevice;
+
+			vk::ImageCreateInfo image_create_info = {};
+			image_create_info.imageType = vk::ImageType::e2D;
+			image_create_info.format = format;
+			image_create_info.extent = vk::Extent3D{ settings.resolution, settings.resolution, 1 };
+			image_create_info.mipLevels = 1;
+			image_create_info.arrayLayers = cascadeCount;
+			image_create_info.samples = vk::SampleCountFlagBits::e1;
+			image_create_info.tiling = vk::ImageTiling::eOptimal;
+			image_create_info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eSampled;
+			image_create_info.initialLayout = vk::ImageLayout::eUndefined;
+			VK_ASSERT(logical_device.createImage(&image_create_info, nullptr, &image));
+
+			vk::MemoryRequirements memory_requirements;
+			logical_device.getImageMemoryRequirements(image, &memory_requirements);
+			vk::MemoryAllocateInfo memory_allocate_info = {};
+			memory_allocate_info.allocationSize = memory_requirements.size;
+			memory_allocate_info.memoryTypeIndex = device->findMemoryType(memory_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			VK_ASSERT(logical_device.allocateMemory(&memory_allocate_info, nullptr, &memory));
+			logical_device.bindImageMemory(image, memory, 0);
+
+			vk::ImageViewCreateInfo view_create_info = {};
+			view_create_info.image = image;
+			view_create_info.viewType = vk::ImageViewType::e2DArray;
+			view_create_info.format = format;
+			view_create_info.subresourceRange = { vk::ImageAspectFlagBits::eDepth, 0, 1, 0, cascadeCount };
+			VK_ASSERT(logical_device.createImageView(&view_create_info, nullptr, &arrayView));
+
+			view_create_info.viewType = vk::ImageViewType::e2D;
+			for (uint32_t cascade = 0; cascade < cascadeCount; cascade++) {
+				view_create_info.subresourceRange = { vk::ImageAspectFlagBits::eDepth, 0, 1, cascade, 1 };
+				VK_ASSERT(logical_device.createImageView(&view_create_info, nullptr, &layerViews[cascade]));
+			}
+		}
+
+		/* Layers are cleared every time, the pass waits for shading of earlier frames still reading them */
+		auto createRenderPass() -> void
+		{
+			auto& logical_device = device->logicalDevice;
+
+			vk::AttachmentDescription attachment = {};
+			attachment.format = format;
+			attachment.samples = vk::SampleCountFlagBits::e1;
+			attachment.loadOp = vk::AttachmentLoadOp::eClear;
+			attachment.storeOp = vk::AttachmentStoreOp::eStore;
+			attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+			attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+			attachment.initialLayout = vk::ImageLayout::eUndefined;
+			attachment.finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
+			vk::AttachmentReference depth_reference = { 0, vk::ImageLayout::eDepthStencilAttachmentOptimal };
+
+			vk::SubpassDescription subpass_description = {};
+			subpass_description.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+			subpass_description.pDepthStencilAttachment = &depth_reference;
+
+			auto subpass_dependencies = std::array<vk::SubpassDependency, 2>();
+			subpass_dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+			subpass_dependencies[0].dstSubpass = 0;
+			subpass_dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+			subpass_dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eEarlyFragmentTests | vk::PipelineStageFlagBits::eLateFragmentTests;
+			subpass_dependencies[0].srcAccessMask = vk::AccessFlagBits::eShaderRead;
+			subpass_dependencies[0].dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+
+			subpass_dependencies[1].srcSubpass = 0;
+			subpass_dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+			subpass_dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eLateFragmentTests;
+			subpass_dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
+			subpass_dependencies[1].srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+			subpass_dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+			vk::RenderPassCreateInfo render_pass_create_info = {};
+			render_pass_create_info.attachmentCount = 1;
+			render_pass_create_info.pAttachments = &attachment;
+			render_pass_create_info.subpassCount = 1;
+			render_pass_create_info.pSubpasses = &subpass_description;
+			render_pass_create_info.dependencyCount = static_cast<uint32_t>(subpass_dependencies.size());
+			render_pass_create_info.pDependencies = subpass_dependencies.data();
+			VK_ASSERT(logical_device.createRenderPass(&render_pass_create_info, nullptr, &renderPass));
+
+			for (uint32_t cascade = 0; cascade < cascadeCount; cascade++) {
+				vk::FramebufferCreateInfo framebuffer_create_info = {};
+				framebuffer_create_info.renderPass = renderPass;
+				framebuffer_create_info.attachmentCount = 1;
+				framebuffer_create_info.pAttachments = &layerViews[cascade];
+				framebuffer_create_info.width = settings.resolution;
+				framebuffer_create_info.height = settings.resolution;
+				framebuffer_create_info.layers = 1;
+				VK_ASSERT(logical_device.createFramebuffer(&framebuffer_create_info, nullptr, &framebuffers[cascade]));
+			}
+		}
+
+		/* Positions only like the depth pre-pass, the cascade matrix comes as a push constant */
+		auto createPipeline(const vk::PipelineCache pipeline_cache) -> void
+		{
+			auto& logical_device = device->logicalDevice;
+
+			/* Caster transform of the cascade and node matrix of the draw, within the guaranteed 128 bytes */
+			vk::PushConstantRange push_constant_range = { vk::ShaderStageFlagBits::eVertex, 0, 2 * sizeof(glm::mat4) };
+			vk::PipelineLayoutCreateInfo pipeline_layout_create_info = {};
+			pipeline_layout_create_info.pushConstantRangeCount = 1;
+			pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
+			VK_ASSERT(logical_device.createPipelineLayout(&pipeline_layout_create_info, nullptr, &pipelineLayout));
+
+			vk::PipelineInputAssemblyStateCreateInfo input_assembly_state_create_info = {};
+			input_assembly_state_create_info.topology = vk::PrimitiveTopology::eTriangleList;
+			input_assembly_state_create_info.primitiveRestartEnable = false;
+
+			/* Slope scaled bias against acne, constant part in units of the depth format */
+			vk::PipelineRasterizationStateCreateInfo rasterization_state_create_info = {};
+			rasterization_state_create_info.polygonMode = vk::PolygonMode::eFill;
+			rasterization_state_create_info.cullMode = vk::CullModeFlagBits::eBack;
+			rasterization_state_create_info.frontFace = vk::FrontFace::eCounterClockwise;
+			rasterization_state_create_info.depthBiasEnable = true;
+			rasterization_state_create_info.depthBiasConstantFactor = settings.depthBiasConstant;
+			rasterization_state_create_info.depthBiasSlopeFactor = settings.depthBiasSlope;
+			rasterization_state_create_info.lineWidth = 1.0f;
+
+			vk::PipelineMultisampleStateCreateInfo multisample_state_create_info = {};
+
+			vk::PipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = {};
+			depth_stencil_state_create_info.depthTestEnable = true;
+			depth_stencil_state_create_info.depthWriteEnable = true;
+			depth_stencil_state_create_info.depthCompareOp = vk::CompareOp::eLessOrEqual;
+
+			vk::PipelineColorBlendStateCreateInfo color_blend_state_create_info = {};
+
+			const auto dynamic_states = std::array<vk::DynamicState, 2> { vk::DynamicState::eViewport, vk::DynamicState::eScissor };
+			vk::PipelineDynamicStateCreateInfo dynamic_state_create_info = {};
+			dynamic_state_create_info.dynamicStateCount = static_cast<uint32_t>(dynamic_states.size());
+			dynamic_state_create_info.pDynamicStates = dynamic_states.data();
+
+			vk::PipelineViewportStateCreateInfo viewport_state_create_info = {};
+			viewport_state_create_info.viewportCount = 1;
+			viewport_state_create_info.scissorCount = 1;
+
+			vk::VertexInputBindingDescription position_input_binding = { 0, sizeof(glm::vec3), vk::VertexInputRate::eVertex };
+			vk::VertexInputAttributeDescription position_input_attribute = { 0, 0, vk::Format::eR32G32B32Sfloat, 0 };
+
+			vk::PipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
+			vertex_input_state_create_info.vertexBindingDescriptionCount = 1;
+			vertex_input_state_create_info.pVertexBindingDescriptions = &position_input_binding;
+			vertex_input_state_create_info.vertexAttributeDescriptionCount = 1;
+			vertex_input_state_create_info.pVertexAttributeDescriptions = &position_input_attribute;
+
+			const auto shadow_stage = loadShaderFromFile(logical_device, "shadow.vert.spv", vk::ShaderStageFlagBits::eVertex);
+
+			vk::GraphicsPipelineCreateInfo graphics_pipeline_create_info = {};
+			graphics_pipeline_create_info.layout = pipelineLayout;
+			graphics_pipeline_create_info.renderPass = renderPass;
+			graphics_pipeline_create_info.pInputAssemblyState = &input_assembly_state_create_info;
+			graphics_pipeline_create_info.pVertexInputState = &vertex_input_state_create_info;
+			graphics_pipeline_create_info.pRasterizationState = &rasterization_state_create_info;
+			graphics_pipeline_create_info.pColorBlendState = &color_blend_state_create_info;
+			graphics_pipeline_create_info.pMultisampleState = &multisample_state_create_info;
+			graphics_pipeline_create_info.pViewportState = &viewport_state_create_info;
+			graphics_pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
+			graphics_pipeline_create_info.pDynamicState = &dynamic_state_create_info;
+			graphics_pipeline_create_info.stageCount = 1;
+			graphics_pipeline_create_info.pStages = &shadow_stage;
+			VK_ASSERT(logical_device.createGraphicsPipelines(pipeline_cache, 1, &graphics_pipeline_create_info, nullptr, &pipeline));
+			logical_device.destroyShaderModule(shadow_stage.module, nullptr);
+		}
+	};
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+
+#include <vulkan/vulkan.hpp>
+
+#include <gli/gli.hpp>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <VulkanDevice.hpp>
+#include <VulkanTexture.hpp>
+#include <UploadManager.hpp>
+#include <ThreadPool.hpp>
+#include <EnvironmentMap.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	GGX prefiltered specular cubemap, one roughness per mip (roughness = level / (levels - 1))
+	Filtered importance sampling picks the source mip from the sample pdf so a low
+	sample count stays noise free. Results are cached as E5B9G9R9 KTX keyed by environment content.
+	No alpha is needed and the shared exponent halves size and lookup bandwidth against RGBA16F.
+	*/
+	class SpecularPrefilter {
+	public:
+		using Settings = struct {
+			uint32_t size = 256;
+			uint32_t sampleCount = 64;
+			uint32_t minimumSize = 4;
+		};
+
+		static auto levelCount(const Settings& settings) -> uint32_t
+		{
+			auto levels = uint32_t{ 1 };
+			for (auto size = settings.size; size > std::max(settings.minimumSize, 1u); size /= 2) {
+				levels++;
+			}
+			return levels;
+		}
+
+		static auto cacheFilename(const std::string& cache_dir, const uint64_t environment_hash, const Settings& settings) -> std::string
+		{
+			char hash_string[17];
+			snprintf(hash_string, sizeof(hash_string), "%016llx", static_cast<unsigned long long>(environment_hash));
+			return cache_dir + "prefiltered_" + hash_string + "_" + std::to_string(settings.size) + "_" + std::to_string(settings.sampleCount) + "_e5b9g9r9.ktx";
+		}
+
+		/* Loads from cache, prefilters and stores it there on a miss */
+		static auto load(
+			vkpbr::TextureCubemap& texture,
+			const vkpbr::EnvironmentMap& environment,
+			const Settings& settings,
+			const std::string& cache_dir,
+			vkpbr::VulkanDevice* device,
+			vkpbr::UploadManager* uploader,
+			vkpbr::ThreadPool& thread_pool) -> void
+		{
+			const auto filename = cacheFilename(cache_dir, environment.contentHash(), settings);
+
+			if (!std::ifstream(filename).good()) {
+				const auto prefiltered = generate(environment, settings, thread_pool);
+				std::filesystem::create_directories(cache_dir);
+				if (!gli::save_ktx(prefiltered, filename)) {
+					std::cerr << "[ERROR] Could not write prefiltered environment cache: " << filename << std::endl;
+				}
+			}
+
+			texture.loadFromFile(filename, vk::Format::eE5B9G9R9UfloatPack32, device, uploader);
+		}
+
+		/* Every (level, face, row) is an independent job on the pool */
+		static auto generate(const vkpbr::EnvironmentMap& environment, const Settings& settings, vkpbr::ThreadPool& thread_pool) -> gli::texture_cube
+		{
+			const auto levels = levelCount(settings);
+			auto result = gli::texture_cube(gli::FORMAT_RGB9E5_UFLOAT_PACK32, gli::extent2d(settings.size, settings.size), levels);
+
+			/* Source mip chain for filtered importance sampling */
+			auto source_chain = std::vector<vkpbr::EnvironmentMap>{ environment };
+			while (source_chain.back().size > 1) {
+				source_chain.push_back(source_chain.back().downsample());
+			}
+
+			using Row = struct {
+				uint32_t level;
+				uint32_t face;
+				uint32_t y;
+			};
+
+			auto rows = std::vector<Row>{};
+			auto sample_sets = std::vector<std::vector<Sample>>(levels);
+			for (uint32_t level = 0; level < levels; level++) {
+				const auto roughness = levels > 1 ? static_cast<float>(level) / static_cast<float>(levels - 1) : 0.0f;
+				sample_sets[level] = buildSamples(roughness, settings.sampleCount, environment.size, static_cast<uint32_t>(source_chain.size()));
+
+				const auto level_size = std::max(settings.size >> level, 1u);
+				for (uint32_t face = 0; face < 6; face++) {
+					for (uint32_t y = 0; y < level_size; y++) {
+						rows.push_back({ level, face, y });
+					}
+				}
+			}
+
+			thread_pool.parallelFor(rows.size(), 4, [&](const size_t first, const size_t last) {
+				for (auto i = first; i < last; i++) {
+					const auto& row = rows[i];
+					const auto level_size = std::max(settings.size >> row.level, 1u);
+					auto* texels = result[row.face][row.level].data<uint32_t>() + static_cast<size_t>(row.y) * level_size;
+
+					for (uint32_t x = 0; x < level_size; x++) {
+						const auto normal = glm::normalize(vkpbr::EnvironmentMap::texelDirection(row.face, x, row.y, level_size));
+						const auto color = row.level == 0
+							? sampleChain(source_chain, normal, mirrorLod(environment.size, settings.size))
+							: integrate(source_chain, sample_sets[row.level], normal);
+						texels[x] = glm::packF3x9_E1x5(color);
+					}
+				}
+			});
+
+			return result;
+		}
+
+	private:
+		/* Tangent space light direction (N = V = R), its weight and source lod */
+		using Sample = struct {
+			glm::vec3 direction;
+			float     weight;
+			float     lod;
+		};
+
+		static auto radicalInverse(uint32_t bits) -> float
+		{
+			bits = (bits << 16u) | (bits >> 16u);
+			bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+			bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+			bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+			bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+			return static_cast<float>(bits) * 2.3283064365386963e-10f;
+		}
+
+		/* Lod at which one source texel matches one output texel */
+		static auto mirrorLod(const uint32_t source_size, const uint32_t output_size) -> float
+		{
+			return std::max(std::log2(static_cast<float>(source_size) / static_cast<float>(output_size)), 0.0f);
+		}
+
+		/*
+		Samples only depend on roughness since N = V, lod follows Krivanek and Colbert:
+		0.5 * log2(solid angle of sample / solid angle of source texel) + 1
+		*/
+		static auto buildSamples(const float roughness, const uint32_t sample_count, const uint32_t source_size, const uint32_t source_levels) -> std::vector<Sample>
+		{
+			const auto a = std::max(roughness * roughness, 1e-4f);
+			const auto a2 = a * a;
+			const auto texel_solid_angle = 4.0f * glm::pi<float>() / (6.0f * static_cast<float>(source_size) * static_cast<float>(source_size));
+
+			auto samples = std::vector<Sample>{};
+			samples.reserve(sample_count);
+			for (uint32_t i = 0; i < sample_count; i++) {
+				const auto phi = 2.0f * glm::pi<float>() * static_cast<float>(i) / static_cast<float>(sample_count);
+				const auto xi_y = radicalInverse(i);
+				const auto cos_theta2 = (1.0f - xi_y) / (1.0f + (a2 - 1.0f) * xi_y);
+				const auto cos_theta = std::sqrt(cos_theta2);
+				const auto sin_theta = std::sqrt(std::max(1.0f - cos_theta2, 0.0f));
+				const auto half_vector = glm::vec3(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+
+				const auto light = 2.0f * cos_theta * half_vector - glm::vec3(0.0f, 0.0f, 1.0f);
+				if (light.z <= 0.0f) {
+					continue;
+				}
+
+				/* pdf of L is D * NdotH / (4 * VdotH), with N = V this is D / 4 */
+				const auto d_denominator = cos_theta2 * (a2 - 1.0f) + 1.0f;
+				const auto distribution = a2 / (glm::pi<float>() * d_denominator * d_denominator);
+				const auto pdf = distribution / 4.0f;
+				const auto sample_solid_angle = 1.0f / (static_cast<float>(sample_count) * pdf + 1e-6f);
+				const auto lod = glm::clamp(0.5f * std::log2(sample_solid_angle / texel_solid_angle) + 1.0f, 0.0f, static_cast<float>(source_levels - 1));
+
+				samples.push_back({ light, light.z, lod });
+			}
+			return samples;
+		}
+
+		static auto integrate(const std::vector<vkpbr::EnvironmentMap>& source_chain, const std::vector<Sample>& samples, const glm::vec3& normal) -> glm::vec3
+		{
+			const auto up = std::abs(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+			const auto tangent = glm::normalize(glm::cross(up, normal));
+			const auto bitangent = glm::cross(normal, tangent);
+
+			auto color = glm::vec3(0.0f);
+			auto total_weight = 0.0f;
+			for (const auto& sample : samples) {
+				const auto direction = tangent * sample.direction.x + bitangent * sample.direction.y + normal * sample.direction.z;
+				color += sampleChain(source_chain, direction, sample.lod) * sample.weight;
+				total_weight += sample.weight;
+			}
+			return total_weight > 0.0f ? color / total_weight : color;
+		}
+
+		/* Trilinear lookup in the source chain */
+		static auto sampleChain(const std::vector<vkpbr::EnvironmentMap>& source_chain, const glm::vec3& direction, const float lod) -> glm::vec3
+		{
+			const auto lower = std::min(static_cast<size_t>(lod), source_chain.size() - 1);
+			const auto upper = std::min(lower + 1, source_chain.size() - 1);
+			const auto blend = lod - static_cast<float>(lower);
+			const auto lower_color = source_chain[lower].sample(direction);
+			return blend > 0.0f && upper != lower ? glm::mix(lower_color, source_chain[upper].sample(direction), blend) : lower_color;
+		}
+	};
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <EnvironmentMap.hpp>
+#include <ThreadPool.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	L2 spherical harmonics (9 RGB coefficients) for diffuse IBL
+	Coefficients returned by irradiance() are already convolved with the clamped
+	cosine lobe, E(n) = sum(c_i * Y_i(n)) is what pbr_shader.frag evaluates.
+	*/
+	class SphericalHarmonics {
+	public:
+		using Coefficients = std::array<glm::vec3, 9>;
+
+		/* Real SH basis, normal must be unit length */
+		static auto basis(const glm::vec3& n) -> std::array<float, 9>
+		{
+			return {
+				0.282095f,
+				0.488603f * n.y,
+				0.488603f * n.z,
+				0.488603f * n.x,
+				1.092548f * n.x * n.y,
+				1.092548f * n.y * n.z,
+				0.315392f * (3.0f * n.z * n.z - 1.0f),
+				1.092548f * n.x * n.z,
+				0.546274f * (n.x * n.x - n.y * n.y)
+			};
+		}
+
+		/*
+		Radiance projection, every face row is reduced on a pool worker into its own
+		partial sum which are then added in order so the result does not depend on scheduling
+		*/
+		static auto project(const vkpbr::EnvironmentMap& environment, vkpbr::ThreadPool& thread_pool) -> Coefficients
+		{
+			using Partial = struct {
+				Coefficients coefficients;
+				float        weight;
+			};
+
+			const auto size = environment.size;
+			auto partials = std::vector<Partial>(static_cast<size_t>(size) * 6, Partial{ {}, 0.0f });
+
+			thread_pool.parallelFor(partials.size(), 4, [&](const size_t first, const size_t last) {
+				for (auto row = first; row < last; row++) {
+					const auto face = static_cast<uint32_t>(row / size);
+					const auto y = static_cast<uint32_t>(row % size);
+					auto& partial = partials[row];
+					for (uint32_t x = 0; x < size; x++) {
+						const auto direction = glm::normalize(vkpbr::EnvironmentMap::texelDirection(face, x, y, size));
+						const auto solid_angle = vkpbr::EnvironmentMap::texelSolidAngle(x, y, size);
+						const auto weighted = environment.texel(face, x, y) * solid_angle;
+						const auto y_lm = basis(direction);
+						for (size_t i = 0; i < 9; i++) {
+							partial.coefficients[i] += weighted * y_lm[i];
+						}
+						partial.weight += solid_angle;
+					}
+				}
+			});
+
+			auto result = Coefficients{};
+			auto total_weight = 0.0f;
+			for (const auto& partial : partials) {
+				for (size_t i = 0; i < 9; i++) {
+					result[i] += partial.coefficients[i];
+				}
+				total_weight += partial.weight;
+			}
+
+			/* Texel solid angles sum to 4 pi up to rounding, renormalize the rest */
+			const auto normalization = 4.0f * glm::pi<float>() / total_weight;
+			for (auto& coefficient : result) {
+				coefficient *= normalization;
+			}
+			return result;
+		}
+
+		/* Convolution with clamped cosine, A0 = pi, A1 = 2pi/3, A2 = pi/4 */
+		static auto irradiance(const Coefficients& radiance) -> Coefficients
+		{
+			constexpr auto pi = glm::pi<float>();
+			constexpr auto bands = std::array<float, 9>{ pi, 2.0f * pi / 3.0f, 2.0f * pi / 3.0f, 2.0f * pi / 3.0f, pi / 4.0f, pi / 4.0f, pi / 4.0f, pi / 4.0f, pi / 4.0f };
+
+			auto result = radiance;
+			for (size_t i = 0; i < 9; i++) {
+				result[i] *= bands[i];
+			}
+			return result;
+		}
+	};
+}
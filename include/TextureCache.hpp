@@ -0,0 +1,228 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <vulkan/vulkan.hpp>
+
+#include <VulkanTexture.hpp>
+#include <TextureStreamer.hpp>
+#include "tiny_gltf.h"
+
+
+namespace vkpbr {
+
+	/*
+	Process wide cache of glTF textures keyed by image content, format and sampler state
+	Identical images used by several models are decoded and uploaded once and shared
+	through reference counted handles, the texture is destroyed with its last handle.
+	*/
+	class TextureCache {
+	public:
+		using Handle = std::shared_ptr<vkpbr::TextureGLTF>;
+
+		using Key = struct {
+			uint64_t   contentHash;
+			vk::Format format;
+			uint64_t   samplerState;
+		};
+
+		using LoadedImage = struct {
+			std::string uri;
+			uint64_t    contentHash;
+		};
+
+		/*
+		Passed to tinygltf image loader callback, images whose content is already cached
+		are not decoded, their encoded bytes are kept in case a new variant is needed
+		*/
+		using ImageLoadContext = struct {
+			vkpbr::TextureCache*                                 cache;
+			std::vector<LoadedImage>                             loadedImages;
+			std::vector<uint64_t>                                imageHashes;
+			std::unordered_map<uint64_t, std::vector<uint8_t>>   encodedImages;
+			std::unordered_map<uint64_t, std::vector<Handle>>    pinned;
+			std::unordered_set<uint64_t>                         decoded;
+		};
+
+		TextureCache()
+			: registry(std::make_shared<Registry>())
+		{
+		}
+
+		TextureCache(const TextureCache&) = delete;
+		auto operator=(const TextureCache&) -> TextureCache& = delete;
+
+		auto init(vkpbr::TextureStreamer* streamer) -> void
+		{
+			registry->streamer = streamer;
+		}
+
+		static auto hashBytes(const uint8_t* data, const size_t size) -> uint64_t
+		{
+			/* FNV-1a over 64bit words */
+			auto hash = uint64_t{ 14695981039346656037ull };
+			const auto prime = uint64_t{ 1099511628211ull };
+
+			size_t i = 0;
+			for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+				uint64_t word;
+				memcpy(&word, data + i, sizeof(uint64_t));
+				hash = (hash ^ word) * prime;
+			}
+			for (; i < size; i++) {
+				hash = (hash ^ data[i]) * prime;
+			}
+			return (hash ^ size) * prime;
+		}
+
+		/*
+		Fills imageHashes, one per glTF image, from the hashes recorded by loadImageData
+		External images that failed to load never reached the loader, the uri keeps both lists aligned
+		Images the loader did not see are hashed from their decoded pixels, 0 when there are none
+		*/
+		static auto resolveImageHashes(const tinygltf::Model& model, ImageLoadContext& context) -> void
+		{
+			context.imageHashes.assign(model.images.size(), 0);
+			size_t loaded = 0;
+			for (size_t i = 0; i < model.images.size(); i++) {
+				const auto& image = model.images[i];
+				if (loaded < context.loadedImages.size() && context.loadedImages[loaded].uri == image.uri) {
+					context.imageHashes[i] = context.loadedImages[loaded++].contentHash;
+				}
+				else if (!image.image.empty()) {
+					context.imageHashes[i] = hashBytes(image.image.data(), image.image.size());
+				}
+			}
+		}
+
+		/* tinygltf::LoadImageDataFunction, user_data is ImageLoadContext */
+		static auto loadImageData(
+			tinygltf::Image* image,
+			std::string* error,
+			std::string* warning,
+			int required_width,
+			int required_height,
+			const unsigned char* bytes,
+			int size,
+			void* user_data) -> bool
+		{
+			auto* context = static_cast<ImageLoadContext*>(user_data);
+			const auto hash = hashBytes(bytes, static_cast<size_t>(size));
+			context->loadedImages.push_back({ image->uri, hash });
+
+			/* Already cached or already decoded earlier in this file */
+			auto cached = context->cache->findContent(hash);
+			if (!cached.empty() || context->decoded.count(hash)) {
+				context->pinned[hash] = std::move(cached);
+				context->encodedImages[hash].assign(bytes, bytes + size);
+				return true;
+			}
+
+			context->decoded.insert(hash);
+			return tinygltf::LoadImageData(image, error, warning, required_width, required_height, bytes, size, nullptr);
+		}
+
+		/* Decodes image skipped by loadImageData, needed when no cached variant matched */
+		static auto decodeSkippedImage(tinygltf::Model& model, const size_t image_index, ImageLoadContext& context) -> void
+		{
+			auto& image = model.images[image_index];
+			if (!image.image.empty()) {
+				return;
+			}
+			auto& encoded = context.encodedImages[context.imageHashes[image_index]];
+			assert(!encoded.empty());
+			std::string error, warning;
+			if (!tinygltf::LoadImageData(&image, &error, &warning, 0, 0, encoded.data(), static_cast<int>(encoded.size()), nullptr)) {
+				std::cerr << "Could not decode cached glTF image: " << error << std::endl;
+			}
+		}
+
+		auto find(const Key& key) const -> Handle
+		{
+			std::lock_guard<std::mutex> lock(registry->mutex);
+			const auto it = registry->entries.find(key);
+			return it != registry->entries.end() ? it->second.lock() : nullptr;
+		}
+
+		/* Live textures created from the given image content, any format or sampler */
+		auto findContent(const uint64_t content_hash) const -> std::vector<Handle>
+		{
+			std::lock_guard<std::mutex> lock(registry->mutex);
+			auto handles = std::vector<Handle>{};
+			for (auto& entry : registry->entries) {
+				if (entry.first.contentHash == content_hash) {
+					if (auto handle = entry.second.lock()) {
+						handles.push_back(std::move(handle));
+					}
+				}
+			}
+			return handles;
+		}
+
+		/*
+		Takes ownership of a fully loaded texture
+		Handles may outlive the cache, the texture is then only released
+		*/
+		auto insert(const Key& key, std::unique_ptr<vkpbr::TextureGLTF> texture) -> Handle
+		{
+			auto weak_registry = std::weak_ptr<Registry>(registry);
+			auto handle = Handle(texture.release(), [weak_registry, key](vkpbr::TextureGLTF* released_texture) {
+				if (auto locked_registry = weak_registry.lock()) {
+					{
+						std::lock_guard<std::mutex> lock(locked_registry->mutex);
+						const auto it = locked_registry->entries.find(key);
+						if (it != locked_registry->entries.end() && it->second.expired()) {
+							locked_registry->entries.erase(it);
+						}
+					}
+					if (locked_registry->streamer && released_texture->streamIndex != UINT32_MAX) {
+						locked_registry->streamer->unregisterTexture(released_texture);
+					}
+				}
+				released_texture->release();
+				delete released_texture;
+			});
+
+			std::lock_guard<std::mutex> lock(registry->mutex);
+			registry->entries[key] = handle;
+			return handle;
+		}
+
+		auto size() const -> size_t
+		{
+			std::lock_guard<std::mutex> lock(registry->mutex);
+			return registry->entries.size();
+		}
+
+	private:
+		struct KeyHasher {
+			auto operator()(const Key& key) const -> size_t
+			{
+				auto hash = key.contentHash;
+				hash ^= static_cast<uint64_t>(key.format) + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+				hash ^= key.samplerState + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+				return static_cast<size_t>(hash);
+			}
+		};
+
+		struct KeyEqual {
+			auto operator()(const Key& a, const Key& b) const -> bool
+			{
+				return a.contentHash == b.contentHash && a.format == b.format && a.samplerState == b.samplerState;
+			}
+		};
+
+		using Registry = struct {
+			std::mutex                                                                      mutex;
+			std::unordered_map<Key, std::weak_ptr<vkpbr::TextureGLTF>, KeyHasher, KeyEqual> entries;
+			vkpbr::TextureStreamer*                                                         streamer;
+		};
+
+		std::shared_ptr<Registry> registry;
+	};
+}
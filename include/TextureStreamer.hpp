@@ -0,0 +1,511 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <future>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+#include <vulkan/vulkan.hpp>
+
+#include <VulkanDevice.hpp>
+#include <VulkanTexture.hpp>
+#include <UploadManager.hpp>
+#include <ThreadPool.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Mip level streaming for glTF textures
+	Textures start with only their smallest mips resident, more detailed levels
+	are paged in asynchronously from the CPU mip chain when the renderer requests them
+	and evicted again when they are not needed or the memory budget is exceeded.
+	Residency change = new image with levels [target, mipLevels), swapped in when its upload finishes.
+	*/
+	class TextureStreamer {
+	public:
+		using Settings = struct {
+			vk::DeviceSize memoryBudget = 0;         // 0 = half of the largest device local heap
+			uint32_t       tailSize = 64;            // largest mip extent kept resident at all times
+			uint32_t       maxUploadsPerFrame = 4;
+			float          stagingShare = 0.5f;      // part of the upload ring jobs may hold before their copy is recorded
+			uint32_t       evictionDelayFrames = 120;
+		};
+		Settings settings;
+
+		TextureStreamer() = default;
+		TextureStreamer(const TextureStreamer&) = delete;
+		auto operator=(const TextureStreamer&) -> TextureStreamer& = delete;
+
+		auto init(vkpbr::VulkanDevice* device, vkpbr::UploadManager* uploader, const uint32_t retire_frames) -> void
+		{
+			this->device = device;
+			this->uploader = uploader;
+			this->retireFrames = retire_frames;
+
+			/* Separate from the frame pool, culling and recording never queue behind mip copies */
+			copier = std::make_unique<vkpbr::ThreadPool>(std::max(1u, vkpbr::ThreadPool::defaultThreadCount() / 4));
+
+			if (settings.memoryBudget == 0) {
+				for (uint32_t i = 0; i < device->deviceMemoryProperties.memoryHeapCount; i++) {
+					const auto& heap = device->deviceMemoryProperties.memoryHeaps[i];
+					if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal) {
+						settings.memoryBudget = std::max(settings.memoryBudget, heap.size / 2);
+					}
+				}
+			}
+		}
+
+		/*
+		Makes texture resident at its tail mips, mip chain has to be built already
+		Texture stays owned by the caller and has to outlive the streamer registration
+		*/
+		auto registerTexture(vkpbr::TextureGLTF* texture) -> void
+		{
+			assert(!texture->mipChain.empty());
+
+			auto entry = StreamEntry{};
+			entry.texture = texture;
+			entry.tailMip = tailMip(*texture);
+			entry.wantedMip = entry.tailMip;
+			entry.targetMip = entry.tailMip;
+			entry.lastDetailFrame = frameIndex;
+
+			const auto residency = createResidency(*texture, entry.tailMip);
+
+			/* Tail upload is only recorded, it is submitted with the rest of the loading batch */
+			const auto staging = uploader->reserve(texture->mipChainSize(entry.tailMip));
+			copyMipsToStaging(*texture, entry.tailMip, static_cast<uint8_t*>(staging.data));
+			recordUpload(staging, *texture, residency);
+
+			texture->device = device;
+			texture->imageLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+			texture->textureSampler = device->samplerCache.get(texture->samplerInfo);
+			swapResidency(*texture, residency);
+
+			entries.push_back(entry);
+			texture->streamIndex = static_cast<uint32_t>(entries.size() - 1);
+		}
+
+		/* Texture keeps its current residency, any upload still in flight is dropped when it completes */
+		auto unregisterTexture(vkpbr::TextureGLTF* texture) -> void
+		{
+			if (texture->streamIndex == UINT32_MAX) {
+				return;
+			}
+			entries[texture->streamIndex].texture = nullptr;
+			texture->streamIndex = UINT32_MAX;
+		}
+
+		/* LOD feedback, call for every texture seen this frame with the most detailed mip it needs */
+		auto requestMip(const vkpbr::TextureGLTF* texture, const uint32_t mip) -> void
+		{
+			if (nullptr == texture || texture->streamIndex == UINT32_MAX) {
+				return;
+			}
+			auto& entry = entries[texture->streamIndex];
+			entry.wantedMip = std::min(entry.wantedMip, mip);
+		}
+
+		/* Most detailed mip needed for texture of given extent covering projected_pixels on screen */
+		static auto requiredMip(const uint32_t texture_extent, const float projected_pixels) -> uint32_t
+		{
+			if (projected_pixels <= 1.0f) {
+				return UINT32_MAX;
+			}
+			const auto ratio = static_cast<float>(texture_extent) / projected_pixels;
+			return ratio <= 1.0f ? 0u : static_cast<uint32_t>(std::floor(std::log2(ratio)));
+		}
+
+		/*
+		Once per frame - finishes uploads, retires old images and starts new requests
+		Returns textures whose image view changed, their descriptors have to be rewritten
+		*/
+		auto update() -> std::vector<vkpbr::TextureGLTF*>
+		{
+			frameIndex++;
+			auto changed_textures = std::vector<vkpbr::TextureGLTF*>{};
+
+			finishJobs(changed_textures);
+			destroyRetired(false);
+			updateTargets();
+			enforceBudget();
+			startJobs();
+
+			return changed_textures;
+		}
+
+		auto residentMemory() const -> vk::DeviceSize
+		{
+			vk::DeviceSize size = 0;
+			for (const auto& entry : entries) {
+				if (entry.texture) {
+					size += entry.texture->residentSize;
+				}
+			}
+			return size;
+		}
+
+		/* Waits for outstanding work, streamed textures themselves are released by their owner */
+		auto release() -> void
+		{
+			for (auto& job : jobs) {
+				if (job->stagingReady.valid()) {
+					job->stagingReady.wait();
+				}
+				if (job->ticket == 0) {
+					uploader->commit(job->staging);
+				}
+			}
+			uploader->waitIdle();
+			for (auto& job : jobs) {
+				destroyResidency(job->residency);
+			}
+			jobs.clear();
+			destroyRetired(true);
+
+			for (auto& entry : entries) {
+				if (entry.texture) {
+					entry.texture->streamIndex = UINT32_MAX;
+				}
+			}
+			entries.clear();
+		}
+
+	private:
+		using Residency = struct {
+			vk::Image        image;
+			vk::DeviceMemory memory;
+			vk::ImageView    view;
+			uint32_t         firstMip;
+			vk::DeviceSize   size;
+		};
+
+		using RetiredResidency = struct {
+			Residency residency;
+			uint64_t  frame;
+		};
+
+		using StreamEntry = struct {
+			vkpbr::TextureGLTF* texture;
+			uint32_t            tailMip;
+			uint32_t            wantedMip;
+			uint32_t            targetMip;
+			uint64_t            lastDetailFrame;
+			bool                pending;
+		};
+
+		/* ticket 0 = staging still being filled on a worker */
+		struct StreamJob {
+			uint32_t                                entryIndex;
+			Residency                               residency;
+			vkpbr::UploadManager::StagingAllocation staging;
+			std::future<void>                       stagingReady;
+			uint64_t                                ticket;
+		};
+
+		vkpbr::VulkanDevice*                    device = nullptr;
+		vkpbr::UploadManager*                   uploader = nullptr;
+		std::unique_ptr<vkpbr::ThreadPool>      copier;
+		uint32_t                                retireFrames = 3;
+		uint64_t                                frameIndex = 0;
+		std::vector<StreamEntry>                entries;
+		std::vector<std::unique_ptr<StreamJob>> jobs;
+		std::vector<RetiredResidency>           retired;
+
+		auto tailMip(const vkpbr::TextureGLTF& texture) const -> uint32_t
+		{
+			for (uint32_t level = 0; level < static_cast<uint32_t>(texture.mipChain.size()); level++) {
+				if (std::max(texture.mipChain[level].width, texture.mipChain[level].height) <= settings.tailSize) {
+					return level;
+				}
+			}
+			return static_cast<uint32_t>(texture.mipChain.size() - 1);
+		}
+
+		auto createResidency(const vkpbr::TextureGLTF& texture, const uint32_t first_mip) const -> Residency
+		{
+			auto residency = Residency{};
+			residency.firstMip = first_mip;
+
+			const auto level_count = static_cast<uint32_t>(texture.mipChain.size()) - first_mip;
+
+			vk::ImageCreateInfo image_create_info = {};
+			image_create_info.imageType = vk::ImageType::e2D;
+			image_create_info.format = vk::Format::eR8G8B8A8Unorm;
+			image_create_info.mipLevels = level_count;
+			image_create_info.arrayLayers = 1;
+			image_create_info.samples = vk::SampleCountFlagBits::e1;
+			image_create_info.tiling = vk::ImageTiling::eOptimal;
+			image_create_info.sharingMode = vk::SharingMode::eExclusive;
+			image_create_info.initialLayout = vk::ImageLayout::eUndefined;
+			image_create_info.extent = vk::Extent3D{ texture.mipChain[first_mip].width, texture.mipChain[first_mip].height, 1 };
+			image_create_info.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+			VK_ASSERT(device->logicalDevice.createImage(&image_create_info, nullptr, &residency.image));
+
+			vk::MemoryRequirements memory_requirements;
+			device->logicalDevice.getImageMemoryRequirements(residency.image, &memory_requirements);
+
+			vk::MemoryAllocateInfo allocate_info = {};
+			allocate_info.allocationSize = memory_requirements.size;
+			allocate_info.memoryTypeIndex = device->findMemoryType(memory_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+			VK_ASSERT(device->logicalDevice.allocateMemory(&allocate_info, nullptr, &residency.memory));
+			device->logicalDevice.bindImageMemory(residency.image, residency.memory, 0);
+			residency.size = memory_requirements.size;
+
+			vk::ImageViewCreateInfo view_create_info = {};
+			view_create_info.image = residency.image;
+			view_create_info.viewType = vk::ImageViewType::e2D;
+			view_create_info.format = image_create_info.format;
+			view_create_info.components = { vk::ComponentSwizzle::eR, vk::ComponentSwizzle::eG, vk::ComponentSwizzle::eB, vk::ComponentSwizzle::eA };
+			view_create_info.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, level_count, 0, 1 };
+			VK_ASSERT(device->logicalDevice.createImageView(&view_create_info, nullptr, &residency.view));
+
+			return residency;
+		}
+
+		auto destroyResidency(const Residency& residency) const -> void
+		{
+			device->logicalDevice.destroyImageView(residency.view, nullptr);
+			device->logicalDevice.destroyImage(residency.image, nullptr);
+			device->logicalDevice.freeMemory(residency.memory, nullptr);
+		}
+
+		static auto copyMipsToStaging(const vkpbr::TextureGLTF& texture, const uint32_t first_mip, uint8_t* mapped) -> void
+		{
+			for (auto level = first_mip; level < static_cast<uint32_t>(texture.mipChain.size()); level++) {
+				const auto& mip = texture.mipChain[level];
+				memcpy(mapped, mip.data.data(), mip.data.size());
+				mapped += mip.data.size();
+			}
+		}
+
+		/* Whole residency is uploaded from CPU, the old image is never read so it can stay in use until swap */
+		auto recordUpload(const vkpbr::UploadManager::StagingAllocation& staging, const vkpbr::TextureGLTF& texture, const Residency& residency) const -> void
+		{
+			const auto level_count = static_cast<uint32_t>(texture.mipChain.size()) - residency.firstMip;
+
+			vk::ImageSubresourceRange subresource_range = {};
+			subresource_range.aspectMask = vk::ImageAspectFlagBits::eColor;
+			subresource_range.baseMipLevel = 0;
+			subresource_range.levelCount = level_count;
+			subresource_range.layerCount = 1;
+
+			auto buffer_regions = std::vector<vk::BufferImageCopy>{};
+			vk::DeviceSize offset = 0;
+			for (uint32_t i = 0; i < level_count; i++) {
+				const auto& mip = texture.mipChain[residency.firstMip + i];
+				vk::BufferImageCopy buffer_image_copy = {};
+				buffer_image_copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
+				buffer_image_copy.imageSubresource.mipLevel = i;
+				buffer_image_copy.imageSubresource.baseArrayLayer = 0;
+				buffer_image_copy.imageSubresource.layerCount = 1;
+				buffer_image_copy.imageExtent = vk::Extent3D{ mip.width, mip.height, 1 };
+				buffer_image_copy.bufferOffset = offset;
+				buffer_regions.push_back(buffer_image_copy);
+				offset += mip.data.size();
+			}
+
+			uploader->copyReservedToImage(staging, residency.image, std::move(buffer_regions), subresource_range, vk::ImageLayout::eShaderReadOnlyOptimal);
+		}
+
+		auto swapResidency(vkpbr::TextureGLTF& texture, const Residency& residency) const -> void
+		{
+			texture.image = residency.image;
+			texture.imageView = residency.view;
+			texture.deviceMemory = residency.memory;
+			texture.residentMip = residency.firstMip;
+			texture.residentSize = residency.size;
+			texture.updateDescriptorInfo();
+		}
+
+		auto finishJobs(std::vector<vkpbr::TextureGLTF*>& changed_textures) -> void
+		{
+			auto recorded = false;
+			for (auto& job : jobs) {
+				/* Staging copy done on worker, record into the upload batch */
+				if (job->ticket == 0) {
+					if (job->stagingReady.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+						continue;
+					}
+					job->stagingReady.get();
+
+					auto& entry = entries[job->entryIndex];
+					if (!entry.texture) {
+						uploader->commit(job->staging);
+						destroyResidency(job->residency);
+						job.reset();
+						continue;
+					}
+
+					job->ticket = uploader->currentTicket();
+					recordUpload(job->staging, *entry.texture, job->residency);
+					recorded = true;
+					continue;
+				}
+
+				if (!uploader->isComplete(job->ticket)) {
+					continue;
+				}
+
+				auto& entry = entries[job->entryIndex];
+				if (!entry.texture) {
+					retired.push_back({ job->residency, frameIndex });
+					job.reset();
+					continue;
+				}
+
+				auto old_residency = Residency{ entry.texture->image, entry.texture->deviceMemory, entry.texture->imageView, entry.texture->residentMip, entry.texture->residentSize };
+				retired.push_back({ old_residency, frameIndex });
+				swapResidency(*entry.texture, job->residency);
+				entry.pending = false;
+				changed_textures.push_back(entry.texture);
+
+				job.reset();
+			}
+
+			jobs.erase(std::remove(jobs.begin(), jobs.end(), nullptr), jobs.end());
+
+			/* Submit without waiting, completion is polled next frames */
+			if (recorded) {
+				uploader->flush();
+			}
+		}
+
+		/* Old images may still be referenced by frames in flight */
+		auto destroyRetired(const bool all) -> void
+		{
+			auto it = std::remove_if(retired.begin(), retired.end(), [this, all](const RetiredResidency& retired_residency) {
+				if (all || frameIndex - retired_residency.frame > retireFrames) {
+					destroyResidency(retired_residency.residency);
+					return true;
+				}
+				return false;
+			});
+			retired.erase(it, retired.end());
+		}
+
+		/* Page in immediately, evict only after the detail was not requested for a while */
+		auto updateTargets() -> void
+		{
+			for (auto& entry : entries) {
+				if (!entry.texture) {
+					continue;
+				}
+
+				const auto wanted = std::min(entry.wantedMip, entry.tailMip);
+				const auto resident = entry.texture->residentMip;
+
+				if (wanted <= resident) {
+					entry.lastDetailFrame = frameIndex;
+				}
+
+				if (wanted < resident) {
+					entry.targetMip = wanted;
+				}
+				else if (wanted > resident && frameIndex - entry.lastDetailFrame > settings.evictionDelayFrames) {
+					entry.targetMip = wanted;
+				}
+				else {
+					entry.targetMip = resident;
+				}
+
+				entry.wantedMip = entry.tailMip;
+			}
+		}
+
+		/* Drop detail of least recently needed textures until targets fit into the budget */
+		auto enforceBudget() -> void
+		{
+			vk::DeviceSize total = 0;
+			for (const auto& entry : entries) {
+				if (entry.texture) {
+					total += entry.texture->mipChainSize(entry.targetMip);
+				}
+			}
+
+			if (total <= settings.memoryBudget) {
+				return;
+			}
+
+			auto order = std::vector<uint32_t>(entries.size());
+			for (uint32_t i = 0; i < static_cast<uint32_t>(order.size()); i++) {
+				order[i] = i;
+			}
+			std::sort(order.begin(), order.end(), [this](const uint32_t a, const uint32_t b) {
+				return entries[a].lastDetailFrame < entries[b].lastDetailFrame;
+			});
+
+			for (auto index : order) {
+				auto& entry = entries[index];
+				if (!entry.texture) {
+					continue;
+				}
+				while (total > settings.memoryBudget && entry.targetMip < entry.tailMip) {
+					total -= entry.texture->mipChainSize(entry.targetMip) - entry.texture->mipChainSize(entry.targetMip + 1);
+					entry.targetMip++;
+				}
+				if (total <= settings.memoryBudget) {
+					break;
+				}
+			}
+		}
+
+		/*
+		Uncommitted ring space cannot be recycled, so jobs stop at stagingShare of the ring and never wait for it,
+		whatever does not fit is started in a later frame and the rest of the ring stays free for other uploads
+		*/
+		auto startJobs() -> void
+		{
+			const auto staging_limit = static_cast<vk::DeviceSize>(static_cast<double>(uploader->settings.ringSize) * settings.stagingShare);
+			auto staging_bytes = vk::DeviceSize{ 0 };
+			for (const auto& job : jobs) {
+				if (job->ticket == 0 && !job->staging.dedicated) {
+					staging_bytes += job->staging.size;
+				}
+			}
+
+			uint32_t started = 0;
+			for (uint32_t i = 0; i < static_cast<uint32_t>(entries.size()) && started < settings.maxUploadsPerFrame; i++) {
+				auto& entry = entries[i];
+				if (!entry.texture || entry.pending || entry.targetMip == entry.texture->residentMip) {
+					continue;
+				}
+
+				const auto staging_size = entry.texture->mipChainSize(entry.targetMip);
+				if (staging_bytes > 0 && staging_bytes + staging_size > staging_limit) {
+					continue;
+				}
+
+				/* Ring space is filled on a worker and committed once the copy is recorded */
+				const auto staging = uploader->tryReserve(staging_size);
+				if (!staging) {
+					continue;
+				}
+				if (!staging->dedicated) {
+					staging_bytes += staging->size;
+				}
+
+				auto job = std::make_unique<StreamJob>();
+				job->entryIndex = i;
+				job->residency = createResidency(*entry.texture, entry.targetMip);
+				job->staging = *staging;
+				job->ticket = 0;
+
+				const auto* texture = entry.texture;
+				const auto first_mip = entry.targetMip;
+				auto* mapped = job->staging.data;
+				job->stagingReady = copier->enqueue([texture, first_mip, mapped] {
+					copyMipsToStaging(*texture, first_mip, static_cast<uint8_t*>(mapped));
+				});
+
+				entry.pending = true;
+				jobs.push_back(std::move(job));
+				started++;
+			}
+		}
+	};
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+
+namespace vkpbr {
+
+	/*
+	Simple fixed size pool of worker threads
+	Used for asynchronous asset work (texture streaming, IBL generation, ...)
+	*/
+	class ThreadPool {
+	public:
+		explicit ThreadPool(uint32_t thread_count = defaultThreadCount())
+		{
+			workers.reserve(thread_count);
+			for (uint32_t i = 0; i < thread_count; i++) {
+				workers.emplace_back([this] { workerLoop(); });
+			}
+		}
+
+		~ThreadPool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				stopping = true;
+			}
+			queueCondition.notify_all();
+			for (auto& worker : workers) {
+				worker.join();
+			}
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+		static auto defaultThreadCount() -> uint32_t
+		{
+			/* Leave one core for the render thread */
+			const auto hardware_threads = std::thread::hardware_concurrency();
+			return hardware_threads > 1 ? hardware_threads - 1 : 1;
+		}
+
+		auto workerCount() const -> uint32_t
+		{
+			return static_cast<uint32_t>(workers.size());
+		}
+
+		template<typename F>
+		auto enqueue(F&& function) -> std::future<decltype(function())>
+		{
+			using ReturnType = decltype(function());
+			auto task = std::make_shared<std::packaged_task<ReturnType()>>(std::forward<F>(function));
+			auto result = task->get_future();
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				tasks.emplace([task] { (*task)(); });
+			}
+			queueCondition.notify_one();
+			return result;
+		}
+
+		/*
+		Splits [0, count) into chunks of at least min_chunk items and runs
+		function(first, last) on them, calling thread takes part in the work
+		*/
+		template<typename F>
+		auto parallelFor(const size_t count, const size_t min_chunk, F&& function) -> void
+		{
+			if (count == 0) {
+				return;
+			}
+
+			const auto chunk_count = std::min<size_t>(
+				std::max<size_t>(1, count / std::max<size_t>(1, min_chunk)),
+				static_cast<size_t>(workerCount()) + 1
+			);
+			const auto chunk_size = (count + chunk_count - 1) / chunk_count;
+
+			auto pending = std::vector<std::future<void>>{};
+			pending.reserve(chunk_count);
+			for (size_t chunk = 1; chunk < chunk_count; chunk++) {
+				const auto first = chunk * chunk_size;
+				const auto last = std::min(count, first + chunk_size);
+				if (first < last) {
+					pending.push_back(enqueue([&function, first, last] { function(first, last); }));
+				}
+			}
+
+			/* Workers reference function, every chunk has to finish before an exception leaves this frame */
+			auto error = std::exception_ptr{};
+			try {
+				function(size_t{ 0 }, std::min(count, chunk_size));
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			for (auto& task : pending) {
+				try {
+					task.get();
+				} catch (...) {
+					if (!error) {
+						error = std::current_exception();
+					}
+				}
+			}
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+	private:
+		std::vector<std::thread>          workers;
+		std::queue<std::function<void()>> tasks;
+		std::mutex                        queueMutex;
+		std::condition_variable           queueCondition;
+		bool                              stopping = false;
+
+		auto workerLoop() -> void
+		{
+			while (true) {
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					queueCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+					if (stopping && tasks.empty()) {
+						return;
+					}
+					task = std::move(tasks.front());
+					tasks.pop();
+				}
+				task();
+			}
+		}
+	};
+}
@@ -0,0 +1,632 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <optional>
+#include <algorithm>
+
+#include <vulkan/vulkan.hpp>
+
+#include <VulkanDevice.hpp>
+#include <Utility.hpp>
+
+
+namespace vkpbr {
+
+	/*
+	Batches buffer and image uploads through one persistently mapped staging ring
+	Copies and barriers are recorded into a shared command buffer that is submitted
+	on flush() (or when the batch grows too big), completion is tracked by ticket values
+	backed by one fence per batch, ring space is recycled once its batch finished.
+	With a separate transfer queue family the copies run there, resources are released
+	to the graphics family and acquired by a small graphics submission waiting on a semaphore.
+	*/
+	class UploadManager {
+	public:
+		using Settings = struct {
+			vk::DeviceSize ringSize = 128ull * 1024 * 1024;
+			vk::DeviceSize batchFlushSize = 32ull * 1024 * 1024;
+		};
+		Settings settings;
+
+		/* Staging memory returned by reserve(), mapped for writing until committed */
+		using StagingAllocation = struct {
+			vk::Buffer     buffer;
+			vk::DeviceSize offset;
+			vk::DeviceSize size;
+			void*          data;
+			uint64_t       id;
+			bool           dedicated;
+		};
+
+		UploadManager() = default;
+		UploadManager(const UploadManager&) = delete;
+		auto operator=(const UploadManager&) -> UploadManager& = delete;
+
+		auto init(
+			vkpbr::VulkanDevice* device,
+			const vk::Queue transfer_queue,
+			const uint32_t transfer_family,
+			const vk::Queue graphics_queue,
+			const uint32_t graphics_family) -> void
+		{
+			this->device = device;
+			this->transferQueue = transfer_queue;
+			this->graphicsQueue = graphics_queue;
+			this->transferFamily = transfer_family;
+			this->graphicsFamily = graphics_family;
+
+			commandPool = device->createCommandPool(
+				transfer_family,
+				vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient
+			);
+			if (ownershipTransfer()) {
+				acquireCommandPool = device->createCommandPool(
+					graphics_family,
+					vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient
+				);
+			}
+
+			VK_ASSERT(device->createBuffer(
+				settings.ringSize,
+				vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+				ringBuffer,
+				ringMemory
+			));
+			VK_ASSERT(device->logicalDevice.mapMemory(ringMemory, 0, settings.ringSize, static_cast<vk::MemoryMapFlagBits>(0), &ringMapped));
+		}
+
+		auto release() -> void
+		{
+			if (!device) {
+				return;
+			}
+
+			flush();
+			waitIdle();
+
+			for (auto& batch : freeBatches) {
+				device->logicalDevice.destroyFence(batch.fence, nullptr);
+				if (batch.semaphore) {
+					device->logicalDevice.destroySemaphore(batch.semaphore, nullptr);
+				}
+			}
+			freeBatches.clear();
+
+			for (auto& dedicated : dedicatedAllocations) {
+				device->logicalDevice.unmapMemory(dedicated.memory);
+				device->logicalDevice.destroyBuffer(dedicated.buffer, nullptr);
+				device->logicalDevice.freeMemory(dedicated.memory, nullptr);
+			}
+			dedicatedAllocations.clear();
+			ringRecords.clear();
+
+			device->logicalDevice.unmapMemory(ringMemory);
+			device->logicalDevice.destroyBuffer(ringBuffer, nullptr);
+			device->logicalDevice.freeMemory(ringMemory, nullptr);
+			device->logicalDevice.destroyCommandPool(commandPool, nullptr);
+			if (acquireCommandPool) {
+				device->logicalDevice.destroyCommandPool(acquireCommandPool, nullptr);
+			}
+			device = nullptr;
+		}
+
+		/* Command buffer of the open batch, for barriers and transfer commands around staged copies */
+		auto commandBuffer() -> vk::CommandBuffer
+		{
+			if (!recording) {
+				beginBatch();
+			}
+			return current.cmdBuffer;
+		}
+
+		/*
+		Graphics queue command buffer of the open batch, runs after the staged copies were acquired
+		For work the transfer queue cannot do (blits), same as commandBuffer() without transfer family
+		*/
+		auto graphicsCommandBuffer() -> vk::CommandBuffer
+		{
+			if (!recording) {
+				beginBatch();
+			}
+			return ownershipTransfer() ? current.acquireCmdBuffer : current.cmdBuffer;
+		}
+
+		auto ownershipTransfer() const -> bool
+		{
+			return transferFamily != graphicsFamily;
+		}
+
+		/* Ticket of the open batch, complete once everything recorded so far finished on the GPU */
+		auto currentTicket() const -> uint64_t
+		{
+			return submittedTicket + 1;
+		}
+
+		/*
+		Space in the ring that can be filled later (e.g. on a worker thread)
+		Has to be committed once the copy reading it is recorded
+		*/
+		auto reserve(const vk::DeviceSize size, const vk::DeviceSize alignment = 16) -> StagingAllocation
+		{
+			auto allocation = StagingAllocation{};
+			allocation.size = size;
+
+			if (size > settings.ringSize / 2) {
+				/* Too big for the ring, gets its own buffer freed with the batch */
+				auto dedicated = DedicatedAllocation{ nextAllocationId++, nullptr, nullptr, 0 };
+				VK_ASSERT(device->createBuffer(
+					size,
+					vk::BufferUsageFlagBits::eTransferSrc,
+					vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+					dedicated.buffer,
+					dedicated.memory
+				));
+				VK_ASSERT(device->logicalDevice.mapMemory(dedicated.memory, 0, size, static_cast<vk::MemoryMapFlagBits>(0), &allocation.data));
+				dedicatedAllocations.push_back(dedicated);
+
+				allocation.buffer = dedicated.buffer;
+				allocation.offset = 0;
+				allocation.id = dedicated.id;
+				allocation.dedicated = true;
+				return allocation;
+			}
+
+			vk::DeviceSize offset;
+			while (!tryAllocate(size, alignment, offset)) {
+				/* Ring full, wait for the oldest batch that owns ring space */
+				flush();
+				if (!retireOldest()) {
+					throw VulkanDeviceException("[ERROR] Upload ring exhausted by uncommitted reservations.");
+				}
+			}
+			return ringAllocation(offset, size);
+		}
+
+		/* Same as reserve() but never waits, empty while the ring has no room */
+		auto tryReserve(const vk::DeviceSize size, const vk::DeviceSize alignment = 16) -> std::optional<StagingAllocation>
+		{
+			if (size > settings.ringSize / 2) {
+				return reserve(size, alignment);
+			}
+
+			collect();
+			vk::DeviceSize offset;
+			if (!tryAllocate(size, alignment, offset)) {
+				return std::nullopt;
+			}
+			return ringAllocation(offset, size);
+		}
+
+		/* Attaches reserved staging space to the open batch */
+		auto commit(const StagingAllocation& allocation) -> void
+		{
+			const auto ticket = currentTicket();
+			if (allocation.dedicated) {
+				for (auto& dedicated : dedicatedAllocations) {
+					if (dedicated.id == allocation.id) {
+						dedicated.ticket = ticket;
+					}
+				}
+				return;
+			}
+			for (auto& record : ringRecords) {
+				if (record.id == allocation.id) {
+					record.ticket = ticket;
+				}
+			}
+		}
+
+		/* Reserve + copy + commit */
+		auto stage(const void* data, const vk::DeviceSize size, const vk::DeviceSize alignment = 16) -> StagingAllocation
+		{
+			auto allocation = reserve(size, alignment);
+			memcpy(allocation.data, data, static_cast<size_t>(size));
+			commit(allocation);
+			return allocation;
+		}
+
+		auto copyToBuffer(
+			const void* data,
+			const vk::DeviceSize size,
+			const vk::Buffer dst_buffer,
+			const vk::DeviceSize dst_offset = 0,
+			const vk::PipelineStageFlags dst_stage = vk::PipelineStageFlagBits::eVertexInput,
+			const vk::AccessFlags dst_access = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead) -> void
+		{
+			const auto allocation = stage(data, size);
+			auto cmd_buffer = commandBuffer();
+
+			vk::BufferCopy copy_region = {};
+			copy_region.srcOffset = allocation.offset;
+			copy_region.dstOffset = dst_offset;
+			copy_region.size = size;
+			cmd_buffer.copyBuffer(allocation.buffer, dst_buffer, 1, &copy_region);
+
+			vk::BufferMemoryBarrier memory_barrier = {};
+			memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+			memory_barrier.dstAccessMask = dst_access;
+			memory_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			memory_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			memory_barrier.buffer = dst_buffer;
+			memory_barrier.offset = dst_offset;
+			memory_barrier.size = size;
+
+			if (ownershipTransfer()) {
+				/* Release on transfer queue, matching acquire on graphics queue */
+				memory_barrier.dstAccessMask = static_cast<vk::AccessFlagBits>(0);
+				memory_barrier.srcQueueFamilyIndex = transferFamily;
+				memory_barrier.dstQueueFamilyIndex = graphicsFamily;
+				cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlagBits(0), 0, nullptr, 1, &memory_barrier, 0, nullptr);
+
+				memory_barrier.srcAccessMask = static_cast<vk::AccessFlagBits>(0);
+				memory_barrier.dstAccessMask = dst_access;
+				current.acquireCmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, dst_stage, vk::DependencyFlagBits(0), 0, nullptr, 1, &memory_barrier, 0, nullptr);
+			}
+			else {
+				cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dst_stage, vk::DependencyFlagBits(0), 0, nullptr, 1, &memory_barrier, 0, nullptr);
+			}
+
+			afterRecord(size);
+		}
+
+		/*
+		Copies tightly packed data into image subresources
+		Regions carry offsets relative to data, image ends up in final_layout
+		*/
+		auto copyToImage(
+			const void* data,
+			const vk::DeviceSize size,
+			const vk::Image image,
+			std::vector<vk::BufferImageCopy> regions,
+			const vk::ImageSubresourceRange& subresource_range,
+			const vk::ImageLayout final_layout,
+			const vk::PipelineStageFlags dst_stage = vk::PipelineStageFlagBits::eFragmentShader,
+			const vk::AccessFlags dst_access = vk::AccessFlagBits::eShaderRead) -> void
+		{
+			const auto allocation = stage(data, size);
+			recordImageCopy(allocation, image, std::move(regions), subresource_range, final_layout, dst_stage, dst_access);
+			afterRecord(size);
+		}
+
+		/* Same as copyToImage for space filled through reserve(), commits the allocation */
+		auto copyReservedToImage(
+			const StagingAllocation& allocation,
+			const vk::Image image,
+			std::vector<vk::BufferImageCopy> regions,
+			const vk::ImageSubresourceRange& subresource_range,
+			const vk::ImageLayout final_layout,
+			const vk::PipelineStageFlags dst_stage = vk::PipelineStageFlagBits::eFragmentShader,
+			const vk::AccessFlags dst_access = vk::AccessFlagBits::eShaderRead) -> void
+		{
+			commit(allocation);
+			recordImageCopy(allocation, image, std::move(regions), subresource_range, final_layout, dst_stage, dst_access);
+			afterRecord(allocation.size);
+		}
+
+		/* Submits the open batch without waiting, returns its ticket */
+		auto flush() -> uint64_t
+		{
+			collect();
+			if (!recording) {
+				return submittedTicket;
+			}
+
+			current.cmdBuffer.end();
+			current.ticket = currentTicket();
+
+			if (ownershipTransfer()) {
+				/* Copies on transfer queue, acquire (+ graphics only work) on graphics queue, fence covers both */
+				current.acquireCmdBuffer.end();
+
+				vk::SubmitInfo submit_info = {};
+				submit_info.commandBufferCount = 1;
+				submit_info.pCommandBuffers = &current.cmdBuffer;
+				submit_info.signalSemaphoreCount = 1;
+				submit_info.pSignalSemaphores = &current.semaphore;
+				VK_ASSERT(transferQueue.submit(1, &submit_info, nullptr));
+
+				const vk::PipelineStageFlags wait_stage = vk::PipelineStageFlagBits::eAllCommands;
+				vk::SubmitInfo acquire_submit_info = {};
+				acquire_submit_info.waitSemaphoreCount = 1;
+				acquire_submit_info.pWaitSemaphores = &current.semaphore;
+				acquire_submit_info.pWaitDstStageMask = &wait_stage;
+				acquire_submit_info.commandBufferCount = 1;
+				acquire_submit_info.pCommandBuffers = &current.acquireCmdBuffer;
+				VK_ASSERT(graphicsQueue.submit(1, &acquire_submit_info, current.fence));
+			}
+			else {
+				vk::SubmitInfo submit_info = {};
+				submit_info.commandBufferCount = 1;
+				submit_info.pCommandBuffers = &current.cmdBuffer;
+				VK_ASSERT(transferQueue.submit(1, &submit_info, current.fence));
+			}
+
+			submittedTicket = current.ticket;
+			inFlight.push_back(current);
+			current = Batch{};
+			recording = false;
+			recordedBytes = 0;
+
+			return submittedTicket;
+		}
+
+		auto isComplete(const uint64_t ticket) -> bool
+		{
+			collect();
+			return ticket <= completedTicket;
+		}
+
+		auto wait(const uint64_t ticket) -> void
+		{
+			if (ticket > submittedTicket) {
+				flush();
+			}
+			while (completedTicket < ticket && retireOldest()) {
+			}
+		}
+
+		auto waitIdle() -> void
+		{
+			wait(submittedTicket);
+		}
+
+		/* Retires finished batches and frees their staging space */
+		auto collect() -> void
+		{
+			while (!inFlight.empty() && device->logicalDevice.getFenceStatus(inFlight.front().fence) == vk::Result::eSuccess) {
+				retireBatch();
+			}
+		}
+
+	private:
+		using Batch = struct {
+			vk::CommandBuffer cmdBuffer;
+			vk::CommandBuffer acquireCmdBuffer;
+			vk::Semaphore     semaphore;
+			vk::Fence         fence;
+			uint64_t          ticket;
+		};
+
+		/* Ring space in allocation order, freed in order once its ticket completed */
+		using RingRecord = struct {
+			uint64_t       id;
+			vk::DeviceSize end;
+			vk::DeviceSize bytes;
+			uint64_t       ticket;
+		};
+
+		using DedicatedAllocation = struct {
+			uint64_t         id;
+			vk::Buffer       buffer;
+			vk::DeviceMemory memory;
+			uint64_t         ticket;
+		};
+
+		vkpbr::VulkanDevice*             device = nullptr;
+		vk::Queue                        transferQueue;
+		vk::Queue                        graphicsQueue;
+		uint32_t                         transferFamily = 0;
+		uint32_t                         graphicsFamily = 0;
+		vk::CommandPool                  commandPool;
+		vk::CommandPool                  acquireCommandPool;
+		vk::Buffer                       ringBuffer;
+		vk::DeviceMemory                 ringMemory;
+		void*                            ringMapped = nullptr;
+		vk::DeviceSize                   head = 0;
+		vk::DeviceSize                   tail = 0;
+		vk::DeviceSize                   used = 0;
+		std::deque<RingRecord>           ringRecords;
+		std::vector<DedicatedAllocation> dedicatedAllocations;
+		uint64_t                         nextAllocationId = 1;
+		Batch                            current = {};
+		bool                             recording = false;
+		vk::DeviceSize                   recordedBytes = 0;
+		std::deque<Batch>                inFlight;
+		std::vector<Batch>               freeBatches;
+		uint64_t                         submittedTicket = 0;
+		uint64_t                         completedTicket = 0;
+
+		auto beginBatch() -> void
+		{
+			if (!freeBatches.empty()) {
+				current = freeBatches.back();
+				freeBatches.pop_back();
+			}
+			else {
+				vk::CommandBufferAllocateInfo alloc_info = {};
+				alloc_info.commandPool = commandPool;
+				alloc_info.level = vk::CommandBufferLevel::ePrimary;
+				alloc_info.commandBufferCount = 1;
+				VK_ASSERT(device->logicalDevice.allocateCommandBuffers(&alloc_info, &current.cmdBuffer));
+
+				vk::FenceCreateInfo fence_create_info = {};
+				VK_ASSERT(device->logicalDevice.createFence(&fence_create_info, nullptr, &current.fence));
+
+				if (ownershipTransfer()) {
+					alloc_info.commandPool = acquireCommandPool;
+					VK_ASSERT(device->logicalDevice.allocateCommandBuffers(&alloc_info, &current.acquireCmdBuffer));
+
+					vk::SemaphoreCreateInfo semaphore_create_info = {};
+					VK_ASSERT(device->logicalDevice.createSemaphore(&semaphore_create_info, nullptr, &current.semaphore));
+				}
+			}
+
+			vk::CommandBufferBeginInfo begin_info = {};
+			begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+			VK_ASSERT(current.cmdBuffer.begin(&begin_info));
+			if (ownershipTransfer()) {
+				VK_ASSERT(current.acquireCmdBuffer.begin(&begin_info));
+			}
+			recording = true;
+		}
+
+		auto afterRecord(const vk::DeviceSize size) -> void
+		{
+			recordedBytes += size;
+			if (recordedBytes >= settings.batchFlushSize) {
+				flush();
+			}
+		}
+
+		auto recordImageCopy(
+			const StagingAllocation& allocation,
+			const vk::Image image,
+			std::vector<vk::BufferImageCopy> regions,
+			const vk::ImageSubresourceRange& subresource_range,
+			const vk::ImageLayout final_layout,
+			const vk::PipelineStageFlags dst_stage,
+			const vk::AccessFlags dst_access) -> void
+		{
+			auto cmd_buffer = commandBuffer();
+
+			for (auto& region : regions) {
+				region.bufferOffset += allocation.offset;
+			}
+
+			{
+				vk::ImageMemoryBarrier memory_barrier = {};
+				memory_barrier.oldLayout = vk::ImageLayout::eUndefined;
+				memory_barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
+				memory_barrier.srcAccessMask = static_cast<vk::AccessFlagBits>(0);
+				memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+				memory_barrier.image = image;
+				memory_barrier.subresourceRange = subresource_range;
+				cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &memory_barrier);
+			}
+
+			cmd_buffer.copyBufferToImage(allocation.buffer, image, vk::ImageLayout::eTransferDstOptimal, static_cast<uint32_t>(regions.size()), regions.data());
+
+			if (ownershipTransfer()) {
+				/* Layout transition is part of the release / acquire pair, both have to match */
+				vk::ImageMemoryBarrier memory_barrier = {};
+				memory_barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+				memory_barrier.newLayout = final_layout;
+				memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				memory_barrier.dstAccessMask = static_cast<vk::AccessFlagBits>(0);
+				memory_barrier.srcQueueFamilyIndex = transferFamily;
+				memory_barrier.dstQueueFamilyIndex = graphicsFamily;
+				memory_barrier.image = image;
+				memory_barrier.subresourceRange = subresource_range;
+				cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &memory_barrier);
+
+				memory_barrier.srcAccessMask = static_cast<vk::AccessFlagBits>(0);
+				memory_barrier.dstAccessMask = dst_access;
+				current.acquireCmdBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, dst_stage, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &memory_barrier);
+			}
+			else if (final_layout != vk::ImageLayout::eTransferDstOptimal) {
+				vk::ImageMemoryBarrier memory_barrier = {};
+				memory_barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+				memory_barrier.newLayout = final_layout;
+				memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+				memory_barrier.dstAccessMask = dst_access;
+				memory_barrier.image = image;
+				memory_barrier.subresourceRange = subresource_range;
+				cmd_buffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, dst_stage, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &memory_barrier);
+			}
+		}
+
+		auto ringAllocation(const vk::DeviceSize offset, const vk::DeviceSize size) const -> StagingAllocation
+		{
+			auto allocation = StagingAllocation{};
+			allocation.buffer = ringBuffer;
+			allocation.offset = offset;
+			allocation.size = size;
+			allocation.data = static_cast<uint8_t*>(ringMapped) + offset;
+			allocation.id = ringRecords.back().id;
+			allocation.dedicated = false;
+			return allocation;
+		}
+
+		static auto alignUp(const vk::DeviceSize value, const vk::DeviceSize alignment) -> vk::DeviceSize
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		/* Free space is [head, ringSize) + [0, tail) when not wrapped, [head, tail) when wrapped */
+		auto tryAllocate(const vk::DeviceSize size, const vk::DeviceSize alignment, vk::DeviceSize& offset) -> bool
+		{
+			if (used == 0) {
+				head = 0;
+				tail = 0;
+			}
+
+			const auto aligned = alignUp(head, alignment);
+			const auto wrapped = head < tail || (used > 0 && head == tail);
+			vk::DeviceSize consumed;
+
+			if (!wrapped) {
+				if (aligned + size <= settings.ringSize) {
+					offset = aligned;
+					consumed = aligned + size - head;
+				}
+				else if (size <= tail) {
+					offset = 0;
+					consumed = settings.ringSize - head + size;
+				}
+				else {
+					return false;
+				}
+			}
+			else {
+				if (aligned + size <= tail) {
+					offset = aligned;
+					consumed = aligned + size - head;
+				}
+				else {
+					return false;
+				}
+			}
+
+			head = offset + size;
+			if (head == settings.ringSize) {
+				head = 0;
+			}
+			used += consumed;
+			ringRecords.push_back({ nextAllocationId++, head, consumed, 0 });
+			return true;
+		}
+
+		auto retireOldest() -> bool
+		{
+			if (inFlight.empty()) {
+				return false;
+			}
+			VK_ASSERT(device->logicalDevice.waitForFences(1, &inFlight.front().fence, VK_TRUE, UINT64_MAX));
+			retireBatch();
+			return true;
+		}
+
+		auto retireBatch() -> void
+		{
+			auto batch = inFlight.front();
+			inFlight.pop_front();
+			completedTicket = batch.ticket;
+
+			VK_ASSERT(device->logicalDevice.resetFences(1, &batch.fence));
+			batch.cmdBuffer.reset(static_cast<vk::CommandBufferResetFlagBits>(0));
+			if (batch.acquireCmdBuffer) {
+				batch.acquireCmdBuffer.reset(static_cast<vk::CommandBufferResetFlagBits>(0));
+			}
+			freeBatches.push_back(batch);
+
+			while (!ringRecords.empty() && ringRecords.front().ticket != 0 && ringRecords.front().ticket <= completedTicket) {
+				tail = ringRecords.front().end;
+				used -= ringRecords.front().bytes;
+				ringRecords.pop_front();
+			}
+
+			auto it = std::remove_if(dedicatedAllocations.begin(), dedicatedAllocations.end(), [this](const DedicatedAllocation& dedicated) {
+				if (dedicated.ticket != 0 && dedicated.ticket <= completedTicket) {
+					device->logicalDevice.unmapMemory(dedicated.memory);
+					device->logicalDevice.destroyBuffer(dedicated.buffer, nullptr);
+					device->logicalDevice.freeMemory(dedicated.memory, nullptr);
+					return true;
+				}
+				return false;
+			});
+			dedicatedAllocations.erase(it, dedicatedAllocations.end());
+		}
+	};
+}
@@ -3,8 +3,28 @@
 #include <VulkanRenderer.hpp>
 #include <VulkanTexture.hpp>
 #include <utility>
+#include <limits>
 #include <gltfModel.hpp>
 #include <Camera.hpp>
+#include <ThreadPool.hpp>
+#include <UploadManager.hpp>
+#include <TextureStreamer.hpp>
+#include <TextureCache.hpp>
+#include <BRDFLut.hpp>
+#include <EnvironmentMap.hpp>
+#include <SphericalHarmonics.hpp>
+#include <SpecularPrefilter.hpp>
+#include <ParallelCommandRecorder.hpp>
+#include <FrustumCuller.hpp>
+#include <RadixSort.hpp>
+#include <DrawSortKey.hpp>
+#include <GPUCuller.hpp>
+#include <DepthPyramid.hpp>
+#include <MaterialPipelines.hpp>
+#include <CommandState.hpp>
+#include <ClusteredLighting.hpp>
+#include <ShadowCascades.hpp>
+#include <ResolutionScaler.hpp>
 
 
 class VKPBR : public VulkanRenderer
@@ -15,7 +35,6 @@ private:
 		Texture2D      empty;
 		Texture2D      lutBRDF;
 		TextureCubemap environment;
-		TextureCubemap irradiance;
 		TextureCubemap prefiltered;
 	};
 
@@ -29,12 +48,15 @@ private:
 		vk::DeviceMemory         memory;
 		vk::DescriptorBufferInfo descriptor;
 		void*                    mappedMemory;
+		vk::DeviceSize           sliceSize;
 	};
 
 	using UniformBuffers = struct {
 		Buffer scene;
 		Buffer skybox;
 		Buffer parameters;
+		/* World matrix of every node, indexed by vkpbr::gltf::Node::index */
+		Buffer transforms;
 	};
 
 	using UBOMatrices = struct {
@@ -50,12 +72,19 @@ private:
 		float     exposure = 4.5f;
 		float     gamma = 2.2f;
 		float     prefilteredMipLevels;
+		float     padding = 0.0f;
+		/* Cosine convolved L2 irradiance, std140 array so rgb is padded to vec4 */
+		std::array<glm::vec4, 9> shIrradiance = {};
+		vkpbr::ClusteredLighting::GridParameters clusterGrid = {};
+		/* Directional light of lightSource, shadowed by the cascades */
+		glm::vec4 lightColor = glm::vec4(1.0f);
+		vkpbr::ShadowCascades::Parameters shadows = {};
 	};
 
+	/* Material shading pipelines are specialization permutations, see materialPipelines */
 	using Pipelines = struct {
 		vk::Pipeline skybox;
-		vk::Pipeline pbr;
-		vk::Pipeline pbrAlphaBlend;
+		vk::Pipeline depthOnly;
 	};
 
 	using DescriptorSetLayouts = struct {
@@ -74,21 +103,22 @@ private:
 		glm::vec3 rotation = glm::vec3(75.0f, 40.0f, 0.0f);
 	};
 
+	/* One indexed draw of the per frame visible list */
+	using DrawItem = struct {
+		vkpbr::gltf::Node*      node;
+		vkpbr::gltf::Primitive* primitive;
+		vk::Pipeline            pipeline;
+	};
+
+	/* Material factors, feature flags are specialization constants of the pipeline */
 	using PushConstantBlockMaterial = struct {
 		glm::vec4 baseColorFactor;
 		glm::vec4 emissiveFactor;
 		glm::vec4 diffuseFactor;
 		glm::vec4 specularFactor;
 
-		float workflow;
-		float hasColorTexture;
-		float hasPhysicalDescriptorTexture;
-		float hasNormalTexture;
-		float hasOcclusionTexture;
-		float hasEmissiveTexture;
 		float metallicFactor;
 		float roughnessFactor;
-		float alphaMask;
 		float alphaMaskCutoff;
 	};
 
@@ -98,16 +128,45 @@ private:
 	UBOMatrices               uboMatrices;
 	UBOParameters             uboParameters;
 	Pipelines                 pipelines;
+	vkpbr::MaterialPipelines  materialPipelines;
 	DescriptorSetLayouts      descriptorSetLayouts;
 	DescriptorSets            descriptorSets;
 	LightSource               lightSource;
-	PushConstantBlockMaterial pushConstantBlockMaterial;
 	vk::PipelineLayout        pipelineLayout;
 	float                     scale = 1.0f;
 	Camera                    camera;
 	bool                      rotateModel = false;
 	glm::vec3                 modelRotation = glm::vec3(0.0f);
 	glm::vec3                 modelPosition = glm::vec3(0.0f);
+	vkpbr::ThreadPool         threadPool;
+	vkpbr::UploadManager      uploadManager;
+	vkpbr::TextureStreamer    textureStreamer;
+	vkpbr::TextureCache       textureCache;
+	vkpbr::ParallelCommandRecorder commandRecorder;
+	std::vector<DrawItem>     drawList;
+	std::vector<DrawItem>     drawCandidates;
+	std::vector<uint64_t>     drawCandidateKeys;
+	std::vector<uint64_t>     drawKeys;
+	std::vector<uint32_t>     drawOrder;
+	vkpbr::RadixSort          radixSort;
+	vkpbr::FrustumCuller      frustumCuller;
+	vkpbr::GPUCuller          gpuCuller;
+	/* Culling and draw commands generated on the GPU, CPU work per frame is independent of the scene size, toggled with G */
+	bool                      gpuDrivenRendering = true;
+	vkpbr::DepthPyramid       depthPyramid;
+	/* Two pass Hi-Z occlusion culling on top of GPU driven rendering */
+	bool                      occlusionCulling = true;
+	/* Opaque depth first on the position stream, shading then tests equal, toggled with P */
+	bool                      depthPrepass = false;
+	/* Punctual lights of the scene, culled into froxels every frame */
+	vkpbr::ClusteredLighting  clusteredLighting;
+	std::vector<vkpbr::ClusteredLighting::Light> frameLights;
+	vkpbr::ShadowCascades     shadowCascades;
+	/* Picks renderScale from the GPU frame time and upscales the scene, toggled with R */
+	vkpbr::ResolutionScaler   resolutionScaler;
+	vkpbr::BRDFLut::Settings  brdfLutSettings;
+	vkpbr::EnvironmentMap     environmentMap;
+	vkpbr::SpecularPrefilter::Settings specularPrefilterSettings;
 
 	enum class PBRworkflow {
 		metallic_roughness = 0,
@@ -121,22 +180,69 @@ public:
 
 	auto prepareForRender() -> void override;
 
+	auto createFramebuffer() -> void override;
+
 	auto loadAssets() -> void;
 
+	/* Recomputes environment dependent lighting, call after environmentMap changed */
+	auto applyEnvironment() -> void;
+
 	auto setupPipelines() -> void;
 
+	/* GPU must be done with the pipelines */
+	auto releasePipelines() -> void;
+
+	auto requestMaterialPipelines(const vkpbr::gltf::Model& model) -> void;
+
+	auto materialPipeline(const vkpbr::gltf::Material& material) const -> vk::Pipeline;
+
+	auto bindMaterial(vkpbr::CommandState& state, const vkpbr::gltf::Material& material) const -> void;
+
+	auto keyPressed(int key) -> void override;
+
 	auto setupUniformBuffers() -> void;
 
 	auto updateUniformBuffers() -> void;
 
 	auto updateUniformParameters() -> void;
 
+	auto updateLights() -> void;
+
+	auto setupShadows() -> void;
+
+	auto updateShadows() -> void;
+
 	auto setupDescriptors() -> void;
 
+	auto writeMaterialDescriptorSet(const vkpbr::gltf::Material& material, vk::DescriptorSet descriptor_set) -> void;
+
+	auto updateTextureStreaming() -> void;
+
+	/* Rewrites the stale material sets of the current frame slot, its fence has to have signaled */
+	auto updateMaterialDescriptorSets() -> void;
+
+	auto requestMaterialMips(const vkpbr::gltf::Material& material, float projected_pixels) -> void;
+
 	auto setupCommandBuffers() -> void override;
 
-	auto renderModelNode(vkpbr::gltf::Node*               node, vk::CommandBuffer cmd_buffer,
-	                     vkpbr::gltf::Material::AlphaMode alpha_mode) const -> void;
+	/* Blended draws are always listed, opaque ones only when the GPU does not generate them */
+	auto buildDrawList(bool include_opaque) -> void;
+
+	auto recordCommandBuffer() -> void;
+
+	auto setupGPUCulling() -> void;
+
+	auto bindSceneState(vkpbr::CommandState& state, vk::Buffer vertex_buffer) const -> void;
+
+	auto bindDepthState(vkpbr::CommandState& state) const -> void;
+
+	auto recordDepthDraws(vk::CommandBuffer cmd_buffer, size_t first, size_t last) const -> void;
+
+	auto recordDraws(vk::CommandBuffer cmd_buffer, size_t first, size_t last) const -> void;
+
+	auto recordIndirectDraws(vk::CommandBuffer cmd_buffer, vkpbr::GPUCuller::Pass pass) const -> void;
+
+	auto recordDepthPyramid(vk::CommandBuffer cmd_buffer) const -> void;
 
 	auto render() -> void override;
 };
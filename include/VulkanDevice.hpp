@@ -4,11 +4,14 @@
 #include <vector>
 #include <set>
 #include <optional>
+#include <string>
+#include <algorithm>
 
 #include <vulkan/vulkan.hpp>
 
 #include <Utility.hpp>
 #include <CustomException.hpp>
+#include <SamplerCache.hpp>
 
 
 namespace vkpbr
@@ -31,10 +34,12 @@ namespace vkpbr
 		std::vector<vk::QueueFamilyProperties>    queueFamilyProperties;
 		std::vector<std::string>                  supportedExtensions;
 		vk::CommandPool                           commandPool;
+		vkpbr::SamplerCache                       samplerCache;
 		struct QueueFamilyIndices {
 			std::optional<uint32_t> graphicsFamily;
 			//std::optional<uint32_t> presentFamily;
 			std::optional<uint32_t> computeFamily;
+			std::optional<uint32_t> transferFamily;
 
 			auto isComplete() const -> bool
 			{
@@ -64,6 +69,20 @@ namespace vkpbr
 			assert(queue_family_count > 0);
 			queueFamilyProperties.resize(queue_family_count);
 			physicalDevice.getQueueFamilyProperties(&queue_family_count, queueFamilyProperties.data());
+
+			/* Device extensions, optional ones are enabled only when listed here */
+			uint32_t extension_count;
+			physicalDevice.enumerateDeviceExtensionProperties(nullptr, &extension_count, nullptr);
+			auto extension_properties = std::vector<vk::ExtensionProperties>(extension_count);
+			physicalDevice.enumerateDeviceExtensionProperties(nullptr, &extension_count, extension_properties.data());
+			for (const auto& extension : extension_properties) {
+				supportedExtensions.emplace_back(extension.extensionName);
+			}
+		}
+
+		auto extensionSupported(const std::string& extension) const -> bool
+		{
+			return std::find(supportedExtensions.begin(), supportedExtensions.end(), extension) != supportedExtensions.end();
 		}
 
 		~VulkanDevice()
@@ -72,6 +91,8 @@ namespace vkpbr
 				logicalDevice.destroyCommandPool(commandPool, nullptr);
 			}
 
+			samplerCache.release();
+
 			if (logicalDevice)
 			{
 				logicalDevice.destroy(nullptr);
@@ -91,6 +112,16 @@ namespace vkpbr
 			throw VulkanDeviceException("[ERROR] Failed to find matching memory type.");
 		}
 
+		/* Memory type with the preferred properties when the device has one, with the fallback ones otherwise */
+		auto findMemoryType(const uint32_t type_filter, const vk::MemoryPropertyFlags& preferred, const vk::MemoryPropertyFlags& fallback) const -> uint32_t {
+			for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
+				if ((type_filter & (1 << i)) && (deviceMemoryProperties.memoryTypes[i].propertyFlags & preferred) == preferred) {
+					return i;
+				}
+			}
+			return findMemoryType(type_filter, fallback);
+		}
+
 		auto getQueueFamilyIndex(const vk::QueueFlagBits queue_flags) -> uint32_t
 		{
 			//Looking for queue family index supporting compute but not graphics
@@ -103,6 +134,19 @@ namespace vkpbr
 				}
 			}
 
+			//Looking for transfer only queue family (DMA engine), otherwise the graphics one
+			//Async compute queues copy no faster and would only take time from compute work
+			if (queue_flags == vk::QueueFlagBits::eTransfer) {
+				for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
+					if ((queueFamilyProperties[i].queueFlags & queue_flags)
+						&& (!(queueFamilyProperties[i].queueFlags & vk::QueueFlagBits::eGraphics))
+						&& (!(queueFamilyProperties[i].queueFlags & vk::QueueFlagBits::eCompute))) {
+						return i;
+					}
+				}
+				return getQueueFamilyIndex(vk::QueueFlagBits::eGraphics);
+			}
+
 			for (uint32_t i = 0; i < static_cast<uint32_t>(queueFamilyProperties.size()); i++) {
 				if (queueFamilyProperties[i].queueFlags & queue_flags) {
 					return i;
@@ -217,7 +261,7 @@ namespace vkpbr
 		auto createLogicalDevice(
 			vk::PhysicalDeviceFeatures enabled_features,
 			const std::vector<const char*>& enabled_extensions,
-			const vk::QueueFlags& requested_queue_types = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute) -> vk::Result
+			const vk::QueueFlags& requested_queue_types = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer) -> vk::Result
 		{
 			auto queue_create_infos = std::vector<vk::DeviceQueueCreateInfo>();
 			const auto queue_priority = float{ 0.0 };
@@ -246,6 +290,21 @@ namespace vkpbr
 				queueFamilyIndices.computeFamily = queueFamilyIndices.graphicsFamily;
 			}
 
+			// Transfer queue, graphics family is used when there is no separate one
+			if (requested_queue_types & vk::QueueFlagBits::eTransfer) {
+				queueFamilyIndices.transferFamily = getQueueFamilyIndex(vk::QueueFlagBits::eTransfer);
+				if (queueFamilyIndices.transferFamily.value() != queueFamilyIndices.graphicsFamily.value()
+					&& queueFamilyIndices.transferFamily.value() != queueFamilyIndices.computeFamily.value()) {
+					vk::DeviceQueueCreateInfo queue_info = {};
+					queue_info.queueFamilyIndex = queueFamilyIndices.transferFamily.value();
+					queue_info.queueCount = 1;
+					queue_info.pQueuePriorities = &queue_priority;
+					queue_create_infos.push_back(queue_info);
+				}
+			} else {
+				queueFamilyIndices.transferFamily = queueFamilyIndices.graphicsFamily;
+			}
+
 			auto device_extensions = std::vector<const char*>(enabled_extensions);
 			device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
@@ -262,6 +321,7 @@ namespace vkpbr
 			const auto result = physicalDevice.createDevice(&device_create_info, nullptr, &logicalDevice);
 			if (vk::Result::eSuccess == result) {
 				commandPool = createCommandPool(queueFamilyIndices.graphicsFamily.value());
+				samplerCache.init(logicalDevice);
 			}
 
 			this->enabledFeatures = enabled_features;
@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <chrono>
+#include <string>
+#include <vector>
 
 #include <vulkan/vulkan.hpp>
 #include <window.hpp>
@@ -30,6 +32,12 @@ namespace vkpbr {
 			bool						vsync = false;
 			bool						multisampling = true;
 			vk::SampleCountFlagBits 	sampleCount = vk::SampleCountFlagBits::e4;
+			uint32_t					framesInFlight = 2;
+			/* Scene resolution relative to the window, scaled between the bounds to hold the GPU frame time */
+			bool						dynamicResolution = true;
+			float						minRenderScale = 0.5f;
+			float						maxRenderScale = 1.0f;
+			float						targetFrameTime = 16.0f;
 		} settings;
 		const std::vector<const char*> wantedLayers = {
 			"VK_LAYER_LUNARG_standard_validation",
@@ -39,6 +47,10 @@ namespace vkpbr {
 		const std::vector<const char*> wantedExtensions = {
 			VK_KHR_SWAPCHAIN_EXTENSION_NAME
 		};
+		/* Enabled when the device has them, users check VulkanDevice::extensionSupported() */
+		const std::vector<const char*> optionalExtensions = {
+			VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME
+		};
 		glfw::Window window;
 
 		VulkanRenderer();
@@ -54,8 +66,9 @@ namespace vkpbr {
 		auto setupWindow() -> void;
 		auto renderLoop() -> void;
 		auto renderFrame() -> void;
-		auto prepareFrame() -> void;
-		auto submitFrame() const -> void;
+		auto prepareFrame() -> bool;
+		auto submitFrame() -> void;
+		auto waitForFramesInFlight() const -> void;
 
 		auto initSwapchain() -> void;
 		auto setupSwapchain() -> void;
@@ -71,21 +84,48 @@ namespace vkpbr {
 		std::unique_ptr<vkpbr::VulkanDevice> vulkanDevice;
 		vk::Device                           device;
 		vk::Queue                            queue;
+		vk::Queue                            transferQueue;
 		vkpbr::VulkanSwapchain               swapchain;
-		vk::CommandPool                      commandPool;
-		vk::Semaphore                        presentCompleteSemaphore;
-		vk::Semaphore                        renderCompleteSemaphore;
-		std::vector<vk::Fence>               memoryFences;
-		std::vector<vk::CommandBuffer>       drawCalls;
 		vk::Format                           depthFormat;
+		/* Scene passes render into sceneColor, the present pass upscales it into the swapchain image */
 		vk::RenderPass                       renderPass;
+		/* Same attachments as renderPass, loads what an earlier pass of the frame stored */
+		vk::RenderPass                       renderPassResume;
+		vk::RenderPass                       presentPass;
+		/* Samples of the color and depth attachments, settings.sampleCount clamped to the device */
+		vk::SampleCountFlagBits              samples = vk::SampleCountFlagBits::e1;
+		/* Multisampled color and depth are stored and sampleable for passes resuming the scene pass, transient otherwise */
+		bool                                 resumableScenePass = false;
 		vk::DescriptorPool                   descriptorPool;
 		vk::PipelineCache                    pipelineCache;
+		/* Pipeline cache data is kept between runs, larger caches are neither loaded nor stored */
+		const std::string                    pipelineCachePath = std::string(RESOURCE_DIR) + "cache/pipeline_cache.bin";
+		static constexpr size_t              maxPipelineCacheSize = 64 * 1024 * 1024;
+		/* Present pass framebuffer for every swapchain image */
 		std::vector<vk::Framebuffer>         framebuffers;
+		vk::Framebuffer                      sceneFramebuffer;
+		/* Size the scene targets are allocated at, the scene renders into renderExtent() of it */
+		vk::Extent2D                         sceneExtent;
+		float                                renderScale = 1.0f;
 		bool                                 swapchain_recreated;
 		uint32_t                             currentBuffer = 0;
 		bool                                 preparedToRender = false;
 
+		/*
+		Everything one frame owns while the GPU works on it, the CPU records frame
+		N + framesInFlight only after the fence of frame N signaled
+		*/
+		using FrameResources = struct {
+			vk::Semaphore     presentComplete;
+			vk::Semaphore     renderComplete;
+			vk::Fence         inFlight;
+			vk::CommandPool   commandPool;
+			vk::CommandBuffer cmdBuffer;
+		};
+		std::vector<FrameResources>          frames;
+		std::vector<vk::Fence>               imagesInFlight;
+		uint32_t                             currentFrame = 0;
+
 		using FPScontainer = struct {
 			float fpsTimer = 0.0f;
 			uint32_t frameCounter = 0;
@@ -95,15 +135,40 @@ namespace vkpbr {
 		FPScontainer stopwatch; //TODO: stalo by za to prijit na lepsi jmeno
 
 		auto checkValidationLayerSupport() const -> bool;
-
-	private:
+		auto loadPipelineCacheData() const -> std::vector<uint8_t>;
+		auto savePipelineCache() const -> void;
+		/* Key press forwarded from the window */
+		virtual auto keyPressed(int key) -> void;
+		/* Aspects of depthFormat, layout transitions of the depth image need all of them */
+		auto depthAspectMask() const -> vk::ImageAspectFlags;
+		/* Highest sample count up to settings.sampleCount usable for color and depth, e1 without multisampling */
+		auto supportedSampleCount() const -> vk::SampleCountFlagBits;
+		/* Render passes and framebuffers for changed settings, pipelines of the old passes are up to the caller */
+		auto recreateRenderTargets() -> void;
+		auto destroyFramebuffer() -> void;
+		/* Window size scaled by renderScale, at most sceneExtent */
+		auto renderExtent() const -> vk::Extent2D;
+
+		/* sampledView is depth aspect only so compute passes can read the depth buffer, null when depth is transient */
 		using DepthStencil = struct {
 			vk::Image        image;
 			vk::ImageView    view;
+			vk::ImageView    sampledView;
 			vk::DeviceMemory memory;
 		};
 		DepthStencil depthStencil;
 
+		using ColorTarget = struct {
+			vk::Image        image;
+			vk::ImageView    view;
+			vk::DeviceMemory memory;
+		};
+		/* Multisampled color, only alive inside the render pass and resolved into sceneColor */
+		ColorTarget multisampleColor;
+		/* Left in shader read only layout by the scene passes */
+		ColorTarget sceneColor;
+
+	private:
 
 		VkDebugUtilsMessengerEXT debugCallback;
 		static auto createDebugReportCallback(
@@ -120,6 +185,7 @@ namespace vkpbr {
 		auto setupDebugCallback() -> void;
 
 		static auto windowResizeCallback(GLFWwindow* window, int width, int height) -> void;
+		static auto windowKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) -> void;
 		auto recreateSwapchain() -> void;
 
 		auto selectPhysicalDevice() -> void;
@@ -127,8 +193,9 @@ namespace vkpbr {
 
 		auto selectSuitableDepthFormat() -> void;
 
-		auto createCommandBuffers() -> void;
+		auto createFrameResources() -> void;
 		auto createRenderPass() -> void;
+		auto createPresentPass() -> void;
 
 	};
 }
\ No newline at end of file
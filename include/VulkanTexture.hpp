@@ -6,6 +6,7 @@
 #include <gli/gli.hpp>
 
 #include <VulkanDevice.hpp>
+#include <UploadManager.hpp>
 #include <Utility.hpp>
 #include "tiny_gltf.h"
 
@@ -41,13 +42,11 @@ namespace vkpbr {
 		}
 
 
+		/* Sampler is shared through the device sampler cache and not destroyed here */
 		auto release() const -> void
 		{
 			device->logicalDevice.destroyImageView(imageView, nullptr);
 			device->logicalDevice.destroyImage(image, nullptr);
-			if (textureSampler) {
-				device->logicalDevice.destroySampler(textureSampler, nullptr);
-			}
 			device->logicalDevice.freeMemory(deviceMemory, nullptr);
 		}
 	};
@@ -59,9 +58,10 @@ namespace vkpbr {
 			const std::string& filename,
 			vk::Format format,
 			vkpbr::VulkanDevice* device,
-			vk::Queue loading_queue,
+			vkpbr::UploadManager* uploader,
 			const vk::ImageUsageFlags& image_usage = vk::ImageUsageFlagBits::eSampled,
-			const vk::ImageLayout& image_layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+			const vk::ImageLayout& image_layout = vk::ImageLayout::eShaderReadOnlyOptimal,
+			const vk::SamplerAddressMode address_mode = vk::SamplerAddressMode::eRepeat)
 		{
 			gli::texture2d texture(gli::load(filename.c_str()));
 			assert(!texture.empty());
@@ -71,10 +71,6 @@ namespace vkpbr {
 			height = static_cast<uint32_t>(texture[0].extent().y);
 			mipLevels = static_cast<uint32_t>(texture.levels());
 
-			/* Prepare texture loading command, buffer and memory */
-			auto [loading_cmd, staging_buffer, staging_memory] =  textureLoadingCommand(format, texture);
-			auto buffer_regions = setupBufferCopyRegions(texture);
-
 			createImage(format, image_usage);
 			bindImageMemory();
 
@@ -84,66 +80,11 @@ namespace vkpbr {
 			subresource_range.levelCount = mipLevels;
 			subresource_range.layerCount = 1;
 
-			/* Memory barrier */
-			{
-				vk::ImageMemoryBarrier memory_barrier = {};
-				memory_barrier.oldLayout = vk::ImageLayout::eUndefined;
-				memory_barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
-				memory_barrier.srcAccessMask = static_cast<vk::AccessFlagBits>(0);
-				memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-				memory_barrier.image = image;
-				memory_barrier.subresourceRange = subresource_range;
-				loading_cmd.pipelineBarrier(
-					vk::PipelineStageFlagBits::eAllCommands,
-					vk::PipelineStageFlagBits::eAllCommands,
-					static_cast<vk::DependencyFlagBits>(0),
-					0,
-					nullptr,
-					0,
-					nullptr,
-					1,
-					&memory_barrier
-				);
-			}
-
-			/* Copy mip levels from buffer */
-			loading_cmd.copyBufferToImage(
-				staging_buffer,
-				image,
-				vk::ImageLayout::eTransferDstOptimal,
-				static_cast<uint32_t>(buffer_regions.size()),
-				buffer_regions.data()
-			);
-
+			/* Copy mip levels through the staging ring, submitted with the rest of the batch */
 			this->imageLayout = image_layout;
-			/* Memory barrier */
-			{
-				vk::ImageMemoryBarrier memory_barrier = {};
-				memory_barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-				memory_barrier.newLayout = imageLayout;
-				memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-				memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-				memory_barrier.image = image;
-				memory_barrier.subresourceRange = subresource_range;
-				loading_cmd.pipelineBarrier(
-					vk::PipelineStageFlagBits::eAllCommands,
-					vk::PipelineStageFlagBits::eAllCommands,
-					static_cast<vk::DependencyFlagBits>(0),
-					0,
-					nullptr,
-					0,
-					nullptr,
-					1,
-					&memory_barrier
-				);
-			}
-
-			device->finishAndSubmitCmdBuffer(loading_cmd, loading_queue);
-
-			device->logicalDevice.freeMemory(staging_memory, nullptr);
-			device->logicalDevice.destroyBuffer(staging_buffer, nullptr);
+			uploader->copyToImage(texture.data(), texture.size(), image, setupBufferCopyRegions(texture), subresource_range, imageLayout);
 
-			createTextureSampler();
+			createTextureSampler(address_mode);
 			createImageView(format);
 			
 			updateDescriptorInfo();
@@ -151,43 +92,6 @@ namespace vkpbr {
 	
 	private:
 
-		auto textureLoadingCommand(vk::Format& format, const gli::texture2d& texture) const -> std::tuple<vk::CommandBuffer, vk::Buffer, vk::DeviceMemory>
-		{
-			/* Get device properties */
-			vk::FormatProperties format_properties;
-			device->physicalDevice.getFormatProperties(format, &format_properties);
-
-			vk::MemoryAllocateInfo allocate_info = {};
-			vk::MemoryRequirements memory_requirements = {};
-
-			vk::CommandBuffer loadingCmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
-
-			vk::Buffer staging_buffer;
-			vk::DeviceMemory staging_memory;
-
-			vk::BufferCreateInfo buffer_create_info = {};
-			buffer_create_info.size = texture.size();
-			buffer_create_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
-			buffer_create_info.sharingMode = vk::SharingMode::eExclusive;
-
-			VK_ASSERT(device->logicalDevice.createBuffer(&buffer_create_info, nullptr, &staging_buffer));
-			device->logicalDevice.getBufferMemoryRequirements(staging_buffer, &memory_requirements);
-
-			allocate_info.allocationSize = memory_requirements.size;
-			allocate_info.memoryTypeIndex = device->findMemoryType(memory_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-			VK_ASSERT(device->logicalDevice.allocateMemory(&allocate_info, nullptr, &staging_memory));
-			device->logicalDevice.bindBufferMemory(staging_buffer, staging_memory, 0);
-
-			// Copy texture data
-			uint8_t* data;
-			VK_ASSERT(device->logicalDevice.mapMemory(staging_memory, 0, memory_requirements.size, vk::MemoryMapFlagBits(), reinterpret_cast<void**>(&data)));
-			memcpy(data, texture.data(), texture.size());
-			device->logicalDevice.unmapMemory(staging_memory);
-
-			return std::make_tuple(loadingCmd, staging_buffer, staging_memory);
-		}
-	
 		auto createImage(const vk::Format& format, const vk::ImageUsageFlags& image_usage) -> void
 		{
 			vk::ImageCreateInfo image_create_info = {};
@@ -242,23 +146,23 @@ namespace vkpbr {
 			device->logicalDevice.bindImageMemory(image, deviceMemory, 0);
 		}
 
-		auto createTextureSampler() -> void
+		auto createTextureSampler(const vk::SamplerAddressMode address_mode) -> void
 		{
 			vk::SamplerCreateInfo sampler_create_info = {};
 			sampler_create_info.magFilter = vk::Filter::eLinear;
 			sampler_create_info.minFilter = vk::Filter::eLinear;
 			sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
-			sampler_create_info.addressModeU = vk::SamplerAddressMode::eRepeat;
-			sampler_create_info.addressModeV = vk::SamplerAddressMode::eRepeat;
-			sampler_create_info.addressModeW = vk::SamplerAddressMode::eRepeat;
+			sampler_create_info.addressModeU = address_mode;
+			sampler_create_info.addressModeV = address_mode;
+			sampler_create_info.addressModeW = address_mode;
 			sampler_create_info.mipLodBias = 0.0f;
 			sampler_create_info.compareOp = vk::CompareOp::eNever;
 			sampler_create_info.minLod = 0.0f;
-			sampler_create_info.maxLod = static_cast<float>(mipLevels);
+			sampler_create_info.maxLod = VK_LOD_CLAMP_NONE;
 			sampler_create_info.anisotropyEnable = device->enabledFeatures.samplerAnisotropy;
 			sampler_create_info.maxAnisotropy = device->enabledFeatures.samplerAnisotropy ? device->deviceProperties.limits.maxSamplerAnisotropy : 1.0f;
 			sampler_create_info.borderColor = vk::BorderColor::eFloatOpaqueWhite;
-			VK_ASSERT(device->logicalDevice.createSampler(&sampler_create_info, nullptr, &textureSampler));
+			textureSampler = device->samplerCache.get(sampler_create_info);
 		}
 	
 		auto createImageView(vk::Format format) -> void
@@ -276,10 +180,147 @@ namespace vkpbr {
 
 	class TextureGLTF : public Texture {
 	public:
+		using MipLevel = struct {
+			uint32_t             width;
+			uint32_t             height;
+			std::vector<uint8_t> data;
+		};
+
+		/* CPU copy of the whole mip chain, source for texture streaming */
+		std::vector<MipLevel> mipChain;
+		uint32_t              residentMip = 0;
+		vk::DeviceSize        residentSize = 0;
+		uint32_t              streamIndex = UINT32_MAX;
+		vk::SamplerCreateInfo samplerInfo = samplerCreateInfo(nullptr, false, 1.0f);
+
+		/*
+		Sampler state of a glTF sampler, nullptr = glTF defaults (linear, repeat)
+		Min filters without mipmap clamp sampling to the base level
+		*/
+		static auto samplerCreateInfo(const tinygltf::Sampler* sampler, const bool anisotropy, const float max_anisotropy) -> vk::SamplerCreateInfo
+		{
+			const auto address_mode = [](const int wrap) {
+				switch (wrap) {
+				case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE:   return vk::SamplerAddressMode::eClampToEdge;
+				case TINYGLTF_TEXTURE_WRAP_MIRRORED_REPEAT: return vk::SamplerAddressMode::eMirroredRepeat;
+				default:                                    return vk::SamplerAddressMode::eRepeat;
+				}
+			};
+
+			vk::SamplerCreateInfo sampler_create_info = {};
+			sampler_create_info.magFilter = vk::Filter::eLinear;
+			sampler_create_info.minFilter = vk::Filter::eLinear;
+			sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
+			sampler_create_info.addressModeU = vk::SamplerAddressMode::eRepeat;
+			sampler_create_info.addressModeV = vk::SamplerAddressMode::eRepeat;
+			sampler_create_info.addressModeW = vk::SamplerAddressMode::eRepeat;
+			sampler_create_info.compareOp = vk::CompareOp::eNever;
+			sampler_create_info.borderColor = vk::BorderColor::eFloatOpaqueWhite;
+			sampler_create_info.minLod = 0.0f;
+			sampler_create_info.maxLod = VK_LOD_CLAMP_NONE;
+			sampler_create_info.anisotropyEnable = anisotropy;
+			sampler_create_info.maxAnisotropy = anisotropy ? max_anisotropy : 1.0f;
+
+			if (nullptr == sampler) {
+				return sampler_create_info;
+			}
+
+			if (sampler->magFilter == TINYGLTF_TEXTURE_FILTER_NEAREST) {
+				sampler_create_info.magFilter = vk::Filter::eNearest;
+			}
+
+			switch (sampler->minFilter) {
+			case TINYGLTF_TEXTURE_FILTER_NEAREST:
+				sampler_create_info.minFilter = vk::Filter::eNearest;
+				sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+				sampler_create_info.maxLod = 0.25f;
+				break;
+			case TINYGLTF_TEXTURE_FILTER_LINEAR:
+				sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+				sampler_create_info.maxLod = 0.25f;
+				break;
+			case TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_NEAREST:
+				sampler_create_info.minFilter = vk::Filter::eNearest;
+				sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+				break;
+			case TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_NEAREST:
+				sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eNearest;
+				break;
+			case TINYGLTF_TEXTURE_FILTER_NEAREST_MIPMAP_LINEAR:
+				sampler_create_info.minFilter = vk::Filter::eNearest;
+				break;
+			default:
+				break;
+			}
+
+			sampler_create_info.addressModeU = address_mode(sampler->wrapS);
+			sampler_create_info.addressModeV = address_mode(sampler->wrapT);
+			return sampler_create_info;
+		}
+
+		/*
+		Decodes glTF image into RGBA8 and box filters the full mip chain on CPU
+		Does not touch the device, so it can run on worker threads
+		*/
+		auto buildMipChain(const tinygltf::Image& gltf_image) -> void
+		{
+			width = static_cast<uint32_t>(gltf_image.width);
+			height = static_cast<uint32_t>(gltf_image.height);
+			mipLevels = static_cast<uint32_t>(floor(log2(std::max(width, height))) + 1.0);
+			layerCount = 1;
+
+			mipChain.resize(mipLevels);
+			mipChain[0].width = width;
+			mipChain[0].height = height;
+			mipChain[0].data.resize(static_cast<size_t>(width) * height * 4);
+
+			const auto components = static_cast<size_t>(gltf_image.component);
+			for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+				for (size_t j = 0; j < 4; j++) {
+					mipChain[0].data[i * 4 + j] = j < components ? gltf_image.image[i * components + j] : uint8_t{ 255 };
+				}
+			}
+
+			for (uint32_t level = 1; level < mipLevels; level++) {
+				const auto& source = mipChain[level - 1];
+				auto& target = mipChain[level];
+				target.width = std::max(1u, source.width >> 1);
+				target.height = std::max(1u, source.height >> 1);
+				target.data.resize(static_cast<size_t>(target.width) * target.height * 4);
+
+				for (uint32_t y = 0; y < target.height; y++) {
+					const auto y0 = std::min(y * 2, source.height - 1);
+					const auto y1 = std::min(y * 2 + 1, source.height - 1);
+					for (uint32_t x = 0; x < target.width; x++) {
+						const auto x0 = std::min(x * 2, source.width - 1);
+						const auto x1 = std::min(x * 2 + 1, source.width - 1);
+						for (uint32_t c = 0; c < 4; c++) {
+							const auto sum =
+								source.data[(y0 * source.width + x0) * 4 + c] +
+								source.data[(y0 * source.width + x1) * 4 + c] +
+								source.data[(y1 * source.width + x0) * 4 + c] +
+								source.data[(y1 * source.width + x1) * 4 + c];
+							target.data[(y * target.width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+						}
+					}
+				}
+			}
+		}
+
+		/* Bytes needed to keep levels [first_mip, mipLevels) resident */
+		auto mipChainSize(const uint32_t first_mip) const -> vk::DeviceSize
+		{
+			vk::DeviceSize size = 0;
+			for (auto level = first_mip; level < static_cast<uint32_t>(mipChain.size()); level++) {
+				size += mipChain[level].data.size();
+			}
+			return size;
+		}
+
 		auto loadFromGLTFImage(
 			tinygltf::Image& gltf_image,
 			vkpbr::VulkanDevice* device,
-			const vk::Queue copy_queue) -> void
+			vkpbr::UploadManager* uploader) -> void
 		{
 			this->device = device;
 
@@ -299,37 +340,6 @@ namespace vkpbr {
 			vk::MemoryAllocateInfo memory_allocate_info = {};
 			vk::MemoryRequirements memory_requirements = {};
 
-			vk::Buffer staging_buffer;
-			vk::DeviceMemory staging_memory;
-
-			vk::BufferCreateInfo buffer_create_info = {};
-			buffer_create_info.size = buffer_size;
-			buffer_create_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
-			buffer_create_info.sharingMode = vk::SharingMode::eExclusive;
-			VK_ASSERT(device->logicalDevice.createBuffer(&buffer_create_info, nullptr, &staging_buffer));
-			device->logicalDevice.getBufferMemoryRequirements(staging_buffer, &memory_requirements);
-			memory_allocate_info.allocationSize = memory_requirements.size;
-			memory_allocate_info.memoryTypeIndex = device->findMemoryType(
-				memory_requirements.memoryTypeBits,
-				vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-			);
-			VK_ASSERT(device->logicalDevice.allocateMemory(&memory_allocate_info, nullptr, &staging_memory));
-			device->logicalDevice.bindBufferMemory(staging_buffer, staging_memory, 0);
-	
-
-			uint8_t* data;
-			VK_ASSERT(
-				device->logicalDevice.mapMemory(
-					staging_memory,
-					0,
-					memory_requirements.size,
-					static_cast<vk::MemoryMapFlagBits>(0),
-					reinterpret_cast<void**>(&data)
-				)
-			);
-			memcpy(data, buffer, buffer_size);
-			device->logicalDevice.unmapMemory(staging_memory);
-
 			vk::ImageCreateInfo image_create_info = {};
 			image_create_info.imageType = vk::ImageType::e2D;
 			image_create_info.format = format;
@@ -349,25 +359,11 @@ namespace vkpbr {
 			VK_ASSERT(device->logicalDevice.allocateMemory(&memory_allocate_info, nullptr, &deviceMemory));
 			device->logicalDevice.bindImageMemory(image, deviceMemory, 0);
 
-			auto copy_cmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
-
 			vk::ImageSubresourceRange subresource_range = {};
 			subresource_range.aspectMask = vk::ImageAspectFlagBits::eColor;
 			subresource_range.levelCount = 1;
 			subresource_range.layerCount = 1;
 
-			/* Memory barrier */
-			{
-				vk::ImageMemoryBarrier image_memory_barrier = {};
-				image_memory_barrier.oldLayout = vk::ImageLayout::eUndefined;
-				image_memory_barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
-				image_memory_barrier.srcAccessMask = vk::AccessFlagBits(0);
-				image_memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-				image_memory_barrier.image = image;
-				image_memory_barrier.subresourceRange = subresource_range;
-				copy_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
-			}
-
 			vk::BufferImageCopy buffer_image_copy = {};
 			buffer_image_copy.imageSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
 			buffer_image_copy.imageSubresource.mipLevel = 0;
@@ -377,28 +373,24 @@ namespace vkpbr {
 			buffer_image_copy.imageExtent.height = height;
 			buffer_image_copy.imageExtent.depth = 1;
 
-			copy_cmd.copyBufferToImage(staging_buffer, image, vk::ImageLayout::eTransferDstOptimal, 1, &buffer_image_copy);
+			/* Level 0 goes through the staging ring and ends up as blit source */
+			uploader->copyToImage(
+				buffer,
+				buffer_size,
+				image,
+				{ buffer_image_copy },
+				subresource_range,
+				vk::ImageLayout::eTransferSrcOptimal,
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::AccessFlagBits::eTransferRead
+			);
 
-			/* End memory barrier */
-			{
-				vk::ImageMemoryBarrier image_memory_barrier = {};
-				image_memory_barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-				image_memory_barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
-				image_memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-				image_memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-				image_memory_barrier.image = image;
-				image_memory_barrier.subresourceRange = subresource_range;
-				copy_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
+			if (gltf_image.component == 3) {
+				delete[] buffer;
 			}
 
-			device->finishAndSubmitCmdBuffer(copy_cmd, copy_queue, true);
-
-			device->logicalDevice.freeMemory(staging_memory, nullptr);
-			device->logicalDevice.destroyBuffer(staging_buffer, nullptr);
-
-
-			/* Gemerate mip chain */
-			auto blit_cmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
+			/* Gemerate mip chain, recorded into the same upload batch (blits need graphics queue) */
+			auto blit_cmd = uploader->graphicsCommandBuffer();
 
 			for (uint32_t i = 1; i < mipLevels; i++) {
 				vk::ImageBlit image_blit = {};
@@ -406,15 +398,15 @@ namespace vkpbr {
 				image_blit.srcSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
 				image_blit.srcSubresource.layerCount = 1;
 				image_blit.srcSubresource.mipLevel = i - 1;
-				image_blit.srcOffsets[1].x = static_cast<int32_t>(width >> (i - 1));
-				image_blit.srcOffsets[1].y = static_cast<int32_t>(height >> (i - 1));
+				image_blit.srcOffsets[1].x = static_cast<int32_t>(std::max(1u, width >> (i - 1)));
+				image_blit.srcOffsets[1].y = static_cast<int32_t>(std::max(1u, height >> (i - 1)));
 				image_blit.srcOffsets[1].z = 1;
 
 				image_blit.dstSubresource.aspectMask = vk::ImageAspectFlagBits::eColor;
 				image_blit.dstSubresource.layerCount = 1;
 				image_blit.dstSubresource.mipLevel = i;
-				image_blit.dstOffsets[1].x = static_cast<int32_t>(width >> i);
-				image_blit.dstOffsets[1].y = static_cast<int32_t>(height >> i);
+				image_blit.dstOffsets[1].x = static_cast<int32_t>(std::max(1u, width >> i));
+				image_blit.dstOffsets[1].y = static_cast<int32_t>(std::max(1u, height >> i));
 				image_blit.dstOffsets[1].z = 1;
 
 				vk::ImageSubresourceRange mip_sub_range = {};
@@ -455,31 +447,14 @@ namespace vkpbr {
 				vk::ImageMemoryBarrier img_memory_barrier = {};
 				img_memory_barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
 				img_memory_barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-				img_memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-				img_memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
+				img_memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite | vk::AccessFlagBits::eTransferRead;
+				img_memory_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
 				img_memory_barrier.image = image;
 				img_memory_barrier.subresourceRange = subresource_range;
-				blit_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &img_memory_barrier);
+				blit_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eFragmentShader, vk::DependencyFlagBits(0), 0, nullptr, 0, nullptr, 1, &img_memory_barrier);
 			}
 
-			device->finishAndSubmitCmdBuffer(blit_cmd, copy_queue, true);
-
-			vk::SamplerCreateInfo sampler_create_info = {};
-			sampler_create_info.magFilter = vk::Filter::eLinear;
-			sampler_create_info.minFilter = vk::Filter::eLinear;
-			sampler_create_info.mipmapMode = vk::SamplerMipmapMode::eLinear;
-			sampler_create_info.addressModeU = vk::SamplerAddressMode::eMirroredRepeat;
-			sampler_create_info.addressModeV = vk::SamplerAddressMode::eMirroredRepeat;
-			sampler_create_info.addressModeW = vk::SamplerAddressMode::eMirroredRepeat;
-			sampler_create_info.compareOp = vk::CompareOp::eNever;
-			sampler_create_info.borderColor = vk::BorderColor::eFloatOpaqueWhite;
-			sampler_create_info.maxAnisotropy = 1.0;
-			sampler_create_info.anisotropyEnable = false;
-			sampler_create_info.maxLod = static_cast<float>(mipLevels);
-			sampler_create_info.maxAnisotropy = 16.0;
-			sampler_create_info.anisotropyEnable = true;
-
-			VK_ASSERT(device->logicalDevice.createSampler(&sampler_create_info, nullptr, &textureSampler));
+			textureSampler = device->samplerCache.get(samplerInfo);
 
 			vk::ImageViewCreateInfo view_create_info = {};
 			view_create_info.image = image;
@@ -531,66 +506,42 @@ namespace vkpbr {
 			const std::string& filename,
 			vk::Format format,
 			vkpbr::VulkanDevice* device,
-			const vk::Queue copy_queue,
+			vkpbr::UploadManager* uploader,
 			const vk::ImageUsageFlags& usage_flags = vk::ImageUsageFlagBits::eSampled,
 			const vk::ImageLayout& image_layout = vk::ImageLayout::eShaderReadOnlyOptimal)
 		{
 			gli::texture_cube loaded_texture(gli::load(filename));
 			assert(!loaded_texture.empty());
 
+			loadFromTexture(loaded_texture, format, device, uploader, usage_flags, image_layout);
+		}
+
+		/* Cubemap produced at runtime, e.g. converted from an equirectangular image */
+		auto loadFromTexture(
+			const gli::texture_cube& loaded_texture,
+			vk::Format format,
+			vkpbr::VulkanDevice* device,
+			vkpbr::UploadManager* uploader,
+			const vk::ImageUsageFlags& usage_flags = vk::ImageUsageFlagBits::eSampled,
+			const vk::ImageLayout& image_layout = vk::ImageLayout::eShaderReadOnlyOptimal)
+		{
 			this->device = device;
 			width = static_cast<uint32_t>(loaded_texture.extent().x);
 			height = static_cast<uint32_t>(loaded_texture.extent().y);
 			mipLevels = static_cast<uint32_t>(loaded_texture.levels());
 
-			auto [staging_buffer, staging_memory ] = copyDataToStagingBuffer(loaded_texture);
-
 			auto buffer_copy_regions = setupBufferCopyRegions(loaded_texture);
 
 			createImage(loaded_texture, format, usage_flags);
 
-			copyBufferToImage(staging_buffer, buffer_copy_regions, image_layout, copy_queue);
+			copyBufferToImage(loaded_texture, buffer_copy_regions, image_layout, uploader);
 
 			createSampler(format);
 
-			device->logicalDevice.freeMemory(staging_memory, nullptr);
-			device->logicalDevice.destroyBuffer(staging_buffer, nullptr);
-
 			updateDescriptorInfo();
 		}
 
-		auto copyDataToStagingBuffer(gli::texture_cube& loaded_texture) const -> std::tuple<vk::Buffer, vk::DeviceMemory>
-		{
-			vk::MemoryAllocateInfo allocate_info = {};
-			vk::MemoryRequirements memory_requirements = {};
-
-			auto staging_buffer = vk::Buffer{};
-			auto staging_memory = vk::DeviceMemory{};
-
-			vk::BufferCreateInfo buffer_create_info = {};
-			buffer_create_info.size = loaded_texture.size();
-			buffer_create_info.usage = vk::BufferUsageFlagBits::eTransferSrc;
-			buffer_create_info.sharingMode = vk::SharingMode::eExclusive;
-
-			VK_ASSERT(device->logicalDevice.createBuffer(&buffer_create_info, nullptr, &staging_buffer));
-
-			device->logicalDevice.getBufferMemoryRequirements(staging_buffer, &memory_requirements);
-			allocate_info.allocationSize = memory_requirements.size;
-			allocate_info.memoryTypeIndex = device->findMemoryType(memory_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-
-			VK_ASSERT(device->logicalDevice.allocateMemory(&allocate_info, nullptr, &staging_memory));
-			device->logicalDevice.bindBufferMemory(staging_buffer, staging_memory, 0);
-
-			/* copy data*/
-			uint8_t* data;
-			VK_ASSERT(device->logicalDevice.mapMemory(staging_memory, 0, memory_requirements.size, static_cast<vk::MemoryMapFlags>(0), reinterpret_cast<void**>(&data)));
-			memcpy(data, loaded_texture.data(), loaded_texture.size());
-			device->logicalDevice.unmapMemory(staging_memory);
-
-			return std::make_tuple(staging_buffer, staging_memory);
-		}
-
-		auto setupBufferCopyRegions(gli::texture_cube& loaded_texture) const -> std::vector<vk::BufferImageCopy>
+		auto setupBufferCopyRegions(const gli::texture_cube& loaded_texture) const -> std::vector<vk::BufferImageCopy>
 		{
 			auto buffer_copy_regions = std::vector<vk::BufferImageCopy>{};
 			size_t offset = 0;
@@ -603,7 +554,7 @@ namespace vkpbr {
 					buffer_copy_region.imageSubresource.baseArrayLayer = cube_side;
 					buffer_copy_region.imageSubresource.layerCount = 1;
 					buffer_copy_region.imageExtent.width = static_cast<uint32_t>(loaded_texture[cube_side][level].extent().x);
-					buffer_copy_region.imageExtent.width = static_cast<uint32_t>(loaded_texture[cube_side][level].extent().y);
+					buffer_copy_region.imageExtent.height = static_cast<uint32_t>(loaded_texture[cube_side][level].extent().y);
 					buffer_copy_region.imageExtent.depth = 1;
 					buffer_copy_region.bufferOffset = offset;
 
@@ -615,7 +566,7 @@ namespace vkpbr {
 			return buffer_copy_regions;
 		}
 
-		auto createImage(gli::texture_cube& loaded_texture, vk::Format& format, const vk::ImageUsageFlags& usage_flags) -> void
+		auto createImage(const gli::texture_cube& loaded_texture, vk::Format& format, const vk::ImageUsageFlags& usage_flags) -> void
 		{
 			vk::MemoryAllocateInfo allocate_info = {};
 			vk::MemoryRequirements memory_requirements = {};
@@ -648,52 +599,18 @@ namespace vkpbr {
 			device->logicalDevice.bindImageMemory(image, deviceMemory, 0);
 		}
 
-		auto copyBufferToImage(vk::Buffer staging_buffer, std::vector<vk::BufferImageCopy>& buffer_copy_regions, const vk::ImageLayout image_layout, const vk::Queue copy_queue) -> void
+		auto copyBufferToImage(const gli::texture_cube& loaded_texture, std::vector<vk::BufferImageCopy>& buffer_copy_regions, const vk::ImageLayout image_layout, vkpbr::UploadManager* uploader) -> void
 		{
-			auto copy_cmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
-
 			vk::ImageSubresourceRange subresource_range = {};
 			subresource_range.aspectMask = vk::ImageAspectFlagBits::eColor;
 			subresource_range.baseMipLevel = 0;
 			subresource_range.levelCount = mipLevels;
 			subresource_range.layerCount = 6;
 
-			/* Memory barrier */
-			{
-				vk::ImageMemoryBarrier memory_barrier = {};
-				memory_barrier.oldLayout = vk::ImageLayout::eUndefined;
-				memory_barrier.newLayout = vk::ImageLayout::eTransferDstOptimal;
-				memory_barrier.srcAccessMask = static_cast<vk::AccessFlagBits>(0);
-				memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-				memory_barrier.image = image;
-				memory_barrier.subresourceRange = subresource_range;
-				copy_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, static_cast<vk::DependencyFlagBits>(0), 0, nullptr, 0, nullptr, 1, &memory_barrier);
-			}
-
-			copy_cmd.copyBufferToImage(
-				staging_buffer,
-				image,
-				vk::ImageLayout::eTransferDstOptimal,
-				static_cast<uint32_t>(buffer_copy_regions.size()),
-				buffer_copy_regions.data()
-			);
-
 			/* after copy, change to shader read */
 			imageLayout = image_layout;
 
-			/* Barrier end */
-			{
-				vk::ImageMemoryBarrier memory_barrier = {};
-				memory_barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-				memory_barrier.newLayout = imageLayout;
-				memory_barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-				memory_barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-				memory_barrier.image = image;
-				memory_barrier.subresourceRange = subresource_range;
-				copy_cmd.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eAllCommands, static_cast<vk::DependencyFlagBits>(0), 0, nullptr, 0, nullptr, 1, &memory_barrier);
-			}
-
-			device->finishAndSubmitCmdBuffer(copy_cmd, copy_queue);
+			uploader->copyToImage(loaded_texture.data(), loaded_texture.size(), image, buffer_copy_regions, subresource_range, imageLayout);
 		}
 
 		auto createSampler(const vk::Format format) -> void
@@ -710,10 +627,10 @@ namespace vkpbr {
 			sampler_create_info.anisotropyEnable = device->enabledFeatures.samplerAnisotropy;
 			sampler_create_info.compareOp = vk::CompareOp::eNever;
 			sampler_create_info.minLod = 0.0f;
-			sampler_create_info.maxLod = static_cast<float>(mipLevels);
+			sampler_create_info.maxLod = VK_LOD_CLAMP_NONE;
 			sampler_create_info.borderColor = vk::BorderColor::eFloatOpaqueWhite;
 
-			VK_ASSERT(device->logicalDevice.createSampler(&sampler_create_info, nullptr, &textureSampler));
+			textureSampler = device->samplerCache.get(sampler_create_info);
 
 			vk::ImageViewCreateInfo view_create_info = {};
 			view_create_info.viewType = vk::ImageViewType::eCube;
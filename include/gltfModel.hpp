@@ -3,12 +3,17 @@
 #include <vulkan/vulkan.hpp>
 #include <VulkanDevice.hpp>
 #include <VulkanTexture.hpp>
+#include <UploadManager.hpp>
+#include <TextureStreamer.hpp>
+#include <TextureCache.hpp>
+#include <ThreadPool.hpp>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/constants.hpp>
 
 #include "tiny_gltf.h"
 
@@ -53,7 +58,23 @@ namespace vkpbr {
 			};
 			PBRWorkflows pbrWorkflows;
 
-			vk::DescriptorSet descriptorSet = nullptr;
+			/* One set per frame in flight, a frame only rewrites its own while the others may be in use */
+			std::vector<vk::DescriptorSet> descriptorSets;
+			/* Frame slots whose set still refers to a texture residency that was swapped out */
+			uint32_t                       staleDescriptorSets = 0;
+		};
+
+		/* KHR_lights_punctual light, nodes place it and point it along their -Z axis */
+		struct Light {
+			enum class Type { directional, point, spot };
+
+			Type      type = Type::point;
+			glm::vec3 color = glm::vec3(1.0f);
+			float     intensity = 1.0f;
+			/* Zero means unlimited */
+			float     range = 0.0f;
+			float     innerConeAngle = 0.0f;
+			float     outerConeAngle = glm::quarter_pi<float>();
 		};
 
 		struct Primitive {
@@ -141,6 +162,8 @@ namespace vkpbr {
 			glm::vec3          translation = {};
 			glm::quat          rotation = {};
 			glm::vec3          scale = {};
+			/* Index into Model::lights, -1 without a light */
+			int32_t            light = -1;
 
 			auto localMatrix() -> glm::mat4
 			{
@@ -197,6 +220,8 @@ namespace vkpbr {
 				vk::DeviceMemory memory;
 			};
 			Vertices vertices;
+			/* Tightly packed copy of the positions for depth only passes */
+			Vertices positions;
 
 			using Indices = struct
 			{
@@ -208,8 +233,9 @@ namespace vkpbr {
 
 			std::vector<Node*> nodes;
 			std::vector<Node*> linearNodes;
-			std::vector<TextureGLTF> textures;
+			std::vector<vkpbr::TextureCache::Handle> textures;
 			std::vector<Material> materials;
+			std::vector<Light> lights;
 
 			using Dimensions = struct
 			{
@@ -221,16 +247,24 @@ namespace vkpbr {
 			};
 			Dimensions dimensions;
 
+			/* Optional shared services used while loading */
+			using LoadContext = struct
+			{
+				vkpbr::ThreadPool*      threadPool;
+				vkpbr::TextureStreamer* textureStreamer;
+				vkpbr::TextureCache*    textureCache;
+			};
+
 			auto release(vk::Device device) -> void
 			{
 				device.destroyBuffer(vertices.buffer, nullptr);
 				device.freeMemory(vertices.memory, nullptr);
+				device.destroyBuffer(positions.buffer, nullptr);
+				device.freeMemory(positions.memory, nullptr);
 				device.destroyBuffer(indices.buffer, nullptr);
 				device.freeMemory(indices.memory, nullptr);
 
-				for (auto& texture : textures) {
-					texture.release();
-				}
+				textures.clear();
 				for (auto& node : nodes)
 				{
 					delete node;
@@ -276,6 +310,11 @@ namespace vkpbr {
 					new_node->matrix = glm::make_mat4x4(node.matrix.data());
 				}
 
+				const auto light_extension = node.extensions.find("KHR_lights_punctual");
+				if (light_extension != node.extensions.end() && light_extension->second.Has("light")) {
+					new_node->light = static_cast<int32_t>(number(light_extension->second.Get("light"), -1.0f));
+				}
+
 				/* Node with children */
 				if (!node.children.empty()) {
 					for (auto i = 0; i < node.children.size(); i++) {
@@ -397,13 +436,127 @@ namespace vkpbr {
 				linearNodes.push_back(new_node);
 			}
 
-			auto loadImages(tinygltf::Model& model, vkpbr::VulkanDevice* device, vk::Queue transfer_queue) -> void
+			/* glTF sampler state packed into texture cache key */
+			static auto samplerState(const tinygltf::Model& model, const int sampler_index) -> uint64_t
 			{
-				for (auto& image : model.images) {
-					vkpbr::TextureGLTF texture;
-					texture.loadFromGLTFImage(image, device, transfer_queue);
-					textures.push_back(texture);
+				auto sampler = tinygltf::Sampler{};
+				sampler.minFilter = -1;
+				sampler.magFilter = -1;
+				if (sampler_index > -1) {
+					sampler = model.samplers[sampler_index];
 				}
+				return (static_cast<uint64_t>(sampler.minFilter & 0xFFFF) << 48)
+					| (static_cast<uint64_t>(sampler.magFilter & 0xFFFF) << 32)
+					| (static_cast<uint64_t>(sampler.wrapS & 0xFFFF) << 16)
+					| static_cast<uint64_t>(sampler.wrapT & 0xFFFF);
+			}
+
+			/*
+			One texture per glTF texture (image + sampler), shared through the texture cache when present
+			Only images not found in the cache are decoded and uploaded
+			*/
+			auto loadTextures(
+				tinygltf::Model& model,
+				vkpbr::VulkanDevice* device,
+				vkpbr::UploadManager* uploader,
+				const LoadContext& context,
+				vkpbr::TextureCache::ImageLoadContext& image_context) -> void
+			{
+				using PendingTexture = struct {
+					size_t                              textureIndex;
+					vkpbr::TextureCache::Key            key;
+					std::unique_ptr<vkpbr::TextureGLTF> texture;
+				};
+
+				const auto same_key = [](const vkpbr::TextureCache::Key& a, const vkpbr::TextureCache::Key& b) {
+					return a.contentHash == b.contentHash && a.format == b.format && a.samplerState == b.samplerState;
+				};
+
+				vkpbr::TextureCache::resolveImageHashes(model, image_context);
+				textures.resize(model.textures.size());
+				auto keys = std::vector<vkpbr::TextureCache::Key>(model.textures.size());
+				auto pending = std::vector<PendingTexture>{};
+
+				for (size_t i = 0; i < model.textures.size(); i++) {
+					const auto& gltf_texture = model.textures[i];
+					keys[i] = vkpbr::TextureCache::Key{
+						image_context.imageHashes[gltf_texture.source],
+						vk::Format::eR8G8B8A8Unorm,
+						samplerState(model, gltf_texture.sampler)
+					};
+
+					if (context.textureCache) {
+						textures[i] = context.textureCache->find(keys[i]);
+					}
+
+					const auto already_pending = std::any_of(pending.begin(), pending.end(), [&](const PendingTexture& pending_texture) {
+						return same_key(pending_texture.key, keys[i]);
+					});
+					if (!textures[i] && !already_pending) {
+						pending.push_back({ i, keys[i], std::make_unique<vkpbr::TextureGLTF>() });
+					}
+				}
+
+				/* glTF sampler state, the sampler itself is shared through the device sampler cache */
+				for (auto& pending_texture : pending) {
+					const auto sampler_index = model.textures[pending_texture.textureIndex].sampler;
+					pending_texture.texture->samplerInfo = vkpbr::TextureGLTF::samplerCreateInfo(
+						sampler_index > -1 ? &model.samplers[sampler_index] : nullptr,
+						device->enabledFeatures.samplerAnisotropy,
+						device->deviceProperties.limits.maxSamplerAnisotropy
+					);
+				}
+
+				if (context.textureCache) {
+					for (auto& pending_texture : pending) {
+						vkpbr::TextureCache::decodeSkippedImage(model, static_cast<size_t>(model.textures[pending_texture.textureIndex].source), image_context);
+					}
+				}
+
+				if (context.textureStreamer && context.threadPool) {
+					context.threadPool->parallelFor(pending.size(), 1, [&model, &pending](const size_t first, const size_t last) {
+						for (auto i = first; i < last; i++) {
+							pending[i].texture->buildMipChain(model.images[model.textures[pending[i].textureIndex].source]);
+						}
+					});
+					for (auto& pending_texture : pending) {
+						context.textureStreamer->registerTexture(pending_texture.texture.get());
+					}
+				}
+				else {
+					for (auto& pending_texture : pending) {
+						pending_texture.texture->loadFromGLTFImage(model.images[model.textures[pending_texture.textureIndex].source], device, uploader);
+					}
+				}
+
+				for (auto& pending_texture : pending) {
+					if (context.textureCache) {
+						textures[pending_texture.textureIndex] = context.textureCache->insert(pending_texture.key, std::move(pending_texture.texture));
+					}
+					else {
+						auto* streamer = context.textureStreamer;
+						textures[pending_texture.textureIndex] = vkpbr::TextureCache::Handle(pending_texture.texture.release(), [streamer](vkpbr::TextureGLTF* texture) {
+							if (streamer) {
+								streamer->unregisterTexture(texture);
+							}
+							texture->release();
+							delete texture;
+						});
+					}
+				}
+
+				/* glTF textures sharing image and sampler within this file */
+				for (size_t i = 0; i < textures.size(); i++) {
+					if (!textures[i]) {
+						const auto it = std::find_if(pending.begin(), pending.end(), [&](const PendingTexture& pending_texture) {
+							return same_key(pending_texture.key, keys[i]);
+						});
+						textures[i] = textures[it->textureIndex];
+					}
+				}
+
+				image_context.pinned.clear();
+				image_context.encodedImages.clear();
 			}
 
 			auto loadMaterials(tinygltf::Model& model) -> void
@@ -412,11 +565,11 @@ namespace vkpbr {
 					auto new_material = vkpbr::gltf::Material{};
 
 					if (material.values.find("baseColorTexture") != material.values.end()) {
-						new_material.baseColorTexture = &textures[model.textures[material.values["baseColorTexture"].TextureIndex()].source];
+						new_material.baseColorTexture = textures[material.values["baseColorTexture"].TextureIndex()].get();
 					}
 
 					if (material.values.find("metallicRoughnessTexture") != material.values.end()) {
-						new_material.metallicRoughnessTexture = &textures[model.textures[material.values["metallicRoughnessTexture"].TextureIndex()].source];
+						new_material.metallicRoughnessTexture = textures[material.values["metallicRoughnessTexture"].TextureIndex()].get();
 					}
 
 					if (material.values.find("roughnessFactor") != material.values.end()) {
@@ -432,15 +585,15 @@ namespace vkpbr {
 					}
 
 					if (material.additionalValues.find("normalTexture") != material.additionalValues.end()) {
-						new_material.normalTexture = &textures[model.textures[material.additionalValues["normalTexture"].TextureIndex()].source];
+						new_material.normalTexture = textures[material.additionalValues["normalTexture"].TextureIndex()].get();
 					}
 
 					if (material.additionalValues.find("emissiveTexture") != material.additionalValues.end()) {
-						new_material.emissiveTexture = &textures[model.textures[material.additionalValues["emissiveTexture"].TextureIndex()].source];
+						new_material.emissiveTexture = textures[material.additionalValues["emissiveTexture"].TextureIndex()].get();
 					}
 
 					if (material.additionalValues.find("occlusionTexture") != material.additionalValues.end()) {
-						new_material.occlusionTexture = &textures[model.textures[material.additionalValues["occlusionTexture"].TextureIndex()].source];
+						new_material.occlusionTexture = textures[material.additionalValues["occlusionTexture"].TextureIndex()].get();
 					}
 
 					if (material.additionalValues.find("alphaMode") != material.additionalValues.end()) {
@@ -467,7 +620,61 @@ namespace vkpbr {
 				}
 			}
 
-			auto loadFromFile(const std::string& filename, vkpbr::VulkanDevice* device, vk::Queue transfer_queue, float scale = 1.0f) -> void
+			/* JSON numbers without a fraction are parsed as int */
+			static auto number(const tinygltf::Value& value, const float fallback) -> float
+			{
+				if (value.IsNumber()) {
+					return static_cast<float>(value.Get<double>());
+				}
+				if (value.IsInt()) {
+					return static_cast<float>(value.Get<int>());
+				}
+				return fallback;
+			}
+
+			/* The bundled tinygltf does not know KHR_lights_punctual, its definitions are read from the raw extension */
+			auto loadLights(const tinygltf::Model& model) -> void
+			{
+				const auto extension = model.extensions.find("KHR_lights_punctual");
+				if (extension == model.extensions.end() || !extension->second.Has("lights")) {
+					return;
+				}
+
+				const auto& definitions = extension->second.Get("lights");
+				for (size_t i = 0; i < definitions.ArrayLen(); i++) {
+					const auto& definition = definitions.Get(static_cast<int>(i));
+					auto new_light = Light{};
+
+					const auto& type = definition.Get("type");
+					if (type.IsString() && type.Get<std::string>() == "directional") {
+						new_light.type = Light::Type::directional;
+					}
+					if (type.IsString() && type.Get<std::string>() == "spot") {
+						new_light.type = Light::Type::spot;
+					}
+
+					const auto& color = definition.Get("color");
+					for (int channel = 0; channel < 3 && channel < static_cast<int>(color.ArrayLen()); channel++) {
+						new_light.color[channel] = number(color.Get(channel), 1.0f);
+					}
+					new_light.intensity = number(definition.Get("intensity"), new_light.intensity);
+					new_light.range = number(definition.Get("range"), new_light.range);
+
+					if (definition.Has("spot")) {
+						const auto& spot = definition.Get("spot");
+						new_light.innerConeAngle = number(spot.Get("innerConeAngle"), new_light.innerConeAngle);
+						new_light.outerConeAngle = number(spot.Get("outerConeAngle"), new_light.outerConeAngle);
+					}
+					lights.push_back(new_light);
+				}
+			}
+
+			auto loadFromFile(
+				const std::string& filename,
+				vkpbr::VulkanDevice* device,
+				vkpbr::UploadManager* uploader,
+				float scale = 1.0f,
+				const LoadContext& context = {}) -> void
 			{
 				auto gltf_model = tinygltf::Model{};
 				auto gltf_context = tinygltf::TinyGLTF{};
@@ -478,11 +685,19 @@ namespace vkpbr {
 				auto index_buffer = std::vector<uint32_t>{};
 				auto vertex_buffer = std::vector<Vertex>{};
 
+				/* Images already in the texture cache are not decoded again */
+				auto image_load_context = vkpbr::TextureCache::ImageLoadContext{};
+				if (context.textureCache) {
+					image_load_context.cache = context.textureCache;
+					gltf_context.SetImageLoader(vkpbr::TextureCache::loadImageData, &image_load_context);
+				}
+
 				const auto file_loaded = gltf_context.LoadASCIIFromFile(&gltf_model, &error_string, &warning_string, filename.c_str());
 
 				if (file_loaded) {
-					loadImages(gltf_model, device, transfer_queue);
+					loadTextures(gltf_model, device, uploader, context, image_load_context);
 					loadMaterials(gltf_model);
+					loadLights(gltf_model);
 					const auto& scene = gltf_model.scenes[gltf_model.defaultScene];
 
 					for (size_t i = 0; i < scene.nodes.size(); i++) {
@@ -495,38 +710,19 @@ namespace vkpbr {
 					exit(EXIT_FAILURE); //TODO: predelat na throw
 				}
 
+				auto position_buffer = std::vector<glm::vec3>{};
+				position_buffer.reserve(vertex_buffer.size());
+				for (const auto& vertex : vertex_buffer) {
+					position_buffer.push_back(vertex.position);
+				}
+
 				const auto vertex_buffer_size = vertex_buffer.size() * sizeof(Vertex);
+				const auto position_buffer_size = position_buffer.size() * sizeof(glm::vec3);
 				const auto index_buffer_size = index_buffer.size() * sizeof(uint32_t);
 				indices.count = static_cast<uint32_t>(index_buffer.size());
 
 				assert((vertex_buffer_size > 0) && (index_buffer_size > 0));
 
-				using StagingBuffer = struct {
-					vk::Buffer       buffer;
-					vk::DeviceMemory memory;
-				};
-
-				auto vertex_staging_buffer = StagingBuffer{};
-				auto index_staging_buffer = StagingBuffer{};
-
-				VK_ASSERT(device->createBuffer(
-					vertex_buffer_size,
-					vk::BufferUsageFlagBits::eTransferSrc,
-					vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-					vertex_staging_buffer.buffer,
-					vertex_staging_buffer.memory,
-					vertex_buffer.data()
-				));
-
-				VK_ASSERT(device->createBuffer(
-					index_buffer_size,
-					vk::BufferUsageFlagBits::eTransferSrc,
-					vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
-					index_staging_buffer.buffer,
-					index_staging_buffer.memory,
-					index_buffer.data()
-				));
-
 				/* Device local buffers */
 
 				VK_ASSERT(device->createBuffer(
@@ -537,6 +733,14 @@ namespace vkpbr {
 					vertices.memory
 				));
 
+				VK_ASSERT(device->createBuffer(
+					position_buffer_size,
+					vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eTransferDst,
+					vk::MemoryPropertyFlagBits::eDeviceLocal,
+					positions.buffer,
+					positions.memory
+				));
+
 				VK_ASSERT(device->createBuffer(
 					index_buffer_size,
 					vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst,
@@ -544,22 +748,11 @@ namespace vkpbr {
 					indices.buffer,
 					indices.memory
 				));
-				
-				auto copy_cmd = device->createCommandBuffer(vk::CommandBufferLevel::ePrimary, true);
-				auto copy_region = vk::BufferCopy{};
-
-				copy_region.size = vertex_buffer_size;
-				copy_cmd.copyBuffer(vertex_staging_buffer.buffer, vertices.buffer, 1, &copy_region);
-
-				copy_region.size = index_buffer_size;
-				copy_cmd.copyBuffer(index_staging_buffer.buffer, indices.buffer, 1, &copy_region);
-
-				device->finishAndSubmitCmdBuffer(copy_cmd, transfer_queue, true);
 
-				device->logicalDevice.destroyBuffer(vertex_staging_buffer.buffer, nullptr);
-				device->logicalDevice.freeMemory(vertex_staging_buffer.memory, nullptr);
-				device->logicalDevice.destroyBuffer(index_staging_buffer.buffer, nullptr);
-				device->logicalDevice.freeMemory(index_staging_buffer.memory, nullptr);
+				/* Staged through the upload ring, submitted with the texture uploads */
+				uploader->copyToBuffer(vertex_buffer.data(), vertex_buffer_size, vertices.buffer);
+				uploader->copyToBuffer(position_buffer.data(), position_buffer_size, positions.buffer);
+				uploader->copyToBuffer(index_buffer.data(), index_buffer_size, indices.buffer);
 
 				setSceneDimensions();
 			}
@@ -0,0 +1,27 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth pre-pass, position math has to stay identical to pbr_shader.vert for eEqual testing
+
+// Same member order as VKPBR::UBOMatrices
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    vec3 camPos;
+    float flipUV;
+} ubo;
+
+// World matrix of every node, draws pass the index of their node as first instance
+layout(set = 0, binding = 8) readonly buffer Transforms {
+    mat4 nodeMatrices[];
+} transforms;
+
+layout(location = 0) in vec3 inPosition;
+
+invariant gl_Position;
+
+void main() {
+    mat4 world = transforms.nodeMatrices[gl_InstanceIndex];
+    gl_Position = ubo.proj * ubo.view * world * vec4(inPosition, 1.0);
+}
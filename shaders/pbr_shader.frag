@@ -6,23 +6,57 @@ layout (location = 2) in vec2 inUV;
 
 // Scene bindings
 
+// Same member order as VKPBR::UBOMatrices
 layout (set = 0, binding = 0) uniform UBO {
-	mat4 projection;
 	mat4 model;
 	mat4 view;
+	mat4 projection;
 	vec3 camPos;
+	float flipUV;
 } ubo;
 
-//layout (set = 0, binding = 1) uniform UBOParams {
-//	vec4 lightDir;
-//	float exposure;
-//	float gamma;
-//	float prefilteredCubeMipLevels;
-//} uboParams;
+// Cascade count of vkpbr::ShadowCascades
+#define SHADOW_CASCADES 4
+
+layout (set = 0, binding = 1) uniform UBOParams {
+	vec4 lightDir;
+	float exposure;
+	float gamma;
+	float prefilteredCubeMipLevels;
+	float padding;
+	vec4 shIrradiance[9];
+	uvec4 clusterGridSize;
+	vec4 clusterSlicing;
+	vec4 lightColor;
+	mat4 cascadeViewProjection[SHADOW_CASCADES];
+	vec4 cascadeSplits;
+} uboParams;
+
+layout (set = 0, binding = 3) uniform samplerCube prefilteredMap;
+layout (set = 0, binding = 4) uniform sampler2D samplerBRDFLUT;
+
+// Punctual lights and their froxel records, see vkpbr::ClusteredLighting
+
+struct Light {
+	vec4 positionRange;
+	vec4 colorType;
+	vec4 directionSpotScale;
+	vec4 spotOffset;
+	vec4 viewPositionRadius;
+};
+
+layout (set = 0, binding = 5) readonly buffer Lights {
+	Light lights[];
+};
+
+layout (set = 0, binding = 6) readonly buffer Clusters {
+	uint clusters[];
+};
 
-//layout (set = 0, binding = 2) uniform samplerCube samplerIrradiance;
-//layout (set = 0, binding = 3) uniform samplerCube prefilteredMap;
-//layout (set = 0, binding = 4) uniform sampler2D samplerBRDFLUT;
+#define LIGHT_DIRECTIONAL 0
+#define LIGHT_SPOT 2
+
+layout (set = 0, binding = 7) uniform sampler2DArrayShadow shadowMap;
 
 // Material bindings
 
@@ -32,26 +66,221 @@ layout (set = 1, binding = 2) uniform sampler2D aoMap;
 layout (set = 1, binding = 3) uniform sampler2D metallicMap;
 layout (set = 1, binding = 4) uniform sampler2D emissiveMap;
 
+// Material features, fixed per pipeline by vkpbr::MaterialPipelines
+
+layout (constant_id = 0) const bool HAS_BASE_COLOR_TEXTURE = false;
+layout (constant_id = 1) const bool HAS_METALLIC_ROUGHNESS_TEXTURE = false;
+layout (constant_id = 2) const bool HAS_NORMAL_TEXTURE = false;
+layout (constant_id = 3) const bool HAS_OCCLUSION_TEXTURE = false;
+layout (constant_id = 4) const bool HAS_EMISSIVE_TEXTURE = false;
+layout (constant_id = 5) const int ALPHA_MODE = 0;
+layout (constant_id = 6) const int WORKFLOW = 0;
+
+#define ALPHA_MODE_MASK 1
+#define ALPHA_MODE_BLEND 2
+#define WORKFLOW_SPECULAR_GLOSSINESS 1
+
 layout (push_constant) uniform Material {
 	vec4 baseColorFactor;
-	float hasBaseColorTexture;
-	float hasMetallicRoughnessTexture;
-	float hasNormalTexture;
-	float hasOcclusionTexture;
-	float hasEmissiveTexture;
+	vec4 emissiveFactor;
+	vec4 diffuseFactor;
+	vec4 specularFactor;
 	float metallicFactor;
 	float roughnessFactor;
-	float alphaMask;
 	float alphaMaskCutoff;
 } material;
 
 layout (location = 0) out vec4 outColor;
 
 #define PI 3.1415926535897932384626433832795
-#define ALBEDO pow(texture(albedoMap, inUV).rgb, vec3(2.2))
 
+// Irradiance from cosine convolved L2 SH, see vkpbr::SphericalHarmonics
+vec3 irradianceSH(vec3 n)
+{
+	return uboParams.shIrradiance[0].rgb * 0.282095
+		+ uboParams.shIrradiance[1].rgb * 0.488603 * n.y
+		+ uboParams.shIrradiance[2].rgb * 0.488603 * n.z
+		+ uboParams.shIrradiance[3].rgb * 0.488603 * n.x
+		+ uboParams.shIrradiance[4].rgb * 1.092548 * n.x * n.y
+		+ uboParams.shIrradiance[5].rgb * 1.092548 * n.y * n.z
+		+ uboParams.shIrradiance[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+		+ uboParams.shIrradiance[7].rgb * 1.092548 * n.x * n.z
+		+ uboParams.shIrradiance[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+}
+
+// Tangent frame from screen space derivatives, the vertex format has no tangents
+vec3 perturbNormal(vec3 N)
+{
+	vec3 tangentNormal = texture(normalMap, inUV).xyz * 2.0 - 1.0;
+
+	vec3 q1 = dFdx(inWorldPos);
+	vec3 q2 = dFdy(inWorldPos);
+	vec2 st1 = dFdx(inUV);
+	vec2 st2 = dFdy(inUV);
+
+	vec3 T = normalize(q1 * st2.t - q2 * st1.t);
+	vec3 B = -normalize(cross(N, T));
+	return normalize(mat3(T, B, N) * tangentNormal);
+}
+
+// First uint of the record of the cluster holding this fragment
+uint clusterRecord(float viewDepth)
+{
+	float depth = max(viewDepth, 1e-4);
+	uvec3 size = uboParams.clusterGridSize.xyz;
+	uvec2 tile = min(uvec2(gl_FragCoord.xy / uboParams.clusterSlicing.zw), size.xy - 1u);
+	uint slice = uint(clamp(log(depth) * uboParams.clusterSlicing.x + uboParams.clusterSlicing.y, 0.0, float(size.z - 1u)));
+	return ((slice * size.y + tile.y) * size.x + tile.x) * uboParams.clusterGridSize.w;
+}
+
+// Cook-Torrance with GGX distribution and Smith-Schlick visibility, L points towards the light
+vec3 directLight(vec3 L, vec3 N, vec3 V, vec3 F0, vec3 diffuseColor, float roughness)
+{
+	float NdotL = max(dot(N, L), 0.0);
+	if (NdotL <= 0.0) {
+		return vec3(0.0);
+	}
+	vec3 H = normalize(V + L);
+	float NdotV = max(dot(N, V), 1e-4);
+	float NdotH = max(dot(N, H), 0.0);
+	float VdotH = max(dot(V, H), 0.0);
+
+	float alpha = max(roughness * roughness, 1e-3);
+	float alphaSquared = alpha * alpha;
+	float denominator = NdotH * NdotH * (alphaSquared - 1.0) + 1.0;
+	float D = alphaSquared / (PI * denominator * denominator);
+	float k = alpha * 0.5;
+	float G = NdotL / (NdotL * (1.0 - k) + k) * NdotV / (NdotV * (1.0 - k) + k);
+	vec3 F = F0 + (1.0 - F0) * pow(1.0 - VdotH, 5.0);
+
+	vec3 specular = D * G * F / (4.0 * NdotL * NdotV);
+	vec3 diffuse = (1.0 - F) * diffuseColor / PI;
+	return (diffuse + specular) * NdotL;
+}
+
+// KHR_lights_punctual falloff and cone
+vec3 punctualLight(Light light, vec3 N, vec3 V, vec3 F0, vec3 diffuseColor, float roughness)
+{
+	vec3 L;
+	float attenuation = 1.0;
+	if (uint(light.colorType.w) == LIGHT_DIRECTIONAL) {
+		L = -light.directionSpotScale.xyz;
+	} else {
+		vec3 toLight = light.positionRange.xyz - inWorldPos;
+		float distanceSquared = max(dot(toLight, toLight), 1e-4);
+		L = toLight * inversesqrt(distanceSquared);
+		attenuation = 1.0 / distanceSquared;
+		if (light.positionRange.w > 0.0) {
+			float ratio = distanceSquared / (light.positionRange.w * light.positionRange.w);
+			float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+			attenuation *= window * window;
+		}
+		if (uint(light.colorType.w) == LIGHT_SPOT) {
+			float cone = clamp(dot(light.directionSpotScale.xyz, -L) * light.directionSpotScale.w + light.spotOffset.x, 0.0, 1.0);
+			attenuation *= cone * cone;
+		}
+	}
+
+	if (attenuation <= 0.0) {
+		return vec3(0.0);
+	}
+	return directLight(L, N, V, F0, diffuseColor, roughness) * light.colorType.rgb * attenuation;
+}
+
+// Cascade chosen by view depth, 3x3 taps of hardware 2x2 PCF, lit past the last cascade
+float cascadeShadow(float viewDepth)
+{
+	uint cascade = 0;
+	while (cascade < SHADOW_CASCADES && viewDepth > uboParams.cascadeSplits[cascade]) {
+		cascade++;
+	}
+	if (cascade == SHADOW_CASCADES) {
+		return 1.0;
+	}
+
+	vec4 shadowCoord = uboParams.cascadeViewProjection[cascade] * vec4(inWorldPos, 1.0);
+	vec3 coord = shadowCoord.xyz / shadowCoord.w;
+	vec2 uv = coord.xy * 0.5 + 0.5;
+	vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+
+	float lit = 0.0;
+	for (int y = -1; y <= 1; y++) {
+		for (int x = -1; x <= 1; x++) {
+			lit += texture(shadowMap, vec4(uv + vec2(x, y) * texelSize, float(cascade), coord.z));
+		}
+	}
+	return lit / 9.0;
+}
 
 void main()
-{		
-	outColor = vec4(1.0, 0.0f, 1.0f, 1.0f);
-}
\ No newline at end of file
+{
+	vec4 baseColor = WORKFLOW == WORKFLOW_SPECULAR_GLOSSINESS ? material.diffuseFactor : material.baseColorFactor;
+	if (HAS_BASE_COLOR_TEXTURE) {
+		vec4 texel = texture(albedoMap, inUV);
+		baseColor *= vec4(pow(texel.rgb, vec3(2.2)), texel.a);
+	}
+	if (ALPHA_MODE == ALPHA_MODE_MASK && baseColor.a < material.alphaMaskCutoff) {
+		discard;
+	}
+
+	vec3 N = normalize(inNormal);
+	if (HAS_NORMAL_TEXTURE) {
+		N = perturbNormal(N);
+	}
+	vec3 V = normalize(ubo.camPos - inWorldPos);
+	vec3 R = reflect(-V, N);
+	float NdotV = max(dot(N, V), 0.0);
+
+	vec3 F0;
+	vec3 diffuseColor;
+	float roughness;
+	if (WORKFLOW == WORKFLOW_SPECULAR_GLOSSINESS) {
+		// Glossiness factor in specularFactor.a
+		vec4 specularGlossiness = material.specularFactor;
+		if (HAS_METALLIC_ROUGHNESS_TEXTURE) {
+			specularGlossiness *= texture(metallicMap, inUV);
+		}
+		F0 = specularGlossiness.rgb;
+		roughness = 1.0 - specularGlossiness.a;
+		diffuseColor = baseColor.rgb * (1.0 - max(max(F0.r, F0.g), F0.b));
+	} else {
+		float metallic = material.metallicFactor;
+		roughness = material.roughnessFactor;
+		if (HAS_METALLIC_ROUGHNESS_TEXTURE) {
+			vec4 metallicRoughness = texture(metallicMap, inUV);
+			roughness *= metallicRoughness.g;
+			metallic *= metallicRoughness.b;
+		}
+		F0 = mix(vec3(0.04), baseColor.rgb, metallic);
+		diffuseColor = baseColor.rgb * (1.0 - metallic);
+	}
+
+	// Split sum, prefiltered mips go from roughness 0 to 1
+	vec2 brdf = texture(samplerBRDFLUT, vec2(NdotV, roughness)).rg;
+	vec3 prefiltered = textureLod(prefilteredMap, R, roughness * (uboParams.prefilteredCubeMipLevels - 1.0)).rgb;
+	vec3 specular = prefiltered * (F0 * brdf.x + brdf.y);
+	vec3 diffuse = max(irradianceSH(N), vec3(0.0)) * diffuseColor / PI;
+
+	vec3 ambient = diffuse + specular;
+	if (HAS_OCCLUSION_TEXTURE) {
+		ambient *= texture(aoMap, inUV).r;
+	}
+	if (HAS_EMISSIVE_TEXTURE) {
+		ambient += pow(texture(emissiveMap, inUV).rgb, vec3(2.2)) * material.emissiveFactor.rgb;
+	}
+
+	float viewDepth = -(ubo.view * vec4(inWorldPos, 1.0)).z;
+	vec3 direct = directLight(normalize(uboParams.lightDir.xyz), N, V, F0, diffuseColor, roughness) * uboParams.lightColor.rgb;
+	if (any(greaterThan(direct, vec3(0.0)))) {
+		direct *= cascadeShadow(viewDepth);
+	}
+
+	uint record = clusterRecord(viewDepth);
+	uint lightCount = clusters[record];
+	for (uint i = 0; i < lightCount; i++) {
+		direct += punctualLight(lights[clusters[record + 1 + i]], N, V, F0, diffuseColor, roughness);
+	}
+
+	vec3 color = vec3(1.0) - exp(-(ambient + direct) * uboParams.exposure);
+	outColor = vec4(pow(color, vec3(1.0 / uboParams.gamma)), ALPHA_MODE == ALPHA_MODE_BLEND ? baseColor.a : 1.0);
+}
@@ -4,39 +4,37 @@ layout (location = 0) in vec3 inPos;
 layout (location = 1) in vec3 inNormal;
 layout (location = 2) in vec2 inUV;
 
+// Same member order as VKPBR::UBOMatrices
 layout (set = 0, binding = 0) uniform UBO 
 {
-	mat4 projection;
 	mat4 model;
 	mat4 view;
+	mat4 projection;
 	vec3 camPos;
 	float flipUV;
 } ubo;
 
-
-//layout (set = 2, binding = 0) uniform UBONode {
-//	mat4 matrix;
-//} node;
-
+// World matrix of every node, draws pass the index of their node as first instance
+layout (set = 0, binding = 8) readonly buffer Transforms {
+	mat4 nodeMatrices[];
+} transforms;
 
 layout (location = 0) out vec3 outWorldPos;
 layout (location = 1) out vec3 outNormal;
 layout (location = 2) out vec2 outUV;
 
-out gl_PerVertex
-{
-	vec4 gl_Position;
-};
+// Matches depthonly.vert bit for bit
+invariant gl_Position;
 
 void main() 
 {
-	vec4 locPos;
-
-	locPos.y = -locPos.y;
+	mat4 world = transforms.nodeMatrices[gl_InstanceIndex];
+	vec4 locPos = world * vec4(inPos, 1.0);
 	outWorldPos = locPos.xyz / locPos.w;
+	outNormal = normalize(transpose(inverse(mat3(world))) * inNormal);
 	outUV = inUV;
 	if (ubo.flipUV == 1.0) {
 		outUV.t = 1.0 - inUV.t;
 	}
-	gl_Position =  ubo.projection * ubo.view * vec4(outWorldPos, 1.0);
+	gl_Position = ubo.projection * ubo.view * world * vec4(inPos, 1.0);
 }
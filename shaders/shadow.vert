@@ -0,0 +1,15 @@
+#version 450
+
+// Shadow cascade depth from the position stream, see vkpbr::ShadowCascades
+
+layout (push_constant) uniform Cascade {
+	mat4 casterTransform;
+	mat4 nodeMatrix;
+} cascade;
+
+layout (location = 0) in vec3 inPosition;
+
+void main()
+{
+	gl_Position = cascade.casterTransform * cascade.nodeMatrix * vec4(inPosition, 1.0);
+}
@@ -1,10 +1,11 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
+// Same member order as VKPBR::UBOMatrices
 layout(set = 0, binding = 0) uniform UniformBufferObject {
-    mat4 proj;
     mat4 model;
     mat4 view;
+    mat4 proj;
     vec3 camPos;
     float flipUV;
 } ubo;
@@ -15,6 +16,9 @@ layout(location = 2) in vec2 inUV;
 
 layout(location = 0) out vec3 fragColor;
 
+// Matches depthonly.vert bit for bit
+invariant gl_Position;
+
 void main() {
     gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
     fragColor = inNormal;
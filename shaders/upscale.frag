@@ -0,0 +1,19 @@
+#version 450
+
+// Stretches the rendered corner of the scene target over the swapchain image, see vkpbr::ResolutionScaler
+
+layout (set = 0, binding = 0) uniform sampler2D scene;
+
+layout (push_constant) uniform Params {
+	vec2 uvScale;
+	vec2 uvMax;
+} params;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outColor;
+
+void main()
+{
+	outColor = texture(scene, min(inUV * params.uvScale, params.uvMax));
+}
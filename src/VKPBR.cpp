@@ -10,6 +10,8 @@
 VKPBR::VKPBR()
 {
 	windowTitle = "vkPBR renderer";
+	/* Occlusion culling resumes the scene pass and builds the pyramid from its depth */
+	resumableScenePass = occlusionCulling;
 
 	camera.setPerspective(
 		45.0f,
@@ -27,7 +29,22 @@ VKPBR::VKPBR()
 
 VKPBR::~VKPBR()
 {
-
+	if (device) {
+		device.waitIdle();
+		commandRecorder.release();
+		releasePipelines();
+		gpuCuller.release();
+		depthPyramid.release();
+		clusteredLighting.release();
+		shadowCascades.release();
+		resolutionScaler.release();
+		textureStreamer.release();
+		textures.lutBRDF.release();
+		textures.environment.release();
+		textures.prefiltered.release();
+		models.scene.release(device);
+		uploadManager.release();
+	}
 }
 
 auto VKPBR::prepareForRender() -> void
@@ -35,26 +52,106 @@ auto VKPBR::prepareForRender() -> void
 	VulkanRenderer::prepareForRender();
 	loadAssets();
 	setupUniformBuffers();
+	setupShadows();
 	setupDescriptors();
 	setupPipelines();
+	resolutionScaler.init(vulkanDevice.get(), static_cast<uint32_t>(frames.size()), presentPass, pipelineCache);
+	resolutionScaler.setSource(sceneColor.view, sceneExtent.width, sceneExtent.height);
+	setupGPUCulling();
 	setupCommandBuffers();
 
 	preparedToRender = true;
 }
 
+/* Depth pyramid follows the size of the depth buffer, the upscale reads the new scene color */
+auto VKPBR::createFramebuffer() -> void
+{
+	VulkanRenderer::createFramebuffer();
+
+	if (depthPyramid.initialized()) {
+		depthPyramid.release();
+		depthPyramid.init(vulkanDevice.get(), queue, depthStencil.sampledView, sceneExtent.width, sceneExtent.height, samples, pipelineCache);
+		gpuCuller.setDepthPyramid(depthPyramid);
+	}
+	if (resolutionScaler.initialized()) {
+		resolutionScaler.setSource(sceneColor.view, sceneExtent.width, sceneExtent.height);
+	}
+}
+
 auto VKPBR::loadAssets() -> void
 {
 	const auto& resource_path = std::string(RESOURCE_DIR);
 	const auto& test_scene_file = resource_path + "models/DamagedHelmet/glTF-Embedded/DamagedHelmet.gltf";
 
-	textures.empty.loadFromFile(resource_path + "textures/empty.ktx", vk::Format::eR8G8B8A8Unorm, vulkanDevice.get(), queue);
-	models.scene.loadFromFile(test_scene_file, vulkanDevice.get(), queue);
+	uploadManager.init(
+		vulkanDevice.get(),
+		transferQueue,
+		vulkanDevice->queueFamilyIndices.transferFamily.value(),
+		queue,
+		vulkanDevice->queueFamilyIndices.graphicsFamily.value()
+	);
+	textures.empty.loadFromFile(resource_path + "textures/empty.ktx", vk::Format::eR8G8B8A8Unorm, vulkanDevice.get(), &uploadManager);
+	vkpbr::BRDFLut::load(textures.lutBRDF, brdfLutSettings, resource_path + "cache/", vulkanDevice.get(), &uploadManager, &threadPool, queue, pipelineCache);
+	if (!environmentMap.loadFromFile(resource_path + "environments/environment.hdr", threadPool)
+		&& !environmentMap.loadFromFile(resource_path + "environments/environment.ktx", threadPool)) {
+		environmentMap = vkpbr::EnvironmentMap::uniform(glm::vec3(0.5f));
+	}
+	textureStreamer.init(vulkanDevice.get(), &uploadManager, swapchain.imageCount + 1);
+	textureCache.init(&textureStreamer);
+
+	auto load_context = vkpbr::gltf::Model::LoadContext{};
+	load_context.threadPool = &threadPool;
+	load_context.textureStreamer = &textureStreamer;
+	load_context.textureCache = &textureCache;
+	models.scene.loadFromFile(test_scene_file, vulkanDevice.get(), &uploadManager, 1.0f, load_context);
+
+	/* All asset uploads go out in a few batches, first frame is submitted after them on the same queue */
+	uploadManager.flush();
 
 	uboMatrices.flipUV = 1.0f;
 	scale = 1.0f / models.scene.dimensions.radius;
 	camera.setPosition(glm::vec3(-models.scene.dimensions.center.x * scale, -models.scene.dimensions.center.y * scale, camera.position.z));
 }
 
+auto VKPBR::applyEnvironment() -> void
+{
+	const auto irradiance = vkpbr::SphericalHarmonics::irradiance(vkpbr::SphericalHarmonics::project(environmentMap, threadPool));
+	for (size_t i = 0; i < irradiance.size(); i++) {
+		uboParameters.shIrradiance[i] = glm::vec4(irradiance[i], 0.0f);
+	}
+
+	/* Replacing an environment, previous frames may still sample the old cubemaps */
+	if (textures.prefiltered.image) {
+		device.waitIdle();
+		textures.environment.release();
+		textures.prefiltered.release();
+	}
+	textures.environment.loadFromTexture(environmentMap.toCubemap(threadPool), vk::Format::eE5B9G9R9UfloatPack32, vulkanDevice.get(), &uploadManager);
+	vkpbr::SpecularPrefilter::load(
+		textures.prefiltered,
+		environmentMap,
+		specularPrefilterSettings,
+		std::string(RESOURCE_DIR) + "cache/",
+		vulkanDevice.get(),
+		&uploadManager,
+		threadPool
+	);
+	uboParameters.prefilteredMipLevels = static_cast<float>(textures.prefiltered.mipLevels);
+	uploadManager.flush();
+
+	if (descriptorSets.scene) {
+		vk::WriteDescriptorSet write_descriptor_set = {};
+		write_descriptor_set.descriptorCount = 1;
+		write_descriptor_set.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		write_descriptor_set.dstSet = descriptorSets.scene;
+		write_descriptor_set.dstBinding = 3;
+		write_descriptor_set.pImageInfo = &textures.prefiltered.descriptorInfo;
+		device.updateDescriptorSets(1, &write_descriptor_set, 0, nullptr);
+	}
+
+	updateUniformParameters();
+}
+
 auto VKPBR::setupPipelines() -> void
 {
 	/* Fixed state */
@@ -69,6 +166,7 @@ auto VKPBR::setupPipelines() -> void
 	rasterization_state_create_info.lineWidth = 1.0f;
 
 	vk::PipelineMultisampleStateCreateInfo multisample_state_create_info = {};
+	multisample_state_create_info.rasterizationSamples = samples;
 
 	vk::PipelineDepthStencilStateCreateInfo depth_stencil_state_create_info = {};
 	depth_stencil_state_create_info.depthWriteEnable = false;
@@ -97,30 +195,36 @@ auto VKPBR::setupPipelines() -> void
 
 	/* Pipeline layout */
 	const auto set_layouts = std::vector<vk::DescriptorSetLayout> {
-		descriptorSetLayouts.scene
+		descriptorSetLayouts.scene,
+		descriptorSetLayouts.material
 	};
 
+	vk::PushConstantRange push_constant_range = {};
+	push_constant_range.stageFlags = vk::ShaderStageFlagBits::eFragment;
+	push_constant_range.size = sizeof(PushConstantBlockMaterial);
+
 	vk::PipelineLayoutCreateInfo pipeline_layout_create_info = {};
 	pipeline_layout_create_info.setLayoutCount = set_layouts.size();
 	pipeline_layout_create_info.pSetLayouts = set_layouts.data();
+	pipeline_layout_create_info.pushConstantRangeCount = 1;
+	pipeline_layout_create_info.pPushConstantRanges = &push_constant_range;
 	VK_ASSERT(device.createPipelineLayout(&pipeline_layout_create_info, nullptr, &pipelineLayout));
 
-	/* Vertex binding */
-	vk::VertexInputBindingDescription vertex_input_binding = { 0, sizeof(vkpbr::gltf::Model::Vertex), vk::VertexInputRate::eVertex };
-	auto vertex_input_attributes = std::vector<vk::VertexInputAttributeDescription>{
-		{ 0, 0, vk::Format::eR32G32B32Sfloat, offsetof(vkpbr::gltf::Model::Vertex, position) }, // position
-		{ 1, 0, vk::Format::eR32G32B32Sfloat, offsetof(vkpbr::gltf::Model::Vertex, normal) }, // normals
-		{ 2, 0, vk::Format::eR32G32Sfloat, offsetof(vkpbr::gltf::Model::Vertex, uv) }, // UV
-	};
+	/* Depth pre-pass, positions only and no color writes */
+	vk::VertexInputBindingDescription position_input_binding = { 0, sizeof(glm::vec3), vk::VertexInputRate::eVertex };
+	vk::VertexInputAttributeDescription position_input_attribute = { 0, 0, vk::Format::eR32G32B32Sfloat, 0 };
 
 	vk::PipelineVertexInputStateCreateInfo vertex_input_state_create_info = {};
 	vertex_input_state_create_info.vertexBindingDescriptionCount = 1;
-	vertex_input_state_create_info.pVertexBindingDescriptions = &vertex_input_binding;
-	vertex_input_state_create_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(vertex_input_attributes.size());
-	vertex_input_state_create_info.pVertexAttributeDescriptions = vertex_input_attributes.data();
+	vertex_input_state_create_info.pVertexBindingDescriptions = &position_input_binding;
+	vertex_input_state_create_info.vertexAttributeDescriptionCount = 1;
+	vertex_input_state_create_info.pVertexAttributeDescriptions = &position_input_attribute;
 
-	/* Setting up all pipelines */
-	auto shader_stages = std::array<vk::PipelineShaderStageCreateInfo, 2>{};
+	blend_attachment_state.colorWriteMask = vk::ColorComponentFlags();
+	depth_stencil_state_create_info.depthWriteEnable = true;
+	depth_stencil_state_create_info.depthTestEnable = true;
+
+	const auto depth_stage = loadShaderFromFile(device, "depthonly.vert.spv", vk::ShaderStageFlagBits::eVertex);
 
 	vk::GraphicsPipelineCreateInfo graphics_pipeline_create_info = {};
 	graphics_pipeline_create_info.layout = pipelineLayout;
@@ -133,30 +237,105 @@ auto VKPBR::setupPipelines() -> void
 	graphics_pipeline_create_info.pViewportState = &viewport_state_create_info;
 	graphics_pipeline_create_info.pDepthStencilState = &depth_stencil_state_create_info;
 	graphics_pipeline_create_info.pDynamicState = &dynamic_state_create_info;
-	graphics_pipeline_create_info.stageCount = static_cast<uint32_t>(shader_stages.size());
-	graphics_pipeline_create_info.pStages = shader_stages.data();
+	graphics_pipeline_create_info.stageCount = 1;
+	graphics_pipeline_create_info.pStages = &depth_stage;
+	VK_ASSERT(device.createGraphicsPipelines(pipelineCache, 1, &graphics_pipeline_create_info, nullptr, &pipelines.depthOnly));
+	device.destroyShaderModule(depth_stage.module, nullptr);
+
+	/* Generic pipelines are ready now, material permutations replace them as they finish compiling */
+	materialPipelines.init(device, pipelineCache, pipelineLayout, renderPass, samples);
+	requestMaterialPipelines(models.scene);
+}
 
-	/* PBR pipeline*/
-	shader_stages = {
-		loadShaderFromFile(device, "triangle.vert.spv", vk::ShaderStageFlagBits::eVertex),
-		loadShaderFromFile(device, "triangle.frag.spv", vk::ShaderStageFlagBits::eFragment)
-	};
+auto VKPBR::releasePipelines() -> void
+{
+	materialPipelines.release();
+	device.destroyPipeline(pipelines.depthOnly, nullptr);
+	device.destroyPipelineLayout(pipelineLayout, nullptr);
+}
 
-	depth_stencil_state_create_info.depthWriteEnable = true;
-	depth_stencil_state_create_info.depthTestEnable = true;
-	VK_ASSERT(device.createGraphicsPipelines(pipelineCache, 1, &graphics_pipeline_create_info, nullptr, &pipelines.pbr));
+/* Models loaded later call this as well, their draws use the generic pipelines meanwhile */
+auto VKPBR::requestMaterialPipelines(const vkpbr::gltf::Model& model) -> void
+{
+	for (const auto& material : model.materials) {
+		materialPipelines.request(vkpbr::MaterialPipelines::key(material, false));
+		materialPipelines.request(vkpbr::MaterialPipelines::key(material, true));
+	}
+}
+
+/* Pipeline a material is shaded with, opaque ones only test equal after a depth pre-pass */
+auto VKPBR::materialPipeline(const vkpbr::gltf::Material& material) const -> vk::Pipeline
+{
+	return materialPipelines.get(vkpbr::MaterialPipelines::key(material, depthPrepass));
+}
+
+/* Material set and factors, materials sharing both cost nothing */
+auto VKPBR::bindMaterial(vkpbr::CommandState& state, const vkpbr::gltf::Material& material) const -> void
+{
+	PushConstantBlockMaterial push_constants = {};
+	push_constants.baseColorFactor = material.baseColorFactor;
+	push_constants.emissiveFactor = material.emissiveFactor;
+	push_constants.diffuseFactor = material.extension.diffuseFactor;
+	push_constants.specularFactor = glm::vec4(material.extension.specularFactor, 1.0f);
+	push_constants.metallicFactor = material.metallicFactor;
+	push_constants.roughnessFactor = material.roughnessFactor;
+	push_constants.alphaMaskCutoff = material.alphaCutoff;
+
+	state.bindDescriptorSet(1, material.descriptorSets[currentFrame]);
+	state.pushConstants(vk::ShaderStageFlagBits::eFragment, &push_constants, sizeof(PushConstantBlockMaterial));
+}
+
+auto VKPBR::keyPressed(const int key) -> void
+{
+	/* Toggles the depth pre-pass, command buffers pick it up with the next frame */
+	if (key == GLFW_KEY_P) {
+		depthPrepass = !depthPrepass;
+		std::cout << "Depth pre-pass " << (depthPrepass ? "on" : "off") << std::endl;
+	}
+
+	/* Toggles multisampling, render targets and every pipeline depend on the sample count */
+	if (key == GLFW_KEY_M) {
+		settings.multisampling = !settings.multisampling;
+		recreateRenderTargets();
+		releasePipelines();
+		setupPipelines();
+		if (samples == vk::SampleCountFlagBits::e1) {
+			std::cout << "Multisampling off" << std::endl;
+		} else {
+			std::cout << "Multisampling x" << static_cast<uint32_t>(samples) << std::endl;
+		}
+	}
+
+	/* Toggles GPU driven rendering, the culler is set up whenever the device can compact its draws */
+	if (key == GLFW_KEY_G) {
+		if (gpuCuller.compacting()) {
+			gpuDrivenRendering = !gpuDrivenRendering;
+			std::cout << "GPU driven rendering " << (gpuDrivenRendering ? "on" : "off") << std::endl;
+		} else {
+			std::cout << "GPU driven rendering needs VK_KHR_draw_indirect_count and drawIndirectFirstInstance" << std::endl;
+		}
+	}
 
-	/* Clean up */
-	for (auto& shader_stage : shader_stages) {
-		device.destroyShaderModule(shader_stage.module, nullptr);
+	/* Toggles dynamic resolution, the scene renders at the largest scale while it is off */
+	if (key == GLFW_KEY_R) {
+		settings.dynamicResolution = !settings.dynamicResolution;
+		std::cout << "Dynamic resolution " << (settings.dynamicResolution ? "on" : "off") << std::endl;
 	}
 }
 
 auto VKPBR::setupUniformBuffers() -> void
 {
+	/* Every frame in flight writes its own slice, bound through a dynamic offset */
+	const auto alignment = vulkanDevice->deviceProperties.limits.minUniformBufferOffsetAlignment;
+	const auto slice_size = [alignment](const vk::DeviceSize size) {
+		return (size + alignment - 1) & ~(alignment - 1);
+	};
+	const auto frame_count = static_cast<vk::DeviceSize>(frames.size());
+
 	/* Vertex shader scene uniform buffer */
+	uniformBuffers.scene.sliceSize = slice_size(sizeof(uboMatrices));
 	VK_ASSERT(vulkanDevice->createBuffer(
-		sizeof(uboMatrices),
+		uniformBuffers.scene.sliceSize * frame_count,
 		vk::BufferUsageFlagBits::eUniformBuffer,
 		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
 		uniformBuffers.scene.buffer,
@@ -164,18 +343,60 @@ auto VKPBR::setupUniformBuffers() -> void
 	));
 
 
+	/* Fragment shader lighting parameters */
+	uniformBuffers.parameters.sliceSize = slice_size(sizeof(uboParameters));
+	VK_ASSERT(vulkanDevice->createBuffer(
+		uniformBuffers.parameters.sliceSize * frame_count,
+		vk::BufferUsageFlagBits::eUniformBuffer,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		uniformBuffers.parameters.buffer,
+		uniformBuffers.parameters.memory
+	));
+
+
+	/* Vertex shader node transforms, a storage buffer since the node count is not bounded */
+	const auto storage_alignment = vulkanDevice->deviceProperties.limits.minStorageBufferOffsetAlignment;
+	auto node_count = uint32_t{ 1 };
+	for (const auto* node : models.scene.linearNodes) {
+		node_count = std::max(node_count, node->index + 1);
+	}
+	const auto transforms_size = static_cast<vk::DeviceSize>(node_count) * sizeof(glm::mat4);
+	uniformBuffers.transforms.sliceSize = (transforms_size + storage_alignment - 1) & ~(storage_alignment - 1);
+	VK_ASSERT(vulkanDevice->createBuffer(
+		uniformBuffers.transforms.sliceSize * frame_count,
+		vk::BufferUsageFlagBits::eStorageBuffer,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		uniformBuffers.transforms.buffer,
+		uniformBuffers.transforms.memory
+	));
+
+
 	/* Descriptors */
 	uniformBuffers.scene.descriptor.buffer = uniformBuffers.scene.buffer;
 	uniformBuffers.scene.descriptor.offset = 0;
 	uniformBuffers.scene.descriptor.range = sizeof(uboMatrices);
 
+	uniformBuffers.parameters.descriptor.buffer = uniformBuffers.parameters.buffer;
+	uniformBuffers.parameters.descriptor.offset = 0;
+	uniformBuffers.parameters.descriptor.range = sizeof(uboParameters);
+
+	uniformBuffers.transforms.descriptor.buffer = uniformBuffers.transforms.buffer;
+	uniformBuffers.transforms.descriptor.offset = 0;
+	uniformBuffers.transforms.descriptor.range = transforms_size;
+
 	
 	/* Persistent memory mapping */
-	VK_ASSERT(device.mapMemory(uniformBuffers.scene.memory, 0, sizeof(uboMatrices), static_cast<vk::MemoryMapFlagBits>(0), &uniformBuffers.scene.mappedMemory));
+	VK_ASSERT(device.mapMemory(uniformBuffers.scene.memory, 0, VK_WHOLE_SIZE, static_cast<vk::MemoryMapFlagBits>(0), &uniformBuffers.scene.mappedMemory));
+	VK_ASSERT(device.mapMemory(uniformBuffers.parameters.memory, 0, VK_WHOLE_SIZE, static_cast<vk::MemoryMapFlagBits>(0), &uniformBuffers.parameters.mappedMemory));
+	VK_ASSERT(device.mapMemory(uniformBuffers.transforms.memory, 0, VK_WHOLE_SIZE, static_cast<vk::MemoryMapFlagBits>(0), &uniformBuffers.transforms.mappedMemory));
 
-	updateUniformBuffers();
+	/* Punctual lights and cluster records, sliced per frame the same way */
+	clusteredLighting.init(vulkanDevice.get(), static_cast<uint32_t>(frames.size()), pipelineCache);
+
+	applyEnvironment();
 }
 
+/* Writes the slice of the current frame, the GPU may still read the others */
 auto VKPBR::updateUniformBuffers() -> void
 {
 	// Scene
@@ -194,9 +415,23 @@ auto VKPBR::updateUniformBuffers() -> void
 		camera.position.z * cos(glm::radians(camera.rotation.y)) * cos(glm::radians(camera.rotation.x))
 	);
 
-	memcpy(uniformBuffers.scene.mappedMemory, &uboMatrices, sizeof(uboMatrices));
+	auto* scene_slice = static_cast<uint8_t*>(uniformBuffers.scene.mappedMemory) + uniformBuffers.scene.sliceSize * currentFrame;
+	memcpy(scene_slice, &uboMatrices, sizeof(uboMatrices));
+
+	/* Nodes may move every frame, so their matrices live in the frame slice too */
+	auto* transforms_slice = reinterpret_cast<glm::mat4*>(static_cast<uint8_t*>(uniformBuffers.transforms.mappedMemory) + uniformBuffers.transforms.sliceSize * currentFrame);
+	for (auto* node : models.scene.linearNodes) {
+		transforms_slice[node->index] = uboMatrices.model * node->getTransformationMatrix();
+	}
+
+	updateLights();
+	updateShadows();
+
+	auto* parameters_slice = static_cast<uint8_t*>(uniformBuffers.parameters.mappedMemory) + uniformBuffers.parameters.sliceSize * currentFrame;
+	memcpy(parameters_slice, &uboParameters, sizeof(uboParameters));
 }
 
+/* CPU side only, reaches the GPU with the next updateUniformBuffers() of every frame slice */
 auto VKPBR::updateUniformParameters() -> void
 {
 	uboParameters.lightDirection = glm::vec4(
@@ -204,24 +439,119 @@ auto VKPBR::updateUniformParameters() -> void
 		sin(glm::radians(lightSource.rotation.y)),
 		cos(glm::radians(lightSource.rotation.x)) * cos(glm::radians(lightSource.rotation.y)),
 		0.0f);
-	memcpy(uniformBuffers.parameters.mappedMemory, &uboParameters, sizeof(uboParameters));
+	uboParameters.lightColor = glm::vec4(lightSource.color, 1.0f);
+}
+
+/* Places the glTF lights with their nodes, grid parameters reach shading with the parameters slice */
+auto VKPBR::updateLights() -> void
+{
+	frameLights.clear();
+	for (auto* node : models.scene.linearNodes) {
+		if (node->light < 0 || node->light >= static_cast<int32_t>(models.scene.lights.size())) {
+			continue;
+		}
+		const auto& light = models.scene.lights[node->light];
+		const auto world_matrix = uboMatrices.model * node->getTransformationMatrix();
+
+		auto frame_light = vkpbr::ClusteredLighting::Light{};
+		frame_light.type = light.type == vkpbr::gltf::Light::Type::directional ? vkpbr::ClusteredLighting::Type::directional
+			: light.type == vkpbr::gltf::Light::Type::spot ? vkpbr::ClusteredLighting::Type::spot
+			: vkpbr::ClusteredLighting::Type::point;
+		frame_light.position = glm::vec3(world_matrix[3]);
+		frame_light.direction = -glm::vec3(world_matrix[2]);
+		frame_light.color = light.color * light.intensity;
+		frame_light.range = light.range;
+		frame_light.innerConeAngle = light.innerConeAngle;
+		frame_light.outerConeAngle = light.outerConeAngle;
+		frameLights.push_back(frame_light);
+	}
+
+	/* Cluster tiles are in pixels of the scaled scene */
+	const auto extent = renderExtent();
+	uboParameters.clusterGrid = clusteredLighting.update(
+		currentFrame,
+		frameLights,
+		camera.matrices.view,
+		camera.matrices.perspective,
+		camera.getNearPlane(),
+		camera.getFarPlane(),
+		extent.width,
+		extent.height
+	);
+}
+
+/* Opaque primitives cast shadows, masked and blended ones would need their textures like in the pre-pass */
+auto VKPBR::setupShadows() -> void
+{
+	shadowCascades.init(vulkanDevice.get(), pipelineCache);
+
+	auto casters = std::vector<vkpbr::ShadowCascades::Caster>{};
+	for (auto* node : models.scene.linearNodes) {
+		if (!node->mesh) {
+			continue;
+		}
+
+		const auto node_matrix = node->getTransformationMatrix();
+		for (auto* primitive : node->mesh->primitives) {
+			if (primitive->material.alphaMode != vkpbr::gltf::Material::AlphaMode::opaque) {
+				continue;
+			}
+
+			auto caster = vkpbr::ShadowCascades::Caster{};
+			vkpbr::FrustumCuller::transformBounds(node_matrix, primitive->dimensions.min, primitive->dimensions.max, caster.center, caster.extent);
+			caster.nodeMatrix = node_matrix;
+			caster.firstIndex = primitive->firstIndex;
+			caster.indexCount = primitive->indexCount;
+			casters.push_back(caster);
+		}
+	}
+	shadowCascades.setCasters(std::move(casters));
+}
+
+/* Cascades follow the camera, the scene sphere bounds them in depth */
+auto VKPBR::updateShadows() -> void
+{
+	const auto scene_center = glm::vec3(uboMatrices.model * glm::vec4(models.scene.dimensions.center, 1.0f));
+	uboParameters.shadows = shadowCascades.update(
+		camera.matrices.view,
+		camera.matrices.perspective,
+		camera.getNearPlane(),
+		camera.getFarPlane(),
+		uboMatrices.model,
+		glm::vec3(uboParameters.lightDirection),
+		scene_center,
+		models.scene.dimensions.radius * scale,
+		threadPool
+	);
 }
 
 auto VKPBR::setupDescriptors() -> void
 {
+	const auto material_count = static_cast<uint32_t>(models.scene.materials.size());
+	const auto material_set_count = material_count * static_cast<uint32_t>(frames.size());
+
 	auto pool_sizes = std::vector<vk::DescriptorPoolSize> {
-		{ vk::DescriptorType::eUniformBuffer, 1 },
+		{ vk::DescriptorType::eUniformBufferDynamic, 2 },
+		{ vk::DescriptorType::eStorageBufferDynamic, 3 },
+		{ vk::DescriptorType::eCombinedImageSampler, material_set_count * 5 + 3 },
 	};
 	vk::DescriptorPoolCreateInfo descriptor_pool_create_info = {};
-	descriptor_pool_create_info.poolSizeCount = 1;
+	descriptor_pool_create_info.poolSizeCount = static_cast<uint32_t>(pool_sizes.size());
 	descriptor_pool_create_info.pPoolSizes = pool_sizes.data();
-	descriptor_pool_create_info.maxSets = static_cast<uint32_t>(swapchain.images.size()); //possibly +2
+	descriptor_pool_create_info.maxSets = static_cast<uint32_t>(swapchain.images.size()) + material_set_count; //possibly +2
 	VK_ASSERT(device.createDescriptorPool(&descriptor_pool_create_info, nullptr, &descriptorPool));
 
-	// Scene (matrices)
+	// Scene (matrices, lighting parameters, prefiltered environment, BRDF LUT, punctual lights, cluster records, shadow cascades, node transforms)
 	{
 		auto set_layout_bindings = std::vector<vk::DescriptorSetLayoutBinding> {
-			{ 0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex, nullptr }
+			{ 0, vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, nullptr },
+			{ 1, vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eFragment, nullptr },
+			{ 3, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment, nullptr },
+			{ 4, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment, nullptr },
+			{ 5, vk::DescriptorType::eStorageBufferDynamic, 1, vk::ShaderStageFlagBits::eFragment, nullptr },
+			{ 6, vk::DescriptorType::eStorageBufferDynamic, 1, vk::ShaderStageFlagBits::eFragment, nullptr },
+			{ 7, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment, nullptr },
+			{ 8, vk::DescriptorType::eStorageBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex, nullptr }
 		};
 		vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
 		descriptor_set_layout_create_info.pBindings = set_layout_bindings.data();
@@ -234,23 +564,358 @@ auto VKPBR::setupDescriptors() -> void
 		descriptor_set_allocate_info.descriptorSetCount = 1;
 		VK_ASSERT(device.allocateDescriptorSets(&descriptor_set_allocate_info, &descriptorSets.scene));
 
-		auto write_descriptor_sets = std::array<vk::WriteDescriptorSet, 1> {};
+		const auto light_descriptor = clusteredLighting.lightDescriptor();
+		const auto cluster_descriptor = clusteredLighting.clusterDescriptor();
+		auto write_descriptor_sets = std::array<vk::WriteDescriptorSet, 8> {};
 
 		write_descriptor_sets[0].descriptorCount = 1;
-		write_descriptor_sets[0].descriptorType = vk::DescriptorType::eUniformBuffer;
+		write_descriptor_sets[0].descriptorType = vk::DescriptorType::eUniformBufferDynamic;
 		write_descriptor_sets[0].dstSet = descriptorSets.scene;
 		write_descriptor_sets[0].dstBinding = 0;
 		write_descriptor_sets[0].pBufferInfo = &uniformBuffers.scene.descriptor;
 
+		write_descriptor_sets[1].descriptorCount = 1;
+		write_descriptor_sets[1].descriptorType = vk::DescriptorType::eUniformBufferDynamic;
+		write_descriptor_sets[1].dstSet = descriptorSets.scene;
+		write_descriptor_sets[1].dstBinding = 1;
+		write_descriptor_sets[1].pBufferInfo = &uniformBuffers.parameters.descriptor;
+
+		write_descriptor_sets[2].descriptorCount = 1;
+		write_descriptor_sets[2].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		write_descriptor_sets[2].dstSet = descriptorSets.scene;
+		write_descriptor_sets[2].dstBinding = 4;
+		write_descriptor_sets[2].pImageInfo = &textures.lutBRDF.descriptorInfo;
+
+		write_descriptor_sets[3].descriptorCount = 1;
+		write_descriptor_sets[3].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		write_descriptor_sets[3].dstSet = descriptorSets.scene;
+		write_descriptor_sets[3].dstBinding = 3;
+		write_descriptor_sets[3].pImageInfo = &textures.prefiltered.descriptorInfo;
+
+		write_descriptor_sets[4].descriptorCount = 1;
+		write_descriptor_sets[4].descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+		write_descriptor_sets[4].dstSet = descriptorSets.scene;
+		write_descriptor_sets[4].dstBinding = 5;
+		write_descriptor_sets[4].pBufferInfo = &light_descriptor;
+
+		write_descriptor_sets[5].descriptorCount = 1;
+		write_descriptor_sets[5].descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+		write_descriptor_sets[5].dstSet = descriptorSets.scene;
+		write_descriptor_sets[5].dstBinding = 6;
+		write_descriptor_sets[5].pBufferInfo = &cluster_descriptor;
+
+		write_descriptor_sets[6].descriptorCount = 1;
+		write_descriptor_sets[6].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		write_descriptor_sets[6].dstSet = descriptorSets.scene;
+		write_descriptor_sets[6].dstBinding = 7;
+		write_descriptor_sets[6].pImageInfo = &shadowCascades.descriptorInfo;
+
+		write_descriptor_sets[7].descriptorCount = 1;
+		write_descriptor_sets[7].descriptorType = vk::DescriptorType::eStorageBufferDynamic;
+		write_descriptor_sets[7].dstSet = descriptorSets.scene;
+		write_descriptor_sets[7].dstBinding = 8;
+		write_descriptor_sets[7].pBufferInfo = &uniformBuffers.transforms.descriptor;
+
 		device.updateDescriptorSets(static_cast<uint32_t>(write_descriptor_sets.size()), write_descriptor_sets.data(), 0, nullptr);
 	}
+
+	// Materials (albedo, normal, ao, metallic, emissive)
+	{
+		auto set_layout_bindings = std::vector<vk::DescriptorSetLayoutBinding>{};
+		for (uint32_t binding = 0; binding < 5; binding++) {
+			set_layout_bindings.emplace_back(binding, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment, nullptr);
+		}
+		vk::DescriptorSetLayoutCreateInfo descriptor_set_layout_create_info = {};
+		descriptor_set_layout_create_info.pBindings = set_layout_bindings.data();
+		descriptor_set_layout_create_info.bindingCount = static_cast<uint32_t>(set_layout_bindings.size());
+		VK_ASSERT(device.createDescriptorSetLayout(&descriptor_set_layout_create_info, nullptr, &descriptorSetLayouts.material));
+
+		const auto set_layouts = std::vector<vk::DescriptorSetLayout>(frames.size(), descriptorSetLayouts.material);
+		for (auto& material : models.scene.materials) {
+			vk::DescriptorSetAllocateInfo descriptor_set_allocate_info = {};
+			descriptor_set_allocate_info.descriptorPool = descriptorPool;
+			descriptor_set_allocate_info.pSetLayouts = set_layouts.data();
+			descriptor_set_allocate_info.descriptorSetCount = static_cast<uint32_t>(set_layouts.size());
+			material.descriptorSets.resize(set_layouts.size());
+			VK_ASSERT(device.allocateDescriptorSets(&descriptor_set_allocate_info, material.descriptorSets.data()));
+
+			for (const auto descriptor_set : material.descriptorSets) {
+				writeMaterialDescriptorSet(material, descriptor_set);
+			}
+			material.staleDescriptorSets = 0;
+		}
+	}
+}
+
+auto VKPBR::writeMaterialDescriptorSet(const vkpbr::gltf::Material& material, const vk::DescriptorSet descriptor_set) -> void
+{
+	/* Specular glossiness materials use the base color and metallic roughness slots */
+	const auto specular_glossiness = material.pbrWorkflows.specularGlossiness;
+	const auto* base_color_texture = specular_glossiness ? material.extension.diffuseTexture : material.baseColorTexture;
+	const auto* physical_texture = specular_glossiness ? material.extension.specularGlossinessTexture : material.metallicRoughnessTexture;
+
+	const auto image_descriptors = std::array<vk::DescriptorImageInfo, 5> {
+		base_color_texture ? base_color_texture->descriptorInfo : textures.empty.descriptorInfo,
+		material.normalTexture ? material.normalTexture->descriptorInfo : textures.empty.descriptorInfo,
+		material.occlusionTexture ? material.occlusionTexture->descriptorInfo : textures.empty.descriptorInfo,
+		physical_texture ? physical_texture->descriptorInfo : textures.empty.descriptorInfo,
+		material.emissiveTexture ? material.emissiveTexture->descriptorInfo : textures.empty.descriptorInfo
+	};
+
+	auto write_descriptor_sets = std::array<vk::WriteDescriptorSet, 5> {};
+	for (uint32_t i = 0; i < static_cast<uint32_t>(write_descriptor_sets.size()); i++) {
+		write_descriptor_sets[i].descriptorCount = 1;
+		write_descriptor_sets[i].descriptorType = vk::DescriptorType::eCombinedImageSampler;
+		write_descriptor_sets[i].dstSet = descriptor_set;
+		write_descriptor_sets[i].dstBinding = i;
+		write_descriptor_sets[i].pImageInfo = &image_descriptors[i];
+	}
+
+	device.updateDescriptorSets(static_cast<uint32_t>(write_descriptor_sets.size()), write_descriptor_sets.data(), 0, nullptr);
 }
 
+auto VKPBR::updateTextureStreaming() -> void
+{
+	/* Screen space size of every primitive drives the mip level its textures need */
+	const auto view_model = camera.matrices.view * uboMatrices.model;
+	const auto pixels_per_unit = std::abs(camera.matrices.perspective[1][1]) * 0.5f * static_cast<float>(renderExtent().height);
+
+	for (auto* node : models.scene.linearNodes) {
+		if (!node->mesh) {
+			continue;
+		}
+
+		const auto node_matrix = view_model * node->getTransformationMatrix();
+		const auto node_scale = std::max({
+			glm::length(glm::vec3(node_matrix[0])),
+			glm::length(glm::vec3(node_matrix[1])),
+			glm::length(glm::vec3(node_matrix[2]))
+		});
+
+		for (auto* primitive : node->mesh->primitives) {
+			const auto center = glm::vec3(node_matrix * glm::vec4(primitive->dimensions.center, 1.0f));
+			const auto radius = primitive->dimensions.radius * node_scale;
+			const auto distance = -center.z;
+
+			/* Behind the camera */
+			if (distance + radius < 0.0f) {
+				continue;
+			}
+
+			const auto projected_pixels = distance > radius
+				? (2.0f * radius / distance) * pixels_per_unit
+				: std::numeric_limits<float>::max();
+			requestMaterialMips(primitive->material, projected_pixels);
+		}
+	}
+
+	const auto changed_textures = textureStreamer.update();
+	if (changed_textures.empty()) {
+		return;
+	}
+
+	/*
+	Sets of frames in flight can not change, every slot rewrites its own once its fence signaled.
+	Old residencies are retired for more frames than there are slots, so they outlive the stale sets.
+	*/
+	const auto all_slots = (1u << frames.size()) - 1;
+	for (auto& material : models.scene.materials) {
+		const auto uses_changed_texture = std::any_of(changed_textures.begin(), changed_textures.end(), [&material](const vkpbr::TextureGLTF* texture) {
+			return texture == material.baseColorTexture
+				|| texture == material.normalTexture
+				|| texture == material.occlusionTexture
+				|| texture == material.metallicRoughnessTexture
+				|| texture == material.emissiveTexture
+				|| texture == material.extension.diffuseTexture
+				|| texture == material.extension.specularGlossinessTexture;
+		});
+		if (uses_changed_texture) {
+			material.staleDescriptorSets = all_slots;
+		}
+	}
+}
+
+auto VKPBR::updateMaterialDescriptorSets() -> void
+{
+	const auto slot = 1u << currentFrame;
+	for (auto& material : models.scene.materials) {
+		if (material.staleDescriptorSets & slot) {
+			writeMaterialDescriptorSet(material, material.descriptorSets[currentFrame]);
+			material.staleDescriptorSets &= ~slot;
+		}
+	}
+}
+
+auto VKPBR::requestMaterialMips(const vkpbr::gltf::Material& material, const float projected_pixels) -> void
+{
+	const auto textures_used = std::array<const vkpbr::TextureGLTF*, 7> {
+		material.baseColorTexture,
+		material.metallicRoughnessTexture,
+		material.normalTexture,
+		material.occlusionTexture,
+		material.emissiveTexture,
+		material.extension.diffuseTexture,
+		material.extension.specularGlossinessTexture
+	};
+
+	for (const auto* texture : textures_used) {
+		if (texture) {
+			textureStreamer.requestMip(texture, vkpbr::TextureStreamer::requiredMip(std::max(texture->width, texture->height), projected_pixels));
+		}
+	}
+}
+
+/* Recording happens every frame, only the per frame secondary pools live across frames */
 auto VKPBR::setupCommandBuffers() -> void
 {
-	vk::CommandBufferBeginInfo begin_info = {};
+	commandRecorder.release();
+	/* Two recording sets per frame, shading and depth pre-pass */
+	commandRecorder.init(device, vulkanDevice->queueFamilyIndices.graphicsFamily.value(), &threadPool, static_cast<uint32_t>(frames.size()) * 2);
+}
+
+/*
+Visible draws of this frame in submission order, bounds are culled against the camera frustum
+in SIMD batches and the survivors are radix sorted by state and depth (see DrawSortKey)
+*/
+auto VKPBR::buildDrawList(const bool include_opaque) -> void
+{
+	drawCandidates.clear();
+	drawCandidateKeys.clear();
+	frustumCuller.clear();
+
+	const auto& materials = models.scene.materials;
+	for (auto* node : models.scene.linearNodes) {
+		if (!node->mesh) {
+			continue;
+		}
+
+		const auto world_matrix = uboMatrices.model * node->getTransformationMatrix();
+		for (auto* primitive : node->mesh->primitives) {
+			const auto blended = primitive->material.alphaMode == vkpbr::gltf::Material::AlphaMode::blend;
+			if (!blended && !include_opaque) {
+				continue;
+			}
+
+			glm::vec3 center, extent;
+			vkpbr::FrustumCuller::transformBounds(world_matrix, primitive->dimensions.min, primitive->dimensions.max, center, extent);
+			frustumCuller.addBox(center, extent);
+
+			const auto view_depth = -(camera.matrices.view * glm::vec4(center, 1.0f)).z;
+			const auto depth = vkpbr::DrawSortKey::quantizeDepth(view_depth, camera.getFarPlane());
+			const auto material = static_cast<uint32_t>(&primitive->material - materials.data());
+
+			/* All primitives share the vertex and index buffers of the scene model, masked ones sort after opaque */
+			const auto masked = primitive->material.alphaMode == vkpbr::gltf::Material::AlphaMode::mask;
+			drawCandidateKeys.push_back(blended
+				? vkpbr::DrawSortKey::blended(2, material, depth)
+				: vkpbr::DrawSortKey::opaque(masked ? 1 : 0, material, 0, depth));
+			drawCandidates.push_back({ node, primitive, materialPipeline(primitive->material) });
+		}
+	}
+
+	const auto frustum = vkpbr::FrustumCuller::extractPlanes(camera.matrices.perspective * camera.matrices.view);
+	const auto& visible = frustumCuller.cull(frustum, threadPool);
+
+	drawKeys.clear();
+	drawOrder.clear();
+	for (uint32_t i = 0; i < static_cast<uint32_t>(drawCandidates.size()); i++) {
+		if (visible[i]) {
+			drawKeys.push_back(drawCandidateKeys[i]);
+			drawOrder.push_back(i);
+		}
+	}
+	radixSort.sort(drawKeys, drawOrder, threadPool);
+
+	drawList.clear();
+	for (const auto index : drawOrder) {
+		drawList.push_back(drawCandidates[index]);
+	}
+}
 
-	const auto clear_values = std::vector<vk::ClearValue> {
+/*
+Static opaque draw set of the scene for the GPU culler, bounds stay in model space
+(node transforms applied) and are culled against model space frustum planes
+*/
+auto VKPBR::setupGPUCulling() -> void
+{
+	gpuCuller.release();
+	/* Without a draw count every culled slot would still be drawn with no instances, the CPU path draws less */
+	if (!vulkanDevice->extensionSupported(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) {
+		if (gpuDrivenRendering) {
+			std::cerr << "[WARNING] VK_KHR_draw_indirect_count is not supported, falling back to CPU culling" << std::endl;
+		}
+		gpuDrivenRendering = false;
+		return;
+	}
+	/* Indirect commands carry the node index as first instance, the vertex shaders fetch the node transform with it */
+	if (!vulkanDevice->enabledFeatures.drawIndirectFirstInstance) {
+		if (gpuDrivenRendering) {
+			std::cerr << "[WARNING] drawIndirectFirstInstance is not supported, falling back to CPU culling" << std::endl;
+		}
+		gpuDrivenRendering = false;
+		return;
+	}
+	gpuCuller.init(vulkanDevice.get(), static_cast<uint32_t>(frames.size()), pipelineCache);
+
+	/* Always bound by the culling pipeline, only read when occlusion culling is on */
+	depthPyramid.release();
+	depthPyramid.init(vulkanDevice.get(), queue, depthStencil.sampledView, sceneExtent.width, sceneExtent.height, samples, pipelineCache);
+	gpuCuller.setDepthPyramid(depthPyramid);
+
+	auto draws = std::vector<vkpbr::GPUCuller::Draw>{};
+	for (auto* node : models.scene.linearNodes) {
+		if (!node->mesh) {
+			continue;
+		}
+
+		const auto node_matrix = node->getTransformationMatrix();
+		for (auto* primitive : node->mesh->primitives) {
+			/* Blended primitives need their own pipeline and back to front order */
+			if (primitive->material.alphaMode == vkpbr::gltf::Material::AlphaMode::blend) {
+				continue;
+			}
+
+			auto draw = vkpbr::GPUCuller::Draw{};
+			vkpbr::FrustumCuller::transformBounds(node_matrix, primitive->dimensions.min, primitive->dimensions.max, draw.center, draw.extent);
+			draw.firstIndex = primitive->firstIndex;
+			draw.indexCount = primitive->indexCount;
+			draw.material = static_cast<uint32_t>(&primitive->material - models.scene.materials.data());
+			draw.node = node->index;
+			draws.push_back(draw);
+		}
+	}
+
+	gpuCuller.build(std::move(draws), &uploadManager);
+	uploadManager.flush();
+}
+
+auto VKPBR::recordCommandBuffer() -> void
+{
+	/* Draw list is split between pool workers, each one records its own secondary buffer */
+	const std::vector<vk::CommandBuffer>* secondary_buffers = nullptr;
+	const std::vector<vk::CommandBuffer>* depth_secondary_buffers = nullptr;
+	buildDrawList(!gpuDrivenRendering);
+	if (!gpuDrivenRendering) {
+		vk::CommandBufferInheritanceInfo inheritance_info = {};
+		inheritance_info.renderPass = renderPass;
+		inheritance_info.subpass = 0;
+		inheritance_info.framebuffer = sceneFramebuffer;
+
+		if (depthPrepass) {
+			depth_secondary_buffers = &commandRecorder.record(currentFrame * 2 + 1, drawList.size(), 256, inheritance_info,
+				[this](const vk::CommandBuffer cmd_buffer, const size_t first, const size_t last) {
+					recordDepthDraws(cmd_buffer, first, last);
+				}
+			);
+		}
+		secondary_buffers = &commandRecorder.record(currentFrame * 2, drawList.size(), 256, inheritance_info,
+			[this](const vk::CommandBuffer cmd_buffer, const size_t first, const size_t last) {
+				recordDraws(cmd_buffer, first, last);
+			}
+		);
+	}
+
+	const auto clear_values = std::array<vk::ClearValue, 2> {
 		vk::ClearColorValue(
 			std::array<float,4>{0.2f, 0.3f, 0.3f, 1.0f}
 		),
@@ -259,78 +924,193 @@ auto VKPBR::setupCommandBuffers() -> void
 
 	vk::RenderPassBeginInfo renderpass_begin_info = {};
 	renderpass_begin_info.renderPass = renderPass;
+	renderpass_begin_info.framebuffer = sceneFramebuffer;
 	renderpass_begin_info.renderArea.offset.x = 0;
 	renderpass_begin_info.renderArea.offset.y = 0;
-	renderpass_begin_info.renderArea.extent.width = settings.width;
-	renderpass_begin_info.renderArea.extent.height = settings.height;
+	renderpass_begin_info.renderArea.extent = renderExtent();
 	renderpass_begin_info.clearValueCount = clear_values.size();
 	renderpass_begin_info.pClearValues = clear_values.data();
 
-	for (size_t i = 0; i < drawCalls.size(); ++i) {
-		renderpass_begin_info.framebuffer = framebuffers[i];
-
-		VK_ASSERT(drawCalls[i].begin(&begin_info));
-		drawCalls[i].beginRenderPass(&renderpass_begin_info, vk::SubpassContents::eInline);
+	vk::CommandBufferBeginInfo begin_info = {};
+	begin_info.flags = vk::CommandBufferUsageFlagBits::eOneTimeSubmit;
+
+	auto& cmd_buffer = frames[currentFrame].cmdBuffer;
+	VK_ASSERT(cmd_buffer.begin(&begin_info));
+	resolutionScaler.recordBegin(cmd_buffer, currentFrame, renderScale);
+	clusteredLighting.recordCull(cmd_buffer, currentFrame);
+	shadowCascades.recordRender(cmd_buffer, models.scene.positions.buffer, models.scene.indices.buffer);
+	if (gpuDrivenRendering && occlusionCulling) {
+		gpuCuller.updateView(currentFrame, camera.matrices.perspective * camera.matrices.view * uboMatrices.model);
+
+		/* Whatever was visible last frame, its depth feeds the pyramid */
+		gpuCuller.recordCull(cmd_buffer, currentFrame, vkpbr::GPUCuller::Pass::previouslyVisible);
+		cmd_buffer.beginRenderPass(&renderpass_begin_info, vk::SubpassContents::eInline);
+		recordIndirectDraws(cmd_buffer, vkpbr::GPUCuller::Pass::previouslyVisible);
+		cmd_buffer.endRenderPass();
+
+		recordDepthPyramid(cmd_buffer);
+
+		/* Newly visible draws on top of the first pass */
+		gpuCuller.recordCull(cmd_buffer, currentFrame, vkpbr::GPUCuller::Pass::occlusion);
+		renderpass_begin_info.renderPass = renderPassResume;
+		renderpass_begin_info.clearValueCount = 0;
+		renderpass_begin_info.pClearValues = nullptr;
+		cmd_buffer.beginRenderPass(&renderpass_begin_info, vk::SubpassContents::eInline);
+		recordIndirectDraws(cmd_buffer, vkpbr::GPUCuller::Pass::occlusion);
+		recordDraws(cmd_buffer, 0, drawList.size());
+	} else if (gpuDrivenRendering) {
+		gpuCuller.updateView(currentFrame, camera.matrices.perspective * camera.matrices.view * uboMatrices.model);
+		gpuCuller.recordCull(cmd_buffer, currentFrame, vkpbr::GPUCuller::Pass::frustum);
+
+		cmd_buffer.beginRenderPass(&renderpass_begin_info, vk::SubpassContents::eInline);
+		recordIndirectDraws(cmd_buffer, vkpbr::GPUCuller::Pass::frustum);
+		recordDraws(cmd_buffer, 0, drawList.size());
+	} else {
+		cmd_buffer.beginRenderPass(&renderpass_begin_info, vk::SubpassContents::eSecondaryCommandBuffers);
+		if (depth_secondary_buffers && !depth_secondary_buffers->empty()) {
+			cmd_buffer.executeCommands(static_cast<uint32_t>(depth_secondary_buffers->size()), depth_secondary_buffers->data());
+		}
+		if (!secondary_buffers->empty()) {
+			cmd_buffer.executeCommands(static_cast<uint32_t>(secondary_buffers->size()), secondary_buffers->data());
+		}
+	}
+	cmd_buffer.endRenderPass();
+
+	/* Rendered corner of the scene target stretched over the swapchain image */
+	vk::RenderPassBeginInfo present_begin_info = {};
+	present_begin_info.renderPass = presentPass;
+	present_begin_info.framebuffer = framebuffers[currentBuffer];
+	present_begin_info.renderArea.extent = vk::Extent2D{ settings.width, settings.height };
+	cmd_buffer.beginRenderPass(&present_begin_info, vk::SubpassContents::eInline);
+	resolutionScaler.recordUpscale(cmd_buffer, renderpass_begin_info.renderArea.extent, present_begin_info.renderArea.extent);
+	cmd_buffer.endRenderPass();
+
+	resolutionScaler.recordEnd(cmd_buffer, currentFrame);
+	cmd_buffer.end();
+}
 
-		vk::Viewport viewport = {};
-		viewport.width = static_cast<float>(settings.width);
-		viewport.height = static_cast<float>(settings.height);
-		viewport.minDepth = 0.0f;
-		viewport.maxDepth = 1.0f;
-		drawCalls[i].setViewport(0, 1, &viewport);
+/* Viewport, vertex stream, the shared index buffer and the scene set every draw path starts with */
+auto VKPBR::bindSceneState(vkpbr::CommandState& state, const vk::Buffer vertex_buffer) const -> void
+{
+	const auto extent = renderExtent();
+	state.setViewport(extent.width, extent.height);
+	state.bindVertexBuffer(vertex_buffer);
+	state.bindIndexBuffer(models.scene.indices.buffer, vk::IndexType::eUint32);
+
+	/* Uniform, light and transform slices of the frame being recorded, in binding order */
+	const auto dynamic_offsets = std::array<uint32_t, 5>{
+		static_cast<uint32_t>(uniformBuffers.scene.sliceSize * currentFrame),
+		static_cast<uint32_t>(uniformBuffers.parameters.sliceSize * currentFrame),
+		clusteredLighting.lightOffset(currentFrame),
+		clusteredLighting.clusterOffset(currentFrame),
+		static_cast<uint32_t>(uniformBuffers.transforms.sliceSize * currentFrame)
+	};
+	state.bindDescriptorSet(0, descriptorSets.scene, dynamic_offsets.data(), static_cast<uint32_t>(dynamic_offsets.size()));
+}
 
-		vk::Rect2D scissors = {};
-		scissors.extent = vk::Extent2D{ settings.width, settings.height };
-		drawCalls[i].setScissor(0, 1, &scissors);
+/* Depth only pipeline on the position stream, the scene set is the same as for shading */
+auto VKPBR::bindDepthState(vkpbr::CommandState& state) const -> void
+{
+	bindSceneState(state, models.scene.positions.buffer);
+	state.bindPipeline(pipelines.depthOnly);
+}
 
-		vk::DeviceSize offsets[1] = { 0 };
+/* Pre-pass part of recordDraws(), only fully opaque draws lay down depth */
+auto VKPBR::recordDepthDraws(const vk::CommandBuffer cmd_buffer, const size_t first, const size_t last) const -> void
+{
+	if (first == last) {
+		return;
+	}
+	auto state = vkpbr::CommandState(cmd_buffer, pipelineLayout);
+	bindDepthState(state);
 
-		drawCalls[i].bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.pbr);
+	for (auto i = first; i < last; i++) {
+		const auto* primitive = drawList[i].primitive;
+		if (primitive->material.alphaMode == vkpbr::gltf::Material::AlphaMode::opaque) {
+			cmd_buffer.drawIndexed(primitive->indexCount, 1, primitive->firstIndex, 0, drawList[i].node->index);
+		}
+	}
+}
 
-		auto& model = models.scene;
+/*
+Called from pool workers, must not touch anything but cmd_buffer and read only scene state
+The list is state sorted, the state tracker drops whatever a draw would bind again.
+*/
+auto VKPBR::recordDraws(const vk::CommandBuffer cmd_buffer, const size_t first, const size_t last) const -> void
+{
+	if (first == last) {
+		return;
+	}
+	auto state = vkpbr::CommandState(cmd_buffer, pipelineLayout);
+	bindSceneState(state, models.scene.vertices.buffer);
 
-		drawCalls[i].bindVertexBuffers(0, 1, &model.vertices.buffer, offsets);
-		drawCalls[i].bindIndexBuffer(model.indices.buffer, 0, vk::IndexType::eUint32);
-		
-		/*
-		for (auto node : model.nodes) {
-			renderModelNode(node, drawCalls[i], vkpbr::gltf::Material::AlphaMode::opaque);
-		}
-		*/
+	for (auto i = first; i < last; i++) {
+		const auto& draw = drawList[i];
+		const auto* primitive = draw.primitive;
 
-		drawCalls[i].endRenderPass();
-		drawCalls[i].end();
+		state.bindPipeline(draw.pipeline);
+		bindMaterial(state, primitive->material);
+		cmd_buffer.drawIndexed(primitive->indexCount, 1, primitive->firstIndex, 0, draw.node->index);
 	}
 }
 
-auto VKPBR::renderModelNode(vkpbr::gltf::Node* node, vk::CommandBuffer cmd_buffer, const vkpbr::gltf::Material::AlphaMode alpha_mode) const -> void
+/* One indirect draw per material range, command count does not depend on the number of primitives */
+auto VKPBR::recordIndirectDraws(const vk::CommandBuffer cmd_buffer, const vkpbr::GPUCuller::Pass pass) const -> void
 {
-	if (node->mesh) {
-		for (auto* primitive : node->mesh->primitives) {
-			if (primitive->material.alphaMode == alpha_mode) {
-
-				const auto descriptor_sets = std::vector<vk::DescriptorSet>{
-					descriptorSets.scene,
-				};
-
-				cmd_buffer.bindDescriptorSets(
-					vk::PipelineBindPoint::eGraphics,
-					pipelineLayout,
-					0,
-					static_cast<uint32_t>(descriptor_sets.size()),
-					descriptor_sets.data(),
-					0,
-					nullptr
-				);
-
-				cmd_buffer.drawIndexed(primitive->indexCount, 1, primitive->firstIndex, 0, 0);
-			}
-		}
+	auto state = vkpbr::CommandState(cmd_buffer, pipelineLayout);
+
+	/* Same commands once more on the position stream, masked materials need their texture so they skip it */
+	if (depthPrepass) {
+		bindDepthState(state);
+		gpuCuller.recordDraws(cmd_buffer, currentFrame, pass, [this](const vk::CommandBuffer, const uint32_t material) {
+			return models.scene.materials[material].alphaMode == vkpbr::gltf::Material::AlphaMode::opaque;
+		});
 	}
 
-	for (auto& child : node->children) {
-		renderModelNode(child, cmd_buffer, alpha_mode);
-	}
+	bindSceneState(state, models.scene.vertices.buffer);
+	gpuCuller.recordDraws(cmd_buffer, currentFrame, pass, [this, &state](const vk::CommandBuffer, const uint32_t material) {
+		const auto& scene_material = models.scene.materials[material];
+		state.bindPipeline(materialPipeline(scene_material));
+		bindMaterial(state, scene_material);
+		return true;
+	});
+}
+
+/* Depth of the first pass is read by the pyramid build and handed back to the resume pass */
+auto VKPBR::recordDepthPyramid(const vk::CommandBuffer cmd_buffer) const -> void
+{
+	vk::ImageMemoryBarrier depth_barrier = {};
+	depth_barrier.srcAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+	depth_barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+	depth_barrier.oldLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+	depth_barrier.newLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+	depth_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depth_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depth_barrier.image = depthStencil.image;
+	depth_barrier.subresourceRange = { depthAspectMask(), 0, 1, 0, 1 };
+	cmd_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eLateFragmentTests,
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::DependencyFlags(),
+		0, nullptr,
+		0, nullptr,
+		1, &depth_barrier
+	);
+
+	depthPyramid.recordBuild(cmd_buffer, renderExtent());
+
+	depth_barrier.srcAccessMask = vk::AccessFlagBits::eShaderRead;
+	depth_barrier.dstAccessMask = vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+	depth_barrier.oldLayout = vk::ImageLayout::eDepthStencilReadOnlyOptimal;
+	depth_barrier.newLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+	cmd_buffer.pipelineBarrier(
+		vk::PipelineStageFlagBits::eComputeShader,
+		vk::PipelineStageFlagBits::eEarlyFragmentTests,
+		vk::DependencyFlags(),
+		0, nullptr,
+		0, nullptr,
+		1, &depth_barrier
+	);
 }
 
 auto VKPBR::render() -> void
@@ -339,23 +1119,35 @@ auto VKPBR::render() -> void
 		return;
 	}
 
-	VulkanRenderer::prepareFrame();
+	updateTextureStreaming();
+
+	/* Waits only for the frame that used this slot framesInFlight frames ago */
+	if (!VulkanRenderer::prepareFrame()) {
+		return;
+	}
+	const auto& frame = frames[currentFrame];
+	updateMaterialDescriptorSets();
+
+	/* Fence of the slot signaled, its last frame time is readable */
+	renderScale = settings.dynamicResolution
+		? resolutionScaler.update(currentFrame, settings.targetFrameTime, settings.minRenderScale, settings.maxRenderScale)
+		: settings.maxRenderScale;
 
-	VK_ASSERT(device.waitForFences(1, &memoryFences[currentBuffer], true, UINT64_MAX));
-	VK_ASSERT(device.resetFences(1, &memoryFences[currentBuffer]));
+	updateUniformBuffers();
+	recordCommandBuffer();
 
 	const vk::PipelineStageFlags wait_dst_stage_mask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
 
 	vk::SubmitInfo submit_info = {};
 	submit_info.pWaitDstStageMask = &wait_dst_stage_mask;
 	submit_info.waitSemaphoreCount = 1;
-	submit_info.pWaitSemaphores = &presentCompleteSemaphore;
+	submit_info.pWaitSemaphores = &frame.presentComplete;
 	submit_info.signalSemaphoreCount = 1;
-	submit_info.pSignalSemaphores = &renderCompleteSemaphore;
+	submit_info.pSignalSemaphores = &frame.renderComplete;
 	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &drawCalls[currentBuffer];
+	submit_info.pCommandBuffers = &frame.cmdBuffer;
 
-	VK_ASSERT(queue.submit(1, &submit_info, memoryFences[currentBuffer]));
+	VK_ASSERT(queue.submit(1, &submit_info, frame.inFlight));
 
 	VulkanRenderer::submitFrame();
 }
\ No newline at end of file
@@ -1,6 +1,11 @@
 #include <VulkanRenderer.hpp>
 #include "Utility.hpp"
 #include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
 
 
 static VKAPI_ATTR VkBool32 VKAPI_CALL vulkanDebugFunction(
@@ -74,20 +79,19 @@ VulkanRenderer::~VulkanRenderer()
 {
 	swapchain.destroy();
 	device.destroyDescriptorPool(descriptorPool, nullptr);
-	device.freeCommandBuffers(commandPool, static_cast<uint32_t>(drawCalls.size()), drawCalls.data());
 	device.destroyRenderPass(renderPass, nullptr);
-	for (auto& framebuffer : framebuffers) {
-		device.destroyFramebuffer(framebuffer, nullptr);
+	device.destroyRenderPass(renderPassResume, nullptr);
+	device.destroyRenderPass(presentPass, nullptr);
+	destroyFramebuffer();
+	if (pipelineCache) {
+		savePipelineCache();
 	}
-	device.destroyImageView(depthStencil.view, nullptr);
-	device.destroyImage(depthStencil.image, nullptr);
-	device.freeMemory(depthStencil.memory, nullptr);
 	device.destroyPipelineCache(pipelineCache, nullptr);
-	device.destroyCommandPool(commandPool);
-	device.destroySemaphore(presentCompleteSemaphore, nullptr);
-	device.destroySemaphore(renderCompleteSemaphore, nullptr);
-	for (auto& fence : memoryFences) {
-		device.destroyFence(fence, nullptr);
+	for (auto& frame : frames) {
+		device.destroyCommandPool(frame.commandPool, nullptr);
+		device.destroySemaphore(frame.presentComplete, nullptr);
+		device.destroySemaphore(frame.renderComplete, nullptr);
+		device.destroyFence(frame.inFlight, nullptr);
 	}
 	vulkanDevice.reset();
 	if (settings.validation) {
@@ -115,7 +119,19 @@ auto VulkanRenderer::initVulkan() -> void
 	if (deviceFeatures.samplerAnisotropy) {
 		enabled_features.samplerAnisotropy = VK_TRUE;
 	}
-	if(vk::Result::eSuccess != vulkanDevice->createLogicalDevice(enabled_features, wantedExtensions)) {
+	if (deviceFeatures.multiDrawIndirect) {
+		enabled_features.multiDrawIndirect = VK_TRUE;
+	}
+	if (deviceFeatures.drawIndirectFirstInstance) {
+		enabled_features.drawIndirectFirstInstance = VK_TRUE;
+	}
+	auto device_extensions = wantedExtensions;
+	for (const auto* extension : optionalExtensions) {
+		if (vulkanDevice->extensionSupported(extension)) {
+			device_extensions.push_back(extension);
+		}
+	}
+	if(vk::Result::eSuccess != vulkanDevice->createLogicalDevice(enabled_features, device_extensions)) {
 		throw VulkanRendererException("[ERROR] Could not create logical device!");
 	}
 	device = vulkanDevice->logicalDevice; //TODO: ma cenu delit se o ownership?
@@ -123,6 +139,9 @@ auto VulkanRenderer::initVulkan() -> void
 	/* Graphics queue */
 	device.getQueue(vulkanDevice->queueFamilyIndices.graphicsFamily.value(), 0, &queue);
 
+	/* Transfer queue, same as graphics one if the device has no separate transfer family */
+	device.getQueue(vulkanDevice->queueFamilyIndices.transferFamily.value(), 0, &transferQueue);
+
 	/* Depth format */
 	selectSuitableDepthFormat();
 
@@ -184,32 +203,18 @@ auto VulkanRenderer::prepareForRender() -> void
 	initSwapchain();
 	setupSwapchain();
 
-	/* Sync. init */
-	vk::SemaphoreCreateInfo semaphore_create_info = {};
-	VK_ASSERT(device.createSemaphore(&semaphore_create_info, nullptr, &presentCompleteSemaphore));
-	VK_ASSERT(device.createSemaphore(&semaphore_create_info, nullptr, &renderCompleteSemaphore));
-
-	vk::FenceCreateInfo fence_create_info = {};
-	fence_create_info.flags = vk::FenceCreateFlagBits::eSignaled;
-	memoryFences.resize(swapchain.imageCount);
-	for (auto& fence : memoryFences) {
-		VK_ASSERT(device.createFence(&fence_create_info, nullptr, &fence));
-	}
+	/* Per frame sync. objects and command buffers */
+	createFrameResources();
 
-	/* Command pool */
-	vk::CommandPoolCreateInfo command_pool_create_info = {};
-	command_pool_create_info.queueFamilyIndex = vulkanDevice->queueFamilyIndices.graphicsFamily.value(); //predani graphics queue
-	command_pool_create_info.flags = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
-	VK_ASSERT(device.createCommandPool(&command_pool_create_info, nullptr, &commandPool));
-
-	/* Command buffers / draw calls */
-	createCommandBuffers();
-
-	/* Render pass */
+	/* Render passes */
 	createRenderPass();
+	createPresentPass();
 
-	/* Pipeline */
+	/* Pipeline, seeded with the data of the previous run when it was written for this device and driver */
+	const auto pipeline_cache_data = loadPipelineCacheData();
 	vk::PipelineCacheCreateInfo pipeline_cache_create_info = {};
+	pipeline_cache_create_info.initialDataSize = pipeline_cache_data.size();
+	pipeline_cache_create_info.pInitialData = pipeline_cache_data.data();
 	VK_ASSERT(device.createPipelineCache(&pipeline_cache_create_info, nullptr, &pipelineCache));
 
 	/* Framebuffer */
@@ -220,6 +225,83 @@ auto VulkanRenderer::setupCommandBuffers() -> void
 {
 }
 
+/*
+Empty when there is no usable cache file, drivers are required to validate the data themselves
+but some do not, so the header has to match the vendor, device and pipeline cache UUID here
+*/
+auto VulkanRenderer::loadPipelineCacheData() const -> std::vector<uint8_t>
+{
+	auto input_stream = std::ifstream(pipelineCachePath, std::ios::binary | std::ios::in | std::ios::ate);
+	if (!input_stream.is_open()) {
+		return {};
+	}
+
+	const auto filesize = static_cast<size_t>(input_stream.tellg());
+	if (filesize < sizeof(VkPipelineCacheHeaderVersionOne) || filesize > maxPipelineCacheSize) {
+		std::cerr << "[WARNING] Ignoring pipeline cache of unexpected size: " << pipelineCachePath << std::endl;
+		return {};
+	}
+
+	auto data = std::vector<uint8_t>(filesize);
+	input_stream.seekg(0, std::ios::beg);
+	if (!input_stream.read(reinterpret_cast<char*>(data.data()), filesize)) {
+		return {};
+	}
+
+	auto header = VkPipelineCacheHeaderVersionOne{};
+	memcpy(&header, data.data(), sizeof(header));
+	const auto matches = header.headerSize >= sizeof(header)
+		&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendorID == deviceProperties.vendorID
+		&& header.deviceID == deviceProperties.deviceID
+		&& memcmp(header.pipelineCacheUUID, deviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	if (!matches) {
+		std::cout << "Pipeline cache was written by another device or driver, starting empty" << std::endl;
+		return {};
+	}
+	return data;
+}
+
+/* Written to a temporary file first and renamed over the old one, a crash never leaves a torn cache */
+auto VulkanRenderer::savePipelineCache() const -> void
+{
+	auto size = size_t{ 0 };
+	if (device.getPipelineCacheData(pipelineCache, &size, nullptr) != vk::Result::eSuccess || size == 0) {
+		return;
+	}
+	if (size > maxPipelineCacheSize) {
+		std::cerr << "[WARNING] Pipeline cache of " << size << " bytes exceeds the limit, not saved" << std::endl;
+		return;
+	}
+
+	auto data = std::vector<uint8_t>(size);
+	if (device.getPipelineCacheData(pipelineCache, &size, data.data()) != vk::Result::eSuccess) {
+		return;
+	}
+
+	const auto path = std::filesystem::path(pipelineCachePath);
+	auto temporary_path = path;
+	temporary_path += ".tmp";
+
+	auto error = std::error_code();
+	std::filesystem::create_directories(path.parent_path(), error);
+	{
+		auto output_stream = std::ofstream(temporary_path, std::ios::binary | std::ios::out | std::ios::trunc);
+		if (!output_stream.write(reinterpret_cast<const char*>(data.data()), size) || !output_stream.flush()) {
+			std::cerr << "[ERROR] Could not write pipeline cache: " << temporary_path.string() << std::endl;
+			output_stream.close();
+			std::filesystem::remove(temporary_path, error);
+			return;
+		}
+	}
+
+	std::filesystem::rename(temporary_path, path, error);
+	if (error) {
+		std::cerr << "[ERROR] Could not replace pipeline cache: " << error.message() << std::endl;
+		std::filesystem::remove(temporary_path, error);
+	}
+}
+
 auto VulkanRenderer::setupWindow() -> void
 {
 	using Hint = window::glfw::Hint;
@@ -233,7 +315,7 @@ auto VulkanRenderer::setupWindow() -> void
 	);
 
 	window.setUserPointer(this);
-	window.setKeyCallback(window::glfw::Window::windowKeyCallback);
+	window.setKeyCallback(windowKeyCallback);
 	window.setResizeCallback(windowResizeCallback);
 }
 
@@ -269,9 +351,37 @@ auto VulkanRenderer::renderFrame() -> void
 	}
 }
 
-auto VulkanRenderer::prepareFrame() -> void
+/* Returns false when no image could be acquired and the frame has to be skipped */
+auto VulkanRenderer::prepareFrame() -> bool
+{
+	auto& frame = frames[currentFrame];
+	VK_ASSERT(device.waitForFences(1, &frame.inFlight, VK_TRUE, UINT64_MAX));
+
+	const auto result = swapchain.acquireNextImage(frame.presentComplete, &currentBuffer);
+	if (result == vk::Result::eErrorOutOfDateKHR) {
+		recreateSwapchain();
+		return false;
+	}
+	if (result != vk::Result::eSuboptimalKHR) {
+		VK_ASSERT(result);
+	}
+
+	/* Swapchain may hand out an image an older frame slot still renders into */
+	if (imagesInFlight[currentBuffer] && imagesInFlight[currentBuffer] != frame.inFlight) {
+		VK_ASSERT(device.waitForFences(1, &imagesInFlight[currentBuffer], VK_TRUE, UINT64_MAX));
+	}
+	imagesInFlight[currentBuffer] = frame.inFlight;
+
+	VK_ASSERT(device.resetFences(1, &frame.inFlight));
+	device.resetCommandPool(frame.commandPool, vk::CommandPoolResetFlags());
+	return true;
+}
+
+auto VulkanRenderer::submitFrame() -> void
 {
-	const auto result = swapchain.acquireNextImage(presentCompleteSemaphore, &currentBuffer);
+	const auto result = swapchain.presentToQueue(queue, currentBuffer, frames[currentFrame].renderComplete);
+	currentFrame = (currentFrame + 1) % static_cast<uint32_t>(frames.size());
+
 	if ((result == vk::Result::eErrorOutOfDateKHR) || (result == vk::Result::eSuboptimalKHR)) {
 		recreateSwapchain();
 	}
@@ -280,9 +390,14 @@ auto VulkanRenderer::prepareFrame() -> void
 	}
 }
 
-auto VulkanRenderer::submitFrame() const -> void
+/* For the rare changes of resources all frames share, cheaper than device.waitIdle() */
+auto VulkanRenderer::waitForFramesInFlight() const -> void
 {
-	VK_ASSERT(swapchain.presentToQueue(queue, currentBuffer, renderCompleteSemaphore));
+	auto fences = std::vector<vk::Fence>{};
+	for (const auto& frame : frames) {
+		fences.push_back(frame.inFlight);
+	}
+	VK_ASSERT(device.waitForFences(static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, UINT64_MAX));
 }
 
 auto VulkanRenderer::checkValidationLayerSupport() const -> bool
@@ -340,6 +455,20 @@ auto VulkanRenderer::windowResizeCallback(GLFWwindow* window, int width, int hei
 	renderer->recreateSwapchain();
 }
 
+auto VulkanRenderer::windowKeyCallback(GLFWwindow* glfw_window, int key, int scancode, int action, int mods) -> void
+{
+	window::glfw::Window::windowKeyCallback(glfw_window, key, scancode, action, mods);
+
+	if (action == GLFW_PRESS) {
+		auto renderer = reinterpret_cast<VulkanRenderer*>(glfwGetWindowUserPointer(glfw_window));
+		renderer->keyPressed(key);
+	}
+}
+
+auto VulkanRenderer::keyPressed(int key) -> void
+{
+}
+
 auto VulkanRenderer::recreateSwapchain() -> void
 {
 	if (!preparedToRender) {
@@ -354,16 +483,9 @@ auto VulkanRenderer::recreateSwapchain() -> void
 	settings.width = static_cast<uint32_t>(new_width);
 	settings.height = static_cast<uint32_t>(new_height);
 	setupSwapchain();
-	device.destroyImageView(depthStencil.view, nullptr);
-	device.destroyImage(depthStencil.image, nullptr);
-	device.freeMemory(depthStencil.memory, nullptr);
-
-	for (auto& framebuffer : framebuffers) {
-		device.destroyFramebuffer(framebuffer, nullptr);
-	}
+	destroyFramebuffer();
 	createFramebuffer();
-	device.freeCommandBuffers(commandPool, static_cast<uint32_t>(drawCalls.size()), drawCalls.data());
-	createCommandBuffers();
+	imagesInFlight.assign(swapchain.imageCount, nullptr);
 	setupCommandBuffers();
 	device.waitIdle();
 
@@ -435,41 +557,136 @@ auto VulkanRenderer::selectSuitableDepthFormat() -> void
 	assert(valid_depth_format);
 }
 
-auto VulkanRenderer::createCommandBuffers() -> void
+auto VulkanRenderer::depthAspectMask() const -> vk::ImageAspectFlags
+{
+	const auto has_stencil = depthFormat == vk::Format::eD32SfloatS8Uint
+		|| depthFormat == vk::Format::eD24UnormS8Uint
+		|| depthFormat == vk::Format::eD16UnormS8Uint;
+	return has_stencil ? vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil : vk::ImageAspectFlagBits::eDepth;
+}
+
+auto VulkanRenderer::supportedSampleCount() const -> vk::SampleCountFlagBits
+{
+	if (!settings.multisampling) {
+		return vk::SampleCountFlagBits::e1;
+	}
+	const auto supported = deviceProperties.limits.framebufferColorSampleCounts & deviceProperties.limits.framebufferDepthSampleCounts;
+	auto count = static_cast<uint32_t>(settings.sampleCount);
+	while (count > 1 && !(supported & static_cast<vk::SampleCountFlagBits>(count))) {
+		count >>= 1;
+	}
+	return static_cast<vk::SampleCountFlagBits>(count);
+}
+
+/* Frames in flight render into the old targets, the device has to be idle */
+auto VulkanRenderer::recreateRenderTargets() -> void
 {
-	drawCalls.resize(swapchain.imageCount);
-	vk::CommandBufferAllocateInfo buffer_allocate_info = {};
-	buffer_allocate_info.commandPool = commandPool;
-	buffer_allocate_info.level = vk::CommandBufferLevel::ePrimary;
-	buffer_allocate_info.commandBufferCount = static_cast<uint32_t>(drawCalls.size());
-	VK_ASSERT(device.allocateCommandBuffers(&buffer_allocate_info, drawCalls.data()));
+	device.waitIdle();
+	destroyFramebuffer();
+	device.destroyRenderPass(renderPass, nullptr);
+	device.destroyRenderPass(renderPassResume, nullptr);
+	createRenderPass();
+	createFramebuffer();
+}
+
+auto VulkanRenderer::destroyFramebuffer() -> void
+{
+	for (auto& framebuffer : framebuffers) {
+		device.destroyFramebuffer(framebuffer, nullptr);
+	}
+	framebuffers.clear();
+	device.destroyFramebuffer(sceneFramebuffer, nullptr);
+	sceneFramebuffer = nullptr;
+	device.destroyImageView(depthStencil.view, nullptr);
+	device.destroyImageView(depthStencil.sampledView, nullptr);
+	device.destroyImage(depthStencil.image, nullptr);
+	device.freeMemory(depthStencil.memory, nullptr);
+	depthStencil = {};
+	device.destroyImageView(multisampleColor.view, nullptr);
+	device.destroyImage(multisampleColor.image, nullptr);
+	device.freeMemory(multisampleColor.memory, nullptr);
+	multisampleColor = {};
+	device.destroyImageView(sceneColor.view, nullptr);
+	device.destroyImage(sceneColor.image, nullptr);
+	device.freeMemory(sceneColor.memory, nullptr);
+	sceneColor = {};
+}
+
+auto VulkanRenderer::renderExtent() const -> vk::Extent2D
+{
+	const auto scaled = [this](const uint32_t size, const uint32_t limit) {
+		return std::clamp(static_cast<uint32_t>(std::lround(static_cast<float>(size) * renderScale)), 1u, limit);
+	};
+	return vk::Extent2D{ scaled(settings.width, sceneExtent.width), scaled(settings.height, sceneExtent.height) };
+}
+
+auto VulkanRenderer::createFrameResources() -> void
+{
+	vk::SemaphoreCreateInfo semaphore_create_info = {};
+
+	vk::FenceCreateInfo fence_create_info = {};
+	fence_create_info.flags = vk::FenceCreateFlagBits::eSignaled;
+
+	/* Pool is reset as a whole once the frame fence signaled */
+	vk::CommandPoolCreateInfo command_pool_create_info = {};
+	command_pool_create_info.queueFamilyIndex = vulkanDevice->queueFamilyIndices.graphicsFamily.value();
+	command_pool_create_info.flags = vk::CommandPoolCreateFlagBits::eTransient;
+
+	frames.resize(std::max(settings.framesInFlight, 1u));
+	for (auto& frame : frames) {
+		VK_ASSERT(device.createSemaphore(&semaphore_create_info, nullptr, &frame.presentComplete));
+		VK_ASSERT(device.createSemaphore(&semaphore_create_info, nullptr, &frame.renderComplete));
+		VK_ASSERT(device.createFence(&fence_create_info, nullptr, &frame.inFlight));
+		VK_ASSERT(device.createCommandPool(&command_pool_create_info, nullptr, &frame.commandPool));
+
+		vk::CommandBufferAllocateInfo buffer_allocate_info = {};
+		buffer_allocate_info.commandPool = frame.commandPool;
+		buffer_allocate_info.level = vk::CommandBufferLevel::ePrimary;
+		buffer_allocate_info.commandBufferCount = 1;
+		VK_ASSERT(device.allocateCommandBuffers(&buffer_allocate_info, &frame.cmdBuffer));
+	}
+
+	imagesInFlight.assign(swapchain.imageCount, nullptr);
 }
 
 auto VulkanRenderer::createRenderPass() -> void
 {
-	// Tady se bude kdyztak resit multisampling -> vytvorit o dva attachmenty navic
-	auto attachments = std::array<vk::AttachmentDescription, 2>();
+	/* Transient multisampled color and depth are never stored, only the resolve into the scene target leaves the pass */
+	samples = supportedSampleCount();
+	const auto multisampled = samples != vk::SampleCountFlagBits::e1;
+	const auto transient = multisampled && !resumableScenePass;
+	auto attachments = std::array<vk::AttachmentDescription, 3>();
 
 	// Color attachment
 	attachments[0].format = swapchain.colorFormat;
-	attachments[0].samples = vk::SampleCountFlagBits::e1;
+	attachments[0].samples = samples;
 	attachments[0].loadOp = vk::AttachmentLoadOp::eClear;
-	attachments[0].storeOp = vk::AttachmentStoreOp::eStore;
+	attachments[0].storeOp = transient ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
 	attachments[0].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
 	attachments[0].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
 	attachments[0].initialLayout = vk::ImageLayout::eUndefined;
-	attachments[0].finalLayout = vk::ImageLayout::ePresentSrcKHR;
+	attachments[0].finalLayout = multisampled ? vk::ImageLayout::eColorAttachmentOptimal : vk::ImageLayout::eShaderReadOnlyOptimal;
 
 	// Depth attachment
 	attachments[1].format = depthFormat;
-	attachments[1].samples = vk::SampleCountFlagBits::e1;
+	attachments[1].samples = samples;
 	attachments[1].loadOp = vk::AttachmentLoadOp::eClear;
-	attachments[1].storeOp = vk::AttachmentStoreOp::eStore;
+	attachments[1].storeOp = transient ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore;
 	attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eClear;
 	attachments[1].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
 	attachments[1].initialLayout = vk::ImageLayout::eUndefined;
 	attachments[1].finalLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
+	// Resolve attachment, multisampled only
+	attachments[2].format = swapchain.colorFormat;
+	attachments[2].samples = vk::SampleCountFlagBits::e1;
+	attachments[2].loadOp = vk::AttachmentLoadOp::eDontCare;
+	attachments[2].storeOp = vk::AttachmentStoreOp::eStore;
+	attachments[2].stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+	attachments[2].stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+	attachments[2].initialLayout = vk::ImageLayout::eUndefined;
+	attachments[2].finalLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+
 	/*
 	Subpasses
 	The index of the attachment in this array is directly referenced from
@@ -483,6 +700,10 @@ auto VulkanRenderer::createRenderPass() -> void
 	depth_reference.attachment = 1;
 	depth_reference.layout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
 
+	vk::AttachmentReference resolve_reference = {};
+	resolve_reference.attachment = 2;
+	resolve_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
+
 	vk::SubpassDescription subpass_description = {};
 	subpass_description.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
 	subpass_description.colorAttachmentCount = 1;
@@ -492,7 +713,7 @@ auto VulkanRenderer::createRenderPass() -> void
 	subpass_description.pInputAttachments = nullptr;
 	subpass_description.preserveAttachmentCount = 0;
 	subpass_description.pPreserveAttachments = nullptr;
-	subpass_description.pResolveAttachments = nullptr;
+	subpass_description.pResolveAttachments = multisampled ? &resolve_reference : nullptr;
 
 	/*
 	Subpass dependencies
@@ -510,16 +731,17 @@ auto VulkanRenderer::createRenderPass() -> void
 	subpass_dependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
 	subpass_dependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
 
+	/* Scene color is sampled by the upscale */
 	subpass_dependencies[1].srcSubpass = 0;
 	subpass_dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
 	subpass_dependencies[1].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
-	subpass_dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eBottomOfPipe;
+	subpass_dependencies[1].dstStageMask = vk::PipelineStageFlagBits::eFragmentShader;
 	subpass_dependencies[1].srcAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite;
-	subpass_dependencies[1].dstAccessMask = vk::AccessFlagBits::eMemoryRead;
-	subpass_dependencies[1].dependencyFlags = vk::DependencyFlagBits::eByRegion;
+	subpass_dependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
+	subpass_dependencies[1].dependencyFlags = vk::DependencyFlags();
 
 	vk::RenderPassCreateInfo render_pass_create_info = {};
-	render_pass_create_info.attachmentCount = static_cast<uint32_t>(attachments.size());
+	render_pass_create_info.attachmentCount = multisampled ? 3 : 2;
 	render_pass_create_info.pAttachments = attachments.data();
 	render_pass_create_info.subpassCount = 1;
 	render_pass_create_info.pSubpasses = &subpass_description;
@@ -527,22 +749,94 @@ auto VulkanRenderer::createRenderPass() -> void
 	render_pass_create_info.pDependencies = subpass_dependencies.data();
 	
 	VK_ASSERT(device.createRenderPass(&render_pass_create_info, nullptr, &renderPass));
+
+	/* Resume pass, attachments keep their content and the previous pass has to finish writing them, unusable with transient targets */
+	attachments[0].loadOp = vk::AttachmentLoadOp::eLoad;
+	attachments[0].initialLayout = attachments[0].finalLayout;
+	attachments[1].loadOp = vk::AttachmentLoadOp::eLoad;
+	attachments[1].stencilLoadOp = vk::AttachmentLoadOp::eLoad;
+	attachments[1].initialLayout = vk::ImageLayout::eDepthStencilAttachmentOptimal;
+
+	subpass_dependencies[0].srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eLateFragmentTests;
+	subpass_dependencies[0].dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput | vk::PipelineStageFlagBits::eEarlyFragmentTests;
+	subpass_dependencies[0].srcAccessMask = vk::AccessFlagBits::eColorAttachmentWrite | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+	subpass_dependencies[0].dstAccessMask = vk::AccessFlagBits::eColorAttachmentRead | vk::AccessFlagBits::eColorAttachmentWrite
+		| vk::AccessFlagBits::eDepthStencilAttachmentRead | vk::AccessFlagBits::eDepthStencilAttachmentWrite;
+
+	VK_ASSERT(device.createRenderPass(&render_pass_create_info, nullptr, &renderPassResume));
+}
+
+/* Upscale covers the whole swapchain image, its old content is never loaded */
+auto VulkanRenderer::createPresentPass() -> void
+{
+	vk::AttachmentDescription attachment = {};
+	attachment.format = swapchain.colorFormat;
+	attachment.samples = vk::SampleCountFlagBits::e1;
+	attachment.loadOp = vk::AttachmentLoadOp::eDontCare;
+	attachment.storeOp = vk::AttachmentStoreOp::eStore;
+	attachment.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+	attachment.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+	attachment.initialLayout = vk::ImageLayout::eUndefined;
+	attachment.finalLayout = vk::ImageLayout::ePresentSrcKHR;
+
+	vk::AttachmentReference color_reference = {};
+	color_reference.attachment = 0;
+	color_reference.layout = vk::ImageLayout::eColorAttachmentOptimal;
+
+	vk::SubpassDescription subpass_description = {};
+	subpass_description.pipelineBindPoint = vk::PipelineBindPoint::eGraphics;
+	subpass_description.colorAttachmentCount = 1;
+	subpass_description.pColorAttachments = &color_reference;
+
+	/* Swapchain image is acquired before color output, the submit waits there */
+	vk::SubpassDependency subpass_dependency = {};
+	subpass_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpass_dependency.dstSubpass = 0;
+	subpass_dependency.srcStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+	subpass_dependency.dstStageMask = vk::PipelineStageFlagBits::eColorAttachmentOutput;
+	subpass_dependency.dstAccessMask = vk::AccessFlagBits::eColorAttachmentWrite;
+
+	vk::RenderPassCreateInfo render_pass_create_info = {};
+	render_pass_create_info.attachmentCount = 1;
+	render_pass_create_info.pAttachments = &attachment;
+	render_pass_create_info.subpassCount = 1;
+	render_pass_create_info.pSubpasses = &subpass_description;
+	render_pass_create_info.dependencyCount = 1;
+	render_pass_create_info.pDependencies = &subpass_dependency;
+	VK_ASSERT(device.createRenderPass(&render_pass_create_info, nullptr, &presentPass));
 }
 
 auto VulkanRenderer::createFramebuffer() -> void
 {
+	/* Allocated once for the largest scale, scale changes only move the render area */
+	sceneExtent.width = std::max(static_cast<uint32_t>(std::ceil(static_cast<float>(settings.width) * settings.maxRenderScale)), 1u);
+	sceneExtent.height = std::max(static_cast<uint32_t>(std::ceil(static_cast<float>(settings.height) * settings.maxRenderScale)), 1u);
+
 	vk::ImageCreateInfo image_create_info = {};
 	image_create_info.pNext = nullptr;
 	image_create_info.imageType = vk::ImageType::e2D;
 	image_create_info.format = depthFormat;
-	image_create_info.extent = vk::Extent3D( settings.width, settings.height, 1 );
+	image_create_info.extent = vk::Extent3D( sceneExtent.width, sceneExtent.height, 1 );
 	image_create_info.mipLevels = 1;
 	image_create_info.arrayLayers = 1;
-	image_create_info.samples = vk::SampleCountFlagBits::e1;
+	image_create_info.samples = samples;
 	image_create_info.tiling = vk::ImageTiling::eOptimal;
-	image_create_info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransferSrc;
+	image_create_info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment | vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eSampled;
 	//image_create_info.flags = 0;
 
+	/* Multisampled targets not resumed are transient, tilers can keep them in on chip memory without ever backing them */
+	const auto multisampled = samples != vk::SampleCountFlagBits::e1;
+	const auto transient = multisampled && !resumableScenePass;
+	const auto multisample_usage = transient ? vk::ImageUsageFlags(vk::ImageUsageFlagBits::eTransientAttachment) : vk::ImageUsageFlags();
+	const auto multisample_memory = transient
+		? vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eLazilyAllocated
+		: vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eDeviceLocal);
+	if (multisampled) {
+		/* Stored multisampled depth is resolved by compute, it has to be sampleable */
+		image_create_info.usage = vk::ImageUsageFlagBits::eDepthStencilAttachment
+			| (transient ? multisample_usage : vk::ImageUsageFlags(vk::ImageUsageFlagBits::eSampled));
+	}
+
 	vk::MemoryAllocateInfo memory_allocate_info = {};
 	memory_allocate_info.pNext = nullptr;
 	memory_allocate_info.allocationSize = 0;
@@ -554,7 +848,7 @@ auto VulkanRenderer::createFramebuffer() -> void
 	depth_stencil_view.format = depthFormat;
 	//depth_stencil_view.flags = 0;
 	//depth_stencil_view.subresourceRange = {};
-	depth_stencil_view.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+	depth_stencil_view.subresourceRange.aspectMask = depthAspectMask();
 	depth_stencil_view.subresourceRange.baseMipLevel = 0;
 	depth_stencil_view.subresourceRange.levelCount = 1;
 	depth_stencil_view.subresourceRange.baseArrayLayer = 0;
@@ -566,6 +860,7 @@ auto VulkanRenderer::createFramebuffer() -> void
 	memory_allocate_info.allocationSize = memory_requirements.size;
 	memory_allocate_info.memoryTypeIndex = vulkanDevice->findMemoryType(
 		memory_requirements.memoryTypeBits,
+		multisample_memory,
 		vk::MemoryPropertyFlagBits::eDeviceLocal
 	);
 
@@ -575,19 +870,68 @@ auto VulkanRenderer::createFramebuffer() -> void
 	depth_stencil_view.image = depthStencil.image;
 	VK_ASSERT(device.createImageView(&depth_stencil_view, nullptr, &depthStencil.view));
 
+	if (!transient) {
+		depth_stencil_view.subresourceRange.aspectMask = vk::ImageAspectFlagBits::eDepth;
+		VK_ASSERT(device.createImageView(&depth_stencil_view, nullptr, &depthStencil.sampledView));
+	}
+
+	if (multisampled) {
+		image_create_info.format = swapchain.colorFormat;
+		image_create_info.usage = vk::ImageUsageFlagBits::eColorAttachment | multisample_usage;
+		VK_ASSERT(device.createImage(&image_create_info, nullptr, &multisampleColor.image));
+		device.getImageMemoryRequirements(multisampleColor.image, &memory_requirements);
+		memory_allocate_info.allocationSize = memory_requirements.size;
+		memory_allocate_info.memoryTypeIndex = vulkanDevice->findMemoryType(memory_requirements.memoryTypeBits, multisample_memory, vk::MemoryPropertyFlagBits::eDeviceLocal);
+		VK_ASSERT(device.allocateMemory(&memory_allocate_info, nullptr, &multisampleColor.memory));
+		device.bindImageMemory(multisampleColor.image, multisampleColor.memory, 0);
+
+		vk::ImageViewCreateInfo color_view = {};
+		color_view.image = multisampleColor.image;
+		color_view.viewType = vk::ImageViewType::e2D;
+		color_view.format = swapchain.colorFormat;
+		color_view.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+		VK_ASSERT(device.createImageView(&color_view, nullptr, &multisampleColor.view));
+	}
+
+	/* Scene color, sampled by the upscale */
+	image_create_info.format = swapchain.colorFormat;
+	image_create_info.samples = vk::SampleCountFlagBits::e1;
+	image_create_info.usage = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eSampled;
+	VK_ASSERT(device.createImage(&image_create_info, nullptr, &sceneColor.image));
+	device.getImageMemoryRequirements(sceneColor.image, &memory_requirements);
+	memory_allocate_info.allocationSize = memory_requirements.size;
+	memory_allocate_info.memoryTypeIndex = vulkanDevice->findMemoryType(memory_requirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal);
+	VK_ASSERT(device.allocateMemory(&memory_allocate_info, nullptr, &sceneColor.memory));
+	device.bindImageMemory(sceneColor.image, sceneColor.memory, 0);
+
+	vk::ImageViewCreateInfo scene_color_view = {};
+	scene_color_view.image = sceneColor.image;
+	scene_color_view.viewType = vk::ImageViewType::e2D;
+	scene_color_view.format = swapchain.colorFormat;
+	scene_color_view.subresourceRange = { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 };
+	VK_ASSERT(device.createImageView(&scene_color_view, nullptr, &sceneColor.view));
+
+	/* Single sampled: scene color, depth. Multisampled: color, depth, scene color as resolve target */
 	vk::ImageView attachments[4];
+	attachments[0] = multisampled ? multisampleColor.view : sceneColor.view;
 	attachments[1] = depthStencil.view;
+	attachments[2] = sceneColor.view;
 
 	vk::FramebufferCreateInfo framebuffer_create_info = {};
 	framebuffer_create_info.pNext = nullptr;
 	framebuffer_create_info.renderPass = renderPass;
-	framebuffer_create_info.attachmentCount = 2;
+	framebuffer_create_info.attachmentCount = multisampled ? 3 : 2;
 	framebuffer_create_info.pAttachments = attachments;
-	framebuffer_create_info.width = settings.width;
-	framebuffer_create_info.height = settings.height;
+	framebuffer_create_info.width = sceneExtent.width;
+	framebuffer_create_info.height = sceneExtent.height;
 	framebuffer_create_info.layers = 1;
+	VK_ASSERT(device.createFramebuffer(&framebuffer_create_info, nullptr, &sceneFramebuffer));
 
-	/* Framebuffer for every swapchain image */
+	/* Present framebuffer for every swapchain image */
+	framebuffer_create_info.renderPass = presentPass;
+	framebuffer_create_info.attachmentCount = 1;
+	framebuffer_create_info.width = settings.width;
+	framebuffer_create_info.height = settings.height;
 	framebuffers.resize(swapchain.imageCount);
 	for (uint32_t i = 0; i < framebuffers.size(); i++) {
 		attachments[0] = swapchain.buffers[i].view;
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <iostream>
+
+
+/* Failed checks are reported and counted, a test keeps running to show every failure */
+inline auto checkFailures() -> int&
+{
+	static int failures = 0;
+	return failures;
+}
+
+#define VKPBR_CHECK(f)																				\
+{																										\
+	if (!(f))																							\
+	{																									\
+		std::cerr << "[ERROR] Check \"" << #f << "\" failed in " << __FILE__ << " at line " << __LINE__ << std::endl; \
+		checkFailures()++;																				\
+	}																									\
+}
+
+/* Exit code of a test executable */
+inline auto checkResult() -> int
+{
+	return checkFailures() == 0 ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+#include <DrawSortKey.hpp>
+
+#include "Check.hpp"
+
+
+int main()
+{
+	using vkpbr::DrawSortKey;
+	const auto max_depth = (1u << DrawSortKey::depthBits) - 1;
+
+	/* Depth quantization covers [0, far] and clamps outside of it */
+	VKPBR_CHECK(DrawSortKey::quantizeDepth(0.0f, 100.0f) == 0);
+	VKPBR_CHECK(DrawSortKey::quantizeDepth(100.0f, 100.0f) == max_depth);
+	VKPBR_CHECK(DrawSortKey::quantizeDepth(-5.0f, 100.0f) == 0);
+	VKPBR_CHECK(DrawSortKey::quantizeDepth(500.0f, 100.0f) == max_depth);
+	VKPBR_CHECK(DrawSortKey::quantizeDepth(25.0f, 100.0f) < DrawSortKey::quantizeDepth(50.0f, 100.0f));
+
+	/* Opaque fields land in their bit ranges */
+	const auto opaque = DrawSortKey::opaque(3, 5, 7, 11);
+	VKPBR_CHECK((opaque >> 63) == 0);
+	VKPBR_CHECK(((opaque >> 59) & 0xF) == 3);
+	VKPBR_CHECK(((opaque >> 40) & DrawSortKey::maxMaterial) == 5);
+	VKPBR_CHECK(((opaque >> 24) & DrawSortKey::maxMeshBuffer) == 7);
+	VKPBR_CHECK((opaque & max_depth) == 11);
+
+	/* Out of range state saturates instead of spilling into the neighbouring field */
+	const auto saturated = DrawSortKey::opaque(100, DrawSortKey::maxMaterial + 1, DrawSortKey::maxMeshBuffer + 1, 0);
+	VKPBR_CHECK((saturated >> 63) == 0);
+	VKPBR_CHECK(((saturated >> 59) & 0xF) == DrawSortKey::maxPipeline);
+	VKPBR_CHECK(((saturated >> 40) & DrawSortKey::maxMaterial) == DrawSortKey::maxMaterial);
+	VKPBR_CHECK(((saturated >> 24) & DrawSortKey::maxMeshBuffer) == DrawSortKey::maxMeshBuffer);
+
+	/* Opaque order: pipeline, material, mesh buffers, then front to back */
+	VKPBR_CHECK(DrawSortKey::opaque(0, 9, 9, max_depth) < DrawSortKey::opaque(1, 0, 0, 0));
+	VKPBR_CHECK(DrawSortKey::opaque(1, 0, 9, max_depth) < DrawSortKey::opaque(1, 1, 0, 0));
+	VKPBR_CHECK(DrawSortKey::opaque(1, 1, 0, max_depth) < DrawSortKey::opaque(1, 1, 1, 0));
+	VKPBR_CHECK(DrawSortKey::opaque(1, 1, 1, 10) < DrawSortKey::opaque(1, 1, 1, 20));
+
+	/* Blended draws come after every opaque one, back to front, state only breaks ties */
+	VKPBR_CHECK(DrawSortKey::opaque(DrawSortKey::maxPipeline, DrawSortKey::maxMaterial, DrawSortKey::maxMeshBuffer, max_depth) < DrawSortKey::blended(0, 0, max_depth));
+	VKPBR_CHECK(DrawSortKey::blended(9, 9, 20) < DrawSortKey::blended(0, 0, 10));
+	VKPBR_CHECK(DrawSortKey::blended(0, 9, 10) < DrawSortKey::blended(1, 0, 10));
+	VKPBR_CHECK(DrawSortKey::blended(1, 0, 10) < DrawSortKey::blended(1, 1, 10));
+
+	return checkResult();
+}
@@ -0,0 +1,125 @@
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <FrustumCuller.hpp>
+#include <ThreadPool.hpp>
+
+#include "Check.hpp"
+
+
+/* One box at a time, the same test cullBatches() runs on 4 or 8 lanes, summed in the same order */
+static auto referenceVisible(const vkpbr::FrustumCuller::Frustum& frustum, const glm::vec3& center, const glm::vec3& extent) -> bool
+{
+	for (const auto& plane : frustum) {
+		const auto distance = (plane.x * center.x + plane.y * center.y) + (plane.z * center.z + plane.w);
+		const auto radius = (std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y) + std::abs(plane.z) * extent.z;
+		if (distance + radius < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static auto nearlyEqual(const glm::vec3& a, const glm::vec3& b, const float epsilon = 1e-4f) -> bool
+{
+	return glm::all(glm::lessThanEqual(glm::abs(a - b), glm::vec3(epsilon)));
+}
+
+int main()
+{
+	auto thread_pool = vkpbr::ThreadPool(3);
+	auto random = std::mt19937(11);
+	auto uniform = std::uniform_real_distribution<float>(-1.0f, 1.0f);
+
+	const auto projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	const auto view = glm::lookAt(glm::vec3(3.0f, 2.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	const auto view_projection = projection * view;
+	const auto frustum = vkpbr::FrustumCuller::extractPlanes(view_projection);
+
+	/* Planes are normalized and keep points with clip coordinates inside the [0, 1] depth volume */
+	for (const auto& plane : frustum) {
+		VKPBR_CHECK(std::abs(glm::length(glm::vec3(plane)) - 1.0f) < 1e-4f);
+	}
+	const auto inverse_view_projection = glm::inverse(view_projection);
+	for (uint32_t i = 0; i < 1000; i++) {
+		const auto ndc = glm::vec3(uniform(random) * 1.2f, uniform(random) * 1.2f, uniform(random) * 0.55f + 0.45f);
+		const auto world = inverse_view_projection * glm::vec4(ndc, 1.0f);
+		const auto point = glm::vec3(world) / world.w;
+		const auto inside = std::abs(ndc.x) < 0.999f && std::abs(ndc.y) < 0.999f && ndc.z > 0.001f && ndc.z < 0.999f;
+		const auto outside = std::abs(ndc.x) > 1.001f || std::abs(ndc.y) > 1.001f || ndc.z < -0.001f || ndc.z > 1.001f;
+		const auto visible = referenceVisible(frustum, point, glm::vec3(0.0f));
+		if (inside) {
+			VKPBR_CHECK(visible);
+		}
+		if (outside) {
+			VKPBR_CHECK(!visible);
+		}
+	}
+
+	/* Transformed bounds are the AABB of the eight transformed corners */
+	const auto transform = glm::scale(
+		glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, -2.0f, 3.0f)), 0.7f, glm::normalize(glm::vec3(1.0f, 2.0f, 3.0f))),
+		glm::vec3(2.0f, 0.5f, -1.0f)
+	);
+	const auto local_min = glm::vec3(-1.0f, 0.0f, -2.0f);
+	const auto local_max = glm::vec3(3.0f, 1.0f, 0.5f);
+	auto corner_min = glm::vec3(std::numeric_limits<float>::max());
+	auto corner_max = glm::vec3(std::numeric_limits<float>::lowest());
+	for (uint32_t corner = 0; corner < 8; corner++) {
+		const auto local = glm::vec3(
+			(corner & 1) ? local_max.x : local_min.x,
+			(corner & 2) ? local_max.y : local_min.y,
+			(corner & 4) ? local_max.z : local_min.z
+		);
+		const auto world = glm::vec3(transform * glm::vec4(local, 1.0f));
+		corner_min = glm::min(corner_min, world);
+		corner_max = glm::max(corner_max, world);
+	}
+	auto center = glm::vec3(0.0f);
+	auto extent = glm::vec3(0.0f);
+	vkpbr::FrustumCuller::transformBounds(transform, local_min, local_max, center, extent);
+	VKPBR_CHECK(nearlyEqual(center - extent, corner_min));
+	VKPBR_CHECK(nearlyEqual(center + extent, corner_max));
+
+	/* SIMD batches agree with the scalar test, counts are not multiples of the lane count */
+	auto culler = vkpbr::FrustumCuller{};
+	for (const auto count : { 0u, 1u, 3u, 7u, 13u, 1001u, 20003u }) {
+		culler.clear();
+		auto centers = std::vector<glm::vec3>{};
+		auto extents = std::vector<glm::vec3>{};
+		for (uint32_t i = 0; i < count; i++) {
+			centers.push_back(glm::vec3(uniform(random), uniform(random), uniform(random)) * 60.0f);
+			extents.push_back(glm::abs(glm::vec3(uniform(random), uniform(random), uniform(random))) * 4.0f);
+			culler.addBox(centers.back(), extents.back());
+		}
+		VKPBR_CHECK(culler.size() == count);
+
+		const auto& visible = culler.cull(frustum, thread_pool);
+		VKPBR_CHECK(visible.size() == count);
+		auto visible_count = 0u;
+		for (uint32_t i = 0; i < count && i < visible.size(); i++) {
+			VKPBR_CHECK((visible[i] != 0) == referenceVisible(frustum, centers[i], extents[i]));
+			visible_count += visible[i] != 0 ? 1 : 0;
+		}
+		if (count > 1000) {
+			VKPBR_CHECK(visible_count > 0 && visible_count < count);
+		}
+
+		/* Boxes added after a cull follow the real ones, not the lane padding */
+		culler.addBox(glm::vec3(0.0f), glm::vec3(0.5f));
+		const auto& appended = culler.cull(frustum, thread_pool);
+		VKPBR_CHECK(appended.size() == count + 1);
+		VKPBR_CHECK(!appended.empty() && appended.back() != 0);
+	}
+
+	return checkResult();
+}
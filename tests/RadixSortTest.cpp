@@ -0,0 +1,80 @@
+#include <vector>
+#include <random>
+#include <numeric>
+#include <algorithm>
+
+#include <RadixSort.hpp>
+#include <ThreadPool.hpp>
+
+#include "Check.hpp"
+
+
+/* Result has to match std::stable_sort on the same keys, values are the input positions */
+static auto checkAgainstStableSort(std::vector<uint64_t> keys, vkpbr::RadixSort& radix_sort, vkpbr::ThreadPool& thread_pool) -> void
+{
+	auto values = std::vector<uint32_t>(keys.size());
+	std::iota(values.begin(), values.end(), 0u);
+
+	auto expected = std::vector<uint32_t>(keys.size());
+	std::iota(expected.begin(), expected.end(), 0u);
+	std::stable_sort(expected.begin(), expected.end(), [&keys](const uint32_t a, const uint32_t b) {
+		return keys[a] < keys[b];
+	});
+
+	const auto original = keys;
+	radix_sort.sort(keys, values, thread_pool);
+
+	VKPBR_CHECK(keys.size() == original.size());
+	VKPBR_CHECK(values == expected);
+	VKPBR_CHECK(std::is_sorted(keys.begin(), keys.end()));
+	for (size_t i = 0; i < keys.size() && i < values.size(); i++) {
+		VKPBR_CHECK(keys[i] == original[values[i]]);
+	}
+}
+
+int main()
+{
+	auto thread_pool = vkpbr::ThreadPool(3);
+	auto radix_sort = vkpbr::RadixSort{};
+	auto random = std::mt19937_64(7);
+
+	/* Empty and single key inputs are left alone */
+	checkAgainstStableSort({}, radix_sort, thread_pool);
+	checkAgainstStableSort({ 42 }, radix_sort, thread_pool);
+
+	/* Full 64 bit keys, enough of them for several chunks */
+	auto keys = std::vector<uint64_t>(20000);
+	for (auto& key : keys) {
+		key = random();
+	}
+	checkAgainstStableSort(keys, radix_sort, thread_pool);
+
+	/* Many duplicates, stability decides the value order */
+	for (auto& key : keys) {
+		key = random() % 16;
+	}
+	checkAgainstStableSort(keys, radix_sort, thread_pool);
+
+	/* Only the top byte differs, every other pass is skipped as uniform */
+	for (auto& key : keys) {
+		key = (random() % 256) << 56;
+	}
+	checkAgainstStableSort(keys, radix_sort, thread_pool);
+
+	/* Odd number of executed passes, the result ends up in the scratch buffers first */
+	for (auto& key : keys) {
+		key = random() % 256;
+	}
+	checkAgainstStableSort(keys, radix_sort, thread_pool);
+
+	/* Already sorted and reversed input, scratch memory is reused between calls */
+	std::sort(keys.begin(), keys.end());
+	checkAgainstStableSort(keys, radix_sort, thread_pool);
+	std::reverse(keys.begin(), keys.end());
+	checkAgainstStableSort(keys, radix_sort, thread_pool);
+
+	/* All keys equal */
+	checkAgainstStableSort(std::vector<uint64_t>(5000, 0x0123456789ABCDEFull), radix_sort, thread_pool);
+
+	return checkResult();
+}
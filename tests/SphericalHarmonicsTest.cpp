@@ -0,0 +1,100 @@
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+
+#include <cmath>
+#include <functional>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <SphericalHarmonics.hpp>
+#include <EnvironmentMap.hpp>
+#include <ThreadPool.hpp>
+
+#include "Check.hpp"
+
+
+static auto environmentFrom(const std::function<glm::vec3(const glm::vec3&)>& radiance, const uint32_t size) -> vkpbr::EnvironmentMap
+{
+	auto environment = vkpbr::EnvironmentMap::uniform(glm::vec3(0.0f), size);
+	for (uint32_t face = 0; face < 6; face++) {
+		for (uint32_t y = 0; y < size; y++) {
+			for (uint32_t x = 0; x < size; x++) {
+				const auto direction = glm::normalize(vkpbr::EnvironmentMap::texelDirection(face, x, y, size));
+				environment.faces[face][static_cast<size_t>(y) * size + x] = radiance(direction);
+			}
+		}
+	}
+	return environment;
+}
+
+/* What pbr_shader.frag computes from the uploaded coefficients */
+static auto evaluate(const vkpbr::SphericalHarmonics::Coefficients& coefficients, const glm::vec3& normal) -> glm::vec3
+{
+	const auto y_lm = vkpbr::SphericalHarmonics::basis(normal);
+	auto result = glm::vec3(0.0f);
+	for (size_t i = 0; i < 9; i++) {
+		result += coefficients[i] * y_lm[i];
+	}
+	return result;
+}
+
+static auto nearlyEqual(const glm::vec3& a, const glm::vec3& b, const float epsilon) -> bool
+{
+	return glm::all(glm::lessThanEqual(glm::abs(a - b), glm::vec3(epsilon)));
+}
+
+int main()
+{
+	constexpr auto pi = glm::pi<float>();
+	constexpr uint32_t size = 32;
+	auto thread_pool = vkpbr::ThreadPool(3);
+	const auto normals = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+
+	/* Texel solid angles cover the sphere */
+	auto total_solid_angle = 0.0f;
+	for (uint32_t y = 0; y < size; y++) {
+		for (uint32_t x = 0; x < size; x++) {
+			total_solid_angle += 6.0f * vkpbr::EnvironmentMap::texelSolidAngle(x, y, size);
+		}
+	}
+	VKPBR_CHECK(std::abs(total_solid_angle - 4.0f * pi) < 1e-3f);
+
+	/* Constant radiance L only has a DC term and gives irradiance pi * L for every normal */
+	const auto radiance = glm::vec3(0.25f, 0.5f, 2.0f);
+	const auto uniform = vkpbr::SphericalHarmonics::project(vkpbr::EnvironmentMap::uniform(radiance, size), thread_pool);
+	VKPBR_CHECK(nearlyEqual(uniform[0], radiance * (0.282095f * 4.0f * pi), 1e-3f));
+	for (size_t i = 1; i < 9; i++) {
+		VKPBR_CHECK(nearlyEqual(uniform[i], glm::vec3(0.0f), 1e-3f));
+	}
+	const auto uniform_irradiance = vkpbr::SphericalHarmonics::irradiance(uniform);
+	for (const auto& normal : normals) {
+		VKPBR_CHECK(nearlyEqual(evaluate(uniform_irradiance, normal), radiance * pi, 1e-3f));
+	}
+
+	/* L = a + b * z is exactly representable, E(n) = pi * a + 2pi/3 * b * n.z */
+	const auto linear = environmentFrom([](const glm::vec3& direction) { return glm::vec3(1.0f + 0.5f * direction.z); }, size);
+	const auto linear_irradiance = vkpbr::SphericalHarmonics::irradiance(vkpbr::SphericalHarmonics::project(linear, thread_pool));
+	for (const auto& normal : normals) {
+		const auto expected = glm::vec3(pi * 1.0f + 2.0f * pi / 3.0f * 0.5f * normal.z);
+		VKPBR_CHECK(nearlyEqual(evaluate(linear_irradiance, normal), expected, 1e-2f));
+	}
+
+	/* Quadratic band, L = z^2 has E(n) = pi/3 + pi/4 * (n.z^2 - 1/3) */
+	const auto quadratic = environmentFrom([](const glm::vec3& direction) { return glm::vec3(direction.z * direction.z); }, size);
+	const auto quadratic_irradiance = vkpbr::SphericalHarmonics::irradiance(vkpbr::SphericalHarmonics::project(quadratic, thread_pool));
+	for (const auto& normal : normals) {
+		const auto expected = glm::vec3(pi / 3.0f + pi / 4.0f * (normal.z * normal.z - 1.0f / 3.0f));
+		VKPBR_CHECK(nearlyEqual(evaluate(quadratic_irradiance, normal), expected, 1e-2f));
+	}
+
+	/* Partial sums are added in row order, the worker count must not change a single bit */
+	auto single_worker = vkpbr::ThreadPool(1);
+	const auto reference = vkpbr::SphericalHarmonics::project(quadratic, single_worker);
+	const auto parallel = vkpbr::SphericalHarmonics::project(quadratic, thread_pool);
+	for (size_t i = 0; i < 9; i++) {
+		VKPBR_CHECK(reference[i] == parallel[i]);
+	}
+
+	return checkResult();
+}